@@ -2,5 +2,6 @@ CC=gcc
 CXX=g++
 AR=ar
 _CPPFLAGS=-O3 -Wall -Wextra -Werror
+_LDFLAGS=-pthread
 AR_FLAGS=cr -o
 RM_FLAGS=-r
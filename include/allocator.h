@@ -0,0 +1,224 @@
+/*
+ * Allocators for short-lived memory:
+ * a bump-pointer arena, freed all at once by resetting it to a mark,
+ * and a pool of fixed-size objects, with a free list for each thread.
+ * Either can be passed as a "struct allocator"
+ * to the constructors that take one, such as "init_min_heap_with".
+ */
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* the alignment of every allocation from an arena */
+#define ARENA_ALIGNMENT		_Alignof(max_align_t)
+/* the number of objects a thread moves to or from a pool's shared list */
+#define POOL_BATCH		32
+
+/*
+ * Allocate memory.
+ * state:	the allocator's state
+ * size:	the number of bytes to allocate
+ * returns	the allocated memory, or NULL on failure, with errno set
+ */
+typedef void *(*allocate_t)(void *state, size_t size);
+/*
+ * Release memory allocated by the same allocator.
+ * state:	the allocator's state
+ * to_release:	the memory to release, or NULL
+ */
+typedef void (*release_t)(void *state, void *to_release);
+
+/* a source of memory, which is "malloc" and "free" when NULL */
+struct allocator {
+	/* allocates memory */
+	allocate_t allocate;
+	/* releases memory */
+	release_t release;
+	/* the state passed to both functions */
+	void *state;
+};
+
+/*
+ * Allocate memory from an allocator.
+ * allocator:	the allocator, or NULL to use "malloc"
+ * size:	the number of bytes to allocate
+ * returns	the allocated memory, or NULL on failure, with errno set
+ */
+static inline void *allocate_with(struct allocator *allocator, size_t size)
+{
+	return allocator == NULL ? malloc(size) :
+	       allocator->allocate(allocator->state, size);
+}
+
+/*
+ * Release memory to the allocator it came from.
+ * allocator:	the allocator, or NULL to use "free"
+ * to_release:	the memory to release, or NULL
+ */
+static inline void release_with(struct allocator *allocator, void *to_release)
+{
+	if (allocator == NULL) {
+		free(to_release);
+	} else {
+		allocator->release(allocator->state, to_release);
+	}
+}
+
+/* a chunk of memory that an arena allocates from */
+struct arena_block;
+
+/*
+ * a bump-pointer allocator:
+ * each allocation takes the next bytes of the current block,
+ * and nothing is freed until the arena is reset
+ */
+struct arena {
+	/* the block being allocated from, which links to the earlier ones */
+	struct arena_block *block;
+	/* the number of bytes used in "block" */
+	size_t used;
+	/* the number of bytes in each block, unless an allocation needs more */
+	size_t block_size;
+	/* a freed block of the usual size, kept for the next one needed */
+	struct arena_block *spare;
+
+	/* allocates from the arena, and releases nothing */
+	struct allocator allocator;
+};
+
+/* a position in an arena, to which it can be reset */
+struct arena_mark {
+	/* the block being allocated from when the mark was made */
+	struct arena_block *block;
+	/* the number of bytes used in the block when the mark was made */
+	size_t used;
+};
+
+/*
+ * Initialize an empty arena, which allocates blocks as needed.
+ * to_init:	the arena to initialize
+ * block_size:	the number of bytes to allocate at a time
+ * returns	0 if successful
+ *		-1 if the block size is 0, with errno set to EINVAL
+ */
+int init_arena(struct arena *to_init, size_t block_size);
+/*
+ * Deallocate every block of an arena,
+ * so that the struct can be deallocated.
+ * to_teardown:	the arena to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_arena(struct arena *to_teardown);
+/*
+ * Allocate memory from an arena,
+ * aligned to "ARENA_ALIGNMENT".
+ * arena:	the source arena
+ * size:	the number of bytes to allocate
+ * returns	the allocated memory,
+ *		or NULL if a new block could not be allocated,
+ *		with errno set to ENOMEM
+ */
+void *allocate_arena(struct arena *arena, size_t size);
+/*
+ * Find the current position of an arena,
+ * so that everything allocated after it can be freed at once.
+ * arena:	the source arena
+ * returns	the mark of the current position
+ */
+static inline struct arena_mark mark_arena(struct arena *arena)
+{
+	struct arena_mark mark;
+
+	mark.block = arena->block;
+	mark.used = arena->used;
+	return mark;
+}
+/*
+ * Free everything allocated from an arena since a mark was made.
+ * arena:	the arena to reset
+ * mark:	a mark of the arena, made after any earlier reset
+ *		to an earlier position
+ */
+void reset_arena(struct arena *arena, const struct arena_mark *mark);
+/*
+ * Free everything allocated from an arena,
+ * keeping a block to allocate from next.
+ * arena:	the arena to reset
+ */
+static inline void clear_arena(struct arena *arena)
+{
+	struct arena_mark start = {NULL, 0};
+
+	reset_arena(arena, &start);
+}
+
+/* the free objects of a thread, for one pool */
+struct pool_cache;
+
+/*
+ * a thread-safe allocator of objects that are all the same size.
+ * Each thread allocates from and frees to its own list,
+ * and moves objects to or from the shared list in batches of "POOL_BATCH",
+ * so it only takes the lock once in that many calls.
+ */
+struct pool {
+	/* the number of bytes in each object */
+	size_t object_size;
+	/* the number of objects allocated at a time */
+	size_t block_objects;
+
+	/* guards the fields after it */
+	pthread_mutex_t lock;
+	/* the shared list of free objects */
+	void *free_list;
+	/* the blocks of objects, which link to each other */
+	void *blocks;
+	/* the lists of the threads, which link to each other */
+	struct pool_cache *caches;
+
+	/* finds each thread's list */
+	pthread_key_t cache_key;
+
+	/* allocates objects from the pool, of at most "object_size" bytes */
+	struct allocator allocator;
+};
+
+/*
+ * Initialize an empty pool, which allocates blocks of objects as needed.
+ * to_init:		the pool to initialize
+ * object_size:		the number of bytes in each object
+ * block_objects:	the number of objects to allocate at a time
+ * returns		0 if successful
+ *			-1 if either size is 0, with errno set to EINVAL,
+ *			   or if the pool's lock or key could not be made,
+ *			   with errno set by "pthread"
+ */
+int init_pool(struct pool *to_init, size_t object_size, size_t block_objects);
+/*
+ * Deallocate every object of a pool, including those still in use,
+ * so that the struct can be deallocated.
+ * No other thread may be using the pool.
+ * to_teardown:	the pool to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_pool(struct pool *to_teardown);
+/*
+ * Allocate an object from a pool, in constant time.
+ * pool:	the source pool
+ * returns	the object,
+ *		or NULL if a block or the thread's list could not be allocated,
+ *		with errno set to ENOMEM
+ */
+void *allocate_pool(struct pool *pool);
+/*
+ * Return an object to the pool it was allocated from.
+ * It can be freed by a different thread from the one that allocated it.
+ * pool:	the destination pool
+ * object:	the object to free, or NULL
+ */
+void free_pool(struct pool *pool, void *object);
+
+#endif /* ALLOCATOR_H */
@@ -5,9 +5,11 @@
 #define DATA_STRUCTS_H
 
 #include <stdlib.h>
+#include <inttypes.h>
 #include <errno.h>
 
 #include <logger.h>
+#include <allocator.h>
 
 /* a single, sortable heap element */
 struct heap_element {
@@ -24,36 +26,59 @@ struct min_heap {
 
 	/* holds the heap of elements */
 	struct heap_element *elements;
+	/* the allocator of "elements", or NULL if it is "malloc" */
+	struct allocator *allocator;
 };
 
 /*
- * Initialize a heap and allocate the array of elements.
+ * Initialize a heap and allocate the array of elements
+ * from an allocator, such as an arena or a pool.
  * to_init:	the heap to initialize
  * capacity:	the "capacity" field,
- *		as well as the number of elements to allocate
+ *		as well as the number of usable elements to allocate
+ * allocator:	the allocator of the elements, or NULL to use "malloc"
  * returns	0 if successful
- *		-1 if allocation failed, with errno set to ENOMEM
+ *		-1 if allocation failed, with errno set by the allocator
  */
-static inline int init_min_heap(struct min_heap *to_init, size_t capacity)
+static inline int init_min_heap_with(struct min_heap *to_init,
+				     size_t capacity,
+				     struct allocator *allocator)
 {
 	/*
 	 * In a heap array, the 0 index is never used,
-	 * so the array "starts" one position before the allocated space.
+	 * so allocate one extra position in front of the elements.
 	 */
 	struct heap_element *
-	malloced_elements = malloc(sizeof(struct heap_element) * capacity);
+	malloced_elements = allocate_with(allocator,
+					  sizeof(struct heap_element) *
+					  (capacity + 1));
 	if (malloced_elements == NULL) {
 		printlg(ERROR_LEVEL, "Could not allocate heap elements.\n");
-		errno = ENOMEM;
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
 		return -1;
 	}
-	to_init->elements = malloced_elements - 1;
+	to_init->elements = malloced_elements;
+	to_init->allocator = allocator;
 
 	to_init->size = 0;
 	to_init->capacity = capacity;
 
 	return 0;
 }
+/*
+ * Initialize a heap and allocate the array of elements.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of usable elements to allocate
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_min_heap(struct min_heap *to_init, size_t capacity)
+{
+	return init_min_heap_with(to_init, capacity, NULL);
+}
 
 /*
  * Reset all the fields in a min-heap
@@ -63,11 +88,7 @@ static inline int init_min_heap(struct min_heap *to_init, size_t capacity)
  */
 static inline void teardown_min_heap(struct min_heap *to_teardown)
 {
-	/*
-	 * The allocated space that we want to free is
-	 * one position after the pointer.
-	 */
-	free(to_teardown->elements + 1);
+	release_with(to_teardown->allocator, to_teardown->elements);
 	to_teardown->elements = NULL;
 	to_teardown->capacity = 0;
 	to_teardown->size = 0;
@@ -92,14 +113,1062 @@ heapify(struct min_heap *heap_out, struct heap_element *array_in, size_t size);
  *		-1 if the heap was empty
  */
 int pop_min_heap(struct heap_element *head_out, struct min_heap *heap_in);
+/*
+ * Read the smallest element of the min-heap, without removing it.
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff the heap had an element to read.
+ *		-1 if the heap was empty
+ */
+static inline int
+peek_min_heap(struct heap_element *head_out, struct min_heap *heap_in)
+{
+	if (heap_in->size == 0) {
+		return -1;
+	}
+
+	*head_out = heap_in->elements[1];
+	return 0;
+}
+/*
+ * Add an element to the min-heap, and rearrange accordingly
+ * heap_out:	the destination heap
+ * to_push:	the element to copy into the heap
+ * returns	0 on success and
+ *		-1 if the heap is already at capacity, with errno set to ERANGE
+ */
+int push_min_heap(struct min_heap *heap_out, struct heap_element *to_push);
+/*
+ * Remove the smallest element from the min-heap,
+ * and then add a new element,
+ * with a single rearrangement instead of one for each operation.
+ * The new element may be the next head, but is never the one removed.
+ * head_out:	the space to write the head element
+ * heap:	the source and destination heap
+ * to_push:	the element to copy into the heap
+ * returns	0 iff successfully replaced the head.
+ *		-1 if the heap was empty, in which case nothing was added
+ */
+int replace_min_heap(struct heap_element *head_out, struct min_heap *heap,
+		     struct heap_element *to_push);
+/*
+ * Add an element to the min-heap,
+ * and then remove the smallest element, which may be the new one,
+ * with at most one rearrangement.
+ * Since the size does not change, this works even on a full heap.
+ * head_out:	the space to write the head element
+ * heap:	the source and destination heap
+ * to_push:	the element to copy into the heap
+ */
+void pushpop_min_heap(struct heap_element *head_out, struct min_heap *heap,
+		      struct heap_element *to_push);
+/*
+ * Perform heap sort on an array, without allocating any extra space,
+ * so that the keys are sorted from lowest to highest.
+ * A max-heap is built inside the array itself,
+ * and the largest elements are moved to the end one at a time.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ */
+void heap_sort_in_place(struct heap_element *array, size_t size);
 /*
  * Perform heap sort on an array,
  * so that the keys are sorted from lowest to highest.
+ * The sort is done in place by "heap_sort_in_place",
+ * so no second copy of the array is allocated.
  * array:	the array to sort
  * size:	the number of elements in the array
- * returns	0 iff successful,
- *		-1 on allocation failure, with errno set to ENOMEM.
+ * returns	0, since sorting in place cannot fail.
+ *		The return value is kept for compatibility.
  */
 int heap_sort(struct heap_element *array, size_t size);
 
+/*
+ * the number of elements below which "radix_sort"
+ * falls back to "heap_sort_in_place",
+ * since the fixed cost of counting digits dominates for small arrays
+ */
+#ifndef RADIX_SORT_THRESHOLD
+#define RADIX_SORT_THRESHOLD	256
+#endif /* RADIX_SORT_THRESHOLD */
+/*
+ * Perform a least-significant-digit radix sort on an array,
+ * so that the keys are sorted from lowest to highest,
+ * in linear time.
+ * Equal keys keep their original relative order,
+ * unless the array is smaller than "RADIX_SORT_THRESHOLD".
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful,
+ *		-1 if the scratch buffer could not be allocated,
+ *		   with errno set to ENOMEM.
+ */
+int radix_sort(struct heap_element *array, size_t size);
+/*
+ * Perform the same sort as "radix_sort",
+ * but with scratch space provided by the caller, so it cannot fail.
+ * array:	the array to sort
+ * scratch:	space for at least "size" elements,
+ *		whose contents will be overwritten
+ * size:	the number of elements in the array
+ */
+void radix_sort_buffered(struct heap_element *array,
+			 struct heap_element *scratch, size_t size);
+/*
+ * Rearrange an array so that the element at a given position
+ * is the one that would be there if the array were sorted,
+ * with no larger keys before it and no smaller keys after it.
+ * Quickselect is used, in linear time on average,
+ * with a fallback to heap sort if partitioning goes badly.
+ * array:	the array to rearrange
+ * size:	the number of elements in the array
+ * nth:		the position to fill, which should be less than "size"
+ */
+void nth_element(struct heap_element *array, size_t size, size_t nth);
+/*
+ * Sort only the smallest elements of an array, from lowest to highest,
+ * at the front of the array.
+ * The rest of the array is left in no particular order.
+ * array:	the array to rearrange
+ * size:	the number of elements in the array
+ * k:		the number of smallest elements to sort,
+ *		which is limited to "size"
+ */
+void partial_sort(struct heap_element *array, size_t size, size_t k);
+
+/*
+ * an accumulator of the elements with the K smallest, or largest, keys
+ * offered to it so far, using space only for those K
+ */
+struct top_k {
+	/* the number of elements to keep */
+	size_t k;
+	/* the number of elements kept so far */
+	size_t size;
+	/*
+	 * 0 to keep the smallest keys, or ~0 to keep the largest,
+	 * XORed into each stored key.
+	 * The stored keys are then kept smallest-first either way,
+	 * in a max-heap whose head is the first to be pushed out.
+	 */
+	int key_flip;
+
+	/* holds the max-heap of kept elements, starting from 0 */
+	struct heap_element *elements;
+	/* the allocator of "elements", or NULL if it is "malloc" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize a top-K accumulator and allocate its elements
+ * from an allocator, such as an arena or a pool.
+ * to_init:	the accumulator to initialize
+ * k:		the number of elements to keep
+ * keep_largest:	nonzero to keep the largest keys,
+ *			or 0 to keep the smallest
+ * allocator:	the allocator of the elements, or NULL to use "malloc"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_top_k_with(struct top_k *to_init, size_t k, int keep_largest,
+		    struct allocator *allocator);
+/*
+ * Initialize a top-K accumulator and allocate its elements.
+ * to_init:	the accumulator to initialize
+ * k:		the number of elements to keep
+ * keep_largest:	nonzero to keep the largest keys,
+ *			or 0 to keep the smallest
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_top_k(struct top_k *to_init, size_t k,
+			     int keep_largest)
+{
+	return init_top_k_with(to_init, k, keep_largest, NULL);
+}
+/*
+ * Deallocate the elements of an accumulator,
+ * so that the struct can be deallocated.
+ * to_teardown:	the accumulator to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_top_k(struct top_k *to_teardown);
+/*
+ * Read the kept element that would be pushed out first,
+ * ie. the largest kept key, or the smallest if keeping the largest.
+ * Once the accumulator is full, only better keys are kept.
+ * head_out:	the space to write the element
+ * top:		the source accumulator
+ * returns	0 iff there was an element to read.
+ *		-1 if no element was kept yet
+ */
+static inline int peek_top_k(struct heap_element *head_out, struct top_k *top)
+{
+	if (top->size == 0) {
+		return -1;
+	}
+
+	*head_out = top->elements[0];
+	head_out->key ^= top->key_flip;
+	return 0;
+}
+/*
+ * Offer an element to an accumulator,
+ * which keeps it if it is among the K best so far.
+ * Once the accumulator is full,
+ * an element that is not kept costs a single comparison.
+ * top:		the destination accumulator
+ * offered:	the element to copy into the accumulator, if kept
+ * returns	1 if the element was kept, 0 otherwise
+ */
+int offer_top_k(struct top_k *top, const struct heap_element *offered);
+/*
+ * Offer every element of an array to an accumulator, as in "offer_top_k".
+ * top:		the destination accumulator
+ * offered:	the elements to offer
+ * n_offered:	the number of elements in "offered"
+ * returns	the number of elements that were kept when offered
+ */
+size_t offer_many_top_k(struct top_k *top, const struct heap_element *offered,
+			size_t n_offered);
+/*
+ * Write the kept elements in order, best first,
+ * ie. from lowest to highest key, or the reverse if keeping the largest.
+ * The accumulator is unchanged, and can take more elements.
+ * out:		the output array, with space for "size" elements
+ * top:		the source accumulator
+ * returns	the number of elements written, ie. the "size" field
+ */
+size_t results_top_k(struct heap_element *out, struct top_k *top);
+
+/*
+ * a min-heap whose elements can be found again after insertion,
+ * through a handle that stays the same while the element moves in the heap
+ */
+struct indexed_min_heap {
+	/* the maximum number of elements that this heap can hold */
+	size_t capacity;
+	/* the current number of elements that this heap holds */
+	size_t size;
+
+	/* holds the heap of elements, starting from position 1 */
+	struct heap_element *elements;
+	/* the handle of the element at each position, starting from 1 */
+	size_t *handles;
+	/*
+	 * the position of the element with each handle,
+	 * or 0 if the handle is not in use
+	 */
+	size_t *positions;
+
+	/* the stack of handles that are not in use */
+	size_t *free_handles;
+	/* the number of handles in "free_handles" */
+	size_t n_free;
+
+	/* the allocator of the arrays, or NULL if it is "malloc" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize an indexed heap and allocate its arrays
+ * from an allocator, such as an arena or a pool.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of elements and handles to allocate
+ * allocator:	the allocator of the arrays, or NULL to use "malloc"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_indexed_min_heap_with(struct indexed_min_heap *to_init,
+			       size_t capacity, struct allocator *allocator);
+/*
+ * Initialize an indexed heap and allocate its arrays.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of elements and handles to allocate
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_indexed_min_heap(struct indexed_min_heap *to_init,
+					size_t capacity)
+{
+	return init_indexed_min_heap_with(to_init, capacity, NULL);
+}
+/*
+ * Reset all the fields in an indexed heap
+ * and deallocate its arrays so that the struct can be deallocated.
+ * to_teardown:	the heap to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_indexed_min_heap(struct indexed_min_heap *to_teardown);
+/*
+ * Check if a handle refers to an element that is still in the heap.
+ * heap:	the heap that gave out the handle
+ * handle:	the handle to check
+ * returns	1 iff the handle's element is in the heap, 0 otherwise
+ */
+static inline int
+in_indexed_min_heap(struct indexed_min_heap *heap, size_t handle)
+{
+	return handle < heap->capacity && heap->positions[handle] != 0;
+}
+/*
+ * Read the element with the given handle, without removing it.
+ * heap:	the source heap
+ * handle:	the handle of the element, which must be in the heap
+ * returns	a pointer to the element,
+ *		which is only valid until the heap is next changed
+ */
+static inline struct heap_element *
+get_indexed_min_heap(struct indexed_min_heap *heap, size_t handle)
+{
+	debug_assert(in_indexed_min_heap(heap, handle));
+	return &heap->elements[heap->positions[handle]];
+}
+/*
+ * Add an element to the indexed heap.
+ * heap:	the destination heap
+ * to_push:	the element to copy into the heap
+ * handle_out:	the space to write the element's new handle
+ * returns	0 on success and
+ *		-1 if the heap is already at capacity, with errno set to ERANGE
+ */
+int push_indexed_min_heap(struct indexed_min_heap *heap,
+			  struct heap_element *to_push, size_t *handle_out);
+/*
+ * Remove the smallest element from the indexed heap,
+ * and release its handle.
+ * head_out:	the space to write the head element
+ * handle_out:	the space to write the head element's old handle,
+ *		or NULL if it is not needed
+ * heap:	the source heap
+ * returns	0 iff successfully popped the heap.
+ *		-1 if the heap was empty
+ */
+int pop_indexed_min_heap(struct heap_element *head_out, size_t *handle_out,
+			 struct indexed_min_heap *heap);
+/*
+ * Remove the element with the given handle from the indexed heap,
+ * and release its handle.
+ * removed_out:	the space to write the removed element,
+ *		or NULL if it is not needed
+ * heap:	the source heap
+ * handle:	the handle of the element to remove
+ * returns	0 on success and
+ *		-1 if the handle is not in the heap, with errno set to EINVAL
+ */
+int remove_indexed_min_heap(struct heap_element *removed_out,
+			    struct indexed_min_heap *heap, size_t handle);
+/*
+ * Lower the key of an element in the indexed heap.
+ * heap:	the heap containing the element
+ * handle:	the handle of the element to change
+ * key:		the new key, which must not be greater than the old key
+ * returns	0 on success and
+ *		-1 if the handle is not in the heap,
+ *		   or the new key is greater than the old key,
+ *		   with errno set to EINVAL
+ */
+int decrease_key_indexed_min_heap(struct indexed_min_heap *heap,
+				  size_t handle, int key);
+/*
+ * Raise the key of an element in the indexed heap.
+ * heap:	the heap containing the element
+ * handle:	the handle of the element to change
+ * key:		the new key, which must not be less than the old key
+ * returns	0 on success and
+ *		-1 if the handle is not in the heap,
+ *		   or the new key is less than the old key,
+ *		   with errno set to EINVAL
+ */
+int increase_key_indexed_min_heap(struct indexed_min_heap *heap,
+				  size_t handle, int key);
+
+/*
+ * a min-heap in which every node has "DARY_HEAP_ARITY" children,
+ * laid out so that all the children of a node start on a cache line.
+ * The arity is chosen when the library is compiled, and must be 4 or 8.
+ */
+struct dary_min_heap {
+	/* the maximum number of elements that this heap can hold */
+	size_t capacity;
+	/* the current number of elements that this heap holds */
+	size_t size;
+
+	/* holds the heap of elements, starting from position 0 */
+	struct heap_element *elements;
+	/*
+	 * the aligned space holding "elements",
+	 * which starts a few positions before it to align the children
+	 */
+	struct heap_element *allocated;
+	/* the memory holding "allocated", as it came from the allocator */
+	void *block;
+	/* the allocator of "block", or NULL if it is "posix_memalign" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize a d-ary heap and allocate the aligned array of elements
+ * from an allocator, such as an arena or a pool,
+ * which is asked for enough extra memory to align the array.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of usable elements to allocate
+ * allocator:	the allocator of the elements,
+ *		or NULL to use "posix_memalign"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_dary_min_heap_with(struct dary_min_heap *to_init, size_t capacity,
+			    struct allocator *allocator);
+/*
+ * Initialize a d-ary heap and allocate the aligned array of elements.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of usable elements to allocate
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_dary_min_heap(struct dary_min_heap *to_init,
+				     size_t capacity)
+{
+	return init_dary_min_heap_with(to_init, capacity, NULL);
+}
+/*
+ * Reset all the fields in a d-ary heap
+ * and deallocate its array so that the struct can be deallocated.
+ * to_teardown:	the heap to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_dary_min_heap(struct dary_min_heap *to_teardown);
+/*
+ * Put all the elements of an array into a d-ary heap.
+ * heap_out:	the destination heap
+ * array_in:	the source array
+ * size:	the number of elements in array_in,
+ *		which should not exceed the capacity of the heap
+ * returns	0 on success and
+ *		-1 if the size is too large, with errno set to ERANGE
+ */
+int heapify_dary(struct dary_min_heap *heap_out, struct heap_element *array_in,
+		 size_t size);
+/*
+ * Read the smallest element of the d-ary heap, without removing it.
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff the heap had an element to read.
+ *		-1 if the heap was empty
+ */
+static inline int
+peek_dary_min_heap(struct heap_element *head_out, struct dary_min_heap *heap_in)
+{
+	if (heap_in->size == 0) {
+		return -1;
+	}
+
+	*head_out = heap_in->elements[0];
+	return 0;
+}
+/*
+ * Add an element to the d-ary heap, and rearrange accordingly
+ * heap_out:	the destination heap
+ * to_push:	the element to copy into the heap
+ * returns	0 on success and
+ *		-1 if the heap is already at capacity, with errno set to ERANGE
+ */
+int push_dary_min_heap(struct dary_min_heap *heap_out,
+		       struct heap_element *to_push);
+/*
+ * Remove the smallest element from the d-ary heap, and rearrange accordingly
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff successfully popped the heap.
+ *		-1 if the heap was empty
+ */
+int pop_dary_min_heap(struct heap_element *head_out,
+		      struct dary_min_heap *heap_in);
+
+/*
+ * a min-heap with 8 children per node,
+ * which keeps the keys and the data in separate arrays,
+ * so that all the keys of a group of children can be compared at once
+ * with SIMD instructions, where they are available
+ */
+struct soa_min_heap {
+	/* the maximum number of elements that this heap can hold */
+	size_t capacity;
+	/* the current number of elements that this heap holds */
+	size_t size;
+
+	/* the keys of the heap, starting from position 0 */
+	int32_t *keys;
+	/* the data associated with each key, at the same positions */
+	void **data;
+	/*
+	 * the aligned space holding "keys",
+	 * which starts a few positions before it to align the children
+	 */
+	int32_t *allocated_keys;
+	/* the space holding "data", with the same offset as the keys */
+	void **allocated_data;
+	/* the memory holding "allocated_keys", as it came from the allocator */
+	void *keys_block;
+	/*
+	 * the allocator of "keys_block" and "allocated_data",
+	 * or NULL if they are from "posix_memalign" and "malloc"
+	 */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize a structure-of-arrays heap, and allocate its arrays
+ * from an allocator, such as an arena or a pool,
+ * which is asked for enough extra memory to align the keys.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of usable elements to allocate
+ * allocator:	the allocator of the arrays,
+ *		or NULL to use "posix_memalign" and "malloc"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_soa_min_heap_with(struct soa_min_heap *to_init, size_t capacity,
+			   struct allocator *allocator);
+/*
+ * Initialize a structure-of-arrays heap, and allocate its arrays.
+ * to_init:	the heap to initialize
+ * capacity:	the "capacity" field,
+ *		as well as the number of usable elements to allocate
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_soa_min_heap(struct soa_min_heap *to_init,
+				    size_t capacity)
+{
+	return init_soa_min_heap_with(to_init, capacity, NULL);
+}
+/*
+ * Reset all the fields in a structure-of-arrays heap
+ * and deallocate its arrays so that the struct can be deallocated.
+ * to_teardown:	the heap to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_soa_min_heap(struct soa_min_heap *to_teardown);
+/*
+ * Put all the elements of an array into a structure-of-arrays heap.
+ * heap_out:	the destination heap
+ * array_in:	the source array
+ * size:	the number of elements in array_in,
+ *		which should not exceed the capacity of the heap
+ * returns	0 on success and
+ *		-1 if the size is too large, with errno set to ERANGE
+ */
+int heapify_soa(struct soa_min_heap *heap_out, struct heap_element *array_in,
+		size_t size);
+/*
+ * Read the smallest element of the heap, without removing it.
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff the heap had an element to read.
+ *		-1 if the heap was empty
+ */
+static inline int
+peek_soa_min_heap(struct heap_element *head_out, struct soa_min_heap *heap_in)
+{
+	if (heap_in->size == 0) {
+		return -1;
+	}
+
+	head_out->key = heap_in->keys[0];
+	head_out->data = heap_in->data[0];
+	return 0;
+}
+/*
+ * Add an element to the heap, and rearrange accordingly
+ * heap_out:	the destination heap
+ * to_push:	the element to copy into the heap
+ * returns	0 on success and
+ *		-1 if the heap is already at capacity, with errno set to ERANGE
+ */
+int push_soa_min_heap(struct soa_min_heap *heap_out,
+		      struct heap_element *to_push);
+/*
+ * Remove the smallest element from the heap, and rearrange accordingly
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff successfully popped the heap.
+ *		-1 if the heap was empty
+ */
+int pop_soa_min_heap(struct heap_element *head_out,
+		     struct soa_min_heap *heap_in);
+
+/* the number of buckets in a radix heap: one for each bit of a key, and one */
+#define RADIX_HEAP_BUCKETS	(sizeof(int) * 8 + 1)
+
+/* a bucket of elements in a radix heap, in no particular order */
+struct radix_heap_bucket {
+	/* the elements in the bucket */
+	struct heap_element *elements;
+	/* the number of elements in the bucket */
+	size_t size;
+	/* the number of elements allocated for the bucket */
+	size_t capacity;
+};
+
+/*
+ * a monotone priority queue,
+ * from which elements are popped in the same order as from a min-heap,
+ * as long as no element is pushed with a key below the last one popped.
+ * Elements are kept in buckets by the highest bit in which their key
+ * differs from the last key popped,
+ * so each element is moved between buckets at most once per bit.
+ */
+struct radix_heap {
+	/* the current number of elements that this heap holds */
+	size_t size;
+	/*
+	 * the last key popped, mapped to an unsigned key of the same order,
+	 * which no new key may be below
+	 */
+	unsigned last;
+
+	/*
+	 * the elements by the highest bit in which they differ from "last",
+	 * with bucket 0 holding the elements whose keys equal it
+	 */
+	struct radix_heap_bucket buckets[RADIX_HEAP_BUCKETS];
+
+	/* the allocator of the buckets, or NULL if it is "malloc" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize an empty radix heap, which allocates buckets as it grows
+ * from an allocator, such as an arena or a pool.
+ * A bucket that grows is copied, and its old memory released,
+ * so an arena is best used for heaps that are cleared with it.
+ * to_init:	the heap to initialize
+ * allocator:	the allocator of the buckets, or NULL to use "malloc"
+ */
+void init_radix_heap_with(struct radix_heap *to_init,
+			  struct allocator *allocator);
+/*
+ * Initialize an empty radix heap, which allocates buckets as it grows.
+ * to_init:	the heap to initialize
+ */
+static inline void init_radix_heap(struct radix_heap *to_init)
+{
+	init_radix_heap_with(to_init, NULL);
+}
+/*
+ * Deallocate the buckets of a radix heap,
+ * so that the struct can be deallocated.
+ * to_teardown:	the heap to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_radix_heap(struct radix_heap *to_teardown);
+/*
+ * Add an element to the radix heap, in constant amortized time.
+ * heap_out:	the destination heap
+ * to_push:	the element to copy into the heap
+ * returns	0 on success and
+ *		-1 if the key is below the last key popped,
+ *		   with errno set to EINVAL,
+ *		   or if the bucket could not grow,
+ *		   with errno set to ENOMEM or by the allocator
+ */
+int push_radix_heap(struct radix_heap *heap_out, struct heap_element *to_push);
+/*
+ * Read the smallest element of the radix heap, without removing it.
+ * The buckets may still be rearranged.
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff the heap had an element to read.
+ *		-1 if the heap was empty,
+ *		   or if the buckets could not grow,
+ *		   with errno set to ENOMEM
+ */
+int peek_radix_heap(struct heap_element *head_out, struct radix_heap *heap_in);
+/*
+ * Remove the smallest element from the radix heap,
+ * in time logarithmic in the range of keys, amortized over the pushes.
+ * head_out:	the space to write the head element
+ * heap_in:	the source heap
+ * returns	0 iff successfully popped the heap.
+ *		-1 if the heap was empty,
+ *		   or if the buckets could not grow,
+ *		   with errno set to ENOMEM
+ */
+int pop_radix_heap(struct heap_element *head_out, struct radix_heap *heap_in);
+
+/* a frequently counted item, as tracked by "struct space_saving" */
+struct heavy_hitter {
+	/* the item being counted */
+	uint64_t item;
+	/*
+	 * the number of times the item was counted,
+	 * which may be more than its true count, but never less
+	 */
+	uint64_t count;
+	/*
+	 * the most that "count" can exceed the true count by,
+	 * ie. the count of the item that this item took the counter of
+	 */
+	uint64_t error;
+};
+
+/* marks an unused entry in the index of a "struct space_saving" */
+#define SPACE_SAVING_EMPTY	((size_t) -1)
+
+/*
+ * a tracker of the most frequent items in a stream,
+ * by the Space-Saving algorithm:
+ * a fixed number of counters are kept in a min-heap by count,
+ * and an item without a counter takes over the smallest one.
+ * Any item counted more than "total / capacity" times is tracked.
+ */
+struct space_saving {
+	/* the number of counters */
+	size_t capacity;
+	/* the number of counters in use */
+	size_t size;
+	/* the total of all the counts added */
+	uint64_t total;
+
+	/* the min-heap of counters by count, starting from 0 */
+	struct heavy_hitter *counters;
+	/* the position in "index" of the item of each counter */
+	size_t *index_positions;
+
+	/*
+	 * the position in "counters" of each item,
+	 * hashed with linear probing,
+	 * with unused entries set to "SPACE_SAVING_EMPTY"
+	 */
+	size_t *index;
+	/* the base 2 logarithm of the number of entries in "index" */
+	unsigned index_bits;
+
+	/* the allocator of the arrays, or NULL if it is "malloc" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize a heavy hitter tracker and allocate its counters
+ * from an allocator, such as an arena or a pool.
+ * to_init:	the tracker to initialize
+ * capacity:	the number of counters, ie. the most items tracked
+ * allocator:	the allocator of the arrays, or NULL to use "malloc"
+ * returns	0 if successful
+ *		-1 if the capacity is 0, with errno set to EINVAL,
+ *		   or if allocation failed, with errno set by the allocator
+ */
+int init_space_saving_with(struct space_saving *to_init, size_t capacity,
+			   struct allocator *allocator);
+/*
+ * Initialize a heavy hitter tracker and allocate its counters.
+ * to_init:	the tracker to initialize
+ * capacity:	the number of counters, ie. the most items tracked
+ * returns	0 if successful
+ *		-1 if the capacity is 0, with errno set to EINVAL,
+ *		   or if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_space_saving(struct space_saving *to_init,
+				    size_t capacity)
+{
+	return init_space_saving_with(to_init, capacity, NULL);
+}
+/*
+ * Deallocate the arrays of a tracker, so that the struct can be deallocated.
+ * to_teardown:	the tracker to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_space_saving(struct space_saving *to_teardown);
+/*
+ * Count an item some number of times, in logarithmic time.
+ * tracker:	the destination tracker
+ * item:	the item to count
+ * increment:	the number of times to count the item
+ */
+void add_space_saving(struct space_saving *tracker, uint64_t item,
+		      uint64_t increment);
+/*
+ * Count each item of an array once.
+ * Repeats of the same item in a row are counted together.
+ * tracker:	the destination tracker
+ * items:	the items to count
+ * n_items:	the number of items
+ */
+void add_many_space_saving(struct space_saving *tracker,
+			   const uint64_t *items, size_t n_items);
+/*
+ * Read the count of an item.
+ * tracker:	the source tracker
+ * item:	the item whose count to read
+ * hitter_out:	the space to write the item's count and error
+ * returns	0 iff the item is tracked.
+ *		-1 if the item is not tracked,
+ *		   in which case its true count is at most
+ *		   "min_count_space_saving"
+ */
+int get_space_saving(struct space_saving *tracker, uint64_t item,
+		     struct heavy_hitter *hitter_out);
+/*
+ * Find the most times that an item without a counter can have been counted.
+ * tracker:	the source tracker
+ * returns	the smallest count if every counter is in use, or 0 otherwise
+ */
+static inline uint64_t min_count_space_saving(struct space_saving *tracker)
+{
+	return tracker->size < tracker->capacity ? 0 :
+	       tracker->counters[0].count;
+}
+/*
+ * Write the tracked items, from the highest count to the lowest.
+ * out:		the output array, with space for "size" items
+ * tracker:	the source tracker, which is unchanged
+ * returns	the number of items written, ie. the "size" field
+ */
+size_t results_space_saving(struct heavy_hitter *out,
+			    struct space_saving *tracker);
+
+/* the number of slots of a hash map whose control bytes are compared at once */
+#define HASH_MAP_GROUP		16
+/* the control byte of a slot that has never been used since the last rehash */
+#define HASH_MAP_EMPTY		((int8_t) -128)
+/* the control byte of a slot whose entry was removed */
+#define HASH_MAP_DELETED	((int8_t) -2)
+
+/* an entry of a "struct hash_map" */
+struct hash_map_entry {
+	/* the key, which is either an integer or a string of bytes */
+	union {
+		/* the integer key */
+		uint64_t integer;
+		/* the bytes of the key, which the map does not copy */
+		const void *bytes;
+	} key;
+	/* the number of bytes in the key, if it is a byte string */
+	size_t key_size;
+	/* the value associated with the key */
+	void *value;
+};
+
+/*
+ * a hash map with open addressing, in the style of Swiss tables:
+ * the slots are probed a group at a time,
+ * by comparing 7 bits of the key's hash with a control byte for each slot,
+ * so that most lookups only compare one key, and touch one group.
+ * A map holds either integer keys or byte-string keys, but not both.
+ */
+struct hash_map {
+	/*
+	 * the number of slots, which is a power of 2,
+	 * and a multiple of "HASH_MAP_GROUP"
+	 */
+	size_t capacity;
+	/* the number of entries */
+	size_t size;
+	/* the number of empty slots that can be filled before a rehash */
+	size_t growth_left;
+
+	/*
+	 * the control byte of each slot:
+	 * "HASH_MAP_EMPTY", "HASH_MAP_DELETED",
+	 * or the low 7 bits of the hash of the slot's key
+	 */
+	int8_t *control;
+	/* the entry of each slot */
+	struct hash_map_entry *entries;
+
+	/* the memory holding "control", as it came from the allocator */
+	void *control_block;
+	/*
+	 * the allocator of "control_block" and "entries",
+	 * or NULL if they are from "posix_memalign" and "malloc"
+	 */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize an empty hash map and allocate its slots
+ * from an allocator, such as an arena or a pool.
+ * When the map grows, its old slots are released,
+ * so an arena is best used for maps that are cleared with it.
+ * to_init:	the map to initialize
+ * capacity:	the number of entries to make room for,
+ *		though the map grows as needed
+ * allocator:	the allocator of the slots,
+ *		or NULL to use "posix_memalign" and "malloc"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_hash_map_with(struct hash_map *to_init, size_t capacity,
+		       struct allocator *allocator);
+/*
+ * Initialize an empty hash map and allocate its slots.
+ * to_init:	the map to initialize
+ * capacity:	the number of entries to make room for,
+ *		though the map grows as needed
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_hash_map(struct hash_map *to_init, size_t capacity)
+{
+	return init_hash_map_with(to_init, capacity, NULL);
+}
+/*
+ * Deallocate the slots of a hash map, so that the struct can be deallocated.
+ * The keys and values themselves are not freed.
+ * to_teardown:	the map to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_hash_map(struct hash_map *to_teardown);
+/*
+ * Associate a value with an integer key,
+ * replacing any value it already had.
+ * map:		the destination map, with integer keys
+ * key:		the key
+ * value:	the value to associate with the key
+ * returns	0 on success and
+ *		-1 if the map could not grow, with errno set to ENOMEM
+ */
+int put_hash_map(struct hash_map *map, uint64_t key, void *value);
+/*
+ * Find the value of an integer key.
+ * map:		the source map, with integer keys
+ * key:		the key to look up
+ * value_out:	the space to write the key's value
+ * returns	0 iff the key is in the map.
+ *		-1 if the key is not in the map
+ */
+int get_hash_map(struct hash_map *map, uint64_t key, void **value_out);
+/*
+ * Remove an integer key and its value.
+ * map:		the source map, with integer keys
+ * key:		the key to remove
+ * value_out:	the space to write the key's value, or NULL
+ * returns	0 iff the key was removed.
+ *		-1 if the key is not in the map
+ */
+int remove_hash_map(struct hash_map *map, uint64_t key, void **value_out);
+/*
+ * Associate a value with a byte-string key,
+ * replacing any value it already had.
+ * The key's bytes must stay unchanged until the key is removed.
+ * map:		the destination map, with byte-string keys
+ * key:		the bytes of the key
+ * key_size:	the number of bytes in the key
+ * value:	the value to associate with the key
+ * returns	0 on success and
+ *		-1 if the map could not grow, with errno set to ENOMEM
+ */
+int put_bytes_hash_map(struct hash_map *map, const void *key, size_t key_size,
+		       void *value);
+/*
+ * Find the value of a byte-string key.
+ * map:		the source map, with byte-string keys
+ * key:		the bytes of the key to look up
+ * key_size:	the number of bytes in the key
+ * value_out:	the space to write the key's value
+ * returns	0 iff the key is in the map.
+ *		-1 if the key is not in the map
+ */
+int get_bytes_hash_map(struct hash_map *map, const void *key, size_t key_size,
+		       void **value_out);
+/*
+ * Remove a byte-string key and its value.
+ * map:		the source map, with byte-string keys
+ * key:		the bytes of the key to remove
+ * key_size:	the number of bytes in the key
+ * value_out:	the space to write the key's value, or NULL
+ * returns	0 iff the key was removed.
+ *		-1 if the key is not in the map
+ */
+int remove_bytes_hash_map(struct hash_map *map, const void *key,
+			  size_t key_size, void **value_out);
+
+/* a sorted run being merged by "struct run_merger" */
+struct merge_run {
+	/* the next element of the run to merge */
+	struct heap_element *next;
+	/* the number of elements of the run left to merge */
+	size_t remaining;
+};
+
+/*
+ * merges multiple sorted runs into one sorted sequence,
+ * keeping only the next element of each run in a min-heap
+ */
+struct run_merger {
+	/*
+	 * holds the next element of each run that is not used up,
+	 * with the run as its data
+	 */
+	struct min_heap heap;
+	/* the runs being merged */
+	struct merge_run *runs;
+	/* the number of runs */
+	size_t n_runs;
+	/* the allocator of "runs" and the heap, or NULL if it is "malloc" */
+	struct allocator *allocator;
+};
+
+/*
+ * Initialize a merger of sorted runs, allocating its arrays
+ * from an allocator, such as an arena or a pool.
+ * The runs are not copied, and must not change until the merge is done.
+ * to_init:	the merger to initialize
+ * runs:	the runs to merge, each sorted from lowest to highest key
+ * sizes:	the number of elements in each run
+ * n_runs:	the number of runs
+ * allocator:	the allocator of the arrays, or NULL to use "malloc"
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set by the allocator
+ */
+int init_run_merger_with(struct run_merger *to_init,
+			 struct heap_element **runs, size_t *sizes,
+			 size_t n_runs, struct allocator *allocator);
+/*
+ * Initialize a merger of sorted runs.
+ * The runs are not copied, and must not change until the merge is done.
+ * to_init:	the merger to initialize
+ * runs:	the runs to merge, each sorted from lowest to highest key
+ * sizes:	the number of elements in each run
+ * n_runs:	the number of runs
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+static inline int init_run_merger(struct run_merger *to_init,
+				  struct heap_element **runs, size_t *sizes,
+				  size_t n_runs)
+{
+	return init_run_merger_with(to_init, runs, sizes, n_runs, NULL);
+}
+/*
+ * Deallocate the arrays of a merger, so that the struct can be deallocated.
+ * to_teardown:	the merger to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_run_merger(struct run_merger *to_teardown);
+/*
+ * Take the next element, in sorted order, from the merged runs.
+ * out:		the space to write the next element
+ * merger:	the source merger
+ * returns	0 iff an element was taken.
+ *		-1 if all the runs were used up
+ */
+int next_run_merger(struct heap_element *out, struct run_merger *merger);
+/*
+ * Write all the elements left in the merged runs, in sorted order.
+ * dest:	the output array,
+ *		which must have space for every element left in the runs,
+ *		and must not overlap with them
+ * merger:	the source merger, which will be used up
+ * returns	the number of elements written
+ */
+size_t merge_into(struct heap_element *dest, struct run_merger *merger);
+
 #endif /* DATA_STRUCTS_H */
@@ -0,0 +1,79 @@
+/*
+ * Sorting of fixed-size records that may not fit in memory,
+ * by sorting memory-sized chunks into temporary run files,
+ * and merging the runs back together.
+ */
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <file_buffer.h>
+
+/*
+ * the number of bytes that each run file should be read at a time
+ * while merging, if the memory budget allows,
+ * which limits how many runs are merged at once
+ */
+#define EXTERNAL_SORT_MIN_READ	0x10000
+
+/*
+ * Find the key of a record, by which the records are sorted.
+ * record:	the record whose key to find
+ * returns	the record's key
+ */
+typedef int (*record_key_t)(const void *record);
+
+/*
+ * Read the next records to sort.
+ * records:	the space to write the records to
+ * max_records:	the maximum number of records to write
+ * n_read:	the space to write the number of records written,
+ *		which is 0 only if there are no more records
+ * arg:		the caller's argument passed to "external_sort"
+ * returns	0 on success, -1 on error, with errno set
+ */
+typedef int (*record_reader_t)(void *records, size_t max_records,
+			       size_t *n_read, void *arg);
+
+/*
+ * Sort records from lowest to highest key,
+ * using no more than a given amount of memory for the records.
+ * If the records do not fit, sorted runs are written to temporary files,
+ * which are then merged.
+ * out:			the file stream to which to write the sorted records
+ * record_size:		the number of bytes in each record
+ * get_key:		finds the key of each record
+ * memory_budget:	the number of bytes to use for buffering records
+ * read_records:	reads the records to sort
+ * arg:			the argument passed to "read_records"
+ * returns		0 on success,
+ *			-1 if the records are empty,
+ *			   or the budget is too small for a few records,
+ *			   with errno set to EINVAL,
+ *			   or if memory could not be allocated,
+ *			   with errno set to ENOMEM,
+ *			   or if reading or writing failed,
+ *			   with errno set by "read_records" or the stream
+ */
+int external_sort(FILE *out, size_t record_size, record_key_t get_key,
+		  size_t memory_budget, record_reader_t read_records,
+		  void *arg);
+/*
+ * Sort the records read from a file buffer, as in "external_sort".
+ * out:			the file stream to which to write the sorted records
+ * in:			the buffer from which to read the records,
+ *			starting from its current position
+ * record_size:		the number of bytes in each record
+ * get_key:		finds the key of each record
+ * memory_budget:	the number of bytes to use for buffering records
+ * returns		0 on success,
+ *			-1 on failure, with errno set as in "external_sort",
+ *			   or to EINVAL if the file ends in a partial record
+ */
+int external_sort_file_buffer(FILE *out, file_buffer_t *in,
+			      size_t record_size, record_key_t get_key,
+			      size_t memory_budget);
+
+#endif /* EXTERNAL_SORT_H */
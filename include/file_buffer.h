@@ -1,35 +1,100 @@
 /*
  * buffered wrapper around an input file stream
  * Functions correspond to actual file stream reading operations,
- * but up to a page of file data is buffered in user-space memory.
+ * but up to a page of file data, or more if asked for,
+ * is buffered in user-space memory.
+ * The file can also be read from a file descriptor with "pread",
+ * bypassing the buffering and locking of the stream.
+ * The buffered data can also be read in place,
+ * with "peek_buffer" and "consume_buffer".
+ * Any number of threads can read at positions of the same buffer,
+ * with "read_buffer_at", through a small cache of blocks that they share.
+ * While reads through the cursor are sequential,
+ * "set_read_ahead" has the kernel read the next buffers in the background.
+ * A file can also be mapped into memory, with "open_file_buffer_mapped",
+ * and read straight from the mapping.
  */
 #ifndef FILE_BUFFER_H
 #define FILE_BUFFER_H
 
 #include <stdio.h>
+#include <pthread.h>
+
+#include <allocator.h>
+
+/* the largest buffer that "init_file_buffer_sized" allocates */
+#define FILE_BUFFER_MAX_SIZE	(16 << 20)
+/* the huge page size, to which buffers of at least that size are aligned */
+#define FILE_BUFFER_HUGE_PAGE	(2 << 20)
+/* the most bytes that "set_read_ahead" reads ahead */
+#define FILE_BUFFER_MAX_READ_AHEAD	(64 << 20)
+
+/* a block of the file in the cache shared by "read_buffer_at" */
+struct file_block {
+	/* Readers hold it to copy from the block, and a writer to fill it. */
+	pthread_rwlock_t lock;
+	/* the position in the file of the block's data, or -1 if empty */
+	long offset;
+	/* the number of bytes of data, less than a block only at the end */
+	size_t size;
+	/* the data of the block */
+	unsigned char *data;
+};
 
 /*
  * the underlying data structure of the wrapper,
  * which should not be accessed directly
  */
 struct file_buffer {
-	/* the file stream from which to read */
+	/* the file stream from which to read, or NULL to read from "fd" */
 	FILE *in_file;
+	/* the file descriptor from which to read, or -1 to use "in_file" */
+	int fd;
 	/* the size of the file, in bytes */
 	size_t file_size;
+	/* the whole file mapped into memory, or NULL if it is read */
+	unsigned char *mapping;
 
 	/*
-	 * the buffer, with a page of space
-	 * If there is data, it starts a page size before the real position.
+	 * the buffer, with "buffer_size" bytes of space,
+	 * or NULL if the file is mapped
+	 * If there is data, it starts "buffer_size" before the real position.
 	 */
 	unsigned char *buffer;
+	/*
+	 * the number of bytes in "buffer", a multiple of the page size
+	 * If the file is mapped, the real position moves on in steps of it,
+	 * as if the buffer were refilled, but nothing is ever buffered.
+	 */
+	size_t buffer_size;
 	/* Is there data in the buffer? */
 	int buffered;
+	/*
+	 * the allocator of "buffer",
+	 * or NULL if it has the default aligned allocation
+	 */
+	struct allocator *allocator;
 
 	/* the position from which the next byte will be read to the user */
 	long virtual_position;
 	/* the position from which the next byte will be read from the file */
 	long real_position;
+
+	/* the cache of "read_buffer_at", or NULL if it reads straight away */
+	struct file_block *blocks;
+	/* the number of blocks in the cache */
+	size_t n_blocks;
+	/* the number of bytes in each block */
+	size_t block_size;
+
+	/* the most buffers to read ahead, or 0 not to read ahead */
+	size_t read_ahead_max;
+	/* the number of buffers read ahead, growing while reads are in order */
+	size_t read_ahead_depth;
+	/* the position after the last bytes read from the file */
+	long sequential_end;
+	/* the position up to which the file is being read ahead */
+	long read_ahead_end;
 };
 
 /* the wrapper used by the API user */
@@ -46,6 +111,17 @@ inline static size_t get_file_size(file_buffer_t *buffer)
 	return buffer->file_size;
 }
 
+/*
+ * Get the size of the buffer.
+ * buffer:	the file whose buffer size to fetch
+ * returns	the number of bytes that can be buffered,
+ *		ie. the "buffer_size" field.
+ */
+inline static size_t get_buffer_size(file_buffer_t *buffer)
+{
+	return buffer->buffer_size;
+}
+
 /*
  * Initialize a file buffer from a file stream.
  * to_init:	the buffer to initialize
@@ -57,6 +133,58 @@ inline static size_t get_file_size(file_buffer_t *buffer)
  *		   in which case "ftell" or "fseek" sets "errno"
  */
 int init_file_buffer(file_buffer_t *to_init, FILE *in_file);
+/*
+ * Initialize a file buffer from a file stream,
+ * with a buffer of a given size instead of a page.
+ * Larger buffers read the file in fewer, larger calls.
+ * The buffer is aligned to pages,
+ * or to "FILE_BUFFER_HUGE_PAGE" if it is at least that large.
+ * to_init:		the buffer to initialize
+ * in_file:		the file stream from which to read
+ * buffer_bytes:	the number of bytes to buffer,
+ *			rounded up to a multiple of the page size,
+ *			and at most "FILE_BUFFER_MAX_SIZE"
+ * returns		0 on success,
+ *			-1 if the size is 0 or too large,
+ *			   in which case "errno" will be set to EINVAL,
+ *			   or as for "init_file_buffer"
+ */
+int init_file_buffer_sized(file_buffer_t *to_init, FILE *in_file,
+			   size_t buffer_bytes);
+/*
+ * Initialize a file buffer from a file descriptor,
+ * which is read with "pread" instead of through a file stream,
+ * so there is no second buffer under the file buffer,
+ * and reads of at least "buffer_bytes" go straight into the output.
+ * to_init:		the buffer to initialize
+ * fd:			the file descriptor from which to read,
+ *			whose offset is not used or changed
+ * buffer_bytes:	the number of bytes to buffer,
+ *			as for "init_file_buffer_sized"
+ * returns		0 on success,
+ *			-1 if the size is 0 or too large,
+ *			   in which case "errno" will be set to EINVAL,
+ *			   or the buffer could not be allocated,
+ *			   in which case "errno" will be set to ENOMEM,
+ *			   or the file's size could not be found,
+ *			   in which case "fstat" sets "errno"
+ */
+int init_file_buffer_fd(file_buffer_t *to_init, int fd, size_t buffer_bytes);
+/*
+ * Initialize a file buffer from a file stream,
+ * allocating its page from an allocator, such as an arena or a pool.
+ * to_init:	the buffer to initialize
+ * in_file:	the file stream from which to read
+ * allocator:	the allocator of the page,
+ *		or NULL to use the default aligned allocation
+ * returns	0 on success,
+ *		-1 if the buffer could not be allocated,
+ *		   in which case "errno" will be set by the allocator,
+ *		   or the file's size could not be found,
+ *		   in which case "ftell" or "fseek" sets "errno"
+ */
+int init_file_buffer_with(file_buffer_t *to_init, FILE *in_file,
+			  struct allocator *allocator);
 /*
  * Initialize a file buffer by opening the specified file.
  * to_open:	the buffer to initialize
@@ -68,15 +196,51 @@ int init_file_buffer(file_buffer_t *to_init, FILE *in_file);
  *		   in which case the "fopen" function sets "errno"
  */
 int open_file_buffer(file_buffer_t *to_open, const char *path);
+/*
+ * Initialize a file buffer by opening the specified file
+ * as a file descriptor, to be read with "pread".
+ * to_open:		the buffer to initialize
+ * path:		the path of the file to open
+ * buffer_bytes:	the number of bytes to buffer,
+ *			as for "init_file_buffer_sized"
+ * returns		0 on success,
+ *			-1 if the buffer object could not be initialized,
+ *			   in which case "errno" will be set by
+ *			   "init_file_buffer_fd",
+ *			   or if the file could not be opened,
+ *			   in which case the "open" function sets "errno"
+ */
+int open_file_buffer_fd(file_buffer_t *to_open, const char *path,
+			size_t buffer_bytes);
+/*
+ * Initialize a file buffer by opening the specified file
+ * and mapping it into memory, so that reads through the cursor,
+ * "peek_buffer" and "read_buffer_at" copy straight from the mapping,
+ * with no buffer in between, and a page for the size of the buffer.
+ * The kernel is told that the mapping is read in order,
+ * and "set_read_ahead" has it read ahead of the cursor, with "madvise".
+ * Files that cannot be mapped, such as empty files and pipes,
+ * are read through a file stream instead, as by "open_file_buffer".
+ * The file must not shrink while it is mapped.
+ * to_open:	the buffer to initialize
+ * path:	the path of the file to open
+ * returns	0 on success,
+ *		-1 if the buffer object could not be initialized,
+ *		   in which case "errno" will be set by "init_file_buffer",
+ *		   or if the file could not be opened,
+ *		   in which case the "open" or "fdopen" function sets "errno"
+ */
+int open_file_buffer_mapped(file_buffer_t *to_open, const char *path);
 /*
  * Destroy a buffer, so that the object can be deallocated,
- * but don't close the file stream.
+ * and unmap its file, if it is mapped,
+ * but don't close the file stream or descriptor.
  * to_destroy:	the buffer to destroy
  */
 void destroy_file_buffer(file_buffer_t *to_destroy);
 /*
  * Destroy a buffer, so that the object can be deallocated,
- * and close the file stream.
+ * and close the file stream or descriptor.
  * to_close:	the buffer to destroy
  */
 void close_file_buffer(file_buffer_t *to_close);
@@ -132,5 +296,95 @@ size_t read_buffer_bytes(void *ptr, size_t size, file_buffer_t *buffer);
  *		     or the end of the file was reached.
  */
 int fgetc_buffer(file_buffer_t *buffer);
+/*
+ * Look at the next bytes of the file without copying them,
+ * refilling the buffer, and moving the bytes left in it to its start,
+ * if fewer than "min_len" of them are buffered.
+ * The virtual cursor does not move.
+ * The bytes stay valid until the next call on the buffer,
+ * other than "ftell_buffer" and "get_file_size".
+ * If the file is mapped, the bytes are all the rest of the file.
+ * buffer:	the buffer from which to read
+ * min_len:	the fewest bytes wanted, which is at most the buffer size,
+ *		or 0 to want at least 1
+ * len:		the output for the number of bytes at the pointer,
+ *		which may be more than "min_len",
+ *		and is fewer only at the end of the file
+ * returns	a pointer to the bytes at the virtual cursor,
+ *		or NULL if "min_len" is larger than the buffer size,
+ *		   in which case "errno" is set to EINVAL,
+ *		   or if the file could not be read,
+ *		   in which case "errno" will be set
+ */
+const unsigned char *peek_buffer(file_buffer_t *buffer, size_t min_len,
+				 size_t *len);
+/*
+ * Move the virtual cursor past bytes that were looked at with "peek_buffer".
+ * buffer:	the buffer in which to move
+ * n:		the number of bytes to move by
+ * returns	0 on success,
+ *		-1 if the bytes go past the end of the file,
+ *		   in which case "errno" is set to "ERANGE",
+ *		   or due to "fseek_buffer", which will set "errno"
+ */
+int consume_buffer(file_buffer_t *buffer, size_t n);
+/*
+ * Turn reading ahead on or off.
+ * While it is on, each time the buffer is refilled
+ * right after the previous bytes read from the file,
+ * the number of buffers read ahead doubles, up to a maximum,
+ * and the kernel is asked to read them in the background,
+ * with "posix_fadvise", so that they are ready by the time they are needed.
+ * Any other refill, such as after a seek, stops reading ahead,
+ * until the reads are sequential again.
+ * buffer:		the buffer to read ahead for
+ * max_buffers:		the most buffers to read ahead at once,
+ *			or 0 to turn reading ahead off
+ * returns		0 on success,
+ *			-1 if the buffers are more than
+ *			   "FILE_BUFFER_MAX_READ_AHEAD" bytes,
+ *			   in which case "errno" is set to EINVAL
+ */
+int set_read_ahead(file_buffer_t *buffer, size_t max_buffers);
+
+/*
+ * Give a buffer a cache of blocks for "read_buffer_at",
+ * shared by all the threads reading from it.
+ * Blocks are found by their position, modulo the number of blocks,
+ * so nearby reads from different threads share blocks.
+ * The cache is deallocated along with the buffer.
+ * buffer:	the buffer to give a cache
+ * n_blocks:	the number of blocks to cache
+ * block_bytes:	the number of bytes in each block,
+ *		rounded up to a multiple of the page size
+ * returns	0 on success,
+ *		-1 if either size is 0, the cache is larger than
+ *		   "FILE_BUFFER_MAX_SIZE", or the buffer already has one,
+ *		   in which case "errno" will be set to EINVAL,
+ *		   or the cache could not be allocated,
+ *		   in which case "errno" will be set to ENOMEM,
+ *		   or a lock could not be made,
+ *		   in which case "errno" will be set by "pthread"
+ */
+int init_block_cache(file_buffer_t *buffer, size_t n_blocks,
+		     size_t block_bytes);
+/*
+ * Read a number of bytes at a position, with "pread",
+ * without using or moving the cursor.
+ * Any number of threads can call it at once on the same buffer,
+ * even while one thread uses the cursor.
+ * Reads smaller than a block go through the cache, if there is one.
+ * buffer:	the source buffer
+ * offset:	the position in the file of the first byte to read
+ * ptr:		the output space
+ * size:	the number of bytes to read
+ * returns	number of bytes actually read,
+ *		which is fewer than "size"
+ *		at the end of the file, or due to error,
+ *		in which case "errno" will be set,
+ *		to "ERANGE" if the position is outside the file
+ */
+size_t read_buffer_at(file_buffer_t *buffer, long offset, void *ptr,
+		      size_t size);
 
 #endif /* FILE_BUFFER_H */
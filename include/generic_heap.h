@@ -0,0 +1,241 @@
+/*
+ * Generator of type-specialized min-heaps and heap sorts
+ * "DEFINE_MIN_HEAP" emits a heap type and its functions
+ * for any key and value types, with the comparison written inline,
+ * so each instance compiles like a handwritten heap.
+ *
+ * For example,
+ *	DEFINE_MIN_HEAP(time_heap, uint64_t, struct job *, a < b)
+ * defines "struct time_heap", "struct time_heap_element",
+ * and the functions "time_heap_init", "time_heap_push", "time_heap_pop",
+ * and so on.
+ */
+#ifndef GENERIC_HEAP_H
+#define GENERIC_HEAP_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <logger.h>
+
+/*
+ * Define a min-heap type and its functions.
+ * name:	the prefix of all the defined types and functions
+ * key_type:	the type of the keys by which to sort the heap
+ * value_type:	the type of the data associated with each key
+ * less_expr:	an expression that is true iff key "a" comes before key "b",
+ *		where "a" and "b" are both of type "key_type"
+ *
+ * The following are defined:
+ * struct name##_element:	a key, "key", and its data, "value"
+ * struct name:			the heap, with "capacity", "size",
+ *				and the array "elements", starting from 0
+ * name##_less(a, b):		"less_expr" applied to two keys
+ * name##_init(heap, capacity):	allocate the elements,
+ *				and return 0, or -1 with errno set to ENOMEM
+ * name##_teardown(heap):	deallocate the elements
+ * name##_heapify(heap, array, size):
+ *				copy an array into the heap,
+ *				and return 0, or -1 with errno set to ERANGE
+ *				if the size exceeds the capacity
+ * name##_push(heap, element):	add an element,
+ *				and return 0, or -1 with errno set to ERANGE
+ *				if the heap is full
+ * name##_peek(out, heap):	read the first element,
+ *				and return 0, or -1 if the heap is empty
+ * name##_pop(out, heap):	remove the first element,
+ *				and return 0, or -1 if the heap is empty
+ * name##_sort(array, size):	sort an array in place,
+ *				so that the first element comes first
+ */
+#define DEFINE_MIN_HEAP(name, key_type, value_type, less_expr) \
+struct name##_element { \
+	key_type key; \
+	value_type value; \
+}; \
+\
+struct name { \
+	size_t capacity; \
+	size_t size; \
+	struct name##_element *elements; \
+}; \
+\
+static inline int name##_less(key_type a, key_type b) \
+{ \
+	return (less_expr); \
+} \
+\
+static inline int name##_init(struct name *to_init, size_t capacity) \
+{ \
+	to_init->elements = malloc(sizeof(struct name##_element) * capacity); \
+	if (to_init->elements == NULL && capacity > 0) { \
+		printlg(ERROR_LEVEL, "Could not allocate heap elements.\n"); \
+		errno = ENOMEM; \
+		return -1; \
+	} \
+	to_init->size = 0; \
+	to_init->capacity = capacity; \
+	return 0; \
+} \
+\
+static inline void name##_teardown(struct name *to_teardown) \
+{ \
+	free(to_teardown->elements); \
+	to_teardown->elements = NULL; \
+	to_teardown->capacity = 0; \
+	to_teardown->size = 0; \
+} \
+\
+/* \
+ * Move an element down to its place, bottom-up: \
+ * move the hole down the path of first children to a leaf, \
+ * then move the element back up to where it belongs, \
+ * which takes about half the comparisons of checking every level. \
+ */ \
+static inline void name##_sift_down(struct name##_element *elements, \
+				    size_t size, size_t position) \
+{ \
+	struct name##_element moving = elements[position]; \
+	size_t hole = position; \
+	size_t child; \
+\
+	while (hole < size / 2) { \
+		child = hole * 2 + 1; \
+		if (child + 1 < size && \
+		    name##_less(elements[child + 1].key, \
+				elements[child].key)) { \
+			child++; \
+		} \
+		elements[hole] = elements[child]; \
+		hole = child; \
+	} \
+	while (hole > position) { \
+		size_t parent = (hole - 1) / 2; \
+\
+		if (!name##_less(moving.key, elements[parent].key)) { \
+			break; \
+		} \
+		elements[hole] = elements[parent]; \
+		hole = parent; \
+	} \
+	elements[hole] = moving; \
+} \
+\
+static inline int name##_heapify(struct name *heap_out, \
+				 struct name##_element *array_in, size_t size) \
+{ \
+	size_t position; \
+\
+	if (size > heap_out->capacity) { \
+		printlg(ERROR_LEVEL, "Size %u exceeds capacity %u.\n", \
+			(unsigned) size, (unsigned) heap_out->capacity); \
+		errno = ERANGE; \
+		return -1; \
+	} \
+	memcpy(heap_out->elements, array_in, \
+	       sizeof(struct name##_element) * size); \
+	heap_out->size = size; \
+	for (position = size / 2; position > 0; position--) { \
+		name##_sift_down(heap_out->elements, size, position - 1); \
+	} \
+	return 0; \
+} \
+\
+static inline int name##_push(struct name *heap_out, \
+			      const struct name##_element *to_push) \
+{ \
+	struct name##_element *elements = heap_out->elements; \
+	size_t position; \
+\
+	if (heap_out->size >= heap_out->capacity) { \
+		printlg(ERROR_LEVEL, \
+			"Heap is already full, at capacity %u.\n", \
+			(unsigned) heap_out->capacity); \
+		errno = ERANGE; \
+		return -1; \
+	} \
+	position = heap_out->size++; \
+	while (position > 0) { \
+		size_t parent = (position - 1) / 2; \
+\
+		if (!name##_less(to_push->key, elements[parent].key)) { \
+			break; \
+		} \
+		elements[position] = elements[parent]; \
+		position = parent; \
+	} \
+	elements[position] = *to_push; \
+	return 0; \
+} \
+\
+static inline int name##_peek(struct name##_element *head_out, \
+			      const struct name *heap_in) \
+{ \
+	if (heap_in->size == 0) { \
+		return -1; \
+	} \
+	*head_out = heap_in->elements[0]; \
+	return 0; \
+} \
+\
+static inline int name##_pop(struct name##_element *head_out, \
+			     struct name *heap_in) \
+{ \
+	if (heap_in->size == 0) { \
+		return -1; \
+	} \
+	*head_out = heap_in->elements[0]; \
+	heap_in->size--; \
+	heap_in->elements[0] = heap_in->elements[heap_in->size]; \
+	name##_sift_down(heap_in->elements, heap_in->size, 0); \
+	return 0; \
+} \
+\
+/* Sort in place with a heap whose first element comes last. */ \
+static inline void name##_sift_down_last(struct name##_element *elements, \
+					 size_t size, size_t position) \
+{ \
+	struct name##_element moving = elements[position]; \
+	size_t hole = position; \
+	size_t child; \
+\
+	while (hole < size / 2) { \
+		child = hole * 2 + 1; \
+		if (child + 1 < size && \
+		    name##_less(elements[child].key, \
+				elements[child + 1].key)) { \
+			child++; \
+		} \
+		elements[hole] = elements[child]; \
+		hole = child; \
+	} \
+	while (hole > position) { \
+		size_t parent = (hole - 1) / 2; \
+\
+		if (!name##_less(elements[parent].key, moving.key)) { \
+			break; \
+		} \
+		elements[hole] = elements[parent]; \
+		hole = parent; \
+	} \
+	elements[hole] = moving; \
+} \
+\
+static inline void name##_sort(struct name##_element *array, size_t size) \
+{ \
+	size_t position, end; \
+\
+	for (position = size / 2; position > 0; position--) { \
+		name##_sift_down_last(array, size, position - 1); \
+	} \
+	for (end = size; end > 1; end--) { \
+		struct name##_element last = array[0]; \
+\
+		array[0] = array[end - 1]; \
+		array[end - 1] = last; \
+		name##_sift_down_last(array, end - 1, 0); \
+	} \
+}
+
+#endif /* GENERIC_HEAP_H */
@@ -0,0 +1,93 @@
+/*
+ * Relaxed priority queue shared between threads,
+ * made of several min-heaps, each with its own lock.
+ * Elements are pushed into a random heap,
+ * and popped from the better of two random heaps,
+ * so threads rarely wait for each other,
+ * at the cost of sometimes popping an element other than the smallest.
+ */
+#ifndef MULTI_QUEUE_H
+#define MULTI_QUEUE_H
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include <data_structs.h>
+
+/*
+ * the number of heaps for each thread using the queue,
+ * so that two threads rarely pick the same heap
+ */
+#define MULTI_QUEUE_HEAPS_PER_THREAD	2
+/* the alignment of each heap, so that no two heaps share a cache line */
+#define MULTI_QUEUE_ALIGNMENT	64
+/* the head key of a heap that is empty, which no "int" key can equal */
+#define MULTI_QUEUE_EMPTY	INT64_MAX
+
+/* one of the heaps of a "struct multi_queue" */
+struct multi_queue_heap {
+	/* set while a thread is using the heap */
+	_Alignas(MULTI_QUEUE_ALIGNMENT) atomic_flag lock;
+	/*
+	 * the key of the heap's first element, or "MULTI_QUEUE_EMPTY",
+	 * so that heaps can be compared without taking their locks
+	 */
+	_Atomic int64_t head_key;
+	/* the elements */
+	struct min_heap heap;
+};
+
+/*
+ * a relaxed priority queue,
+ * which any number of threads can push to and pop from at once
+ */
+struct multi_queue {
+	/* the number of heaps */
+	size_t n_heaps;
+	/* the heaps, which together hold the queue's elements */
+	struct multi_queue_heap *heaps;
+};
+
+/*
+ * Initialize a queue and allocate its heaps.
+ * Not thread-safe.
+ * to_init:	the queue to initialize
+ * n_threads:	the number of threads that will use the queue,
+ *		which sets the number of heaps
+ * capacity:	the number of elements the queue must be able to hold,
+ *		which is split evenly between the heaps
+ * returns	0 if successful
+ *		-1 if there are no threads, with errno set to EINVAL,
+ *		   or if allocation failed, with errno set to ENOMEM
+ */
+int init_multi_queue(struct multi_queue *to_init, unsigned n_threads,
+		     size_t capacity);
+/*
+ * Deallocate the heaps of a queue, so that the struct can be deallocated.
+ * Not thread-safe.
+ * to_teardown:	the queue to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_multi_queue(struct multi_queue *to_teardown);
+/*
+ * Add an element to a random heap of the queue.
+ * If that heap is full, the other heaps are tried in turn.
+ * queue:	the destination queue
+ * to_push:	the element to copy into the queue
+ * returns	0 on success and
+ *		-1 if every heap is full, with errno set to ERANGE
+ */
+int push_multi_queue(struct multi_queue *queue, struct heap_element *to_push);
+/*
+ * Remove the smallest element of the better of two random heaps.
+ * The element is usually among the smallest few elements of the queue,
+ * but need not be the smallest.
+ * head_out:	the space to write the removed element
+ * queue:	the source queue
+ * returns	0 iff an element was popped.
+ *		-1 if every heap was empty when checked
+ */
+int pop_multi_queue(struct heap_element *head_out, struct multi_queue *queue);
+
+#endif /* MULTI_QUEUE_H */
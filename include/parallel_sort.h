@@ -0,0 +1,36 @@
+/*
+ * Multi-threaded sorting of heap element arrays
+ */
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include <stdlib.h>
+
+#include <data_structs.h>
+
+/*
+ * the smallest number of elements that each thread is given,
+ * so that threads are only started when they have enough work.
+ * Arrays smaller than twice this are sorted by the calling thread alone.
+ */
+#define PARALLEL_SORT_MIN_CHUNK	1024
+
+/*
+ * Sort an array with multiple threads,
+ * so that the keys are sorted from lowest to highest.
+ * Each thread sorts a chunk of the array,
+ * then the sorted chunks are merged in pairs,
+ * with the threads splitting up each merge between them.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * n_threads:	the maximum number of threads to use,
+ *		including the calling thread.
+ *		Fewer are used if the chunks would be smaller than
+ *		"PARALLEL_SORT_MIN_CHUNK".
+ * returns	0 iff successful,
+ *		-1 if the scratch space could not be allocated,
+ *		   with errno set to ENOMEM.
+ */
+int parallel_sort(struct heap_element *array, size_t size, unsigned n_threads);
+
+#endif /* PARALLEL_SORT_H */
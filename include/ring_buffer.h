@@ -0,0 +1,153 @@
+/*
+ * Bounded lock-free queues of pointers, for handing work between threads:
+ * a ring buffer for a single producer and a single consumer,
+ * and a queue for any number of producers and consumers.
+ * Neither allocates after it is initialized.
+ */
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/*
+ * the alignment of the parts of a queue written by different threads,
+ * so that no two of them share a cache line
+ */
+#define RING_BUFFER_ALIGNMENT	64
+
+/*
+ * a ring buffer written by one thread and read by another.
+ * Each side keeps a copy of the other's position,
+ * and only reads the real one when its copy says the ring is full or empty.
+ */
+struct spsc_ring {
+	/* the number of pointers read so far, written by the consumer */
+	_Alignas(RING_BUFFER_ALIGNMENT) atomic_size_t head;
+	/* the consumer's copy of "tail" */
+	size_t tail_cache;
+
+	/* the number of pointers written so far, written by the producer */
+	_Alignas(RING_BUFFER_ALIGNMENT) atomic_size_t tail;
+	/* the producer's copy of "head" */
+	size_t head_cache;
+
+	/* one less than the number of slots, which is a power of 2 */
+	_Alignas(RING_BUFFER_ALIGNMENT) size_t mask;
+	/* the slots holding the pointers */
+	void **slots;
+};
+
+/* a slot of a "struct mpmc_queue" */
+struct mpmc_cell {
+	/*
+	 * the position that may use the cell next:
+	 * equal to a writer's position if the cell is free for it,
+	 * or one more than a reader's position if it holds its pointer
+	 */
+	atomic_size_t sequence;
+	/* the pointer held by the cell */
+	void *data;
+};
+
+/*
+ * a bounded queue that any number of threads can write and read at once,
+ * in which each cell has a sequence number saying whose turn it is,
+ * so that a thread only needs to claim a position to use its cell
+ */
+struct mpmc_queue {
+	/* the next position to write */
+	_Alignas(RING_BUFFER_ALIGNMENT) atomic_size_t tail;
+	/* the next position to read */
+	_Alignas(RING_BUFFER_ALIGNMENT) atomic_size_t head;
+
+	/* one less than the number of cells, which is a power of 2 */
+	_Alignas(RING_BUFFER_ALIGNMENT) size_t mask;
+	/* the cells */
+	struct mpmc_cell *cells;
+};
+
+/*
+ * Initialize a ring buffer and allocate its slots.
+ * to_init:	the ring buffer to initialize
+ * capacity:	the number of pointers it must hold,
+ *		which is rounded up to a power of 2
+ * returns	0 if successful
+ *		-1 if the capacity is 0 or too large,
+ *		   with errno set to EINVAL,
+ *		   or if allocation failed, with errno set to ENOMEM
+ */
+int init_spsc_ring(struct spsc_ring *to_init, size_t capacity);
+/*
+ * Deallocate the slots of a ring buffer,
+ * so that the struct can be deallocated.
+ * to_teardown:	the ring buffer to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_spsc_ring(struct spsc_ring *to_teardown);
+/*
+ * Add as many pointers as fit to the ring buffer,
+ * from the producer thread only.
+ * ring:	the destination ring buffer
+ * items:	the pointers to add, in order
+ * n_items:	the number of pointers in "items"
+ * returns	the number of pointers added, from the start of "items",
+ *		which is 0 if the ring buffer is full
+ */
+size_t push_spsc_ring(struct spsc_ring *ring, void *const *items,
+		      size_t n_items);
+/*
+ * Remove as many pointers as are available from the ring buffer,
+ * up to a limit, from the consumer thread only.
+ * items_out:	the space to write the removed pointers, in order
+ * ring:	the source ring buffer
+ * max_items:	the most pointers to remove
+ * returns	the number of pointers removed,
+ *		which is 0 if the ring buffer is empty
+ */
+size_t pop_spsc_ring(void **items_out, struct spsc_ring *ring,
+		     size_t max_items);
+
+/*
+ * Initialize a multi-producer, multi-consumer queue,
+ * and allocate its cells.
+ * to_init:	the queue to initialize
+ * capacity:	the number of pointers it must hold,
+ *		which is rounded up to a power of 2, and at least 2
+ * returns	0 if successful
+ *		-1 if the capacity is 0 or too large,
+ *		   with errno set to EINVAL,
+ *		   or if allocation failed, with errno set to ENOMEM
+ */
+int init_mpmc_queue(struct mpmc_queue *to_init, size_t capacity);
+/*
+ * Deallocate the cells of a queue, so that the struct can be deallocated.
+ * to_teardown:	the queue to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_mpmc_queue(struct mpmc_queue *to_teardown);
+/*
+ * Add pointers to the queue, from any thread.
+ * A batch is added at consecutive positions,
+ * so the pointers are read in the order given,
+ * though other threads' pointers may come between batches.
+ * queue:	the destination queue
+ * items:	the pointers to add, in order
+ * n_items:	the number of pointers in "items"
+ * returns	the number of pointers added, from the start of "items",
+ *		which is 0 if the queue is full
+ */
+size_t push_mpmc_queue(struct mpmc_queue *queue, void *const *items,
+		       size_t n_items);
+/*
+ * Remove pointers from the queue, from any thread.
+ * items_out:	the space to write the removed pointers, in order
+ * queue:	the source queue
+ * max_items:	the most pointers to remove
+ * returns	the number of pointers removed,
+ *		which is 0 if the queue is empty
+ */
+size_t pop_mpmc_queue(void **items_out, struct mpmc_queue *queue,
+		      size_t max_items);
+
+#endif /* RING_BUFFER_H */
@@ -0,0 +1,182 @@
+/*
+ * Statistics over streams of samples:
+ * an exact running median over a sliding window,
+ * and a fixed-size sketch for approximate quantiles.
+ */
+#ifndef RUNNING_STATS_H
+#define RUNNING_STATS_H
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <data_structs.h>
+
+/* a sample in the window of a "struct running_median" */
+struct median_sample {
+	/* nonzero if the sample is in the upper half, 0 if in the lower */
+	int in_upper;
+	/* the sample's handle in the heap of its half */
+	size_t handle;
+};
+
+/*
+ * the median of the most recent samples, kept exactly,
+ * with the lower half of the samples in a max-heap,
+ * and the upper half in a min-heap
+ */
+struct running_median {
+	/*
+	 * the lower half of the samples,
+	 * with each key stored inverted, ie. as "~key",
+	 * so that the min-heap puts the largest first.
+	 * It holds either as many samples as "upper", or one more.
+	 */
+	struct indexed_min_heap lower;
+	/* the upper half of the samples */
+	struct indexed_min_heap upper;
+
+	/* the samples in the window, in the order they were pushed */
+	struct median_sample *window;
+	/* the maximum number of samples in the window */
+	size_t window_size;
+	/* the number of samples in the window */
+	size_t n_samples;
+	/* the position in "window" of the oldest sample */
+	size_t oldest;
+};
+
+/*
+ * Initialize a running median and allocate its heaps.
+ * to_init:	the running median to initialize
+ * window_size:	the maximum number of samples to keep,
+ *		after which the oldest sample is dropped for each new one
+ * returns	0 if successful
+ *		-1 if the window size is 0, with errno set to EINVAL,
+ *		   or if allocation failed, with errno set to ENOMEM
+ */
+int init_running_median(struct running_median *to_init, size_t window_size);
+/*
+ * Deallocate the heaps and window of a running median,
+ * so that the struct can be deallocated.
+ * to_teardown:	the running median to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_running_median(struct running_median *to_teardown);
+/*
+ * Add a sample, dropping the oldest sample if the window is full.
+ * median:	the destination running median
+ * key:		the sample to add
+ */
+void push_running_median(struct running_median *median, int key);
+/*
+ * Drop the oldest sample, eg. once it is too old to count.
+ * median:	the source running median
+ * returns	0 on success and
+ *		-1 if there are no samples
+ */
+int expire_running_median(struct running_median *median);
+/*
+ * Read the median of the samples in the window, in constant time.
+ * median:	the source running median
+ * lower_out:	the space to write the lower middle sample
+ * upper_out:	the space to write the upper middle sample,
+ *		which is the same as the lower one
+ *		if there is an odd number of samples
+ * returns	0 iff there were samples.
+ *		-1 if there were none
+ */
+static inline int peek_running_median(struct running_median *median,
+				      int *lower_out, int *upper_out)
+{
+	if (median->n_samples == 0) {
+		return -1;
+	}
+
+	*lower_out = ~median->lower.elements[1].key;
+	*upper_out = median->upper.size < median->lower.size ?
+		     *lower_out : median->upper.elements[1].key;
+	return 0;
+}
+
+/*
+ * the number of bits of each sample kept by "struct quantile_sketch",
+ * after its leading bit,
+ * so that quantiles are found to within a relative error of
+ * 2 to the power of minus this.
+ */
+#ifndef QUANTILE_SKETCH_BITS
+#define QUANTILE_SKETCH_BITS	5
+#endif /* QUANTILE_SKETCH_BITS */
+/* the number of buckets of a sketch for each sign of sample */
+#define QUANTILE_SKETCH_BUCKETS	\
+	((size_t) (32 - QUANTILE_SKETCH_BITS) << QUANTILE_SKETCH_BITS)
+
+/*
+ * a fixed-size, approximate summary of the distribution of samples,
+ * counting the samples in buckets whose widths grow with their magnitude,
+ * so that large quantiles, such as the 99th percentile,
+ * are found with a bounded relative error,
+ * no matter how many samples there are
+ */
+struct quantile_sketch {
+	/*
+	 * the number of samples in each bucket,
+	 * from the most negative samples to the most positive
+	 */
+	uint64_t *counts;
+	/* the total number of samples */
+	uint64_t total;
+};
+
+/*
+ * Initialize an empty quantile sketch and allocate its buckets.
+ * to_init:	the sketch to initialize
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+int init_quantile_sketch(struct quantile_sketch *to_init);
+/*
+ * Deallocate the buckets of a sketch,
+ * so that the struct can be deallocated.
+ * to_teardown:	the sketch to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_quantile_sketch(struct quantile_sketch *to_teardown);
+/*
+ * Count a sample in a sketch, in constant time.
+ * sketch:	the destination sketch
+ * key:		the sample to count
+ */
+void add_quantile_sketch(struct quantile_sketch *sketch, int key);
+/*
+ * Stop counting a sample that was counted before,
+ * eg. to keep the sketch over a sliding window.
+ * sketch:	the source sketch
+ * key:		the sample to stop counting
+ * returns	0 on success and
+ *		-1 if no such sample was counted, with errno set to EINVAL
+ */
+int remove_quantile_sketch(struct quantile_sketch *sketch, int key);
+/*
+ * Add all the samples counted in one sketch to another.
+ * dest:	the sketch to add to
+ * source:	the sketch whose samples to add, which is unchanged
+ */
+void merge_quantile_sketch(struct quantile_sketch *dest,
+			   const struct quantile_sketch *source);
+/*
+ * Estimate the sample at a given quantile.
+ * sketch:	the source sketch
+ * quantile:	the fraction of samples that are not above the result,
+ *		from 0 to 1, eg. 0.99 for the 99th percentile
+ * key_out:	the space to write the estimate,
+ *		which is within a relative error of
+ *		"2^-QUANTILE_SKETCH_BITS" of the exact sample
+ * returns	0 on success and
+ *		-1 if the sketch is empty or the quantile is out of range,
+ *		   with errno set to EINVAL
+ */
+int query_quantile_sketch(struct quantile_sketch *sketch, double quantile,
+			  int *key_out);
+
+#endif /* RUNNING_STATS_H */
@@ -0,0 +1,175 @@
+/*
+ * Scheduling of many timers by a hierarchical timing wheel,
+ * with a heap for timers too far in the future for the wheel
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <data_structs.h>
+
+/* the base 2 logarithm of the number of slots in each level of the wheel */
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS	6
+#endif /* TIMER_WHEEL_BITS */
+/* the number of levels in the wheel */
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS	4
+#endif /* TIMER_WHEEL_LEVELS */
+/* the number of slots in each level */
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+/*
+ * the base 2 logarithm of the number of ticks covered by the wheel.
+ * Timers due this many ticks from now, or later, wait in the heap.
+ */
+#define TIMER_WHEEL_SPAN_BITS	(TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)
+/*
+ * the most ticks from now that a timer can be due,
+ * so that its key in the heap fits in an int
+ */
+#define TIMER_WHEEL_MAX_DELAY	((uint64_t) (INT_MAX / 2) << \
+				 TIMER_WHEEL_SPAN_BITS)
+
+/* where a timer is scheduled */
+enum timer_state {
+	/* not scheduled, either never added, expired or cancelled */
+	TIMER_IDLE,
+	/* in a slot of the wheel */
+	TIMER_IN_WHEEL,
+	/* in the heap of far timers */
+	TIMER_IN_HEAP,
+};
+
+/*
+ * a timer, allocated by the caller,
+ * which must stay in place while it is scheduled,
+ * and be initialized by "init_wheel_timer" before it is first added
+ */
+struct wheel_timer {
+	/* the tick at which the timer expires */
+	uint64_t deadline;
+	/* the caller's data associated with the timer */
+	void *data;
+
+	/*
+	 * the next timer in the same slot,
+	 * or in the list of timers passed to the expiry callback
+	 */
+	struct wheel_timer *next;
+	/* the pointer to this timer in its slot's list */
+	struct wheel_timer **prev_next;
+	/* the timer's handle in the heap of far timers */
+	size_t heap_handle;
+	/* where the timer is scheduled */
+	enum timer_state state;
+};
+
+/*
+ * a hierarchical timing wheel:
+ * each level has "TIMER_WHEEL_SLOTS" slots,
+ * each slot of a level covering as many ticks as all of the level below,
+ * and timers move down a level as their deadline gets closer
+ */
+struct timer_wheel {
+	/* the current tick */
+	uint64_t now;
+	/* the number of timers in the wheel, not counting the heap */
+	size_t n_in_wheel;
+
+	/* the lists of timers in each slot of each level */
+	struct wheel_timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	/*
+	 * the timers too far away for the wheel,
+	 * keyed by deadline, divided by the number of ticks in the wheel,
+	 * minus "far_base"
+	 */
+	struct indexed_min_heap far_timers;
+	/*
+	 * the deadline, divided by the number of ticks in the wheel,
+	 * that the keys of far timers count from,
+	 * moved forward as the wheel advances
+	 */
+	uint64_t far_base;
+};
+
+/*
+ * Initialize a timer that is not scheduled yet.
+ * to_init:	the timer to initialize
+ * data:	the caller's data associated with the timer
+ */
+static inline void init_wheel_timer(struct wheel_timer *to_init, void *data)
+{
+	to_init->data = data;
+	to_init->state = TIMER_IDLE;
+}
+
+/*
+ * Handle the timers that expire on the same tick.
+ * expired:	the expired timers, linked by their "next" fields,
+ *		which are all idle, and can be added again,
+ *		as long as "next" is read first
+ * arg:		the argument passed to "advance_timer_wheel"
+ */
+typedef void (*timer_expiry_t)(struct wheel_timer *expired, void *arg);
+
+/*
+ * Initialize an empty timing wheel.
+ * to_init:	the wheel to initialize
+ * now:		the current tick
+ * far_capacity:	the most timers that can be due
+ *			"2^TIMER_WHEEL_SPAN_BITS" ticks or more from now
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM
+ */
+int init_timer_wheel(struct timer_wheel *to_init, uint64_t now,
+		     size_t far_capacity);
+/*
+ * Deallocate the heap of a timing wheel,
+ * so that the struct can be deallocated.
+ * Timers still scheduled are left as they are.
+ * to_teardown:	the wheel to tear down.
+ *		The pointer itself will not be freed.
+ */
+void teardown_timer_wheel(struct timer_wheel *to_teardown);
+/*
+ * Schedule a timer, in constant time unless it goes in the heap.
+ * If the timer is already scheduled, it is moved to the new deadline.
+ * wheel:	the destination wheel
+ * timer:	the timer to schedule
+ * deadline:	the tick at which the timer expires,
+ *		at most "TIMER_WHEEL_MAX_DELAY" ticks from now.
+ *		Deadlines that have passed expire on the next tick.
+ * returns	0 on success and
+ *		-1 if the timer needed the heap, but it was full,
+ *		   with errno set to ERANGE
+ *		-1 if the deadline is too far away,
+ *		   with errno set to EINVAL, leaving the timer as it was
+ */
+int add_timer_wheel(struct timer_wheel *wheel, struct wheel_timer *timer,
+		    uint64_t deadline);
+/*
+ * Unschedule a timer, in constant time unless it is in the heap.
+ * wheel:	the wheel the timer was added to
+ * timer:	the timer to cancel
+ * returns	0 on success and
+ *		-1 if the timer was not scheduled
+ */
+int cancel_timer_wheel(struct timer_wheel *wheel, struct wheel_timer *timer);
+/*
+ * Move the wheel forward, expiring the timers that come due,
+ * in constant time for each tick.
+ * Ticks are skipped quickly when the wheel itself is empty.
+ * wheel:	the wheel to advance
+ * now:		the tick to advance to
+ * expire:	called once for each tick on which timers expire,
+ *		while the wheel's "now" field is that tick
+ * arg:		the argument to pass to "expire"
+ * returns	the number of timers that expired
+ */
+size_t advance_timer_wheel(struct timer_wheel *wheel, uint64_t now,
+			   timer_expiry_t expire, void *arg);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,404 @@
+#include <allocator.h>
+
+#include <logger.h>
+#include <debug_assert.h>
+
+#include <inttypes.h>
+#include <errno.h>
+
+/* the space before the objects of a pool block, which links the blocks */
+#define POOL_HEADER		ARENA_ALIGNMENT
+
+struct arena_block {
+	/* the block allocated from before this one, or NULL */
+	struct arena_block *previous;
+	/* the number of bytes in "data" */
+	size_t size;
+	/* the memory to allocate from */
+	max_align_t data[];
+};
+
+struct pool_cache {
+	/* the thread's free objects, each holding a pointer to the next */
+	void *free_list;
+	/* the number of objects in "free_list" */
+	size_t n_free;
+	/* the pool that the objects belong to */
+	struct pool *pool;
+	/* the next thread's list in the pool */
+	struct pool_cache *next;
+};
+
+/*
+ * Allocate from an arena, as its "struct allocator".
+ * state:	the arena
+ * size:	the number of bytes to allocate
+ * returns	the allocated memory, or NULL with errno set to ENOMEM
+ */
+static void *allocate_arena_allocator(void *state, size_t size)
+{
+	return allocate_arena(state, size);
+}
+
+/*
+ * Do nothing, since arena memory is only freed by a reset,
+ * as the "struct allocator" of an arena.
+ * state:	the arena
+ * to_release:	the memory that is no longer needed
+ */
+static void release_arena_allocator(void *state, void *to_release)
+{
+	(void) state;
+	(void) to_release;
+}
+
+int init_arena(struct arena *to_init, size_t block_size)
+{
+	if (block_size == 0) {
+		printlg(ERROR_LEVEL, "Arena blocks cannot be empty.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	to_init->block = NULL;
+	to_init->used = 0;
+	to_init->block_size = block_size;
+	to_init->spare = NULL;
+
+	to_init->allocator.allocate = allocate_arena_allocator;
+	to_init->allocator.release = release_arena_allocator;
+	to_init->allocator.state = to_init;
+
+	return 0;
+}
+
+void teardown_arena(struct arena *to_teardown)
+{
+	clear_arena(to_teardown);
+	free(to_teardown->spare);
+	to_teardown->spare = NULL;
+}
+
+void *allocate_arena(struct arena *arena, size_t size)
+{
+	struct arena_block *block = arena->block;
+	size_t block_size = arena->block_size;
+	void *allocated;
+
+	if (size > SIZE_MAX - sizeof(struct arena_block) - ARENA_ALIGNMENT) {
+		printlg(ERROR_LEVEL, "Arena allocation is too large.\n");
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+	if (block == NULL || block->size - arena->used < size) {
+		/* Start a new block, leaving the rest of this one unused. */
+		if (size > block_size) {
+			block_size = size;
+		}
+		if (arena->spare != NULL && arena->spare->size >= block_size) {
+			block = arena->spare;
+			arena->spare = NULL;
+		} else {
+			block = malloc(sizeof(struct arena_block) +
+				       block_size);
+			if (block == NULL) {
+				printlg(ERROR_LEVEL,
+					"Could not allocate arena block.\n");
+				errno = ENOMEM;
+				return NULL;
+			}
+			block->size = block_size;
+		}
+		block->previous = arena->block;
+		arena->block = block;
+		arena->used = 0;
+	}
+
+	allocated = (unsigned char *) block->data + arena->used;
+	arena->used += size;
+
+	return allocated;
+}
+
+void reset_arena(struct arena *arena, const struct arena_mark *mark)
+{
+	while (arena->block != mark->block) {
+		struct arena_block *freed = arena->block;
+
+		debug_assert(freed != NULL);
+		arena->block = freed->previous;
+
+		/* Keep one block of the usual size, for the next one needed. */
+		if (arena->spare == NULL && freed->size == arena->block_size) {
+			arena->spare = freed;
+		} else {
+			free(freed);
+		}
+	}
+	arena->used = mark->used;
+}
+
+/*
+ * Allocate from a pool, as its "struct allocator".
+ * state:	the pool
+ * size:	the number of bytes to allocate,
+ *		which must fit in the pool's objects
+ * returns	the allocated object,
+ *		or NULL if the size is too large, with errno set to EINVAL,
+ *		or if the pool could not grow, with errno set to ENOMEM
+ */
+static void *allocate_pool_allocator(void *state, size_t size)
+{
+	struct pool *pool = state;
+
+	if (size > pool->object_size) {
+		printlg(ERROR_LEVEL,
+			"Allocation of %lu bytes exceeds pool objects "
+			"of %lu.\n", (unsigned long) size,
+			(unsigned long) pool->object_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return allocate_pool(pool);
+}
+
+/*
+ * Free an object to a pool, as its "struct allocator".
+ * state:	the pool
+ * to_release:	the object to free, or NULL
+ */
+static void release_pool_allocator(void *state, void *to_release)
+{
+	free_pool(state, to_release);
+}
+
+/*
+ * Move the objects of a thread's list to the pool's shared list,
+ * when the thread exits.
+ * arg:		the "struct pool_cache" of the thread
+ */
+static void flush_pool_cache(void *arg)
+{
+	struct pool_cache *cache = arg;
+	struct pool *pool = cache->pool;
+	struct pool_cache **link;
+
+	pthread_mutex_lock(&pool->lock);
+	while (cache->free_list != NULL) {
+		void *object = cache->free_list;
+
+		cache->free_list = *(void **) object;
+		*(void **) object = pool->free_list;
+		pool->free_list = object;
+	}
+	for (link = &pool->caches; *link != cache; link = &(*link)->next) {
+	}
+	*link = cache->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	free(cache);
+}
+
+int init_pool(struct pool *to_init, size_t object_size, size_t block_objects)
+{
+	int error;
+
+	if (object_size == 0 || block_objects == 0) {
+		printlg(ERROR_LEVEL,
+			"Pool objects and blocks cannot be empty.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Each free object holds a pointer to the next. */
+	to_init->object_size = (object_size + sizeof(void *) - 1) /
+			       sizeof(void *) * sizeof(void *);
+	to_init->block_objects = block_objects;
+
+	error = pthread_mutex_init(&to_init->lock, NULL);
+	if (error) {
+		printlg(ERROR_LEVEL, "Could not make pool lock.\n");
+		errno = error;
+		return -1;
+	}
+	error = pthread_key_create(&to_init->cache_key, flush_pool_cache);
+	if (error) {
+		printlg(ERROR_LEVEL, "Could not make pool key.\n");
+		pthread_mutex_destroy(&to_init->lock);
+		errno = error;
+		return -1;
+	}
+	to_init->free_list = NULL;
+	to_init->blocks = NULL;
+	to_init->caches = NULL;
+
+	to_init->allocator.allocate = allocate_pool_allocator;
+	to_init->allocator.release = release_pool_allocator;
+	to_init->allocator.state = to_init;
+
+	return 0;
+}
+
+void teardown_pool(struct pool *to_teardown)
+{
+	/* No thread exit can flush a list after the key is deleted. */
+	pthread_key_delete(to_teardown->cache_key);
+
+	while (to_teardown->caches != NULL) {
+		struct pool_cache *cache = to_teardown->caches;
+
+		to_teardown->caches = cache->next;
+		free(cache);
+	}
+	while (to_teardown->blocks != NULL) {
+		void *block = to_teardown->blocks;
+
+		to_teardown->blocks = *(void **) block;
+		free(block);
+	}
+	to_teardown->free_list = NULL;
+	pthread_mutex_destroy(&to_teardown->lock);
+}
+
+/*
+ * Find the calling thread's list of free objects for a pool,
+ * making it if the thread has none yet.
+ * pool:	the pool whose list to find
+ * returns	the list, or NULL if it could not be allocated
+ */
+static struct pool_cache *get_pool_cache(struct pool *pool)
+{
+	struct pool_cache *cache = pthread_getspecific(pool->cache_key);
+
+	if (cache != NULL) {
+		return cache;
+	}
+
+	cache = malloc(sizeof(struct pool_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->free_list = NULL;
+	cache->n_free = 0;
+	cache->pool = pool;
+	if (pthread_setspecific(pool->cache_key, cache)) {
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->lock);
+
+	return cache;
+}
+
+/*
+ * Move a batch of objects from the pool's shared list to a thread's list,
+ * allocating a new block of objects if the shared list is empty.
+ * pool:	the source pool
+ * cache:	the thread's empty list
+ * returns	0 if successful
+ *		-1 if a block could not be allocated,
+ *		   with errno set to ENOMEM
+ */
+static int refill_pool_cache(struct pool *pool, struct pool_cache *cache)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->free_list == NULL) {
+		unsigned char *block = malloc(POOL_HEADER + pool->object_size *
+					      pool->block_objects);
+		size_t object_i;
+
+		if (block == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			printlg(ERROR_LEVEL,
+				"Could not allocate pool block.\n");
+			errno = ENOMEM;
+			return -1;
+		}
+		*(void **) block = pool->blocks;
+		pool->blocks = block;
+
+		for (object_i = pool->block_objects; object_i > 0; object_i--) {
+			void *object = block + POOL_HEADER +
+				       pool->object_size * (object_i - 1);
+
+			*(void **) object = pool->free_list;
+			pool->free_list = object;
+		}
+	}
+
+	while (pool->free_list != NULL && cache->n_free < POOL_BATCH) {
+		void *object = pool->free_list;
+
+		pool->free_list = *(void **) object;
+		*(void **) object = cache->free_list;
+		cache->free_list = object;
+		cache->n_free++;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void *allocate_pool(struct pool *pool)
+{
+	struct pool_cache *cache = get_pool_cache(pool);
+	void *object;
+
+	if (cache == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate pool thread list.\n");
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (cache->free_list == NULL && refill_pool_cache(pool, cache)) {
+		return NULL;
+	}
+
+	object = cache->free_list;
+	cache->free_list = *(void **) object;
+	cache->n_free--;
+
+	return object;
+}
+
+void free_pool(struct pool *pool, void *object)
+{
+	struct pool_cache *cache;
+
+	if (object == NULL) {
+		return;
+	}
+
+	cache = get_pool_cache(pool);
+	if (cache == NULL) {
+		/* Without a list of its own, give it straight back. */
+		pthread_mutex_lock(&pool->lock);
+		*(void **) object = pool->free_list;
+		pool->free_list = object;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	*(void **) object = cache->free_list;
+	cache->free_list = object;
+	cache->n_free++;
+
+	/* Give back a batch, keeping one, if the thread has too many. */
+	if (cache->n_free >= POOL_BATCH * 2) {
+		pthread_mutex_lock(&pool->lock);
+		while (cache->n_free > POOL_BATCH) {
+			object = cache->free_list;
+			cache->free_list = *(void **) object;
+			*(void **) object = pool->free_list;
+			pool->free_list = object;
+			cache->n_free--;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
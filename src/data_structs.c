@@ -2,19 +2,48 @@
 
 #include <logger.h>
 #include <debug_assert.h>
+#include <xmath.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 /*
- * type-independent macro for swapping values of two primitive variables.
- * a:	first lvalue, which will hold the old value of "b"
- * b:	second lvalue, which will hold the old value of "a"
+ * Allocate memory aligned to a power of 2 from an allocator.
+ * Without an allocator, "posix_memalign" aligns the memory,
+ * and otherwise enough extra memory is allocated to align it.
+ * allocator:	the allocator, or NULL to use "posix_memalign"
+ * alignment:	the alignment, a power of 2 and a multiple of "sizeof(void *)"
+ * size:	the number of bytes to allocate
+ * block_out:	set to the memory to release with "release_with"
+ * returns	the aligned memory, or NULL if allocation failed,
+ *		with errno set to ENOMEM, or by the allocator
  */
-#define SWAP(a, b) do { \
-	a ^= b; \
-	b ^= a; \
-	a ^= b; \
-} while (0)
+static void *allocate_aligned_with(struct allocator *allocator,
+				   size_t alignment, size_t size,
+				   void **block_out)
+{
+	uintptr_t address;
+
+	if (allocator == NULL) {
+		if (posix_memalign(block_out, alignment, size)) {
+			*block_out = NULL;
+			errno = ENOMEM;
+		}
+		return *block_out;
+	}
+
+	*block_out = allocate_with(allocator, size + alignment - 1);
+	if (*block_out == NULL) {
+		return NULL;
+	}
+	address = ((uintptr_t) *block_out + alignment - 1) &
+		  ~(uintptr_t) (alignment - 1);
+	return (void *) address;
+}
 
 /*
  * Debugging function for checking that a position is between
@@ -52,80 +81,54 @@ static inline int heap_key(struct min_heap *heap, size_t position)
 	return heap->elements[position].key;
 }
 
-/*
- * Swap two elements in a heap.
- * heap:	the source and target heap
- * position_a:	the position of the first element to swap
- * position_b:	the position of the second element to swap
- */
-static inline void swap_in_heap(struct min_heap *heap, size_t position_a,
-				size_t position_b)
-{
-	struct heap_element *element_a = &(heap->elements[position_a]);
-	struct heap_element *element_b = &(heap->elements[position_b]);
-	void *temp_data;
-#ifdef DEBUG
-	void *old_data_a = element_a->data, *old_data_b = element_b->data;
-#endif /* DEBUG */
-
-	temp_data = element_a->data;
-	element_a->data = element_b->data;
-	element_b->data = temp_data;
-	debug_assert(element_a->data == old_data_b);
-	debug_assert(element_b->data == old_data_a);
-	debug_assert_imply(old_data_a != old_data_b,
-			   element_a->data != old_data_a);
-	debug_assert_imply(old_data_a != old_data_b,
-			   element_b->data != old_data_b);
-
-	SWAP(element_a->key, element_b->key);
-}
-
 /*
  * For heapifying an array and popping an element in a heap,
- * check a heap node with its children,
- * and swap it with the smallest child if it is smaller,
- * and recurse to the new position.
+ * move a node down to its place in the heap, bottom-up:
+ * First, move the hole left by the node down the path of smaller children
+ * all the way to a leaf, with one comparison per level,
+ * then move the node back up from that leaf to where it belongs.
+ * Since the node usually belongs near the bottom,
+ * this takes about half the comparisons of checking it at every level.
  * heap:	the target heap
- * position:	the current parent to check
+ * position:	the position of the node to move down
  */
 static void trickle_down(struct min_heap *heap, size_t position)
 {
-	size_t child_0 = position * 2, child_1 = child_0 + 1;
-	size_t next_position = position;
-	int child_0_in_range, child_1_in_range;
+	struct heap_element *elements = heap->elements;
+	struct heap_element moving = elements[position];
+	size_t size = heap->size;
+	size_t hole = position;
 
 	/*
-	 * We check ranges using the smaller "position" value,
-	 * since the actual "child_0" and "child_1" may have wrapped around.
+	 * We check ranges using the smaller "hole" value,
+	 * since the actual child position may have wrapped around.
 	 */
-	child_0_in_range = (position <= (heap->size / 2));
-	child_1_in_range = (heap->size >= 1) &&
-			   (position <= ((heap->size - 1) / 2));
-
-	debug_assert_imply(child_1_in_range, child_0_in_range);
-	if (child_0_in_range) {
-		if (heap_key(heap, next_position) > heap_key(heap, child_0)) {
-			next_position = child_0;
-		}
+	while (hole <= size / 2) {
+		size_t child = hole * 2;
 
-		if (child_1_in_range) {
-			if (heap_key(heap, next_position) >
-			    heap_key(heap, child_1)) {
-				next_position = child_1;
-			}
+		if (child < size && heap_key(heap, child + 1) <
+				    heap_key(heap, child)) {
+			child++;
 		}
+		elements[hole] = elements[child];
+		hole = child;
 	}
 
-	if (next_position != position) {
-		swap_in_heap(heap, position, next_position);
-		trickle_down(heap, next_position);
+	while (hole > position) {
+		size_t parent = hole / 2;
+
+		if (heap_key(heap, parent) <= moving.key) {
+			break;
+		}
+		elements[hole] = elements[parent];
+		hole = parent;
 	}
+	elements[hole] = moving;
 
-	debug_assert_imply(child_0_in_range,
-			   heap_key(heap, position) <= heap_key(heap, child_0));
-	debug_assert_imply(child_1_in_range,
-			   heap_key(heap, position) <= heap_key(heap, child_1));
+	debug_assert_imply(hole <= size / 2,
+			   moving.key <= heap_key(heap, hole * 2));
+	debug_assert_imply(hole < (size + 1) / 2,
+			   moving.key <= heap_key(heap, hole * 2 + 1));
 }
 
 int
@@ -168,35 +171,2253 @@ int pop_min_heap(struct heap_element *head_out, struct min_heap *heap_in)
 	return 0;
 }
 
-int heap_sort(struct heap_element *array, size_t size)
+/*
+ * For pushing an element, move the element at a position up the heap,
+ * shifting larger parents down into the hole it leaves,
+ * until its parent is no larger than it.
+ * heap:	the target heap
+ * position:	the position of the element to move up
+ */
+static void trickle_up(struct min_heap *heap, size_t position)
 {
-	struct min_heap sorter;
-	size_t element_i;
+	struct heap_element moving = heap->elements[position];
+
+	debug_assert(position_in_range(heap, position));
+	while (position > 1) {
+		size_t parent = position / 2;
+
+		if (heap_key(heap, parent) <= moving.key) {
+			break;
+		}
+		heap->elements[position] = heap->elements[parent];
+		position = parent;
+	}
+	heap->elements[position] = moving;
+}
+
+int push_min_heap(struct min_heap *heap_out, struct heap_element *to_push)
+{
+	if (heap_out->size >= heap_out->capacity) {
+		printlg(ERROR_LEVEL, "Heap is already full, at capacity %u.\n",
+			(unsigned) heap_out->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+
+	heap_out->size++;
+	heap_out->elements[heap_out->size] = *to_push;
+	trickle_up(heap_out, heap_out->size);
+
+	return 0;
+}
 
-	if (init_min_heap(&sorter, size)) {
-		printlg(ERROR_LEVEL, "Could not create heap for sorting.\n");
+int replace_min_heap(struct heap_element *head_out, struct min_heap *heap,
+		     struct heap_element *to_push)
+{
+	if (heap->size == 0) {
 		return -1;
 	}
 
-	if (heapify(&sorter, array, size)) {
-		/*
-		 * Failure should not occur,
-		 * since the capacity is exactly the size.
-		 */
-		debug_assert(0);
+	*head_out = heap->elements[1];
+	heap->elements[1] = *to_push;
+	trickle_down(heap, 1);
+
+	return 0;
+}
+
+void pushpop_min_heap(struct heap_element *head_out, struct min_heap *heap,
+		      struct heap_element *to_push)
+{
+	/*
+	 * If the new element would become the head,
+	 * it is popped right back out, and the heap does not change.
+	 */
+	if (heap->size == 0 || to_push->key <= heap_key(heap, 1)) {
+		*head_out = *to_push;
+		return;
+	}
+
+	*head_out = heap->elements[1];
+	heap->elements[1] = *to_push;
+	trickle_down(heap, 1);
+}
+
+/*
+ * For sorting in place, move an element of a 0-based max-heap
+ * down to its position, bottom-up as in "trickle_down":
+ * move the hole down the path of larger children to a leaf,
+ * then move the element back up to where it belongs.
+ * array:	the max-heap, stored from index 0
+ * size:	the number of elements in the max-heap
+ * position:	the index of the element to move down
+ */
+static void sift_down_max(struct heap_element *array, size_t size,
+			  size_t position)
+{
+	struct heap_element moving = array[position];
+	size_t hole = position;
+	size_t child;
+
+	/* Stop at the last parent, ie. the last index with a child. */
+	while (hole < size / 2) {
+		child = hole * 2 + 1;
+		if (child + 1 < size &&
+		    array[child + 1].key > array[child].key) {
+			child++;
+		}
+		array[hole] = array[child];
+		hole = child;
+	}
+
+	while (hole > position) {
+		size_t parent = (hole - 1) / 2;
+
+		if (array[parent].key >= moving.key) {
+			break;
+		}
+		array[hole] = array[parent];
+		hole = parent;
+	}
+	array[hole] = moving;
+}
+
+void heap_sort_in_place(struct heap_element *array, size_t size)
+{
+	size_t position, end;
+
+	printlg(DEBUG_LEVEL, "Sorting %u elements in place.\n",
+		(unsigned) size);
+
+	/* Build a max-heap inside the array. */
+	for (position = size / 2; position > 0; position--) {
+		sift_down_max(array, size, position - 1);
+	}
+
+	/*
+	 * Repeatedly move the largest remaining element
+	 * to the end of the unsorted part.
+	 */
+	for (end = size; end > 1; end--) {
+		struct heap_element largest = array[0];
+
+		array[0] = array[end - 1];
+		array[end - 1] = largest;
+		sift_down_max(array, end - 1, 0);
+	}
+}
+
+int heap_sort(struct heap_element *array, size_t size)
+{
+	heap_sort_in_place(array, size);
+	return 0;
+}
+
+/* the number of bits in each digit sorted by a radix sort pass */
+#define RADIX_BITS	8
+/* the number of distinct values of each digit */
+#define RADIX_SIZE	(1 << RADIX_BITS)
+/* the mask for extracting the lowest digit */
+#define RADIX_MASK	(RADIX_SIZE - 1)
+/* the number of digits, and so passes, in an "int" key */
+#define RADIX_PASSES	((sizeof(int) * CHAR_BIT) / RADIX_BITS)
+
+/*
+ * Map a key to an unsigned value with the same ordering,
+ * by flipping the sign bit.
+ * key:		the signed key to map
+ * returns	the unsigned, order-preserving representation of "key"
+ */
+static inline unsigned radix_key(int key)
+{
+	return (unsigned) key ^ ((unsigned) INT_MAX + 1);
+}
+
+void radix_sort_buffered(struct heap_element *array,
+			 struct heap_element *scratch, size_t size)
+{
+	size_t counts[RADIX_PASSES][RADIX_SIZE];
+	struct heap_element *source, *dest, *temp;
+	size_t element_i, pass_i, digit_i;
+
+	if (size < RADIX_SORT_THRESHOLD) {
+		heap_sort_in_place(array, size);
+		return;
 	}
 
+	printlg(DEBUG_LEVEL, "Radix sorting %u elements.\n", (unsigned) size);
+
+	/* Count the occurrences of every digit for all passes at once. */
+	memset(counts, 0, sizeof(counts));
 	for (element_i = 0; element_i < size; element_i++) {
-		if (pop_min_heap(&array[element_i], &sorter)) {
-			/*
-			 * Failure should not occur,
-			 * since this loop is popping as many elements
-			 * as were put into the array.
-			 */
-			debug_assert(0);
+		unsigned key = radix_key(array[element_i].key);
+
+		for (pass_i = 0; pass_i < RADIX_PASSES; pass_i++) {
+			counts[pass_i][key & RADIX_MASK]++;
+			key >>= RADIX_BITS;
+		}
+	}
+
+	source = array;
+	dest = scratch;
+	for (pass_i = 0; pass_i < RADIX_PASSES; pass_i++) {
+		size_t *pass_counts = counts[pass_i];
+		unsigned shift = pass_i * RADIX_BITS;
+		size_t offset = 0;
+
+		/* If every key has the same digit, the pass changes nothing. */
+		if (pass_counts[(radix_key(source[0].key) >> shift) &
+				RADIX_MASK] == size) {
+			continue;
+		}
+
+		/* Turn the counts into starting offsets. */
+		for (digit_i = 0; digit_i < RADIX_SIZE; digit_i++) {
+			size_t count = pass_counts[digit_i];
+
+			pass_counts[digit_i] = offset;
+			offset += count;
+		}
+
+		for (element_i = 0; element_i < size; element_i++) {
+			unsigned digit = (radix_key(source[element_i].key) >>
+					  shift) & RADIX_MASK;
+
+			dest[pass_counts[digit]++] = source[element_i];
+		}
+
+		temp = source;
+		source = dest;
+		dest = temp;
+	}
+
+	/* After an odd number of passes, the result is in the scratch space. */
+	if (source != array) {
+		memcpy(array, source, sizeof(struct heap_element) * size);
+	}
+}
+
+int radix_sort(struct heap_element *array, size_t size)
+{
+	struct heap_element *scratch;
+
+	if (size < RADIX_SORT_THRESHOLD) {
+		heap_sort_in_place(array, size);
+		return 0;
+	}
+
+	scratch = malloc(sizeof(struct heap_element) * size);
+	if (scratch == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate radix sort buffer.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	radix_sort_buffered(array, scratch, size);
+
+	free(scratch);
+	return 0;
+}
+
+/* the size below which selection finishes with an insertion sort */
+#define SELECT_INSERTION_THRESHOLD	16
+
+/*
+ * Sort a small array by insertion.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ */
+static void insertion_sort(struct heap_element *array, size_t size)
+{
+	size_t sorted, position;
+
+	for (sorted = 1; sorted < size; sorted++) {
+		struct heap_element moving = array[sorted];
+
+		for (position = sorted;
+		     position > 0 && array[position - 1].key > moving.key;
+		     position--) {
+			array[position] = array[position - 1];
+		}
+		array[position] = moving;
+	}
+}
+
+/*
+ * Partition an array around the median of its first, middle and last keys,
+ * by Hoare's scheme, which splits runs of equal keys evenly.
+ * array:	the array to partition, of at least 3 elements
+ * size:	the number of elements in the array
+ * returns	the position of the last element of the lower part,
+ *		so that no key up to it is larger than any key after it,
+ *		and both parts are nonempty
+ */
+static size_t partition_median_of_3(struct heap_element *array, size_t size)
+{
+	struct heap_element temp;
+	size_t middle = (size - 1) / 2;
+	size_t low = 0, high = size - 1;
+	int pivot;
+
+	/* Sort the three keys, so the outer two bound both scans. */
+	if (array[middle].key < array[0].key) {
+		temp = array[middle];
+		array[middle] = array[0];
+		array[0] = temp;
+	}
+	if (array[high].key < array[middle].key) {
+		temp = array[high];
+		array[high] = array[middle];
+		array[middle] = temp;
+		if (array[middle].key < array[0].key) {
+			temp = array[middle];
+			array[middle] = array[0];
+			array[0] = temp;
+		}
+	}
+	pivot = array[middle].key;
+
+	for (;;) {
+		while (array[low].key < pivot) {
+			low++;
+		}
+		while (array[high].key > pivot) {
+			high--;
+		}
+		if (low >= high) {
+			return high;
+		}
+		temp = array[low];
+		array[low++] = array[high];
+		array[high--] = temp;
+	}
+}
+
+void nth_element(struct heap_element *array, size_t size, size_t nth)
+{
+	size_t depth_limit = 0;
+	size_t remaining;
+
+	debug_assert(nth < size);
+
+	/* Allow about twice the partitions of an even split every time. */
+	for (remaining = size; remaining > 1; remaining /= 2) {
+		depth_limit += 2;
+	}
+
+	while (size > SELECT_INSERTION_THRESHOLD) {
+		size_t split;
+
+		if (depth_limit-- == 0) {
+			printlg(DEBUG_LEVEL,
+				"Selecting from %u elements by heap sort.\n",
+				(unsigned) size);
+			heap_sort_in_place(array, size);
+			return;
+		}
+
+		/* Keep only the part holding the nth position. */
+		split = partition_median_of_3(array, size);
+		if (nth <= split) {
+			size = split + 1;
+		} else {
+			array += split + 1;
+			size -= split + 1;
+			nth -= split + 1;
+		}
+	}
+
+	insertion_sort(array, size);
+}
+
+void partial_sort(struct heap_element *array, size_t size, size_t k)
+{
+	if (k >= size) {
+		heap_sort_in_place(array, size);
+		return;
+	}
+	if (k == 0) {
+		return;
+	}
+
+	/* Gather the smallest elements at the front, then sort only them. */
+	nth_element(array, size, k);
+	heap_sort_in_place(array, k);
+}
+
+int init_top_k_with(struct top_k *to_init, size_t k, int keep_largest,
+		    struct allocator *allocator)
+{
+	to_init->elements = allocate_with(allocator,
+					  sizeof(struct heap_element) * k);
+	if (to_init->elements == NULL && k > 0) {
+		printlg(ERROR_LEVEL, "Could not allocate top-K elements.\n");
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	to_init->allocator = allocator;
+
+	to_init->k = k;
+	to_init->size = 0;
+	to_init->key_flip = keep_largest ? ~0 : 0;
+
+	return 0;
+}
+
+void teardown_top_k(struct top_k *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->elements);
+	to_teardown->elements = NULL;
+	to_teardown->k = 0;
+	to_teardown->size = 0;
+}
+
+/*
+ * Add an element to an accumulator that is not yet full,
+ * moving it up its max-heap.
+ * top:		the destination accumulator
+ * to_push:	the element to add, with its key already flipped
+ */
+static void push_top_k(struct top_k *top, struct heap_element to_push)
+{
+	struct heap_element *elements = top->elements;
+	size_t position = top->size++;
+
+	while (position > 0) {
+		size_t parent = (position - 1) / 2;
+
+		if (elements[parent].key >= to_push.key) {
+			break;
+		}
+		elements[position] = elements[parent];
+		position = parent;
+	}
+	elements[position] = to_push;
+}
+
+int offer_top_k(struct top_k *top, const struct heap_element *offered)
+{
+	struct heap_element flipped = *offered;
+
+	flipped.key ^= top->key_flip;
+	if (top->size < top->k) {
+		push_top_k(top, flipped);
+		return 1;
+	}
+
+	/* Only the head is compared against, to reject most elements. */
+	if (top->k == 0 || flipped.key >= top->elements[0].key) {
+		return 0;
+	}
+	top->elements[0] = flipped;
+	sift_down_max(top->elements, top->size, 0);
+	return 1;
+}
+
+size_t offer_many_top_k(struct top_k *top, const struct heap_element *offered,
+			size_t n_offered)
+{
+	size_t offered_i = 0, n_kept = 0;
+	int key_flip = top->key_flip;
+
+	/* Fill the accumulator first, so only the head bounds the rest. */
+	while (offered_i < n_offered && top->size < top->k) {
+		struct heap_element flipped = offered[offered_i++];
+
+		flipped.key ^= key_flip;
+		push_top_k(top, flipped);
+		n_kept++;
+	}
+	if (top->k == 0) {
+		return 0;
+	}
+
+	for (; offered_i < n_offered; offered_i++) {
+		int key = offered[offered_i].key ^ key_flip;
+
+		if (key < top->elements[0].key) {
+			top->elements[0].key = key;
+			top->elements[0].data = offered[offered_i].data;
+			sift_down_max(top->elements, top->size, 0);
+			n_kept++;
+		}
+	}
+
+	return n_kept;
+}
+
+size_t results_top_k(struct heap_element *out, struct top_k *top)
+{
+	size_t element_i;
+
+	memcpy(out, top->elements, sizeof(struct heap_element) * top->size);
+	heap_sort_in_place(out, top->size);
+	for (element_i = 0; element_i < top->size; element_i++) {
+		out[element_i].key ^= top->key_flip;
+	}
+
+	return top->size;
+}
+
+int init_indexed_min_heap_with(struct indexed_min_heap *to_init,
+			       size_t capacity, struct allocator *allocator)
+{
+	size_t handle_i;
+
+	/*
+	 * As in "struct min_heap", the 0 position is never used.
+	 * Every array gets the extra entry, so none is allocated empty.
+	 */
+	to_init->allocator = allocator;
+	to_init->elements = allocate_with(allocator,
+					  sizeof(struct heap_element) *
+					  (capacity + 1));
+	to_init->handles = allocate_with(allocator,
+					 sizeof(size_t) * (capacity + 1));
+	to_init->positions = allocate_with(allocator,
+					   sizeof(size_t) * (capacity + 1));
+	to_init->free_handles = allocate_with(allocator, sizeof(size_t) *
+						     (capacity + 1));
+	if (to_init->elements == NULL || to_init->handles == NULL ||
+	    to_init->positions == NULL || to_init->free_handles == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate indexed heap.\n");
+		teardown_indexed_min_heap(to_init);
+		if (allocator == NULL) {
+			errno = ENOMEM;
 		}
+		return -1;
+	}
+
+	/* Hand out the lowest handles first. */
+	for (handle_i = 0; handle_i < capacity; handle_i++) {
+		to_init->positions[handle_i] = 0;
+		to_init->free_handles[handle_i] = capacity - 1 - handle_i;
 	}
+	to_init->n_free = capacity;
+
+	to_init->size = 0;
+	to_init->capacity = capacity;
 
-	teardown_min_heap(&sorter);
 	return 0;
 }
+
+void teardown_indexed_min_heap(struct indexed_min_heap *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->elements);
+	release_with(to_teardown->allocator, to_teardown->handles);
+	release_with(to_teardown->allocator, to_teardown->positions);
+	release_with(to_teardown->allocator, to_teardown->free_handles);
+	to_teardown->elements = NULL;
+	to_teardown->handles = NULL;
+	to_teardown->positions = NULL;
+	to_teardown->free_handles = NULL;
+	to_teardown->n_free = 0;
+	to_teardown->capacity = 0;
+	to_teardown->size = 0;
+}
+
+/*
+ * Write an element into a position of an indexed heap,
+ * and record the new position of its handle.
+ * heap:	the target heap
+ * position:	the position to fill
+ * element:	the element to write
+ * handle:	the handle of the element
+ */
+static inline void place_indexed(struct indexed_min_heap *heap,
+				 size_t position, struct heap_element *element,
+				 size_t handle)
+{
+	heap->elements[position] = *element;
+	heap->handles[position] = handle;
+	heap->positions[handle] = position;
+}
+
+/*
+ * Move the element at a position of an indexed heap up,
+ * until its parent is no larger than it,
+ * keeping the handle positions up to date.
+ * heap:	the target heap
+ * position:	the position of the element to move up
+ */
+static void trickle_up_indexed(struct indexed_min_heap *heap, size_t position)
+{
+	struct heap_element moving = heap->elements[position];
+	size_t handle = heap->handles[position];
+
+	while (position > 1) {
+		size_t parent = position / 2;
+
+		if (heap->elements[parent].key <= moving.key) {
+			break;
+		}
+		place_indexed(heap, position, &heap->elements[parent],
+			      heap->handles[parent]);
+		position = parent;
+	}
+	place_indexed(heap, position, &moving, handle);
+}
+
+/*
+ * Move the element at a position of an indexed heap down,
+ * until its children are no smaller than it,
+ * keeping the handle positions up to date.
+ * heap:	the target heap
+ * position:	the position of the element to move down
+ */
+static void
+trickle_down_indexed(struct indexed_min_heap *heap, size_t position)
+{
+	struct heap_element moving = heap->elements[position];
+	size_t handle = heap->handles[position];
+	size_t size = heap->size;
+
+	while (position <= size / 2) {
+		size_t child = position * 2;
+
+		if (child < size &&
+		    heap->elements[child + 1].key < heap->elements[child].key) {
+			child++;
+		}
+		if (moving.key <= heap->elements[child].key) {
+			break;
+		}
+		place_indexed(heap, position, &heap->elements[child],
+			      heap->handles[child]);
+		position = child;
+	}
+	place_indexed(heap, position, &moving, handle);
+}
+
+int push_indexed_min_heap(struct indexed_min_heap *heap,
+			  struct heap_element *to_push, size_t *handle_out)
+{
+	size_t handle;
+
+	if (heap->size >= heap->capacity) {
+		printlg(ERROR_LEVEL, "Heap is already full, at capacity %u.\n",
+			(unsigned) heap->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+	debug_assert(heap->n_free == heap->capacity - heap->size);
+
+	handle = heap->free_handles[--heap->n_free];
+	heap->size++;
+	place_indexed(heap, heap->size, to_push, handle);
+	trickle_up_indexed(heap, heap->size);
+
+	*handle_out = handle;
+	return 0;
+}
+
+int remove_indexed_min_heap(struct heap_element *removed_out,
+			    struct indexed_min_heap *heap, size_t handle)
+{
+	size_t position;
+	int old_key;
+
+	if (!in_indexed_min_heap(heap, handle)) {
+		printlg(ERROR_LEVEL, "Handle %u is not in the heap.\n",
+			(unsigned) handle);
+		errno = EINVAL;
+		return -1;
+	}
+
+	position = heap->positions[handle];
+	old_key = heap->elements[position].key;
+	if (removed_out != NULL) {
+		*removed_out = heap->elements[position];
+	}
+	heap->positions[handle] = 0;
+	heap->free_handles[heap->n_free++] = handle;
+
+	/* Fill the hole with the last element, then move it either way. */
+	if (position != heap->size) {
+		place_indexed(heap, position, &heap->elements[heap->size],
+			      heap->handles[heap->size]);
+		heap->size--;
+		if (heap->elements[position].key < old_key) {
+			trickle_up_indexed(heap, position);
+		} else {
+			trickle_down_indexed(heap, position);
+		}
+	} else {
+		heap->size--;
+	}
+
+	return 0;
+}
+
+int pop_indexed_min_heap(struct heap_element *head_out, size_t *handle_out,
+			 struct indexed_min_heap *heap)
+{
+	size_t handle;
+
+	if (heap->size == 0) {
+		return -1;
+	}
+
+	handle = heap->handles[1];
+	if (handle_out != NULL) {
+		*handle_out = handle;
+	}
+	return remove_indexed_min_heap(head_out, heap, handle);
+}
+
+int decrease_key_indexed_min_heap(struct indexed_min_heap *heap,
+				  size_t handle, int key)
+{
+	size_t position;
+
+	if (!in_indexed_min_heap(heap, handle)) {
+		printlg(ERROR_LEVEL, "Handle %u is not in the heap.\n",
+			(unsigned) handle);
+		errno = EINVAL;
+		return -1;
+	}
+
+	position = heap->positions[handle];
+	if (key > heap->elements[position].key) {
+		printlg(ERROR_LEVEL, "Key %d is greater than old key %d.\n",
+			key, heap->elements[position].key);
+		errno = EINVAL;
+		return -1;
+	}
+
+	heap->elements[position].key = key;
+	trickle_up_indexed(heap, position);
+
+	return 0;
+}
+
+int increase_key_indexed_min_heap(struct indexed_min_heap *heap,
+				  size_t handle, int key)
+{
+	size_t position;
+
+	if (!in_indexed_min_heap(heap, handle)) {
+		printlg(ERROR_LEVEL, "Handle %u is not in the heap.\n",
+			(unsigned) handle);
+		errno = EINVAL;
+		return -1;
+	}
+
+	position = heap->positions[handle];
+	if (key < heap->elements[position].key) {
+		printlg(ERROR_LEVEL, "Key %d is less than old key %d.\n",
+			key, heap->elements[position].key);
+		errno = EINVAL;
+		return -1;
+	}
+
+	heap->elements[position].key = key;
+	trickle_down_indexed(heap, position);
+
+	return 0;
+}
+
+/*
+ * the number of children of each node in "struct dary_min_heap",
+ * which can be changed by compiling with "-D DARY_HEAP_ARITY=8"
+ */
+#ifndef DARY_HEAP_ARITY
+#define DARY_HEAP_ARITY	4
+#endif /* DARY_HEAP_ARITY */
+#if DARY_HEAP_ARITY != 4 && DARY_HEAP_ARITY != 8
+#error "DARY_HEAP_ARITY must be 4 or 8."
+#endif
+
+/* the size of a cache line, to which sibling groups are aligned */
+#define CACHE_LINE_SIZE	64
+/* the number of bytes taken by the children of a single node */
+#define DARY_GROUP_SIZE	(DARY_HEAP_ARITY * sizeof(struct heap_element))
+/*
+ * the alignment of the allocation,
+ * so that each group of children starts on a cache line,
+ * and fits in as few cache lines as possible
+ */
+#define DARY_ALIGNMENT	(DARY_GROUP_SIZE > CACHE_LINE_SIZE ? \
+			 DARY_GROUP_SIZE : CACHE_LINE_SIZE)
+/*
+ * The children of position "i" start at position "i * DARY_HEAP_ARITY + 1",
+ * so the elements start this many positions into the aligned allocation,
+ * to make every first child land at a multiple of the arity.
+ */
+#define DARY_OFFSET	(DARY_HEAP_ARITY - 1)
+
+int init_dary_min_heap_with(struct dary_min_heap *to_init, size_t capacity,
+			    struct allocator *allocator)
+{
+	void *allocated = allocate_aligned_with(allocator, DARY_ALIGNMENT,
+						sizeof(struct heap_element) *
+						(capacity + DARY_OFFSET),
+						&to_init->block);
+
+	if (allocated == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate heap elements.\n");
+		return -1;
+	}
+	to_init->allocator = allocator;
+	to_init->allocated = allocated;
+	to_init->elements = to_init->allocated + DARY_OFFSET;
+
+	to_init->size = 0;
+	to_init->capacity = capacity;
+
+	return 0;
+}
+
+void teardown_dary_min_heap(struct dary_min_heap *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->block);
+	to_teardown->block = NULL;
+	to_teardown->allocated = NULL;
+	to_teardown->elements = NULL;
+	to_teardown->capacity = 0;
+	to_teardown->size = 0;
+}
+
+/*
+ * Move the element at a position of a d-ary heap down,
+ * until its children are no smaller than it,
+ * shifting the smallest child up into the hole at each level.
+ * heap:	the target heap
+ * position:	the position of the element to move down
+ */
+static void trickle_down_dary(struct dary_min_heap *heap, size_t position)
+{
+	struct heap_element *elements = heap->elements;
+	struct heap_element moving = elements[position];
+	size_t size = heap->size;
+	size_t first_child;
+
+	while ((first_child = position * DARY_HEAP_ARITY + 1) < size) {
+		size_t n_children = size - first_child;
+		size_t child, smallest = first_child;
+		int smallest_key = elements[first_child].key;
+
+		/*
+		 * Full groups have a fixed trip count,
+		 * so the compiler can unroll the scan without branches.
+		 */
+		if (n_children >= DARY_HEAP_ARITY) {
+			for (child = 1; child < DARY_HEAP_ARITY; child++) {
+				int key = elements[first_child + child].key;
+
+				smallest = key < smallest_key ?
+					   first_child + child : smallest;
+				smallest_key = key < smallest_key ?
+					       key : smallest_key;
+			}
+		} else {
+			for (child = 1; child < n_children; child++) {
+				int key = elements[first_child + child].key;
+
+				if (key < smallest_key) {
+					smallest = first_child + child;
+					smallest_key = key;
+				}
+			}
+		}
+		if (moving.key <= smallest_key) {
+			break;
+		}
+
+		elements[position] = elements[smallest];
+		position = smallest;
+	}
+	elements[position] = moving;
+}
+
+int heapify_dary(struct dary_min_heap *heap_out, struct heap_element *array_in,
+		 size_t size)
+{
+	size_t position;
+
+	if (size > heap_out->capacity) {
+		printlg(ERROR_LEVEL, "Size %u exceeds capacity %u.\n",
+			(unsigned) size, (unsigned) heap_out->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+
+	printlg(DEBUG_LEVEL, "Heapifying %u elements with arity %d.\n",
+		(unsigned) size, DARY_HEAP_ARITY);
+	memcpy(heap_out->elements, array_in,
+	       sizeof(struct heap_element) * size);
+	heap_out->size = size;
+
+	/* Start from the parent of the last element. */
+	for (position = (size + DARY_HEAP_ARITY - 2) / DARY_HEAP_ARITY;
+	     position > 0; position--) {
+		trickle_down_dary(heap_out, position - 1);
+	}
+
+	return 0;
+}
+
+int push_dary_min_heap(struct dary_min_heap *heap_out,
+		       struct heap_element *to_push)
+{
+	struct heap_element *elements = heap_out->elements;
+	size_t position;
+
+	if (heap_out->size >= heap_out->capacity) {
+		printlg(ERROR_LEVEL, "Heap is already full, at capacity %u.\n",
+			(unsigned) heap_out->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+
+	position = heap_out->size++;
+	while (position > 0) {
+		size_t parent = (position - 1) / DARY_HEAP_ARITY;
+
+		if (elements[parent].key <= to_push->key) {
+			break;
+		}
+		elements[position] = elements[parent];
+		position = parent;
+	}
+	elements[position] = *to_push;
+
+	return 0;
+}
+
+int pop_dary_min_heap(struct heap_element *head_out,
+		      struct dary_min_heap *heap_in)
+{
+	if (heap_in->size == 0) {
+		return -1;
+	}
+
+	*head_out = heap_in->elements[0];
+	heap_in->size--;
+	heap_in->elements[0] = heap_in->elements[heap_in->size];
+	trickle_down_dary(heap_in, 0);
+
+	return 0;
+}
+
+/* the number of children of each node in "struct soa_min_heap" */
+#define SOA_HEAP_ARITY	8
+/* the alignment of the keys, so that each group of children is aligned */
+#define SOA_ALIGNMENT	(SOA_HEAP_ARITY * sizeof(int32_t))
+/* As in "struct dary_min_heap", line up the first child of each node. */
+#define SOA_OFFSET	(SOA_HEAP_ARITY - 1)
+
+int init_soa_min_heap_with(struct soa_min_heap *to_init, size_t capacity,
+			   struct allocator *allocator)
+{
+	void *allocated_keys = allocate_aligned_with(allocator, SOA_ALIGNMENT,
+						     sizeof(int32_t) *
+						     (capacity + SOA_OFFSET),
+						     &to_init->keys_block);
+
+	if (allocated_keys == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate heap keys.\n");
+		return -1;
+	}
+	to_init->allocated_data = allocate_with(allocator, sizeof(void *) *
+						(capacity + SOA_OFFSET));
+	if (to_init->allocated_data == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate heap data.\n");
+		release_with(allocator, to_init->keys_block);
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	to_init->allocator = allocator;
+	to_init->allocated_keys = allocated_keys;
+	to_init->keys = to_init->allocated_keys + SOA_OFFSET;
+	to_init->data = to_init->allocated_data + SOA_OFFSET;
+
+	to_init->size = 0;
+	to_init->capacity = capacity;
+
+	return 0;
+}
+
+void teardown_soa_min_heap(struct soa_min_heap *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->keys_block);
+	release_with(to_teardown->allocator, to_teardown->allocated_data);
+	to_teardown->keys_block = NULL;
+	to_teardown->allocated_keys = NULL;
+	to_teardown->allocated_data = NULL;
+	to_teardown->keys = NULL;
+	to_teardown->data = NULL;
+	to_teardown->capacity = 0;
+	to_teardown->size = 0;
+}
+
+#if defined(__SSE2__)
+/*
+ * Find the element-wise minimum of two vectors of signed 32-bit integers,
+ * which is a single instruction from SSE4.1 onwards.
+ * a:		the first vector
+ * b:		the second vector
+ * returns	the element-wise minimum of the vectors
+ */
+static inline __m128i min_epi32(__m128i a, __m128i b)
+{
+#if defined(__SSE4_1__)
+	return _mm_min_epi32(a, b);
+#else
+	__m128i a_greater = _mm_cmpgt_epi32(a, b);
+
+	return _mm_or_si128(_mm_and_si128(a_greater, b),
+			    _mm_andnot_si128(a_greater, a));
+#endif /* __SSE4_1__ */
+}
+#endif /* __SSE2__ */
+
+/*
+ * Find the smallest of a full, aligned group of children.
+ * keys:	the keys of the children,
+ *		aligned to "SOA_ALIGNMENT" bytes
+ * key_out:	the space to write the smallest key
+ * returns	the offset of the first child with the smallest key
+ */
+static inline size_t min_child_group(int32_t *keys, int32_t *key_out)
+{
+#if defined(__AVX2__)
+	__m256i group = _mm256_load_si256((__m256i *) keys);
+	__m256i min = _mm256_min_epi32(group,
+				       _mm256_permute2x128_si256(group, group,
+								 1));
+	int mask;
+
+	/* Spread the minimum to every lane, then find where it came from. */
+	min = _mm256_min_epi32(min, _mm256_shuffle_epi32(min, 0x4e));
+	min = _mm256_min_epi32(min, _mm256_shuffle_epi32(min, 0xb1));
+	mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+					_mm256_cmpeq_epi32(group, min)));
+
+	*key_out = _mm256_cvtsi256_si32(min);
+	return __builtin_ctz(mask);
+#elif defined(__SSE2__)
+	__m128i low = _mm_load_si128((__m128i *) keys);
+	__m128i high = _mm_load_si128((__m128i *) (keys + 4));
+	__m128i min = min_epi32(low, high);
+	int mask;
+
+	/* Spread the minimum to every lane, then find where it came from. */
+	min = min_epi32(min, _mm_shuffle_epi32(min, 0x4e));
+	min = min_epi32(min, _mm_shuffle_epi32(min, 0xb1));
+	mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(low, min))) |
+	       (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(high, min)))
+		<< 4);
+
+	*key_out = _mm_cvtsi128_si32(min);
+	return __builtin_ctz(mask);
+#else
+	size_t child, smallest = 0;
+	int32_t smallest_key = keys[0];
+
+	for (child = 1; child < SOA_HEAP_ARITY; child++) {
+		smallest = keys[child] < smallest_key ? child : smallest;
+		smallest_key = keys[child] < smallest_key ?
+			       keys[child] : smallest_key;
+	}
+
+	*key_out = smallest_key;
+	return smallest;
+#endif
+}
+
+/*
+ * Move the element at a position of a structure-of-arrays heap down,
+ * until its children are no smaller than it.
+ * heap:	the target heap
+ * position:	the position of the element to move down
+ */
+static void trickle_down_soa(struct soa_min_heap *heap, size_t position)
+{
+	int32_t *keys = heap->keys;
+	void **data = heap->data;
+	int32_t moving_key = keys[position];
+	void *moving_data = data[position];
+	size_t size = heap->size;
+	size_t first_child;
+
+	while ((first_child = position * SOA_HEAP_ARITY + 1) < size) {
+		size_t smallest;
+		int32_t smallest_key;
+
+		if (size - first_child >= SOA_HEAP_ARITY) {
+			smallest = first_child +
+				   min_child_group(&keys[first_child],
+						   &smallest_key);
+		} else {
+			size_t child;
+
+			smallest = first_child;
+			smallest_key = keys[first_child];
+			for (child = first_child + 1; child < size; child++) {
+				if (keys[child] < smallest_key) {
+					smallest = child;
+					smallest_key = keys[child];
+				}
+			}
+		}
+		if (moving_key <= smallest_key) {
+			break;
+		}
+
+		keys[position] = smallest_key;
+		data[position] = data[smallest];
+		position = smallest;
+	}
+	keys[position] = moving_key;
+	data[position] = moving_data;
+}
+
+int heapify_soa(struct soa_min_heap *heap_out, struct heap_element *array_in,
+		size_t size)
+{
+	size_t position;
+
+	if (size > heap_out->capacity) {
+		printlg(ERROR_LEVEL, "Size %u exceeds capacity %u.\n",
+			(unsigned) size, (unsigned) heap_out->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+
+	printlg(DEBUG_LEVEL, "Heapifying %u elements into arrays.\n",
+		(unsigned) size);
+	for (position = 0; position < size; position++) {
+		heap_out->keys[position] = array_in[position].key;
+		heap_out->data[position] = array_in[position].data;
+	}
+	heap_out->size = size;
+
+	/* Start from the parent of the last element. */
+	for (position = (size + SOA_HEAP_ARITY - 2) / SOA_HEAP_ARITY;
+	     position > 0; position--) {
+		trickle_down_soa(heap_out, position - 1);
+	}
+
+	return 0;
+}
+
+int push_soa_min_heap(struct soa_min_heap *heap_out,
+		      struct heap_element *to_push)
+{
+	int32_t *keys = heap_out->keys;
+	void **data = heap_out->data;
+	size_t position;
+
+	if (heap_out->size >= heap_out->capacity) {
+		printlg(ERROR_LEVEL, "Heap is already full, at capacity %u.\n",
+			(unsigned) heap_out->capacity);
+		errno = ERANGE;
+		return -1;
+	}
+
+	position = heap_out->size++;
+	while (position > 0) {
+		size_t parent = (position - 1) / SOA_HEAP_ARITY;
+
+		if (keys[parent] <= to_push->key) {
+			break;
+		}
+		keys[position] = keys[parent];
+		data[position] = data[parent];
+		position = parent;
+	}
+	keys[position] = to_push->key;
+	data[position] = to_push->data;
+
+	return 0;
+}
+
+int pop_soa_min_heap(struct heap_element *head_out,
+		     struct soa_min_heap *heap_in)
+{
+	if (heap_in->size == 0) {
+		return -1;
+	}
+
+	head_out->key = heap_in->keys[0];
+	head_out->data = heap_in->data[0];
+	heap_in->size--;
+	heap_in->keys[0] = heap_in->keys[heap_in->size];
+	heap_in->data[0] = heap_in->data[heap_in->size];
+	trickle_down_soa(heap_in, 0);
+
+	return 0;
+}
+
+void init_radix_heap_with(struct radix_heap *to_init,
+			  struct allocator *allocator)
+{
+	memset(to_init, 0, sizeof(struct radix_heap));
+	to_init->allocator = allocator;
+}
+
+void teardown_radix_heap(struct radix_heap *to_teardown)
+{
+	size_t bucket_i;
+
+	for (bucket_i = 0; bucket_i < RADIX_HEAP_BUCKETS; bucket_i++) {
+		release_with(to_teardown->allocator,
+			     to_teardown->buckets[bucket_i].elements);
+	}
+	memset(to_teardown, 0, sizeof(struct radix_heap));
+}
+
+/*
+ * Find the bucket of a key in a radix heap.
+ * mapped_key:	the key, mapped by "radix_key"
+ * last:	the last key popped, mapped the same way
+ * returns	the index of the bucket
+ */
+static inline size_t radix_heap_bucket_of(unsigned mapped_key, unsigned last)
+{
+	if (mapped_key == last) {
+		return 0;
+	}
+	return sizeof(unsigned) * CHAR_BIT - __builtin_clz(mapped_key ^ last);
+}
+
+/*
+ * Make sure a bucket has room for more elements,
+ * doubling its allocation as needed, and never shrinking it,
+ * so that a busy heap stops allocating.
+ * Without "realloc", an allocator's bucket is copied to the new memory.
+ * bucket:	the bucket to grow
+ * needed:	the number of elements the bucket must have room for
+ * allocator:	the allocator of the bucket, or NULL to use "realloc"
+ * returns	0 on success and
+ *		-1 if allocation failed,
+ *		   with errno set to ENOMEM or by the allocator
+ */
+static int reserve_radix_heap_bucket(struct radix_heap_bucket *bucket,
+				     size_t needed,
+				     struct allocator *allocator)
+{
+	struct heap_element *grown;
+	size_t capacity = bucket->capacity > 0 ? bucket->capacity : 16;
+
+	if (needed <= bucket->capacity) {
+		return 0;
+	}
+	while (capacity < needed) {
+		capacity *= 2;
+	}
+
+	if (allocator == NULL) {
+		grown = realloc(bucket->elements,
+				sizeof(struct heap_element) * capacity);
+	} else {
+		grown = allocate_with(allocator, sizeof(struct heap_element) *
+						 capacity);
+		if (grown != NULL) {
+			if (bucket->size > 0) {
+				memcpy(grown, bucket->elements,
+				       sizeof(struct heap_element) *
+				       bucket->size);
+			}
+			release_with(allocator, bucket->elements);
+		}
+	}
+	if (grown == NULL) {
+		printlg(ERROR_LEVEL, "Could not grow radix heap bucket.\n");
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	bucket->elements = grown;
+	bucket->capacity = capacity;
+
+	return 0;
+}
+
+int push_radix_heap(struct radix_heap *heap_out, struct heap_element *to_push)
+{
+	unsigned mapped_key = radix_key(to_push->key);
+	struct radix_heap_bucket *bucket;
+
+	if (mapped_key < heap_out->last) {
+		printlg(ERROR_LEVEL, "Key %d is below the last key popped.\n",
+			to_push->key);
+		errno = EINVAL;
+		return -1;
+	}
+
+	bucket = &heap_out->buckets[radix_heap_bucket_of(mapped_key,
+							 heap_out->last)];
+	if (reserve_radix_heap_bucket(bucket, bucket->size + 1,
+				      heap_out->allocator)) {
+		return -1;
+	}
+	bucket->elements[bucket->size++] = *to_push;
+	heap_out->size++;
+
+	return 0;
+}
+
+/*
+ * Make sure that bucket 0 holds the smallest elements,
+ * by taking the first nonempty bucket, making its smallest key the last one,
+ * and spreading its elements into the lower buckets.
+ * heap:	the heap to rearrange, which must not be empty
+ * returns	0 on success and
+ *		-1 if a bucket could not grow, with errno set to ENOMEM,
+ *		   in which case the heap is unchanged
+ */
+static int refill_radix_heap(struct radix_heap *heap)
+{
+	size_t counts[RADIX_HEAP_BUCKETS] = {0};
+	struct radix_heap_bucket *source;
+	struct heap_element *elements;
+	size_t bucket_i, element_i;
+	unsigned last;
+
+	if (heap->buckets[0].size > 0) {
+		return 0;
+	}
+
+	for (bucket_i = 1; heap->buckets[bucket_i].size == 0; bucket_i++) {
+		debug_assert(bucket_i + 1 < RADIX_HEAP_BUCKETS);
+	}
+	source = &heap->buckets[bucket_i];
+	elements = source->elements;
+
+	last = radix_key(elements[0].key);
+	for (element_i = 1; element_i < source->size; element_i++) {
+		unsigned mapped_key = radix_key(elements[element_i].key);
+
+		if (mapped_key < last) {
+			last = mapped_key;
+		}
+	}
+
+	/* Make room first, so that a failure leaves the heap as it was. */
+	for (element_i = 0; element_i < source->size; element_i++) {
+		unsigned mapped_key = radix_key(elements[element_i].key);
+
+		counts[radix_heap_bucket_of(mapped_key, last)]++;
+	}
+	for (bucket_i = 0; heap->buckets + bucket_i < source; bucket_i++) {
+		if (reserve_radix_heap_bucket(&heap->buckets[bucket_i],
+					      counts[bucket_i],
+					      heap->allocator)) {
+			return -1;
+		}
+	}
+
+	/* Every element moves to a lower bucket, which was empty. */
+	heap->last = last;
+	for (element_i = 0; element_i < source->size; element_i++) {
+		struct heap_element *element = &elements[element_i];
+		size_t dest_i = radix_heap_bucket_of(radix_key(element->key),
+						     last);
+		struct radix_heap_bucket *dest = &heap->buckets[dest_i];
+
+		debug_assert(dest < source);
+		dest->elements[dest->size++] = *element;
+	}
+	source->size = 0;
+
+	return 0;
+}
+
+int peek_radix_heap(struct heap_element *head_out, struct radix_heap *heap_in)
+{
+	struct radix_heap_bucket *head_bucket = &heap_in->buckets[0];
+
+	if (heap_in->size == 0 || refill_radix_heap(heap_in)) {
+		return -1;
+	}
+
+	*head_out = head_bucket->elements[head_bucket->size - 1];
+	return 0;
+}
+
+int pop_radix_heap(struct heap_element *head_out, struct radix_heap *heap_in)
+{
+	struct radix_heap_bucket *head_bucket = &heap_in->buckets[0];
+
+	if (heap_in->size == 0 || refill_radix_heap(heap_in)) {
+		return -1;
+	}
+
+	*head_out = head_bucket->elements[--head_bucket->size];
+	heap_in->size--;
+	return 0;
+}
+
+int init_space_saving_with(struct space_saving *to_init, size_t capacity,
+			   struct allocator *allocator)
+{
+	size_t index_size;
+	size_t entry_i;
+
+	if (capacity == 0) {
+		printlg(ERROR_LEVEL, "A tracker needs at least one counter.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Keep the index at most half full, so probes stay short. */
+	to_init->index_bits = 1;
+	while (((size_t) 1 << to_init->index_bits) < capacity * 2) {
+		to_init->index_bits++;
+	}
+	index_size = (size_t) 1 << to_init->index_bits;
+
+	to_init->counters = allocate_with(allocator,
+					  sizeof(struct heavy_hitter) *
+					  capacity);
+	to_init->index_positions = allocate_with(allocator,
+						 sizeof(size_t) * capacity);
+	to_init->index = allocate_with(allocator, sizeof(size_t) * index_size);
+	if (to_init->counters == NULL || to_init->index_positions == NULL ||
+	    to_init->index == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate tracker counters.\n");
+		release_with(allocator, to_init->counters);
+		release_with(allocator, to_init->index_positions);
+		release_with(allocator, to_init->index);
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	to_init->allocator = allocator;
+	for (entry_i = 0; entry_i < index_size; entry_i++) {
+		to_init->index[entry_i] = SPACE_SAVING_EMPTY;
+	}
+
+	to_init->capacity = capacity;
+	to_init->size = 0;
+	to_init->total = 0;
+
+	return 0;
+}
+
+void teardown_space_saving(struct space_saving *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->counters);
+	release_with(to_teardown->allocator, to_teardown->index_positions);
+	release_with(to_teardown->allocator, to_teardown->index);
+	to_teardown->counters = NULL;
+	to_teardown->index_positions = NULL;
+	to_teardown->index = NULL;
+	to_teardown->capacity = 0;
+	to_teardown->size = 0;
+	to_teardown->total = 0;
+}
+
+/*
+ * Find where an item's entry starts probing in the index,
+ * by multiplicative hashing.
+ * tracker:	the tracker whose index to use
+ * item:	the item to hash
+ * returns	the first position in the index to check
+ */
+static inline size_t space_saving_home(struct space_saving *tracker,
+				       uint64_t item)
+{
+	return (size_t) ((item * 0x9e3779b97f4a7c15ULL) >>
+			 (64 - tracker->index_bits));
+}
+
+/*
+ * Find the entry of an item in the index.
+ * tracker:	the tracker whose index to search
+ * item:	the item to find
+ * returns	the entry's position in the index, if the item is tracked,
+ *		or the position of the empty entry where it would go
+ */
+static size_t find_space_saving(struct space_saving *tracker, uint64_t item)
+{
+	size_t mask = ((size_t) 1 << tracker->index_bits) - 1;
+	size_t entry = space_saving_home(tracker, item);
+
+	while (tracker->index[entry] != SPACE_SAVING_EMPTY &&
+	       tracker->counters[tracker->index[entry]].item != item) {
+		entry = (entry + 1) & mask;
+	}
+
+	return entry;
+}
+
+/*
+ * Remove an entry from the index,
+ * moving back any later entries in the same probe sequence,
+ * so that no probe stops short of its item.
+ * tracker:	the tracker whose index to change
+ * entry:	the position in the index of the entry to remove
+ */
+static void unindex_space_saving(struct space_saving *tracker, size_t entry)
+{
+	size_t mask = ((size_t) 1 << tracker->index_bits) - 1;
+	size_t *index = tracker->index;
+	size_t next = entry;
+
+	for (;;) {
+		size_t home;
+
+		next = (next + 1) & mask;
+		if (index[next] == SPACE_SAVING_EMPTY) {
+			break;
+		}
+
+		/* Only move entries whose probes pass through the hole. */
+		home = space_saving_home(tracker,
+					 tracker->counters[index[next]].item);
+		if (((next - home) & mask) >= ((next - entry) & mask)) {
+			index[entry] = index[next];
+			tracker->index_positions[index[entry]] = entry;
+			entry = next;
+		}
+	}
+
+	index[entry] = SPACE_SAVING_EMPTY;
+}
+
+/*
+ * Write a counter to a position in the heap,
+ * and update its entry in the index.
+ * tracker:	the tracker whose heap to write to
+ * position:	the position in the heap
+ * counter:	the counter to write
+ * index_position:	the position of the counter's entry in the index
+ */
+static inline void place_space_saving(struct space_saving *tracker,
+				      size_t position,
+				      const struct heavy_hitter *counter,
+				      size_t index_position)
+{
+	tracker->counters[position] = *counter;
+	tracker->index_positions[position] = index_position;
+	tracker->index[index_position] = position;
+}
+
+/*
+ * Move a counter down the heap to its position,
+ * after its count was raised.
+ * tracker:	the tracker whose heap to rearrange
+ * position:	the position of the counter to move
+ */
+static void sift_down_space_saving(struct space_saving *tracker,
+				   size_t position)
+{
+	struct heavy_hitter *counters = tracker->counters;
+	struct heavy_hitter moving = counters[position];
+	size_t moving_index = tracker->index_positions[position];
+	size_t size = tracker->size;
+	size_t child;
+
+	while ((child = position * 2 + 1) < size) {
+		if (child + 1 < size &&
+		    counters[child + 1].count < counters[child].count) {
+			child++;
+		}
+		if (counters[child].count >= moving.count) {
+			break;
+		}
+		place_space_saving(tracker, position, &counters[child],
+				   tracker->index_positions[child]);
+		position = child;
+	}
+	place_space_saving(tracker, position, &moving, moving_index);
+}
+
+/*
+ * Move a counter up the heap to its position.
+ * tracker:	the tracker whose heap to rearrange
+ * position:	the position of the counter to move
+ */
+static void sift_up_space_saving(struct space_saving *tracker,
+				 size_t position)
+{
+	struct heavy_hitter *counters = tracker->counters;
+	struct heavy_hitter moving = counters[position];
+	size_t moving_index = tracker->index_positions[position];
+
+	while (position > 0) {
+		size_t parent = (position - 1) / 2;
+
+		if (counters[parent].count <= moving.count) {
+			break;
+		}
+		place_space_saving(tracker, position, &counters[parent],
+				   tracker->index_positions[parent]);
+		position = parent;
+	}
+	place_space_saving(tracker, position, &moving, moving_index);
+}
+
+void add_space_saving(struct space_saving *tracker, uint64_t item,
+		      uint64_t increment)
+{
+	size_t entry = find_space_saving(tracker, item);
+	struct heavy_hitter counter = {
+		.item = item,
+		.count = increment,
+		.error = 0,
+	};
+
+	tracker->total += increment;
+
+	if (tracker->index[entry] != SPACE_SAVING_EMPTY) {
+		size_t position = tracker->index[entry];
+
+		tracker->counters[position].count += increment;
+		sift_down_space_saving(tracker, position);
+	} else if (tracker->size < tracker->capacity) {
+		place_space_saving(tracker, tracker->size++, &counter, entry);
+		sift_up_space_saving(tracker, tracker->size - 1);
+	} else {
+		/*
+		 * Take over the smallest counter,
+		 * whose count is the most this item could have been missed.
+		 */
+		counter.error = tracker->counters[0].count;
+		counter.count += counter.error;
+		unindex_space_saving(tracker, tracker->index_positions[0]);
+		entry = find_space_saving(tracker, item);
+		place_space_saving(tracker, 0, &counter, entry);
+		sift_down_space_saving(tracker, 0);
+	}
+}
+
+void add_many_space_saving(struct space_saving *tracker,
+			   const uint64_t *items, size_t n_items)
+{
+	size_t item_i = 0;
+
+	while (item_i < n_items) {
+		uint64_t item = items[item_i];
+		size_t run_end = item_i + 1;
+
+		while (run_end < n_items && items[run_end] == item) {
+			run_end++;
+		}
+		add_space_saving(tracker, item, run_end - item_i);
+		item_i = run_end;
+	}
+}
+
+int get_space_saving(struct space_saving *tracker, uint64_t item,
+		     struct heavy_hitter *hitter_out)
+{
+	size_t entry = find_space_saving(tracker, item);
+
+	if (tracker->index[entry] == SPACE_SAVING_EMPTY) {
+		return -1;
+	}
+
+	*hitter_out = tracker->counters[tracker->index[entry]];
+	return 0;
+}
+
+size_t results_space_saving(struct heavy_hitter *out,
+			    struct space_saving *tracker)
+{
+	size_t size = tracker->size;
+	size_t end, position, child;
+
+	/*
+	 * The counters are already a min-heap,
+	 * so heap sort the copy by moving each smallest count to the back.
+	 */
+	memcpy(out, tracker->counters, sizeof(struct heavy_hitter) * size);
+	for (end = size; end > 1; end--) {
+		struct heavy_hitter moving = out[end - 1];
+
+		out[end - 1] = out[0];
+		position = 0;
+		while ((child = position * 2 + 1) < end - 1) {
+			if (child + 1 < end - 1 &&
+			    out[child + 1].count < out[child].count) {
+				child++;
+			}
+			if (out[child].count >= moving.count) {
+				break;
+			}
+			out[position] = out[child];
+			position = child;
+		}
+		out[position] = moving;
+	}
+
+	return size;
+}
+
+/* the most slots of a hash map that are used, in eighths */
+#define HASH_MAP_MAX_LOAD	7
+/* the bits of a key's hash kept in its control byte */
+#define HASH_MAP_TAG_MASK	0x7f
+/* the number of bits of the hash kept in the control byte */
+#define HASH_MAP_TAG_BITS	7
+/* the odd constant that hashes are multiplied by */
+#define HASH_MAP_MULTIPLIER	0x9e3779b97f4a7c15ULL
+
+/*
+ * Find the number of slots a hash map needs for a number of entries.
+ * n_entries:	the number of entries to make room for
+ * returns	the smallest power of 2, and multiple of "HASH_MAP_GROUP",
+ *		whose maximum load is at least "n_entries"
+ */
+static size_t hash_map_capacity(size_t n_entries)
+{
+	size_t capacity = HASH_MAP_GROUP;
+
+	while (capacity / 8 * HASH_MAP_MAX_LOAD < n_entries) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+/*
+ * Allocate the slots of an empty hash map, from the map's allocator.
+ * map:		the map whose slots to allocate
+ * capacity:	the number of slots
+ * returns	0 if successful
+ *		-1 if allocation failed,
+ *		   with errno set to ENOMEM or by the allocator
+ */
+static int allocate_hash_map(struct hash_map *map, size_t capacity)
+{
+	void *control_block;
+	void *control = allocate_aligned_with(map->allocator, HASH_MAP_GROUP,
+					      capacity, &control_block);
+
+	if (control == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate hash map control.\n");
+		return -1;
+	}
+	map->entries = allocate_with(map->allocator,
+				     sizeof(struct hash_map_entry) * capacity);
+	if (map->entries == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate hash map entries.\n");
+		release_with(map->allocator, control_block);
+		if (map->allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	map->control_block = control_block;
+	map->control = control;
+	memset(map->control, HASH_MAP_EMPTY, capacity);
+
+	map->capacity = capacity;
+	map->size = 0;
+	map->growth_left = capacity / 8 * HASH_MAP_MAX_LOAD;
+
+	return 0;
+}
+
+int init_hash_map_with(struct hash_map *to_init, size_t capacity,
+		       struct allocator *allocator)
+{
+	to_init->allocator = allocator;
+	return allocate_hash_map(to_init, hash_map_capacity(capacity));
+}
+
+void teardown_hash_map(struct hash_map *to_teardown)
+{
+	release_with(to_teardown->allocator, to_teardown->control_block);
+	release_with(to_teardown->allocator, to_teardown->entries);
+	to_teardown->control_block = NULL;
+	to_teardown->control = NULL;
+	to_teardown->entries = NULL;
+	to_teardown->capacity = 0;
+	to_teardown->size = 0;
+	to_teardown->growth_left = 0;
+}
+
+/*
+ * Mix a word into a hash, by folding together both halves
+ * of its 128-bit product with an odd constant.
+ * word:	the word to mix
+ * returns	the hash
+ */
+static inline uint64_t hash_word(uint64_t word)
+{
+	uint64_t high, low;
+
+	xmultiply(&high, &low, word, HASH_MAP_MULTIPLIER);
+	return high ^ low;
+}
+
+/*
+ * Hash a string of bytes, 8 bytes at a time.
+ * bytes:	the bytes to hash
+ * size:	the number of bytes
+ * returns	the hash
+ */
+static uint64_t hash_bytes(const unsigned char *bytes, size_t size)
+{
+	uint64_t hash = size;
+	uint64_t word;
+
+	while (size >= sizeof(word)) {
+		memcpy(&word, bytes, sizeof(word));
+		hash = hash_word(hash ^ word);
+		bytes += sizeof(word);
+		size -= sizeof(word);
+	}
+	word = 0;
+	memcpy(&word, bytes, size);
+
+	return hash_word(hash ^ word);
+}
+
+/*
+ * Hash the key of an entry.
+ * entry:	the entry holding the key
+ * is_bytes:	nonzero if the key is a byte string
+ * returns	the hash
+ */
+static inline uint64_t hash_key(const struct hash_map_entry *entry,
+				int is_bytes)
+{
+	return is_bytes ? hash_bytes(entry->key.bytes, entry->key_size) :
+	       hash_word(entry->key.integer);
+}
+
+/*
+ * Check whether two entries have the same key.
+ * entry:	the entry in the map
+ * key:		the entry holding the key to compare
+ * is_bytes:	nonzero if the keys are byte strings
+ * returns	nonzero iff the keys are equal
+ */
+static inline int hash_keys_equal(const struct hash_map_entry *entry,
+				  const struct hash_map_entry *key,
+				  int is_bytes)
+{
+	if (!is_bytes) {
+		return entry->key.integer == key->key.integer;
+	}
+	return entry->key_size == key->key_size &&
+	       !memcmp(entry->key.bytes, key->key.bytes, key->key_size);
+}
+
+/*
+ * Find the slots of a group whose control bytes equal a value.
+ * control:	the aligned control bytes of the group
+ * value:	the control byte to look for
+ * returns	a mask with a bit set for each matching slot
+ */
+static inline unsigned match_group(const int8_t *control, int8_t value)
+{
+#if defined(__SSE2__)
+	__m128i group = _mm_load_si128((const __m128i *) control);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+	unsigned mask = 0;
+	size_t slot;
+
+	for (slot = 0; slot < HASH_MAP_GROUP; slot++) {
+		mask |= (unsigned) (control[slot] == value) << slot;
+	}
+	return mask;
+#endif /* __SSE2__ */
+}
+
+/*
+ * Find the slots of a group without an entry,
+ * which are the ones whose control bytes are negative.
+ * control:	the aligned control bytes of the group
+ * returns	a mask with a bit set for each empty or deleted slot
+ */
+static inline unsigned match_free_group(const int8_t *control)
+{
+#if defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *) control));
+#else
+	unsigned mask = 0;
+	size_t slot;
+
+	for (slot = 0; slot < HASH_MAP_GROUP; slot++) {
+		mask |= (unsigned) (control[slot] < 0) << slot;
+	}
+	return mask;
+#endif /* __SSE2__ */
+}
+
+/*
+ * Find the slot of a key,
+ * by probing the groups in the order given by the key's hash
+ * until one has the key, or has a slot that was never used.
+ * map:		the map to search
+ * key:		the entry holding the key to find
+ * hash:	the hash of the key
+ * is_bytes:	nonzero if the key is a byte string
+ * returns	the slot of the key,
+ *		or the map's capacity if the key is not in the map
+ */
+static inline size_t find_hash_map(struct hash_map *map,
+				   const struct hash_map_entry *key,
+				   uint64_t hash, int is_bytes)
+{
+	size_t group_mask = map->capacity / HASH_MAP_GROUP - 1;
+	size_t group = (hash >> HASH_MAP_TAG_BITS) & group_mask;
+	int8_t tag = hash & HASH_MAP_TAG_MASK;
+	size_t step = 0;
+
+	for (;;) {
+		const int8_t *control = map->control + group * HASH_MAP_GROUP;
+		unsigned matches = match_group(control, tag);
+
+		while (matches != 0) {
+			size_t slot = group * HASH_MAP_GROUP +
+				      __builtin_ctz(matches);
+
+			if (hash_keys_equal(&map->entries[slot], key,
+					    is_bytes)) {
+				return slot;
+			}
+			matches &= matches - 1;
+		}
+		if (match_group(control, HASH_MAP_EMPTY) != 0) {
+			return map->capacity;
+		}
+
+		/* Visiting the groups by triangular steps reaches them all. */
+		group = (group + ++step) & group_mask;
+	}
+}
+
+/*
+ * Find the first slot without an entry in a key's probe sequence,
+ * which always exists since the map is never full.
+ * map:		the map to search
+ * hash:	the hash of the key
+ * returns	the slot
+ */
+static size_t find_free_hash_map(struct hash_map *map, uint64_t hash)
+{
+	size_t group_mask = map->capacity / HASH_MAP_GROUP - 1;
+	size_t group = (hash >> HASH_MAP_TAG_BITS) & group_mask;
+	size_t step = 0;
+	unsigned free_slots;
+
+	while ((free_slots = match_free_group(map->control +
+					      group * HASH_MAP_GROUP)) == 0) {
+		group = (group + ++step) & group_mask;
+	}
+
+	return group * HASH_MAP_GROUP + __builtin_ctz(free_slots);
+}
+
+/*
+ * Move every entry into newly allocated slots, dropping the deleted slots.
+ * The number of slots is doubled if the entries fill more than
+ * half the maximum load, or is otherwise kept,
+ * so that a map full of deleted slots is just cleaned up.
+ * map:		the map to rehash
+ * is_bytes:	nonzero if the keys are byte strings
+ * returns	0 if successful
+ *		-1 if allocation failed, with errno set to ENOMEM,
+ *		   in which case the map is unchanged
+ */
+static int rehash_hash_map(struct hash_map *map, int is_bytes)
+{
+	struct hash_map old = *map;
+	size_t capacity = old.capacity;
+	size_t slot;
+
+	if (old.size > capacity / 8 * HASH_MAP_MAX_LOAD / 2) {
+		capacity *= 2;
+	}
+	if (allocate_hash_map(map, capacity)) {
+		*map = old;
+		return -1;
+	}
+	printlg(DEBUG_LEVEL, "Rehashing %u entries into %u slots.\n",
+		(unsigned) old.size, (unsigned) map->capacity);
+
+	for (slot = 0; slot < old.capacity; slot++) {
+		if (old.control[slot] >= 0) {
+			uint64_t hash = hash_key(&old.entries[slot], is_bytes);
+			size_t new_slot = find_free_hash_map(map, hash);
+
+			map->control[new_slot] = hash & HASH_MAP_TAG_MASK;
+			map->entries[new_slot] = old.entries[slot];
+		}
+	}
+	map->size = old.size;
+	map->growth_left -= old.size;
+
+	teardown_hash_map(&old);
+	return 0;
+}
+
+/*
+ * Associate a value with a key, as in "put_hash_map".
+ * map:		the destination map
+ * key:		the entry holding the key
+ * value:	the value to associate with the key
+ * is_bytes:	nonzero if the key is a byte string
+ * returns	0 on success and
+ *		-1 if the map could not grow, with errno set to ENOMEM
+ */
+static inline int put_key_hash_map(struct hash_map *map,
+				   struct hash_map_entry *key, void *value,
+				   int is_bytes)
+{
+	uint64_t hash = hash_key(key, is_bytes);
+	size_t slot = find_hash_map(map, key, hash, is_bytes);
+
+	if (slot < map->capacity) {
+		map->entries[slot].value = value;
+		return 0;
+	}
+
+	/* Reusing a deleted slot does not use up an empty one. */
+	slot = find_free_hash_map(map, hash);
+	if (map->control[slot] == HASH_MAP_EMPTY) {
+		if (map->growth_left == 0) {
+			if (rehash_hash_map(map, is_bytes)) {
+				return -1;
+			}
+			slot = find_free_hash_map(map, hash);
+		}
+		map->growth_left--;
+	}
+
+	map->control[slot] = hash & HASH_MAP_TAG_MASK;
+	map->entries[slot] = *key;
+	map->entries[slot].value = value;
+	map->size++;
+
+	return 0;
+}
+
+/*
+ * Remove a key, as in "remove_hash_map".
+ * A slot is only marked as deleted if its group has no empty slot,
+ * since a probe only passes a group that has been full.
+ * map:		the source map
+ * key:		the entry holding the key
+ * value_out:	the space to write the key's value, or NULL
+ * is_bytes:	nonzero if the key is a byte string
+ * returns	0 iff the key was removed.
+ *		-1 if the key is not in the map
+ */
+static inline int remove_key_hash_map(struct hash_map *map,
+				      struct hash_map_entry *key,
+				      void **value_out, int is_bytes)
+{
+	size_t slot = find_hash_map(map, key, hash_key(key, is_bytes),
+				    is_bytes);
+	const int8_t *group_control;
+
+	if (slot == map->capacity) {
+		return -1;
+	}
+	if (value_out != NULL) {
+		*value_out = map->entries[slot].value;
+	}
+
+	group_control = map->control + (slot & ~(size_t) (HASH_MAP_GROUP - 1));
+	if (match_group(group_control, HASH_MAP_EMPTY) != 0) {
+		map->control[slot] = HASH_MAP_EMPTY;
+		map->growth_left++;
+	} else {
+		map->control[slot] = HASH_MAP_DELETED;
+	}
+	map->size--;
+
+	return 0;
+}
+
+int put_hash_map(struct hash_map *map, uint64_t key, void *value)
+{
+	struct hash_map_entry entry;
+
+	entry.key.integer = key;
+	entry.key_size = 0;
+	return put_key_hash_map(map, &entry, value, 0);
+}
+
+int get_hash_map(struct hash_map *map, uint64_t key, void **value_out)
+{
+	struct hash_map_entry entry;
+	size_t slot;
+
+	entry.key.integer = key;
+	slot = find_hash_map(map, &entry, hash_word(key), 0);
+	if (slot == map->capacity) {
+		return -1;
+	}
+	*value_out = map->entries[slot].value;
+	return 0;
+}
+
+int remove_hash_map(struct hash_map *map, uint64_t key, void **value_out)
+{
+	struct hash_map_entry entry;
+
+	entry.key.integer = key;
+	return remove_key_hash_map(map, &entry, value_out, 0);
+}
+
+int put_bytes_hash_map(struct hash_map *map, const void *key, size_t key_size,
+		       void *value)
+{
+	struct hash_map_entry entry;
+
+	entry.key.bytes = key;
+	entry.key_size = key_size;
+	return put_key_hash_map(map, &entry, value, 1);
+}
+
+int get_bytes_hash_map(struct hash_map *map, const void *key, size_t key_size,
+		       void **value_out)
+{
+	struct hash_map_entry entry;
+	size_t slot;
+
+	entry.key.bytes = key;
+	entry.key_size = key_size;
+	slot = find_hash_map(map, &entry, hash_bytes(key, key_size), 1);
+	if (slot == map->capacity) {
+		return -1;
+	}
+	*value_out = map->entries[slot].value;
+	return 0;
+}
+
+int remove_bytes_hash_map(struct hash_map *map, const void *key,
+			  size_t key_size, void **value_out)
+{
+	struct hash_map_entry entry;
+
+	entry.key.bytes = key;
+	entry.key_size = key_size;
+	return remove_key_hash_map(map, &entry, value_out, 1);
+}
+
+int init_run_merger_with(struct run_merger *to_init,
+			 struct heap_element **runs, size_t *sizes,
+			 size_t n_runs, struct allocator *allocator)
+{
+	size_t run_i;
+
+	to_init->runs = allocate_with(allocator,
+				      sizeof(struct merge_run) * n_runs);
+	if (to_init->runs == NULL && n_runs > 0) {
+		printlg(ERROR_LEVEL, "Could not allocate merged runs.\n");
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
+		return -1;
+	}
+	if (init_min_heap_with(&to_init->heap, n_runs, allocator)) {
+		release_with(allocator, to_init->runs);
+		return -1;
+	}
+	to_init->allocator = allocator;
+	to_init->n_runs = n_runs;
+
+	/* Only runs with elements get an entry in the heap. */
+	for (run_i = 0; run_i < n_runs; run_i++) {
+		struct merge_run *run = &to_init->runs[run_i];
+
+		run->next = runs[run_i];
+		run->remaining = sizes[run_i];
+		if (run->remaining > 0) {
+			struct heap_element head = {
+				.key = run->next->key,
+				.data = run,
+			};
+
+			if (push_min_heap(&to_init->heap, &head)) {
+				/*
+				 * Failure should not occur,
+				 * since there is a slot for every run.
+				 */
+				debug_assert(0);
+			}
+		}
+	}
+
+	return 0;
+}
+
+void teardown_run_merger(struct run_merger *to_teardown)
+{
+	teardown_min_heap(&to_teardown->heap);
+	release_with(to_teardown->allocator, to_teardown->runs);
+	to_teardown->runs = NULL;
+	to_teardown->n_runs = 0;
+}
+
+/*
+ * Take the next element of the run at the head of the merger's heap,
+ * and replace the head with the run's following element,
+ * or remove it if the run is used up.
+ * out:		the space to write the next element
+ * merger:	the source merger, whose heap must not be empty
+ */
+static inline void advance_run_merger(struct heap_element *out,
+				      struct run_merger *merger)
+{
+	struct min_heap *heap = &merger->heap;
+	struct merge_run *run = heap->elements[1].data;
+	struct heap_element head;
+
+	*out = *run->next;
+	run->next++;
+	run->remaining--;
+
+	if (run->remaining > 0) {
+		struct heap_element next_head = {
+			.key = run->next->key,
+			.data = run,
+		};
+
+		replace_min_heap(&head, heap, &next_head);
+	} else {
+		pop_min_heap(&head, heap);
+	}
+}
+
+int next_run_merger(struct heap_element *out, struct run_merger *merger)
+{
+	if (merger->heap.size == 0) {
+		return -1;
+	}
+
+	advance_run_merger(out, merger);
+	return 0;
+}
+
+size_t merge_into(struct heap_element *dest, struct run_merger *merger)
+{
+	struct min_heap *heap = &merger->heap;
+	size_t n_written = 0;
+
+	while (heap->size > 1) {
+		advance_run_merger(&dest[n_written], merger);
+		n_written++;
+	}
+
+	/* Once only one run is left, copy the rest of it all at once. */
+	if (heap->size == 1) {
+		struct merge_run *run = heap->elements[1].data;
+
+		memcpy(&dest[n_written], run->next,
+		       sizeof(struct heap_element) * run->remaining);
+		n_written += run->remaining;
+		run->next += run->remaining;
+		run->remaining = 0;
+		heap->size = 0;
+	}
+
+	return n_written;
+}
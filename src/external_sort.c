@@ -0,0 +1,478 @@
+#include <external_sort.h>
+#include <data_structs.h>
+#include <logger.h>
+#include <debug_assert.h>
+
+#include <string.h>
+#include <errno.h>
+
+/*
+ * the fraction of the memory budget used for staging sorted records
+ * before they are written out in large blocks, while sorting chunks
+ */
+#define STAGING_FRACTION	8
+
+/* a sorted run, stored in a temporary file with other runs */
+struct run {
+	/* the position in the file of the run's first record */
+	long offset;
+	/* the number of records in the run */
+	size_t n_records;
+};
+
+/* a sorted run being read back from its temporary file while merging */
+struct run_reader {
+	/* the position in the file of the next record to read */
+	long offset;
+	/* the number of records left to read from the file */
+	size_t remaining;
+	/* the records of the run read into memory */
+	unsigned char *buffer;
+	/* the number of records in "buffer" */
+	size_t n_buffered;
+	/* the position in "buffer" of the next record to merge */
+	size_t next;
+};
+
+/* state for reading records from a file buffer */
+struct file_buffer_reader {
+	/* the source of the records */
+	file_buffer_t *in;
+	/* the number of bytes in each record */
+	size_t record_size;
+};
+
+/*
+ * Write records to a file stream in a single block.
+ * out:		the destination stream
+ * records:	the records to write
+ * n_records:	the number of records to write
+ * record_size:	the number of bytes in each record
+ * returns	0 on success, -1 on failure, with errno set by "fwrite"
+ */
+static int write_records(FILE *out, const void *records, size_t n_records,
+			 size_t record_size)
+{
+	if (n_records > 0 &&
+	    fwrite(records, record_size, n_records, out) < n_records) {
+		printlg(ERROR_LEVEL, "Failed to write %u sorted records.\n",
+			(unsigned) n_records);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Sort a chunk of records in memory, and write them out in order.
+ * out:			the destination stream
+ * records:		the records to sort
+ * n_records:		the number of records
+ * record_size:		the number of bytes in each record
+ * get_key:		finds the key of each record
+ * elements:		space for twice "n_records" heap elements,
+ *			used to sort the records by key
+ * staging:		space for gathering the sorted records
+ * staging_records:	the number of records that fit in "staging"
+ * returns		0 on success, -1 on failure, with errno set by "fwrite"
+ */
+static int write_sorted_chunk(FILE *out, unsigned char *records,
+			      size_t n_records, size_t record_size,
+			      record_key_t get_key,
+			      struct heap_element *elements,
+			      unsigned char *staging, size_t staging_records)
+{
+	size_t record_i, n_staged = 0;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		unsigned char *record = records + record_i * record_size;
+
+		elements[record_i].key = get_key(record);
+		elements[record_i].data = record;
+	}
+	radix_sort_buffered(elements, elements + n_records, n_records);
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		memcpy(staging + n_staged * record_size,
+		       elements[record_i].data, record_size);
+		n_staged++;
+		if (n_staged == staging_records) {
+			if (write_records(out, staging, n_staged,
+					  record_size)) {
+				return -1;
+			}
+			n_staged = 0;
+		}
+	}
+
+	return write_records(out, staging, n_staged, record_size);
+}
+
+/*
+ * Read the next records of a run into its buffer.
+ * reader:		the run to read
+ * runs_file:		the temporary file holding the run
+ * record_size:		the number of bytes in each record
+ * buffer_records:	the number of records that fit in the buffer
+ * returns		0 on success, even if the run is used up,
+ *			-1 on failure, with errno set by "fseek" or "fread"
+ */
+static int fill_run_reader(struct run_reader *reader, FILE *runs_file,
+			   size_t record_size, size_t buffer_records)
+{
+	size_t wanted = reader->remaining < buffer_records ?
+			reader->remaining : buffer_records;
+
+	reader->next = 0;
+	reader->n_buffered = 0;
+	if (wanted == 0) {
+		return 0;
+	}
+
+	if (fseek(runs_file, reader->offset, SEEK_SET) ||
+	    fread(reader->buffer, record_size, wanted, runs_file) < wanted) {
+		printlg(ERROR_LEVEL, "Failed to read a sorted run.\n");
+		return -1;
+	}
+	reader->n_buffered = wanted;
+	reader->remaining -= wanted;
+	reader->offset += (long) (wanted * record_size);
+
+	return 0;
+}
+
+/*
+ * Merge sorted runs into a single sorted output.
+ * out:			the destination stream
+ * runs_file:		the temporary file holding the runs
+ * runs:		the runs to merge
+ * n_runs:		the number of runs
+ * record_size:		the number of bytes in each record
+ * get_key:		finds the key of each record
+ * memory:		space for "n_runs + 1" buffers,
+ *			one for each run, and one for the output
+ * buffer_records:	the number of records that fit in each buffer
+ * returns		0 on success,
+ *			-1 on failure, with errno set to ENOMEM,
+ *			   or by "fseek", "fread" or "fwrite"
+ */
+static int merge_runs(FILE *out, FILE *runs_file, const struct run *runs,
+		      size_t n_runs, size_t record_size, record_key_t get_key,
+		      unsigned char *memory, size_t buffer_records)
+{
+	size_t buffer_size = buffer_records * record_size;
+	unsigned char *staging = memory + n_runs * buffer_size;
+	struct run_reader readers[n_runs];
+	struct min_heap heap;
+	size_t run_i, n_staged = 0;
+	int failed = 0;
+
+	if (init_min_heap(&heap, n_runs)) {
+		return -1;
+	}
+
+	/* Start each run, with its first record in the heap. */
+	for (run_i = 0; run_i < n_runs && !failed; run_i++) {
+		struct run_reader *reader = &readers[run_i];
+
+		reader->offset = runs[run_i].offset;
+		reader->remaining = runs[run_i].n_records;
+		reader->buffer = memory + run_i * buffer_size;
+		if (fill_run_reader(reader, runs_file, record_size,
+				    buffer_records)) {
+			failed = 1;
+		} else if (reader->n_buffered > 0) {
+			struct heap_element head = {
+				.key = get_key(reader->buffer),
+				.data = reader,
+			};
+
+			push_min_heap(&heap, &head);
+		}
+	}
+
+	while (heap.size > 0 && !failed) {
+		struct run_reader *reader = heap.elements[1].data;
+		struct heap_element head;
+
+		memcpy(staging + n_staged * record_size,
+		       reader->buffer + reader->next * record_size,
+		       record_size);
+		n_staged++;
+		if (n_staged == buffer_records) {
+			failed = write_records(out, staging, n_staged,
+					       record_size);
+			n_staged = 0;
+		}
+
+		reader->next++;
+		if (reader->next == reader->n_buffered &&
+		    fill_run_reader(reader, runs_file, record_size,
+				    buffer_records)) {
+			failed = 1;
+		} else if (reader->next < reader->n_buffered) {
+			struct heap_element next_head = {
+				.key = get_key(reader->buffer +
+					       reader->next * record_size),
+				.data = reader,
+			};
+
+			replace_min_heap(&head, &heap, &next_head);
+		} else {
+			pop_min_heap(&head, &heap);
+		}
+	}
+
+	if (!failed) {
+		failed = write_records(out, staging, n_staged, record_size);
+	}
+
+	teardown_min_heap(&heap);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Merge sorted runs in as many passes as needed,
+ * merging as many runs at once as the memory budget allows.
+ * Each pass but the last writes its runs to a new temporary file.
+ * out:			the destination stream
+ * runs_file:		the temporary file holding the runs,
+ *			which is closed once the runs are merged
+ * runs:		the runs to merge,
+ *			which are overwritten by the runs of each pass
+ * n_runs:		the number of runs
+ * record_size:		the number of bytes in each record
+ * get_key:		finds the key of each record
+ * memory:		the memory to use for buffering records
+ * memory_budget:	the number of bytes in "memory"
+ * returns		0 on success,
+ *			-1 on failure, with errno set as in "merge_runs",
+ *			   or by "tmpfile" or "ftell"
+ */
+static int merge_all_runs(FILE *out, FILE *runs_file, struct run *runs,
+			  size_t n_runs, size_t record_size,
+			  record_key_t get_key, unsigned char *memory,
+			  size_t memory_budget)
+{
+	size_t read_size = record_size > EXTERNAL_SORT_MIN_READ ?
+			   record_size : EXTERNAL_SORT_MIN_READ;
+	size_t max_runs = memory_budget / read_size;
+	size_t buffer_records;
+	int failed = 0;
+
+	/* Keep a buffer for the output, but merge at least two runs. */
+	if (max_runs > 1) {
+		max_runs--;
+	}
+	if (max_runs < 2) {
+		max_runs = 2;
+	}
+
+	while (n_runs > max_runs && !failed) {
+		FILE *merged_file = tmpfile();
+		size_t run_i, n_merged = 0;
+
+		if (merged_file == NULL) {
+			printlg(ERROR_LEVEL, "Failed to create a run file.\n");
+			failed = 1;
+			break;
+		}
+
+		printlg(DEBUG_LEVEL, "Merging %u runs, %u at a time.\n",
+			(unsigned) n_runs, (unsigned) max_runs);
+		buffer_records = memory_budget / (max_runs + 1) / record_size;
+		for (run_i = 0; run_i < n_runs && !failed;
+		     run_i += max_runs) {
+			size_t n_group = n_runs - run_i < max_runs ?
+					 n_runs - run_i : max_runs;
+			struct run merged = {
+				.offset = ftell(merged_file),
+				.n_records = 0,
+			};
+			size_t group_i;
+
+			for (group_i = 0; group_i < n_group; group_i++) {
+				merged.n_records +=
+					runs[run_i + group_i].n_records;
+			}
+			failed = merged.offset < 0 ||
+				 merge_runs(merged_file, runs_file,
+					    &runs[run_i], n_group, record_size,
+					    get_key, memory, buffer_records);
+			runs[n_merged++] = merged;
+		}
+
+		fclose(runs_file);
+		runs_file = merged_file;
+		n_runs = n_merged;
+	}
+
+	if (!failed) {
+		buffer_records = memory_budget / (n_runs + 1) / record_size;
+		failed = merge_runs(out, runs_file, runs, n_runs, record_size,
+				    get_key, memory, buffer_records);
+	}
+
+	fclose(runs_file);
+	return failed ? -1 : 0;
+}
+
+int external_sort(FILE *out, size_t record_size, record_key_t get_key,
+		  size_t memory_budget, record_reader_t read_records,
+		  void *arg)
+{
+	size_t staging_records, chunk_records;
+	unsigned char *memory, *records, *staging;
+	struct heap_element *elements;
+	FILE *runs_file = NULL;
+	struct run *runs = NULL;
+	size_t n_runs = 0;
+	int done = 0, failed = 0;
+
+	if (record_size == 0) {
+		printlg(ERROR_LEVEL, "Records cannot be empty.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	staging_records = memory_budget / STAGING_FRACTION / record_size;
+	chunk_records = (memory_budget - staging_records * record_size) /
+			(record_size + 2 * sizeof(struct heap_element));
+	/* Both merging and sorting need room for a few records at once. */
+	if (staging_records == 0 || chunk_records < 2 ||
+	    memory_budget / 3 < record_size) {
+		printlg(ERROR_LEVEL,
+			"Memory budget %u is too small for records of %u.\n",
+			(unsigned) memory_budget, (unsigned) record_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	memory = malloc(memory_budget);
+	if (memory == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate sorting memory.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+	elements = (struct heap_element *) memory;
+	records = memory + 2 * chunk_records * sizeof(struct heap_element);
+	staging = records + chunk_records * record_size;
+
+	/* Sort each chunk that fits in memory into its own run. */
+	while (!done && !failed) {
+		size_t n_records = 0, n_read;
+		struct run *more_runs;
+
+		while (n_records < chunk_records) {
+			if (read_records(records + n_records * record_size,
+					 chunk_records - n_records, &n_read,
+					 arg)) {
+				printlg(ERROR_LEVEL,
+					"Failed to read records to sort.\n");
+				failed = 1;
+				break;
+			}
+			if (n_read == 0) {
+				done = 1;
+				break;
+			}
+			n_records += n_read;
+		}
+		if (failed || n_records == 0) {
+			break;
+		}
+
+		/* If everything fit in one chunk, skip the run file. */
+		if (done && n_runs == 0) {
+			failed = write_sorted_chunk(out, records, n_records,
+						    record_size, get_key,
+						    elements, staging,
+						    staging_records);
+			break;
+		}
+
+		if (runs_file == NULL && (runs_file = tmpfile()) == NULL) {
+			printlg(ERROR_LEVEL, "Failed to create a run file.\n");
+			failed = 1;
+			break;
+		}
+		more_runs = realloc(runs, sizeof(struct run) * (n_runs + 1));
+		if (more_runs == NULL) {
+			printlg(ERROR_LEVEL, "Could not allocate run list.\n");
+			errno = ENOMEM;
+			failed = 1;
+			break;
+		}
+		runs = more_runs;
+		runs[n_runs].offset = ftell(runs_file);
+		runs[n_runs].n_records = n_records;
+		n_runs++;
+		failed = write_sorted_chunk(runs_file, records, n_records,
+					    record_size, get_key, elements,
+					    staging, staging_records);
+	}
+
+	if (runs_file != NULL) {
+		if (failed) {
+			fclose(runs_file);
+		} else {
+			printlg(DEBUG_LEVEL, "Merging %u sorted runs.\n",
+				(unsigned) n_runs);
+			failed = merge_all_runs(out, runs_file, runs, n_runs,
+						record_size, get_key, memory,
+						memory_budget);
+		}
+	}
+
+	free(runs);
+	free(memory);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Read whole records from a file buffer,
+ * as the "read_records" argument to "external_sort".
+ * records:	the space to write the records to
+ * max_records:	the maximum number of records to write
+ * n_read:	the space to write the number of records written
+ * arg:		the "struct file_buffer_reader" to read from
+ * returns	0 on success,
+ *		-1 if the file could not be read,
+ *		   with errno set by "read_buffer_bytes",
+ *		   or if the file ended in a partial record,
+ *		   with errno set to EINVAL
+ */
+static int read_file_buffer_records(void *records, size_t max_records,
+				    size_t *n_read, void *arg)
+{
+	struct file_buffer_reader *reader = arg;
+	size_t wanted = max_records * reader->record_size;
+	size_t bytes_read = read_buffer_bytes(records, wanted, reader->in);
+
+	if (bytes_read < wanted &&
+	    (size_t) ftell_buffer(reader->in) < get_file_size(reader->in)) {
+		printlg(ERROR_LEVEL, "Failed to read records from file.\n");
+		return -1;
+	}
+	if (bytes_read % reader->record_size != 0) {
+		printlg(ERROR_LEVEL, "File ends in a partial record.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	*n_read = bytes_read / reader->record_size;
+	return 0;
+}
+
+int external_sort_file_buffer(FILE *out, file_buffer_t *in,
+			      size_t record_size, record_key_t get_key,
+			      size_t memory_budget)
+{
+	struct file_buffer_reader reader = {
+		.in = in,
+		.record_size = record_size,
+	};
+
+	return external_sort(out, record_size, get_key, memory_budget,
+			     read_file_buffer_records, &reader);
+}
@@ -5,14 +5,56 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* the page size of the system */
-#define PAGE_SIZE	getpagesize()
-int init_file_buffer(file_buffer_t *to_init, FILE *in_file)
+/*
+ * Allocate a buffer aligned to pages,
+ * or to huge pages if it is at least one, so the kernel can back it by them.
+ * buffer_size:	the number of bytes to allocate, a multiple of the page size
+ * page_size:	the page size of the system
+ * returns	the buffer, or NULL if it could not be allocated
+ */
+static unsigned char *allocate_aligned(size_t buffer_size, size_t page_size)
 {
-	unsigned char *buffer;
+	size_t alignment = buffer_size >= FILE_BUFFER_HUGE_PAGE ?
+			   FILE_BUFFER_HUGE_PAGE : page_size;
+	void *buffer;
+
+	if (posix_memalign(&buffer, alignment, buffer_size)) {
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (alignment == FILE_BUFFER_HUGE_PAGE) {
+		/* This is only a hint, so failing is harmless. */
+		madvise(buffer, buffer_size, MADV_HUGEPAGE);
+	}
+#endif /* MADV_HUGEPAGE */
+	return buffer;
+}
+
+/*
+ * Find the size of the file under a file buffer.
+ * in_file:	the file stream from which to read, or NULL
+ * fd:		the file descriptor from which to read, if "in_file" is NULL
+ * returns	the size of the file,
+ *		or -1 if it could not be found, with errno set
+ */
+static long find_file_size(FILE *in_file, int fd)
+{
+	struct stat status;
 	long file_size;
 
+	if (in_file == NULL) {
+		if (fstat(fd, &status)) {
+			printlg(ERROR_LEVEL,
+				"Failed to find the file's status.\n");
+			return -1;
+		}
+		return (long) status.st_size;
+	}
+
 	/* Find the size of the file, by finding the last location. */
 	if (fseek(in_file, 0, SEEK_END)) {
 		printlg(ERROR_LEVEL, "Failed to reach the end of the file.\n");
@@ -25,28 +67,94 @@ int init_file_buffer(file_buffer_t *to_init, FILE *in_file)
 		printlg(ERROR_LEVEL, "Failed to find the size of the file.\n");;
 		return -1;
 	}
+	return file_size;
+}
+
+/*
+ * Initialize a file buffer with a given source, buffer size and allocator.
+ * to_init:	the buffer to initialize
+ * in_file:	the file stream from which to read,
+ *		or NULL to read from "fd"
+ * fd:		the file descriptor from which to read, if "in_file" is NULL
+ * buffer_size:	the number of bytes to buffer, or 0 for a page
+ * allocator:	the allocator of the buffer,
+ *		or NULL to allocate it aligned with "posix_memalign"
+ * mapping:	the mapping of the whole file, to read instead of "fd",
+ *		in which case no buffer is allocated,
+ *		or NULL to read the file
+ * returns	0 on success, -1 on failure, as for "init_file_buffer_sized"
+ */
+static int init_file_buffer_common(file_buffer_t *to_init, FILE *in_file,
+				   int fd, size_t buffer_size,
+				   struct allocator *allocator,
+				   unsigned char *mapping)
+{
+	size_t page_size = (size_t) getpagesize();
+	unsigned char *buffer;
+	long file_size;
+
+	if (buffer_size > FILE_BUFFER_MAX_SIZE) {
+		printlg(ERROR_LEVEL,
+			"File buffer of %lu bytes is larger than %lu.\n",
+			(unsigned long) buffer_size,
+			(unsigned long) FILE_BUFFER_MAX_SIZE);
+		errno = EINVAL;
+		return -1;
+	}
+	/* Round up to whole pages, and to at least one. */
+	if (buffer_size == 0) {
+		buffer_size = page_size;
+	}
+	buffer_size = (buffer_size + page_size - 1) / page_size * page_size;
+
+	file_size = find_file_size(in_file, fd);
+	if (file_size < 0) {
+		return -1;
+	}
 
 	/* allocate buffer */
-	buffer = malloc(PAGE_SIZE);
-	if (buffer == NULL) {
+	if (mapping != NULL) {
+		buffer = NULL;
+	} else if (allocator == NULL) {
+		buffer = allocate_aligned(buffer_size, page_size);
+	} else {
+		buffer = allocate_with(allocator, buffer_size);
+	}
+	if (buffer == NULL && mapping == NULL) {
 		printlg(ERROR_LEVEL, "Failed to allocate file buffer.\n");
-		errno = ENOMEM;
+		if (allocator == NULL) {
+			errno = ENOMEM;
+		}
 		return -1;
 	}
 
 	/* Finalize field values. */
 	to_init->in_file = in_file;
+	to_init->fd = in_file == NULL ? fd : -1;
 	to_init->file_size = (size_t) file_size;
+	to_init->mapping = mapping;
 
 	to_init->buffer = buffer;
+	to_init->buffer_size = buffer_size;
 	to_init->buffered = 0;
+	to_init->allocator = allocator;
 
 	to_init->virtual_position = 0;
 	to_init->real_position = 0;
 
+	to_init->blocks = NULL;
+	to_init->n_blocks = 0;
+	to_init->block_size = 0;
+
+	to_init->read_ahead_max = 0;
+	to_init->read_ahead_depth = 0;
+	to_init->sequential_end = 0;
+	to_init->read_ahead_end = 0;
+
 	printlg(DEBUG_LEVEL, "File's size is %u.\n",
 		(unsigned) to_init->file_size);
-	printlg(DEBUG_LEVEL, "File's buffer is at %p.\n", to_init->buffer);
+	printlg(DEBUG_LEVEL, "File's buffer is at %p, with %u bytes.\n",
+		to_init->buffer, (unsigned) to_init->buffer_size);
 	printlg(DEBUG_LEVEL, "File's buffer status is %d.\n",
 		to_init->buffered);
 	printlg(DEBUG_LEVEL, "File's virtual pointer is %u.\n",
@@ -57,6 +165,41 @@ int init_file_buffer(file_buffer_t *to_init, FILE *in_file)
 	return 0;
 }
 
+int init_file_buffer(file_buffer_t *to_init, FILE *in_file)
+{
+	return init_file_buffer_common(to_init, in_file, -1, 0, NULL, NULL);
+}
+
+int init_file_buffer_with(file_buffer_t *to_init, FILE *in_file,
+			  struct allocator *allocator)
+{
+	return init_file_buffer_common(to_init, in_file, -1, 0, allocator,
+				       NULL);
+}
+
+int init_file_buffer_sized(file_buffer_t *to_init, FILE *in_file,
+			   size_t buffer_bytes)
+{
+	if (buffer_bytes == 0) {
+		printlg(ERROR_LEVEL, "File buffer cannot be empty.\n");
+		errno = EINVAL;
+		return -1;
+	}
+	return init_file_buffer_common(to_init, in_file, -1, buffer_bytes,
+				       NULL, NULL);
+}
+
+int init_file_buffer_fd(file_buffer_t *to_init, int fd, size_t buffer_bytes)
+{
+	if (buffer_bytes == 0) {
+		printlg(ERROR_LEVEL, "File buffer cannot be empty.\n");
+		errno = EINVAL;
+		return -1;
+	}
+	return init_file_buffer_common(to_init, NULL, fd, buffer_bytes, NULL,
+				       NULL);
+}
+
 int open_file_buffer(file_buffer_t *to_open, const char *path)
 {
 	FILE *in_file = fopen(path, "r");
@@ -75,9 +218,127 @@ int open_file_buffer(file_buffer_t *to_open, const char *path)
 	return 0;
 }
 
+int open_file_buffer_fd(file_buffer_t *to_open, const char *path,
+			size_t buffer_bytes)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		printlg(ERROR_LEVEL, "Failed to open file, %s, for buffer.\n",
+			path);
+		return -1;
+	}
+
+	if (init_file_buffer_fd(to_open, fd, buffer_bytes)) {
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Initialize a file buffer that reads straight from a mapping of its file.
+ * to_init:	the buffer to initialize
+ * fd:		the file descriptor of the file to map
+ * returns	0 on success,
+ *		-1 if the file is not a regular file, or is empty,
+ *		   in which case "errno" will be set to EINVAL,
+ *		   or it could not be mapped,
+ *		   in which case "fstat" or "mmap" sets "errno"
+ */
+static int init_file_buffer_mapped(file_buffer_t *to_init, int fd)
+{
+	struct stat status;
+	size_t file_size;
+	void *mapping;
+
+	if (fstat(fd, &status)) {
+		return -1;
+	}
+	if (!S_ISREG(status.st_mode) || status.st_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	file_size = (size_t) status.st_size;
+
+	mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		return -1;
+	}
+#ifdef MADV_SEQUENTIAL
+	/* This is only a hint, so failing is harmless. */
+	madvise(mapping, file_size, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+
+	if (init_file_buffer_common(to_init, NULL, fd, 0, NULL, mapping)) {
+		munmap(mapping, file_size);
+		return -1;
+	}
+	return 0;
+}
+
+int open_file_buffer_mapped(file_buffer_t *to_open, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	FILE *in_file;
+
+	if (fd < 0) {
+		printlg(ERROR_LEVEL, "Failed to open file, %s, for buffer.\n",
+			path);
+		return -1;
+	}
+
+	if (init_file_buffer_mapped(to_open, fd) == 0) {
+		return 0;
+	}
+
+	/* Fall back to reading the file through a file stream. */
+	printlg(DEBUG_LEVEL, "Could not map file, %s, so reading it.\n",
+		path);
+	in_file = fdopen(fd, "r");
+	if (in_file == NULL) {
+		printlg(ERROR_LEVEL, "Failed to open stream for %s.\n", path);
+		close(fd);
+		return -1;
+	}
+	if (init_file_buffer(to_open, in_file)) {
+		fclose(in_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Deallocate the shared block cache of a buffer, if it has one.
+ * buffer:	the buffer whose cache to deallocate
+ */
+static void destroy_block_cache(file_buffer_t *buffer)
+{
+	size_t block_i;
+
+	if (buffer->blocks == NULL) {
+		return;
+	}
+	for (block_i = 0; block_i < buffer->n_blocks; block_i++) {
+		pthread_rwlock_destroy(&buffer->blocks[block_i].lock);
+	}
+	/* The first block's data holds the data of all of them. */
+	free(buffer->blocks[0].data);
+	free(buffer->blocks);
+	buffer->blocks = NULL;
+	buffer->n_blocks = 0;
+}
+
 void destroy_file_buffer(file_buffer_t *to_destroy)
 {
-	free(to_destroy->buffer);
+	destroy_block_cache(to_destroy);
+	if (to_destroy->mapping != NULL) {
+		munmap(to_destroy->mapping, to_destroy->file_size);
+		to_destroy->mapping = NULL;
+	}
+	release_with(to_destroy->allocator, to_destroy->buffer);
 	to_destroy->buffer = NULL;
 	to_destroy->buffered = 0;
 
@@ -88,8 +349,13 @@ void destroy_file_buffer(file_buffer_t *to_destroy)
 void close_file_buffer(file_buffer_t *to_close)
 {
 	destroy_file_buffer(to_close);
-	fclose(to_close->in_file);
-	to_close->in_file = NULL;
+	if (to_close->in_file == NULL) {
+		close(to_close->fd);
+		to_close->fd = -1;
+	} else {
+		fclose(to_close->in_file);
+		to_close->in_file = NULL;
+	}
 }
 
 int fseek_buffer(file_buffer_t *buffer, long offset, int whence)
@@ -124,11 +390,14 @@ int fseek_buffer(file_buffer_t *buffer, long offset, int whence)
 
 	/*
 	 * If the new location is outside of the buffered range,
+	 * or nothing is buffered, as is always so for a mapped file,
 	 * move the real cursor.
 	 */
-	if ((dest > buffer->real_position) ||
-	    (dest < buffer->real_position - PAGE_SIZE)) {
-		if (fseek(buffer->in_file, dest, SEEK_SET)) {
+	if (!buffer->buffered || (dest > buffer->real_position) ||
+	    (dest < buffer->real_position - (long) buffer->buffer_size)) {
+		/* A file descriptor is read at offsets, so it has no cursor. */
+		if (buffer->in_file != NULL &&
+		    fseek(buffer->in_file, dest, SEEK_SET)) {
 			printlg(ERROR_LEVEL,
 				"Unable to move file position to cursor.\n");
 			return -1;
@@ -147,8 +416,11 @@ void rewind_buffer(file_buffer_t *buffer)
 	buffer->virtual_position = 0;
 
 	/* Really rewind only if we can't keep the buffered data. */
-	if (buffer->real_position > PAGE_SIZE || !buffer->buffered) {
-		rewind(buffer->in_file);
+	if ((size_t) buffer->real_position > buffer->buffer_size ||
+	    !buffer->buffered) {
+		if (buffer->in_file != NULL) {
+			rewind(buffer->in_file);
+		}
 		buffer->buffered = 0;
 
 		buffer->real_position = 0;
@@ -160,6 +432,191 @@ long ftell_buffer(file_buffer_t *buffer)
 	return buffer->virtual_position;
 }
 
+/*
+ * Find the file descriptor to read at offsets, for either kind of buffer.
+ * buffer:	the buffer whose file to read
+ * returns	the descriptor of the buffer, or of its file stream
+ */
+static inline int positional_fd(file_buffer_t *buffer)
+{
+	return buffer->in_file == NULL ? buffer->fd : fileno(buffer->in_file);
+}
+
+/*
+ * Read bytes at an offset of a file descriptor, with "pread",
+ * retrying until all are read.
+ * fd:		the file descriptor to read
+ * dest:	the memory to read into
+ * size:	the number of bytes to read
+ * offset:	the position in the file of the first byte
+ * returns	the number of bytes read, fewer than "size" only
+ *		at the end of the file or on error, which sets "errno"
+ */
+static size_t pread_all(int fd, void *dest, size_t size, long offset)
+{
+	size_t bytes_read = 0;
+
+	while (bytes_read < size) {
+		ssize_t result = pread(fd, (unsigned char *) dest + bytes_read,
+				       size - bytes_read,
+				       (off_t) offset + bytes_read);
+
+		if (result > 0) {
+			bytes_read += result;
+		} else if (result == 0) {
+			/* The file was shorter than it was when opened. */
+			errno = EIO;
+			break;
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+	return bytes_read;
+}
+
+/*
+ * Ask the kernel to start reading part of the file in the background,
+ * with "madvise" if the file is mapped, and "posix_fadvise" otherwise.
+ * These are only hints, so failing is harmless.
+ * buffer:	the buffer whose file to read
+ * start:	the position in the file of the first byte to read
+ * end:		the position after the last byte to read
+ */
+static void advise_will_need(file_buffer_t *buffer, long start, long end)
+{
+	if (buffer->mapping != NULL) {
+#ifdef MADV_WILLNEED
+		/* A mapping is advised from the start of a page. */
+		long page_start = start - start % getpagesize();
+
+		madvise(buffer->mapping + page_start,
+			(size_t) (end - page_start), MADV_WILLNEED);
+#endif /* MADV_WILLNEED */
+		return;
+	}
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(positional_fd(buffer), (off_t) start,
+		      (off_t) (end - start), POSIX_FADV_WILLNEED);
+#endif /* POSIX_FADV_WILLNEED */
+}
+
+/*
+ * Before a read from the file, ask the kernel to start reading ahead of it,
+ * if reading ahead is on and the reads have been sequential.
+ * The number of buffers read ahead doubles with each sequential read,
+ * up to the maximum, and drops to 0 with any other read.
+ * buffer:	the buffer whose file will be read
+ * offset:	the position in the file of the read
+ * size:	the number of bytes that will be read
+ */
+static void advise_read_ahead(file_buffer_t *buffer, long offset,
+			      size_t size)
+{
+	long read_end = offset + (long) size;
+	long ahead_end;
+
+	if (buffer->read_ahead_max == 0 || size == 0) {
+		return;
+	}
+
+	if (offset == buffer->sequential_end) {
+		buffer->read_ahead_depth = buffer->read_ahead_depth == 0 ? 1 :
+					   buffer->read_ahead_depth * 2;
+		if (buffer->read_ahead_depth > buffer->read_ahead_max) {
+			buffer->read_ahead_depth = buffer->read_ahead_max;
+		}
+	} else {
+		buffer->read_ahead_depth = 0;
+		buffer->read_ahead_end = read_end;
+	}
+	buffer->sequential_end = read_end;
+
+	/* Only ask for what was not asked for before, within the file. */
+	ahead_end = read_end +
+		    (long) (buffer->read_ahead_depth * buffer->buffer_size);
+	if (ahead_end > (long) buffer->file_size) {
+		ahead_end = (long) buffer->file_size;
+	}
+	if (buffer->read_ahead_end < read_end) {
+		buffer->read_ahead_end = read_end;
+	}
+	if (ahead_end > buffer->read_ahead_end) {
+		printlg(DEBUG_LEVEL, "Reading ahead from %ld to %ld.\n",
+			buffer->read_ahead_end, ahead_end);
+		advise_will_need(buffer, buffer->read_ahead_end, ahead_end);
+		buffer->read_ahead_end = ahead_end;
+	}
+}
+
+/*
+ * Read bytes from the file into memory,
+ * with "fread" from the file stream, which is already at the offset,
+ * or with "pread" from the file descriptor.
+ * buffer:	the buffer whose file to read
+ * dest:	the memory to read into
+ * size:	the number of bytes to read
+ * offset:	the position in the file of the first byte
+ * returns	the number of bytes read, fewer than "size" only
+ *		at the end of the file or on error, which sets "errno"
+ */
+static size_t read_file(file_buffer_t *buffer, void *dest, size_t size,
+			long offset)
+{
+	advise_read_ahead(buffer, offset, size);
+	if (buffer->in_file != NULL) {
+		return fread(dest, 1, size, buffer->in_file);
+	}
+	return pread_all(buffer->fd, dest, size, offset);
+}
+
+/*
+ * Before bytes are read from a mapped file,
+ * move the real cursor past them in whole buffers,
+ * as if the buffer were refilled, so that reading ahead works the same.
+ * buffer:	the mapped buffer
+ * size:	the number of bytes about to be read from the virtual cursor,
+ *		which are all in the file
+ */
+static void pass_mapped_bytes(file_buffer_t *buffer, size_t size)
+{
+	long read_end = buffer->virtual_position + (long) size;
+	size_t buffer_size = buffer->buffer_size;
+	size_t passed, file_left;
+
+	/* Nothing is buffered, so the real cursor is never behind. */
+	debug_assert(buffer->virtual_position <= buffer->real_position);
+	if (read_end <= buffer->real_position) {
+		return;
+	}
+
+	passed = (read_end - buffer->real_position + buffer_size - 1) /
+		 buffer_size * buffer_size;
+	file_left = buffer->file_size - buffer->real_position;
+	advise_read_ahead(buffer, buffer->real_position,
+			  passed < file_left ? passed : file_left);
+	buffer->real_position += passed;
+}
+
+/*
+ * Read bytes straight from the mapping of a mapped file.
+ * ptr:		the destination pointer
+ * size:	the number of bytes to read
+ * buffer:	the source buffer
+ * returns	number of bytes read, fewer than "size" only at the end
+ */
+static size_t read_mapped(void *ptr, size_t size, file_buffer_t *buffer)
+{
+	size_t file_left = buffer->file_size - buffer->virtual_position;
+
+	if (size > file_left) {
+		size = file_left;
+	}
+	pass_mapped_bytes(buffer, size);
+	memcpy(ptr, buffer->mapping + buffer->virtual_position, size);
+	buffer->virtual_position += size;
+	return size;
+}
+
 /*
  * Read bytes that are known to be unallocated,
  * and do not extend past the end of the file.
@@ -174,53 +631,57 @@ static size_t read_new(void *ptr, size_t size, file_buffer_t *buffer)
 	reached_end = (buffer->virtual_position + size) == buffer->file_size;
 	size_t real_size = reached_end ?
 			   buffer->file_size - buffer->virtual_position : size;
-	size_t n_full_pages = real_size / PAGE_SIZE;
-	size_t remainder_bytes = real_size % PAGE_SIZE;
-	size_t pages_read, bytes_read;
+	size_t buffer_size = buffer->buffer_size;
+	size_t n_full_buffers = real_size / buffer_size;
+	size_t remainder_bytes = real_size % buffer_size;
+	size_t bytes_read;
 
 	debug_assert(buffer->virtual_position + size <= buffer->file_size);
 
-	/* Read the full pages that need to be in the output. */
-	pages_read = fread(ptr, PAGE_SIZE, n_full_pages, buffer->in_file);
-	bytes_read = pages_read * PAGE_SIZE;
+	/*
+	 * Read the full buffers' worth that need to be in the output
+	 * straight into it, with one call.
+	 */
+	bytes_read = read_file(buffer, ptr, n_full_buffers * buffer_size,
+			       buffer->real_position);
 	buffer->virtual_position += bytes_read;
 	buffer->real_position += bytes_read;
 
-	if (pages_read < n_full_pages) {
+	if (bytes_read < n_full_buffers * buffer_size) {
 		printlg(ERROR_LEVEL,
-			"Failed to read desired number of full pages.\n");
+			"Failed to read desired number of full buffers.\n");
 		return bytes_read;
 	}
 
 	/*
-	 * If there are more bytes, read up to a page or the rest of the file
-	 * into the buffer,
+	 * If there are more bytes, fill the buffer
+	 * up to its size or the rest of the file,
 	 * and copy only the needed part into the output.
-	 * But always record that the real pointer advanced by a full page,
-	 * to keep the start of the buffer a page before the real pointer.
+	 * But always record that the real pointer advanced by a full buffer,
+	 * to keep the start of the buffer its size before the real pointer.
 	 */
 	if (remainder_bytes > 0) {
 		size_t
 		dist_from_end = buffer->file_size - buffer->real_position;
-		size_t rest_to_read = dist_from_end < (size_t) PAGE_SIZE ?
-				      dist_from_end : (size_t) PAGE_SIZE;
+		size_t rest_to_read = dist_from_end < buffer_size ?
+				      dist_from_end : buffer_size;
 
 		printlg(DEBUG_LEVEL, "Want to read %u remaining bytes.\n",
 			(unsigned) rest_to_read);
-		if (fread(buffer->buffer, rest_to_read, 1,
-			  buffer->in_file) == 0) {
+		if (read_file(buffer, buffer->buffer, rest_to_read,
+			      buffer->real_position) < rest_to_read) {
 			printlg(ERROR_LEVEL,
 				"Failed to read last part of desired bytes.\n");
 		} else {
 			memcpy(ptr + bytes_read, buffer->buffer,
 			       remainder_bytes);
 
-			debug_assert(remainder_bytes < (size_t) PAGE_SIZE);
+			debug_assert(remainder_bytes < buffer_size);
 
 			buffer->buffered = 1;
 
 			buffer->virtual_position += remainder_bytes;
-			buffer->real_position += PAGE_SIZE;
+			buffer->real_position += buffer_size;
 			bytes_read += remainder_bytes;
 			debug_assert(bytes_read == real_size);
 		}
@@ -239,6 +700,10 @@ size_t read_buffer_bytes(void *ptr, size_t size, file_buffer_t *buffer)
 			    0;
 	size_t bytes_read;
 
+	if (buffer->mapping != NULL) {
+		return read_mapped(ptr, size, buffer);
+	}
+
 	printlg(DEBUG_LEVEL, "Wanted to read %u bytes starting from %u.\n",
 		(unsigned) size, (unsigned) buffer->virtual_position);
 	printlg(DEBUG_LEVEL,
@@ -246,8 +711,8 @@ size_t read_buffer_bytes(void *ptr, size_t size, file_buffer_t *buffer)
 		(unsigned) real_size, (unsigned) buffer->file_size);
 
 	if (bytes_left > 0) {
-		unsigned char *
-		buffer_start = buffer->buffer + PAGE_SIZE - bytes_left;
+		unsigned char *buffer_start = buffer->buffer +
+					      buffer->buffer_size - bytes_left;
 
 		if (bytes_left >= real_size) {
 			memcpy(ptr, buffer_start, real_size);
@@ -274,8 +739,302 @@ int fgetc_buffer(file_buffer_t *buffer)
 {
 	unsigned char byte;
 
+	/* Bytes of a mapping that were already passed need no more work. */
+	if (buffer->mapping != NULL &&
+	    buffer->virtual_position < buffer->real_position &&
+	    (size_t) buffer->virtual_position < buffer->file_size) {
+		return buffer->mapping[buffer->virtual_position++];
+	}
+
 	if (read_buffer_bytes(&byte, 1, buffer) == 0) {
 		return EOF;
 	}
 	return (int) byte;
 }
+
+/*
+ * Move the buffered bytes after the virtual cursor to the start of the buffer,
+ * and fill the rest of it from the file,
+ * up to its size or the end of the file.
+ * Afterwards, the buffer starts at the virtual cursor,
+ * and the real cursor is the buffer's size after it, as usual.
+ * buffer:	the buffer to fill
+ * returns	0 on success,
+ *		-1 if the file could not be read, in which case "errno" is set,
+ *		   and nothing is buffered
+ */
+static int fill_buffer(file_buffer_t *buffer)
+{
+	size_t file_end = buffer->file_size;
+	size_t kept = 0;
+	size_t to_read, bytes_read;
+
+	if (buffer->buffered) {
+		size_t buffered_end = (size_t) buffer->real_position;
+
+		if (buffered_end > file_end) {
+			buffered_end = file_end;
+		}
+
+		kept = buffered_end - buffer->virtual_position;
+		memmove(buffer->buffer, buffer->buffer + buffer->buffer_size -
+			(buffer->real_position - buffer->virtual_position),
+			kept);
+	}
+	/* Without buffered data, the real cursor is at the virtual one. */
+	debug_assert(buffer->buffered ||
+		     buffer->real_position == buffer->virtual_position);
+
+	to_read = file_end - buffer->virtual_position - kept;
+	if (to_read > buffer->buffer_size - kept) {
+		to_read = buffer->buffer_size - kept;
+	}
+	bytes_read = read_file(buffer, buffer->buffer + kept, to_read,
+			       buffer->virtual_position + kept);
+
+	if (bytes_read < to_read) {
+		printlg(ERROR_LEVEL, "Failed to fill the buffer.\n");
+		if (buffer->in_file != NULL && !ferror(buffer->in_file)) {
+			errno = EIO;
+		}
+		/* Put the real cursor back at the virtual one. */
+		buffer->buffered = 0;
+		fseek_buffer(buffer, buffer->virtual_position, SEEK_SET);
+		return -1;
+	}
+
+	/* As in "read_new", the real cursor always moves a full buffer on. */
+	buffer->buffered = 1;
+	buffer->real_position = buffer->virtual_position + buffer->buffer_size;
+	return 0;
+}
+
+const unsigned char *peek_buffer(file_buffer_t *buffer, size_t min_len,
+				 size_t *len)
+{
+	size_t file_left = buffer->file_size - buffer->virtual_position;
+	size_t bytes_left;
+
+	if (min_len > buffer->buffer_size) {
+		printlg(ERROR_LEVEL,
+			"Cannot look at %u bytes, more than the buffer.\n",
+			(unsigned) min_len);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (min_len == 0) {
+		min_len = 1;
+	}
+	if (min_len > file_left) {
+		min_len = file_left;
+	}
+
+	/* The rest of a mapped file is all in place already. */
+	if (buffer->mapping != NULL) {
+		pass_mapped_bytes(buffer, min_len);
+		*len = file_left;
+		return buffer->mapping + buffer->virtual_position;
+	}
+
+	bytes_left = buffer->buffered ?
+		     buffer->real_position - buffer->virtual_position : 0;
+	if (bytes_left > file_left) {
+		bytes_left = file_left;
+	}
+	if (bytes_left < min_len) {
+		if (fill_buffer(buffer)) {
+			return NULL;
+		}
+		bytes_left = file_left < buffer->buffer_size ?
+			     file_left : buffer->buffer_size;
+	}
+
+	*len = bytes_left;
+	return buffer->buffer + buffer->buffer_size -
+	       (buffer->real_position - buffer->virtual_position);
+}
+
+int consume_buffer(file_buffer_t *buffer, size_t n)
+{
+	if (n > buffer->file_size - buffer->virtual_position) {
+		printlg(ERROR_LEVEL, "Cannot consume %u bytes past the end.\n",
+			(unsigned) n);
+		errno = ERANGE;
+		return -1;
+	}
+
+	return fseek_buffer(buffer, (long) n, SEEK_CUR);
+}
+
+int init_block_cache(file_buffer_t *buffer, size_t n_blocks,
+		     size_t block_bytes)
+{
+	size_t page_size = (size_t) getpagesize();
+	struct file_block *blocks;
+	unsigned char *data;
+	size_t block_i;
+
+	/* Round up to whole pages, unless it is too large to. */
+	if (block_bytes <= FILE_BUFFER_MAX_SIZE) {
+		block_bytes = (block_bytes + page_size - 1) / page_size *
+			      page_size;
+	}
+	if (buffer->blocks != NULL || n_blocks == 0 || block_bytes == 0 ||
+	    block_bytes > FILE_BUFFER_MAX_SIZE ||
+	    n_blocks > FILE_BUFFER_MAX_SIZE / block_bytes) {
+		printlg(ERROR_LEVEL,
+			"Cannot make a cache of %u blocks of %u bytes.\n",
+			(unsigned) n_blocks, (unsigned) block_bytes);
+		errno = EINVAL;
+		return -1;
+	}
+
+	blocks = malloc(sizeof(struct file_block) * n_blocks);
+	data = allocate_aligned(block_bytes * n_blocks, page_size);
+	if (blocks == NULL || data == NULL) {
+		printlg(ERROR_LEVEL, "Failed to allocate block cache.\n");
+		free(blocks);
+		free(data);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (block_i = 0; block_i < n_blocks; block_i++) {
+		int error = pthread_rwlock_init(&blocks[block_i].lock, NULL);
+
+		if (error) {
+			printlg(ERROR_LEVEL, "Could not make block lock.\n");
+			while (block_i > 0) {
+				pthread_rwlock_destroy(&blocks[--block_i].lock);
+			}
+			free(blocks);
+			free(data);
+			errno = error;
+			return -1;
+		}
+		blocks[block_i].offset = -1;
+		blocks[block_i].size = 0;
+		blocks[block_i].data = data + block_bytes * block_i;
+	}
+
+	buffer->blocks = blocks;
+	buffer->n_blocks = n_blocks;
+	buffer->block_size = block_bytes;
+	return 0;
+}
+
+/*
+ * Copy bytes from the one cached block that holds the first of them,
+ * reading the block into the cache if it is not there.
+ * buffer:	the buffer with the cache
+ * offset:	the position in the file of the first byte
+ * ptr:		the output space
+ * size:	the number of bytes wanted, which are all in the file
+ * returns	the number of bytes copied, up to the end of the block,
+ *		or 0 if the block could not be read, with "errno" set
+ */
+static size_t read_cached_block(file_buffer_t *buffer, long offset,
+				unsigned char *ptr, size_t size)
+{
+	size_t block_index = (size_t) offset / buffer->block_size;
+	long block_start = (long) (block_index * buffer->block_size);
+	size_t in_block = offset - block_start;
+	struct file_block *block = &buffer->blocks[block_index %
+						   buffer->n_blocks];
+
+	/* Usually the block is there, and readers share it. */
+	pthread_rwlock_rdlock(&block->lock);
+	if (block->offset != block_start) {
+		size_t block_size = buffer->file_size - block_start;
+
+		/* Take the block to read into it, unless another thread did. */
+		pthread_rwlock_unlock(&block->lock);
+		pthread_rwlock_wrlock(&block->lock);
+		if (block_size > buffer->block_size) {
+			block_size = buffer->block_size;
+		}
+		if (block->offset != block_start) {
+			block->size = pread_all(positional_fd(buffer),
+						block->data, block_size,
+						block_start);
+			block->offset = block->size == block_size ?
+					block_start : -1;
+		}
+		if (block->offset != block_start) {
+			pthread_rwlock_unlock(&block->lock);
+			printlg(ERROR_LEVEL, "Failed to read block at %ld.\n",
+				block_start);
+			return 0;
+		}
+	}
+
+	if (size > block->size - in_block) {
+		size = block->size - in_block;
+	}
+	memcpy(ptr, block->data + in_block, size);
+	pthread_rwlock_unlock(&block->lock);
+
+	return size;
+}
+
+size_t read_buffer_at(file_buffer_t *buffer, long offset, void *ptr,
+		      size_t size)
+{
+	size_t bytes_read = 0;
+
+	if (offset < 0 || (size_t) offset > buffer->file_size) {
+		printlg(ERROR_LEVEL, "Invalid read position, %ld.\n", offset);
+		errno = ERANGE;
+		return 0;
+	}
+	if (size > buffer->file_size - offset) {
+		size = buffer->file_size - offset;
+	}
+
+	/* A mapping is only read, so threads can copy from it at once. */
+	if (buffer->mapping != NULL) {
+		memcpy(ptr, buffer->mapping + offset, size);
+		return size;
+	}
+
+	/* Reads of whole blocks gain nothing from the cache. */
+	if (buffer->blocks == NULL || size >= buffer->block_size) {
+		return pread_all(positional_fd(buffer), ptr, size, offset);
+	}
+
+	while (bytes_read < size) {
+		size_t block_read = read_cached_block(buffer,
+						      offset + bytes_read,
+						      (unsigned char *) ptr +
+						      bytes_read,
+						      size - bytes_read);
+
+		if (block_read == 0) {
+			break;
+		}
+		bytes_read += block_read;
+	}
+	return bytes_read;
+}
+
+int set_read_ahead(file_buffer_t *buffer, size_t max_buffers)
+{
+	if (max_buffers > FILE_BUFFER_MAX_READ_AHEAD / buffer->buffer_size) {
+		printlg(ERROR_LEVEL,
+			"Cannot read %u buffers of %u bytes ahead.\n",
+			(unsigned) max_buffers,
+			(unsigned) buffer->buffer_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	buffer->read_ahead_max = max_buffers;
+	buffer->read_ahead_depth = 0;
+	/* The next read from the file continues at the real cursor. */
+	buffer->sequential_end = buffer->real_position;
+	if (buffer->sequential_end > (long) buffer->file_size) {
+		buffer->sequential_end = (long) buffer->file_size;
+	}
+	buffer->read_ahead_end = buffer->sequential_end;
+	return 0;
+}
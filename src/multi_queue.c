@@ -0,0 +1,244 @@
+#include <multi_queue.h>
+
+#include <logger.h>
+#include <get_random.h>
+
+#include <errno.h>
+
+/*
+ * the state of each thread's pseudo-random generator,
+ * or 0 if it has not been seeded yet
+ */
+static _Thread_local uint64_t random_state;
+
+/*
+ * Pick a random heap, with a per-thread xorshift generator,
+ * which is seeded from the system on its first use in each thread.
+ * n_heaps:	the number of heaps to pick from
+ * returns	the index of the heap
+ */
+static size_t random_heap(size_t n_heaps)
+{
+	uint64_t state = random_state;
+
+	if (state == 0) {
+		if (get_random(&state, sizeof(state)) == 0 || state == 0) {
+			/* Fall back to something that differs by thread. */
+			state = (uintptr_t) &random_state | 1;
+		}
+	}
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	random_state = state;
+
+	/* Scale the top half to the range, instead of dividing. */
+	return (size_t) (((state * 0x2545f4914f6cdd1dULL) >> 32) *
+			 (uint64_t) n_heaps >> 32);
+}
+
+/*
+ * Try to take the lock of a heap, without waiting.
+ * heap:	the heap to lock
+ * returns	nonzero iff the lock was taken
+ */
+static inline int try_lock_heap(struct multi_queue_heap *heap)
+{
+	return !atomic_flag_test_and_set_explicit(&heap->lock,
+						  memory_order_acquire);
+}
+
+/*
+ * Take the lock of a heap, waiting for it if needed.
+ * heap:	the heap to lock
+ */
+static inline void lock_heap(struct multi_queue_heap *heap)
+{
+	while (!try_lock_heap(heap)) {
+	}
+}
+
+/*
+ * Release the lock of a heap.
+ * heap:	the heap to unlock
+ */
+static inline void unlock_heap(struct multi_queue_heap *heap)
+{
+	atomic_flag_clear_explicit(&heap->lock, memory_order_release);
+}
+
+/*
+ * Update the head key of a locked heap, after it changed.
+ * heap:	the heap whose first element may have changed
+ */
+static inline void update_head_key(struct multi_queue_heap *heap)
+{
+	struct heap_element head;
+	int64_t key = MULTI_QUEUE_EMPTY;
+
+	if (!peek_min_heap(&head, &heap->heap)) {
+		key = head.key;
+	}
+	atomic_store_explicit(&heap->head_key, key, memory_order_relaxed);
+}
+
+int init_multi_queue(struct multi_queue *to_init, unsigned n_threads,
+		     size_t capacity)
+{
+	size_t n_heaps = (size_t) n_threads * MULTI_QUEUE_HEAPS_PER_THREAD;
+	size_t heap_capacity;
+	void *allocated;
+	size_t heap_i;
+
+	if (n_threads == 0) {
+		printlg(ERROR_LEVEL,
+			"Multi-queue needs at least one thread.\n");
+		errno = EINVAL;
+		return -1;
+	}
+	heap_capacity = (capacity + n_heaps - 1) / n_heaps;
+
+	if (posix_memalign(&allocated, MULTI_QUEUE_ALIGNMENT,
+			   sizeof(struct multi_queue_heap) * n_heaps)) {
+		printlg(ERROR_LEVEL, "Could not allocate multi-queue heaps.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+	to_init->heaps = allocated;
+
+	for (heap_i = 0; heap_i < n_heaps; heap_i++) {
+		struct multi_queue_heap *heap = &to_init->heaps[heap_i];
+
+		if (init_min_heap(&heap->heap, heap_capacity)) {
+			while (heap_i-- > 0) {
+				teardown_min_heap(&to_init->heaps[heap_i].heap);
+			}
+			free(to_init->heaps);
+			to_init->heaps = NULL;
+			return -1;
+		}
+		atomic_flag_clear(&heap->lock);
+		atomic_init(&heap->head_key, MULTI_QUEUE_EMPTY);
+	}
+	to_init->n_heaps = n_heaps;
+
+	return 0;
+}
+
+void teardown_multi_queue(struct multi_queue *to_teardown)
+{
+	size_t heap_i;
+
+	for (heap_i = 0; heap_i < to_teardown->n_heaps; heap_i++) {
+		teardown_min_heap(&to_teardown->heaps[heap_i].heap);
+	}
+	free(to_teardown->heaps);
+	to_teardown->heaps = NULL;
+	to_teardown->n_heaps = 0;
+}
+
+int push_multi_queue(struct multi_queue *queue, struct heap_element *to_push)
+{
+	size_t n_heaps = queue->n_heaps;
+	struct multi_queue_heap *heap;
+	size_t first, heap_i;
+
+	/* Pick random heaps until one is free. */
+	do {
+		first = random_heap(n_heaps);
+		heap = &queue->heaps[first];
+	} while (!try_lock_heap(heap));
+
+	/* If it is full, wait for each other heap until one has space. */
+	heap_i = first;
+	while (heap->heap.size >= heap->heap.capacity) {
+		unlock_heap(heap);
+		heap_i = heap_i + 1 < n_heaps ? heap_i + 1 : 0;
+		if (heap_i == first) {
+			printlg(ERROR_LEVEL,
+				"Multi-queue is already full, "
+				"at capacity %u.\n",
+				(unsigned) (heap->heap.capacity * n_heaps));
+			errno = ERANGE;
+			return -1;
+		}
+		heap = &queue->heaps[heap_i];
+		lock_heap(heap);
+	}
+
+	push_min_heap(&heap->heap, to_push);
+	if (to_push->key < atomic_load_explicit(&heap->head_key,
+						memory_order_relaxed)) {
+		atomic_store_explicit(&heap->head_key, to_push->key,
+				      memory_order_relaxed);
+	}
+	unlock_heap(heap);
+
+	return 0;
+}
+
+/*
+ * Check whether every heap of a queue is empty, without taking any locks.
+ * queue:	the queue to check
+ * returns	nonzero iff no heap had an element when it was checked
+ */
+static int multi_queue_empty(struct multi_queue *queue)
+{
+	size_t heap_i;
+
+	for (heap_i = 0; heap_i < queue->n_heaps; heap_i++) {
+		if (atomic_load_explicit(&queue->heaps[heap_i].head_key,
+					 memory_order_relaxed) !=
+		    MULTI_QUEUE_EMPTY) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pop_multi_queue(struct heap_element *head_out, struct multi_queue *queue)
+{
+	size_t n_heaps = queue->n_heaps;
+	/* the number of picks in a row that found both heaps empty */
+	size_t n_misses = 0;
+
+	for (;;) {
+		struct multi_queue_heap *heap, *other;
+		int64_t key, other_key;
+
+		heap = &queue->heaps[random_heap(n_heaps)];
+		other = &queue->heaps[random_heap(n_heaps)];
+		key = atomic_load_explicit(&heap->head_key,
+					   memory_order_relaxed);
+		other_key = atomic_load_explicit(&other->head_key,
+						 memory_order_relaxed);
+		if (other_key < key) {
+			heap = other;
+			key = other_key;
+		}
+		if (key == MULTI_QUEUE_EMPTY) {
+			/*
+			 * After as many misses as there are heaps,
+			 * look at every heap before picking more.
+			 */
+			if (++n_misses >= n_heaps) {
+				if (multi_queue_empty(queue)) {
+					return -1;
+				}
+				n_misses = 0;
+			}
+			continue;
+		}
+		if (!try_lock_heap(heap)) {
+			continue;
+		}
+
+		/* Another thread may have emptied it since it was read. */
+		if (!pop_min_heap(head_out, &heap->heap)) {
+			update_head_key(heap);
+			unlock_heap(heap);
+			return 0;
+		}
+		unlock_heap(heap);
+	}
+}
@@ -0,0 +1,263 @@
+#include <parallel_sort.h>
+
+#include <logger.h>
+#include <debug_assert.h>
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * a piece of work given to a single thread:
+ * either sorting a chunk, or writing part of the merge of two runs
+ */
+struct sort_task {
+	/* the first sorted run, or the chunk to sort */
+	struct heap_element *run_a;
+	/* the number of elements in "run_a" */
+	size_t size_a;
+	/* the second sorted run, or NULL if sorting a chunk */
+	struct heap_element *run_b;
+	/* the number of elements in "run_b" */
+	size_t size_b;
+
+	/*
+	 * the merged output of both runs,
+	 * or the scratch space for sorting the chunk
+	 */
+	struct heap_element *output;
+	/* the range of output positions this task writes, when merging */
+	size_t output_start, output_end;
+};
+
+/*
+ * Find how many elements of the first run come before
+ * a given position in the merge of two runs.
+ * Ties are broken in favor of the first run.
+ * run_a:	the first sorted run
+ * size_a:	the number of elements in "run_a"
+ * run_b:	the second sorted run
+ * size_b:	the number of elements in "run_b"
+ * position:	the position in the merged output
+ * returns	the number of elements taken from "run_a"
+ *		in the first "position" elements of the merge
+ */
+static size_t co_rank(struct heap_element *run_a, size_t size_a,
+		      struct heap_element *run_b, size_t size_b,
+		      size_t position)
+{
+	size_t low = position > size_b ? position - size_b : 0;
+	size_t high = position < size_a ? position : size_a;
+
+	/* Find the first count of "run_a" that is not too small. */
+	while (low < high) {
+		size_t from_a = low + (high - low) / 2;
+		size_t from_b = position - from_a;
+
+		/*
+		 * If the next element of "run_a" is not after
+		 * the last element taken from "run_b", take more from "run_a".
+		 */
+		if (from_b > 0 &&
+		    run_a[from_a].key <= run_b[from_b - 1].key) {
+			low = from_a + 1;
+		} else {
+			high = from_a;
+		}
+	}
+
+	return low;
+}
+
+/*
+ * Merge part of two sorted runs, as described by a task.
+ * task:	the "struct sort_task" holding both runs,
+ *		and the range of output positions to fill
+ */
+static void merge_part(struct sort_task *task)
+{
+	struct heap_element *run_a = task->run_a, *run_b = task->run_b;
+	size_t i_a = co_rank(run_a, task->size_a, run_b, task->size_b,
+			     task->output_start);
+	size_t i_b = task->output_start - i_a;
+	size_t output_i;
+
+	for (output_i = task->output_start; output_i < task->output_end;
+	     output_i++) {
+		if (i_b >= task->size_b ||
+		    (i_a < task->size_a &&
+		     run_a[i_a].key <= run_b[i_b].key)) {
+			task->output[output_i] = run_a[i_a++];
+		} else {
+			task->output[output_i] = run_b[i_b++];
+		}
+	}
+}
+
+/*
+ * Thread entry point for running a single task.
+ * arg:		the "struct sort_task" to run
+ * returns	NULL
+ */
+static void *run_task(void *arg)
+{
+	struct sort_task *task = arg;
+
+	if (task->run_b == NULL) {
+		radix_sort_buffered(task->run_a, task->output, task->size_a);
+	} else {
+		merge_part(task);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run every task at the same time,
+ * with one new thread for each task but the first,
+ * which the calling thread runs itself.
+ * If a thread cannot be started, its task is run by the calling thread.
+ * tasks:	the tasks to run
+ * n_tasks:	the number of tasks
+ */
+static void run_tasks(struct sort_task *tasks, size_t n_tasks)
+{
+	pthread_t threads[n_tasks];
+	int started[n_tasks];
+	size_t task_i;
+
+	for (task_i = 1; task_i < n_tasks; task_i++) {
+		started[task_i] = !pthread_create(&threads[task_i], NULL,
+						  run_task, &tasks[task_i]);
+		if (!started[task_i]) {
+			printlg(WARNING_LEVEL,
+				"Could not start sorting thread %u.\n",
+				(unsigned) task_i);
+		}
+	}
+
+	if (n_tasks > 0) {
+		run_task(&tasks[0]);
+	}
+
+	for (task_i = 1; task_i < n_tasks; task_i++) {
+		if (started[task_i]) {
+			pthread_join(threads[task_i], NULL);
+		} else {
+			run_task(&tasks[task_i]);
+		}
+	}
+}
+
+/*
+ * Sort chunks of an array in parallel, then merge them in parallel.
+ * array:	the array to sort
+ * scratch:	space for "size" elements, used for sorting and merging
+ * size:	the number of elements in the array
+ * n_runs:	the number of chunks, and so the number of threads,
+ *		which must be at least 2
+ */
+static void sort_runs(struct heap_element *array, struct heap_element *scratch,
+		      size_t size, size_t n_runs)
+{
+	size_t n_threads = n_runs;
+	size_t run_bounds[n_runs + 1];
+	/* Each pair of runs can need a task more than its share of threads. */
+	struct sort_task tasks[n_runs * 2];
+	struct heap_element *source, *dest, *temp;
+	size_t run_i;
+
+	debug_assert(n_runs >= 2);
+
+	/* Sort each chunk, using the same part of the scratch space. */
+	for (run_i = 0; run_i <= n_runs; run_i++) {
+		run_bounds[run_i] = size / n_runs * run_i +
+				    (run_i < size % n_runs ? run_i :
+				     size % n_runs);
+	}
+	debug_assert(run_bounds[n_runs] == size);
+	for (run_i = 0; run_i < n_runs; run_i++) {
+		tasks[run_i].run_a = array + run_bounds[run_i];
+		tasks[run_i].size_a = run_bounds[run_i + 1] -
+				      run_bounds[run_i];
+		tasks[run_i].run_b = NULL;
+		tasks[run_i].output = scratch + run_bounds[run_i];
+	}
+	run_tasks(tasks, n_runs);
+
+	/*
+	 * Merge pairs of runs until one is left,
+	 * splitting each merge evenly between the threads.
+	 */
+	source = array;
+	dest = scratch;
+	while (n_runs > 1) {
+		size_t n_pairs = (n_runs + 1) / 2;
+		size_t parts_per_pair = (n_threads + n_pairs - 1) / n_pairs;
+		size_t n_tasks = 0;
+		size_t pair_i, part_i;
+
+		for (pair_i = 0; pair_i < n_pairs; pair_i++) {
+			size_t start = run_bounds[pair_i * 2];
+			size_t middle = run_bounds[pair_i * 2 + 1];
+			/* An odd run out is merged with an empty run. */
+			size_t end = pair_i * 2 + 2 <= n_runs ?
+				     run_bounds[pair_i * 2 + 2] : middle;
+			size_t merged_size = end - start;
+
+			for (part_i = 0; part_i < parts_per_pair; part_i++) {
+				struct sort_task *task = &tasks[n_tasks++];
+
+				task->run_a = source + start;
+				task->size_a = middle - start;
+				task->run_b = source + middle;
+				task->size_b = end - middle;
+				task->output = dest + start;
+				task->output_start = merged_size * part_i /
+						     parts_per_pair;
+				task->output_end = merged_size * (part_i + 1) /
+						   parts_per_pair;
+			}
+
+			run_bounds[pair_i] = start;
+		}
+		run_bounds[n_pairs] = size;
+		run_tasks(tasks, n_tasks);
+
+		n_runs = n_pairs;
+		temp = source;
+		source = dest;
+		dest = temp;
+	}
+
+	if (source != array) {
+		memcpy(array, source, sizeof(struct heap_element) * size);
+	}
+}
+
+int parallel_sort(struct heap_element *array, size_t size, unsigned n_threads)
+{
+	size_t n_runs = n_threads;
+	struct heap_element *scratch;
+
+	if (n_runs > size / PARALLEL_SORT_MIN_CHUNK) {
+		n_runs = size / PARALLEL_SORT_MIN_CHUNK;
+	}
+	if (n_runs <= 1) {
+		return radix_sort(array, size);
+	}
+
+	scratch = malloc(sizeof(struct heap_element) * size);
+	if (scratch == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate sorting buffer.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	printlg(DEBUG_LEVEL, "Sorting %u elements with %u threads.\n",
+		(unsigned) size, (unsigned) n_runs);
+	sort_runs(array, scratch, size, n_runs);
+
+	free(scratch);
+	return 0;
+}
@@ -0,0 +1,251 @@
+#include <ring_buffer.h>
+
+#include <logger.h>
+
+#include <inttypes.h>
+#include <errno.h>
+
+/*
+ * Find the mask of the power of 2 that a capacity is rounded up to.
+ * capacity:	the requested capacity
+ * item_size:	the number of bytes for each item
+ * mask_out:	the space to write one less than the rounded capacity
+ * returns	0 if successful
+ *		-1 if the capacity is 0, or too large to allocate,
+ *		   with errno set to EINVAL
+ */
+static int find_mask(size_t capacity, size_t item_size, size_t *mask_out)
+{
+	size_t size = 1;
+
+	if (capacity == 0 || capacity > SIZE_MAX / 2 / item_size) {
+		printlg(ERROR_LEVEL, "Invalid queue capacity %lu.\n",
+			(unsigned long) capacity);
+		errno = EINVAL;
+		return -1;
+	}
+	while (size < capacity) {
+		size <<= 1;
+	}
+	*mask_out = size - 1;
+
+	return 0;
+}
+
+int init_spsc_ring(struct spsc_ring *to_init, size_t capacity)
+{
+	if (find_mask(capacity, sizeof(void *), &to_init->mask)) {
+		return -1;
+	}
+	to_init->slots = malloc(sizeof(void *) * (to_init->mask + 1));
+	if (to_init->slots == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate ring buffer slots.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	atomic_init(&to_init->head, 0);
+	atomic_init(&to_init->tail, 0);
+	to_init->tail_cache = 0;
+	to_init->head_cache = 0;
+
+	return 0;
+}
+
+void teardown_spsc_ring(struct spsc_ring *to_teardown)
+{
+	free(to_teardown->slots);
+	to_teardown->slots = NULL;
+	to_teardown->mask = 0;
+}
+
+size_t push_spsc_ring(struct spsc_ring *ring, void *const *items,
+		      size_t n_items)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t capacity = ring->mask + 1;
+	size_t n_free = capacity - (tail - ring->head_cache);
+	size_t item_i;
+
+	/* Only look at the consumer's position if the copy is too old. */
+	if (n_free < n_items) {
+		ring->head_cache = atomic_load_explicit(&ring->head,
+							memory_order_acquire);
+		n_free = capacity - (tail - ring->head_cache);
+		if (n_items > n_free) {
+			n_items = n_free;
+		}
+	}
+
+	for (item_i = 0; item_i < n_items; item_i++) {
+		ring->slots[(tail + item_i) & ring->mask] = items[item_i];
+	}
+	atomic_store_explicit(&ring->tail, tail + n_items,
+			      memory_order_release);
+
+	return n_items;
+}
+
+size_t pop_spsc_ring(void **items_out, struct spsc_ring *ring,
+		     size_t max_items)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t n_ready = ring->tail_cache - head;
+	size_t item_i;
+
+	/* Only look at the producer's position if the copy is too old. */
+	if (n_ready < max_items) {
+		ring->tail_cache = atomic_load_explicit(&ring->tail,
+							memory_order_acquire);
+		n_ready = ring->tail_cache - head;
+	}
+	if (max_items > n_ready) {
+		max_items = n_ready;
+	}
+
+	for (item_i = 0; item_i < max_items; item_i++) {
+		items_out[item_i] = ring->slots[(head + item_i) & ring->mask];
+	}
+	atomic_store_explicit(&ring->head, head + max_items,
+			      memory_order_release);
+
+	return max_items;
+}
+
+int init_mpmc_queue(struct mpmc_queue *to_init, size_t capacity)
+{
+	size_t cell_i;
+
+	/*
+	 * With a single cell, a full cell would look free
+	 * to the writer of the next position.
+	 */
+	if (capacity == 1) {
+		capacity = 2;
+	}
+	if (find_mask(capacity, sizeof(struct mpmc_cell), &to_init->mask)) {
+		return -1;
+	}
+	to_init->cells = malloc(sizeof(struct mpmc_cell) *
+				(to_init->mask + 1));
+	if (to_init->cells == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate queue cells.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (cell_i = 0; cell_i <= to_init->mask; cell_i++) {
+		atomic_init(&to_init->cells[cell_i].sequence, cell_i);
+	}
+	atomic_init(&to_init->tail, 0);
+	atomic_init(&to_init->head, 0);
+
+	return 0;
+}
+
+void teardown_mpmc_queue(struct mpmc_queue *to_teardown)
+{
+	free(to_teardown->cells);
+	to_teardown->cells = NULL;
+	to_teardown->mask = 0;
+}
+
+/*
+ * Claim consecutive positions of a queue whose cells are ready,
+ * for either writing or reading.
+ * The cell of a position is ready when its sequence number
+ * is the position plus an offset.
+ * queue:	the queue whose positions to claim
+ * counter:	the queue's next position to write, or to read
+ * offset:	0 when writing, or 1 when reading
+ * max_claim:	the most positions to claim
+ * first_out:	the space to write the first claimed position
+ * returns	the number of positions claimed,
+ *		which is 0 if the next position is not ready
+ */
+static size_t claim_positions(struct mpmc_queue *queue,
+			      atomic_size_t *counter, size_t offset,
+			      size_t max_claim, size_t *first_out)
+{
+	size_t position = atomic_load_explicit(counter, memory_order_relaxed);
+
+	for (;;) {
+		size_t n_ready;
+
+		/* Count the ready cells, up to the first that is not. */
+		for (n_ready = 0; n_ready < max_claim; n_ready++) {
+			size_t ready = position + n_ready + offset;
+			struct mpmc_cell *cell =
+				&queue->cells[(position + n_ready) &
+					      queue->mask];
+
+			if (atomic_load_explicit(&cell->sequence,
+						 memory_order_acquire) !=
+			    ready) {
+				break;
+			}
+		}
+
+		if (n_ready == 0) {
+			size_t current = atomic_load_explicit(
+				counter, memory_order_relaxed);
+
+			/* If nobody moved on, the queue is full or empty. */
+			if (current == position) {
+				return 0;
+			}
+			position = current;
+			continue;
+		}
+
+		/* On failure, "position" is updated to the current one. */
+		if (atomic_compare_exchange_weak_explicit(
+			    counter, &position, position + n_ready,
+			    memory_order_relaxed, memory_order_relaxed)) {
+			*first_out = position;
+			return n_ready;
+		}
+	}
+}
+
+size_t push_mpmc_queue(struct mpmc_queue *queue, void *const *items,
+		       size_t n_items)
+{
+	size_t position = 0;
+	size_t n_claimed = claim_positions(queue, &queue->tail, 0, n_items,
+					   &position);
+	size_t item_i;
+
+	for (item_i = 0; item_i < n_claimed; item_i++) {
+		struct mpmc_cell *cell =
+			&queue->cells[(position + item_i) & queue->mask];
+
+		cell->data = items[item_i];
+		atomic_store_explicit(&cell->sequence, position + item_i + 1,
+				      memory_order_release);
+	}
+
+	return n_claimed;
+}
+
+size_t pop_mpmc_queue(void **items_out, struct mpmc_queue *queue,
+		      size_t max_items)
+{
+	size_t position = 0;
+	size_t n_claimed = claim_positions(queue, &queue->head, 1, max_items,
+					   &position);
+	size_t item_i;
+
+	for (item_i = 0; item_i < n_claimed; item_i++) {
+		struct mpmc_cell *cell =
+			&queue->cells[(position + item_i) & queue->mask];
+
+		items_out[item_i] = cell->data;
+		/* Free the cell for the writer of the next lap. */
+		atomic_store_explicit(&cell->sequence,
+				      position + item_i + queue->mask + 1,
+				      memory_order_release);
+	}
+
+	return n_claimed;
+}
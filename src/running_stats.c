@@ -0,0 +1,283 @@
+#include <running_stats.h>
+
+#include <logger.h>
+#include <debug_assert.h>
+
+#include <string.h>
+#include <errno.h>
+
+int init_running_median(struct running_median *to_init, size_t window_size)
+{
+	if (window_size == 0) {
+		printlg(ERROR_LEVEL, "A median needs a window of samples.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	to_init->window = malloc(sizeof(struct median_sample) * window_size);
+	if (to_init->window == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate median window.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+	if (init_indexed_min_heap(&to_init->lower, window_size)) {
+		free(to_init->window);
+		return -1;
+	}
+	if (init_indexed_min_heap(&to_init->upper, window_size)) {
+		teardown_indexed_min_heap(&to_init->lower);
+		free(to_init->window);
+		return -1;
+	}
+
+	to_init->window_size = window_size;
+	to_init->n_samples = 0;
+	to_init->oldest = 0;
+
+	return 0;
+}
+
+void teardown_running_median(struct running_median *to_teardown)
+{
+	teardown_indexed_min_heap(&to_teardown->lower);
+	teardown_indexed_min_heap(&to_teardown->upper);
+	free(to_teardown->window);
+	to_teardown->window = NULL;
+	to_teardown->window_size = 0;
+	to_teardown->n_samples = 0;
+}
+
+/*
+ * Move the first sample of one half to the other half,
+ * inverting its key, since only the lower half stores keys inverted.
+ * from:	the half to take the sample from, which must not be empty
+ * to:		the half to put the sample in
+ */
+static void move_median_sample(struct indexed_min_heap *from,
+			       struct indexed_min_heap *to)
+{
+	struct heap_element moved;
+	struct median_sample *sample;
+
+	pop_indexed_min_heap(&moved, NULL, from);
+	sample = moved.data;
+	moved.key = ~moved.key;
+	push_indexed_min_heap(to, &moved, &sample->handle);
+	sample->in_upper = !sample->in_upper;
+}
+
+/*
+ * Move a sample between the halves, if needed,
+ * so that the lower half has as many samples as the upper half, or one more.
+ * This is enough after adding or removing a single sample.
+ * median:	the running median to balance
+ */
+static void balance_running_median(struct running_median *median)
+{
+	if (median->lower.size > median->upper.size + 1) {
+		move_median_sample(&median->lower, &median->upper);
+	} else if (median->upper.size > median->lower.size) {
+		move_median_sample(&median->upper, &median->lower);
+	}
+
+	debug_assert(median->lower.size + median->upper.size ==
+		     median->n_samples);
+	debug_assert(median->lower.size == median->upper.size ||
+		     median->lower.size == median->upper.size + 1);
+}
+
+void push_running_median(struct running_median *median, int key)
+{
+	struct median_sample *sample;
+	struct heap_element to_push;
+
+	if (median->n_samples == median->window_size) {
+		expire_running_median(median);
+	}
+
+	sample = &median->window[(median->oldest + median->n_samples) %
+				 median->window_size];
+	median->n_samples++;
+	to_push.data = sample;
+
+	/* Samples no larger than the lower median go in the lower half. */
+	if (median->lower.size == 0 ||
+	    key <= ~median->lower.elements[1].key) {
+		to_push.key = ~key;
+		sample->in_upper = 0;
+		push_indexed_min_heap(&median->lower, &to_push,
+				      &sample->handle);
+	} else {
+		to_push.key = key;
+		sample->in_upper = 1;
+		push_indexed_min_heap(&median->upper, &to_push,
+				      &sample->handle);
+	}
+
+	balance_running_median(median);
+}
+
+int expire_running_median(struct running_median *median)
+{
+	struct median_sample *sample;
+
+	if (median->n_samples == 0) {
+		return -1;
+	}
+
+	sample = &median->window[median->oldest];
+	remove_indexed_min_heap(NULL, sample->in_upper ? &median->upper :
+				&median->lower, sample->handle);
+	median->oldest = (median->oldest + 1) % median->window_size;
+	median->n_samples--;
+
+	balance_running_median(median);
+	return 0;
+}
+
+int init_quantile_sketch(struct quantile_sketch *to_init)
+{
+	to_init->counts = calloc(QUANTILE_SKETCH_BUCKETS * 2,
+				 sizeof(uint64_t));
+	if (to_init->counts == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate sketch buckets.\n");
+		errno = ENOMEM;
+		return -1;
+	}
+	to_init->total = 0;
+
+	return 0;
+}
+
+void teardown_quantile_sketch(struct quantile_sketch *to_teardown)
+{
+	free(to_teardown->counts);
+	to_teardown->counts = NULL;
+	to_teardown->total = 0;
+}
+
+/*
+ * Find the bucket of a magnitude, among the buckets of one sign.
+ * Magnitudes below "2^QUANTILE_SKETCH_BITS" each get their own bucket,
+ * and larger ones share buckets by their leading bits.
+ * magnitude:	the magnitude to find the bucket of
+ * returns	the bucket's index, from 0 to "QUANTILE_SKETCH_BUCKETS - 1"
+ */
+static inline size_t magnitude_bucket(unsigned magnitude)
+{
+	unsigned shift;
+
+	if (magnitude < (1U << QUANTILE_SKETCH_BITS)) {
+		return magnitude;
+	}
+
+	/* Keep the leading bit, and the "QUANTILE_SKETCH_BITS" after it. */
+	shift = 31 - __builtin_clz(magnitude) - QUANTILE_SKETCH_BITS;
+	return ((size_t) shift << QUANTILE_SKETCH_BITS) +
+	       (magnitude >> shift);
+}
+
+/*
+ * Find the magnitude in the middle of a bucket,
+ * as the estimate of every magnitude in it.
+ * bucket:	the index of the bucket, among the buckets of one sign
+ * returns	the middle magnitude of the bucket
+ */
+static inline unsigned bucket_magnitude(size_t bucket)
+{
+	unsigned shift;
+
+	if (bucket < (1U << QUANTILE_SKETCH_BITS)) {
+		return (unsigned) bucket;
+	}
+
+	shift = (unsigned) (bucket >> QUANTILE_SKETCH_BITS) - 1;
+	return ((unsigned) (bucket - ((size_t) shift << QUANTILE_SKETCH_BITS))
+		<< shift) + ((1U << shift) >> 1);
+}
+
+/*
+ * Find the position of a sample's bucket in the counts of a sketch,
+ * so that the buckets of smaller samples come first.
+ * Negative samples are bucketed by their inverse, "~key",
+ * which is never negative.
+ * key:		the sample
+ * returns	the position in the "counts" field
+ */
+static inline size_t sketch_position(int key)
+{
+	if (key < 0) {
+		return QUANTILE_SKETCH_BUCKETS - 1 -
+		       magnitude_bucket((unsigned) ~key);
+	}
+	return QUANTILE_SKETCH_BUCKETS + magnitude_bucket((unsigned) key);
+}
+
+void add_quantile_sketch(struct quantile_sketch *sketch, int key)
+{
+	sketch->counts[sketch_position(key)]++;
+	sketch->total++;
+}
+
+int remove_quantile_sketch(struct quantile_sketch *sketch, int key)
+{
+	size_t position = sketch_position(key);
+
+	if (sketch->counts[position] == 0) {
+		printlg(ERROR_LEVEL, "Sample %d was never counted.\n", key);
+		errno = EINVAL;
+		return -1;
+	}
+
+	sketch->counts[position]--;
+	sketch->total--;
+	return 0;
+}
+
+void merge_quantile_sketch(struct quantile_sketch *dest,
+			   const struct quantile_sketch *source)
+{
+	size_t position;
+
+	for (position = 0; position < QUANTILE_SKETCH_BUCKETS * 2;
+	     position++) {
+		dest->counts[position] += source->counts[position];
+	}
+	dest->total += source->total;
+}
+
+int query_quantile_sketch(struct quantile_sketch *sketch, double quantile,
+			  int *key_out)
+{
+	double exact_rank = quantile * (double) sketch->total;
+	uint64_t rank, counted = 0;
+	size_t position;
+
+	if (sketch->total == 0 || !(quantile >= 0 && quantile <= 1)) {
+		printlg(ERROR_LEVEL, "Cannot find quantile %f of %u samples.\n",
+			quantile, (unsigned) sketch->total);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Take the first sample with at least the quantile at or below it. */
+	rank = (uint64_t) exact_rank;
+	if ((double) rank < exact_rank || rank == 0) {
+		rank++;
+	}
+
+	for (position = 0; counted + sketch->counts[position] < rank;
+	     position++) {
+		counted += sketch->counts[position];
+	}
+	debug_assert(position < QUANTILE_SKETCH_BUCKETS * 2);
+
+	if (position < QUANTILE_SKETCH_BUCKETS) {
+		*key_out = ~(int) bucket_magnitude(QUANTILE_SKETCH_BUCKETS - 1 -
+						   position);
+	} else {
+		*key_out = (int) bucket_magnitude(position -
+						  QUANTILE_SKETCH_BUCKETS);
+	}
+	return 0;
+}
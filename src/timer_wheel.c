@@ -0,0 +1,277 @@
+#include <timer_wheel.h>
+
+#include <logger.h>
+#include <debug_assert.h>
+
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+/* the mask for finding a slot from the bits of a deadline */
+#define TIMER_WHEEL_MASK	((uint64_t) TIMER_WHEEL_SLOTS - 1)
+
+int init_timer_wheel(struct timer_wheel *to_init, uint64_t now,
+		     size_t far_capacity)
+{
+	if (init_indexed_min_heap(&to_init->far_timers, far_capacity)) {
+		return -1;
+	}
+
+	memset(to_init->slots, 0, sizeof(to_init->slots));
+	to_init->now = now;
+	to_init->n_in_wheel = 0;
+	to_init->far_base = now >> TIMER_WHEEL_SPAN_BITS;
+
+	return 0;
+}
+
+void teardown_timer_wheel(struct timer_wheel *to_teardown)
+{
+	teardown_indexed_min_heap(&to_teardown->far_timers);
+	to_teardown->n_in_wheel = 0;
+}
+
+/*
+ * Add a timer to the front of a slot's list.
+ * slot:	the slot
+ * timer:	the timer to add
+ */
+static inline void link_timer(struct wheel_timer **slot,
+			      struct wheel_timer *timer)
+{
+	timer->next = *slot;
+	if (*slot != NULL) {
+		(*slot)->prev_next = &timer->next;
+	}
+	*slot = timer;
+	timer->prev_next = slot;
+}
+
+/*
+ * Remove a timer from its slot's list.
+ * timer:	the timer to remove
+ */
+static inline void unlink_timer(struct wheel_timer *timer)
+{
+	*timer->prev_next = timer->next;
+	if (timer->next != NULL) {
+		timer->next->prev_next = timer->prev_next;
+	}
+}
+
+/*
+ * Move the base of the far timers' keys up to the current tick,
+ * once it falls far enough behind that new keys might not fit in an int.
+ * Lowering every key by the same amount keeps the heap in order.
+ * wheel:	the wheel whose far timers to rebase
+ */
+static void rebase_far_timers(struct timer_wheel *wheel)
+{
+	struct indexed_min_heap *far_timers = &wheel->far_timers;
+	uint64_t shift = (wheel->now >> TIMER_WHEEL_SPAN_BITS) -
+			 wheel->far_base;
+	size_t element_i;
+
+	if (shift <= INT_MAX / 2) {
+		return;
+	}
+	for (element_i = 1; element_i <= far_timers->size; element_i++) {
+		struct heap_element *far = &far_timers->elements[element_i];
+
+		/* Far timers leave the heap as soon as their span starts. */
+		debug_assert((uint64_t) far->key > shift);
+		far->key = (int) ((uint64_t) far->key - shift);
+	}
+	wheel->far_base += shift;
+}
+
+/*
+ * Put a timer in the lowest level whose slots reach its deadline,
+ * or in the heap if even the highest level does not.
+ * wheel:	the destination wheel
+ * timer:	the timer, whose deadline must not have passed
+ * returns	0 on success and
+ *		-1 if the heap was full, with errno set to ERANGE
+ */
+static int place_timer(struct timer_wheel *wheel, struct wheel_timer *timer)
+{
+	uint64_t delta = timer->deadline - wheel->now;
+	unsigned level = 0;
+
+	debug_assert(timer->deadline >= wheel->now);
+
+	if (delta >> TIMER_WHEEL_SPAN_BITS) {
+		struct heap_element far;
+
+		rebase_far_timers(wheel);
+		far.key = (int) ((timer->deadline >> TIMER_WHEEL_SPAN_BITS) -
+				 wheel->far_base);
+		far.data = timer;
+		if (push_indexed_min_heap(&wheel->far_timers, &far,
+					  &timer->heap_handle)) {
+			return -1;
+		}
+		timer->state = TIMER_IN_HEAP;
+		return 0;
+	}
+
+	while (delta >> (TIMER_WHEEL_BITS * (level + 1))) {
+		level++;
+	}
+	link_timer(&wheel->slots[level][(timer->deadline >>
+					 (TIMER_WHEEL_BITS * level)) &
+					TIMER_WHEEL_MASK], timer);
+	timer->state = TIMER_IN_WHEEL;
+	wheel->n_in_wheel++;
+	return 0;
+}
+
+int add_timer_wheel(struct timer_wheel *wheel, struct wheel_timer *timer,
+		    uint64_t deadline)
+{
+	if (deadline > wheel->now &&
+	    deadline - wheel->now > TIMER_WHEEL_MAX_DELAY) {
+		printlg(ERROR_LEVEL, "Deadline %" PRIu64 " is too far from "
+			"tick %" PRIu64 ".\n", deadline, wheel->now);
+		errno = EINVAL;
+		return -1;
+	}
+	if (timer->state != TIMER_IDLE) {
+		cancel_timer_wheel(wheel, timer);
+	}
+
+	/* The current tick was already handled. */
+	timer->deadline = deadline > wheel->now ? deadline : wheel->now + 1;
+	return place_timer(wheel, timer);
+}
+
+int cancel_timer_wheel(struct timer_wheel *wheel, struct wheel_timer *timer)
+{
+	switch (timer->state) {
+	case TIMER_IN_WHEEL:
+		unlink_timer(timer);
+		wheel->n_in_wheel--;
+		break;
+	case TIMER_IN_HEAP:
+		remove_indexed_min_heap(NULL, &wheel->far_timers,
+					timer->heap_handle);
+		break;
+	default:
+		return -1;
+	}
+
+	timer->state = TIMER_IDLE;
+	return 0;
+}
+
+/*
+ * Move every timer of a slot to the slots of lower levels,
+ * now that their deadlines are close enough.
+ * wheel:	the wheel to rearrange
+ * slot:	the slot to empty
+ */
+static void cascade_slot(struct timer_wheel *wheel, struct wheel_timer **slot)
+{
+	struct wheel_timer *timer = *slot;
+
+	*slot = NULL;
+	while (timer != NULL) {
+		struct wheel_timer *next = timer->next;
+
+		wheel->n_in_wheel--;
+		place_timer(wheel, timer);
+		timer = next;
+	}
+}
+
+/*
+ * Move the wheel forward a single tick.
+ * wheel:	the wheel to advance
+ * expire:	called with the timers that expire on the new tick, if any
+ * arg:		the argument to pass to "expire"
+ * returns	the number of timers that expired
+ */
+static size_t tick_timer_wheel(struct timer_wheel *wheel,
+			       timer_expiry_t expire, void *arg)
+{
+	uint64_t now = ++wheel->now;
+	struct wheel_timer **slot = &wheel->slots[0][now & TIMER_WHEEL_MASK];
+	struct wheel_timer *expired, *timer;
+	size_t n_expired = 0;
+	unsigned level;
+
+	/*
+	 * Each time a level goes around,
+	 * spread the next slot of the level above over the levels below.
+	 */
+	for (level = 1; level < TIMER_WHEEL_LEVELS &&
+	     (now & (((uint64_t) 1 << (TIMER_WHEEL_BITS * level)) - 1)) == 0;
+	     level++) {
+		cascade_slot(wheel, &wheel->slots[level][(now >>
+			     (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]);
+	}
+
+	/* Once the whole wheel goes around, take the timers now in reach. */
+	if (level == TIMER_WHEEL_LEVELS &&
+	    (now & (((uint64_t) 1 << TIMER_WHEEL_SPAN_BITS) - 1)) == 0) {
+		struct indexed_min_heap *far_timers = &wheel->far_timers;
+
+		while (far_timers->size > 0 &&
+		       (uint64_t) far_timers->elements[1].key <=
+		       (now >> TIMER_WHEEL_SPAN_BITS) - wheel->far_base) {
+			struct heap_element far;
+
+			pop_indexed_min_heap(&far, NULL, far_timers);
+			place_timer(wheel, far.data);
+		}
+	}
+
+	expired = *slot;
+	*slot = NULL;
+	for (timer = expired; timer != NULL; timer = timer->next) {
+		debug_assert(timer->deadline == now);
+		timer->state = TIMER_IDLE;
+		n_expired++;
+	}
+	wheel->n_in_wheel -= n_expired;
+
+	if (expired != NULL) {
+		expire(expired, arg);
+	}
+	return n_expired;
+}
+
+size_t advance_timer_wheel(struct timer_wheel *wheel, uint64_t now,
+			   timer_expiry_t expire, void *arg)
+{
+	struct indexed_min_heap *far_timers = &wheel->far_timers;
+	size_t n_expired = 0;
+
+	while (wheel->now < now) {
+		/*
+		 * With nothing in the wheel, skip to just before
+		 * the far timers start coming into reach.
+		 */
+		if (wheel->n_in_wheel == 0) {
+			uint64_t next_reach;
+
+			if (far_timers->size == 0) {
+				wheel->now = now;
+				break;
+			}
+			next_reach = ((uint64_t) far_timers->elements[1].key +
+				      wheel->far_base) << TIMER_WHEEL_SPAN_BITS;
+			if (next_reach > now) {
+				wheel->now = now;
+				break;
+			}
+			if (next_reach - 1 > wheel->now) {
+				wheel->now = next_reach - 1;
+			}
+		}
+
+		n_expired += tick_timer_wheel(wheel, expire, arg);
+	}
+
+	return n_expired;
+}
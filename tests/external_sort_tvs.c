@@ -0,0 +1,61 @@
+#include "external_sort_tvs.h"
+
+/* corner case test for no records at all */
+static struct external_sort_tv no_records = {
+	.n_records = 0,
+	.record_size = 16,
+	.memory_budget = 0x1000,
+};
+
+/* test for records that all fit in memory, without any runs */
+static struct external_sort_tv in_memory = {
+	.n_records = 100,
+	.record_size = 16,
+	.memory_budget = 0x10000,
+};
+
+/* test for a budget small enough that runs are merged two at a time */
+static struct external_sort_tv tiny_budget = {
+	.n_records = 5000,
+	.record_size = 16,
+	.memory_budget = 0x400,
+};
+
+/* test for many repeated keys across runs */
+static struct external_sort_tv repeated_keys = {
+	.n_records = 3000,
+	.record_size = 24,
+	.memory_budget = 0x800,
+	.key_range = 8,
+};
+
+/* test for records much larger than the keys */
+static struct external_sort_tv large_records = {
+	.n_records = 500,
+	.record_size = 1000,
+	.memory_budget = 0x2000,
+};
+
+/* test for all runs merged in a single pass */
+static struct external_sort_tv single_pass = {
+	.n_records = 100000,
+	.record_size = 16,
+	.memory_budget = 0x100000,
+};
+
+/* test for several merge passes, each merging several runs */
+static struct external_sort_tv multiple_passes = {
+	.n_records = 200000,
+	.record_size = 16,
+	.memory_budget = 0x50000,
+};
+
+struct external_sort_tv *external_sort_tvs[N_EXTERNAL_SORT_TVS] = {
+	&no_records,
+	&in_memory,
+	&tiny_budget,
+	&repeated_keys,
+	&large_records,
+	&single_pass,
+	&multiple_passes,
+};
@@ -0,0 +1,26 @@
+/* declarations of external sort testing vectors */
+#include <external_sort.h>
+
+#include <stdlib.h>
+
+/* vector to test sorting with a given memory budget */
+struct external_sort_tv {
+	/* the number of records to generate and sort */
+	size_t n_records;
+	/*
+	 * the number of bytes in each record,
+	 * which must be enough for the key and the record's index
+	 */
+	size_t record_size;
+	/* the memory budget to pass to "external_sort" */
+	size_t memory_budget;
+	/*
+	 * the number of distinct keys to generate, to force repeats,
+	 * or 0 to generate keys from the full range of "int"
+	 */
+	unsigned key_range;
+};
+
+#define N_EXTERNAL_SORT_TVS 7
+/* all the test vectors that will be run by "test_external_sorts" */
+extern struct external_sort_tv *external_sort_tvs[N_EXTERNAL_SORT_TVS];
@@ -4,10 +4,12 @@
 #include <debug_assert.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 /*
  * Check that two, not-necessarily zero-terminated, strings are equal.
@@ -479,8 +481,407 @@ static struct file_buffer_tv error_read = {
 	.tester = error_read_tester
 };
 
+/*
+ * Look at bytes with "peek_buffer", check them against the file,
+ * and consume some of them.
+ * buffer:	the buffer from which to read
+ * file_map:	the mapping of the file, containing the actual values
+ * min_len:	the fewest bytes to look at
+ * consumed:	the number of bytes to consume, at most those looked at
+ * returns	1 if the bytes and the new location are as expected,
+ *		0 otherwise
+ */
+static int peek_check(file_buffer_t *buffer, unsigned char *file_map,
+		      size_t min_len, size_t consumed)
+{
+	long start = ftell_buffer(buffer);
+	size_t file_left = get_file_size(buffer) - start;
+	size_t expected_len = min_len < file_left ? min_len : file_left;
+	const unsigned char *peeked;
+	size_t len;
+
+	peeked = peek_buffer(buffer, min_len, &len);
+	if (peeked == NULL) {
+		printlg(ERROR_LEVEL, "Failed to look at %u bytes at %ld.\n",
+			(unsigned) min_len, start);
+		return 0;
+	}
+	if (len < expected_len || len > file_left) {
+		printlg(ERROR_LEVEL,
+			"Looked at %u bytes at %ld, but wanted %u.\n",
+			(unsigned) len, start, (unsigned) expected_len);
+		return 0;
+	}
+	if (!check_location(buffer, start) ||
+	    !check_string(file_map + start, (unsigned char *) peeked, len)) {
+		return 0;
+	}
+
+	if (consumed > len) {
+		consumed = len;
+	}
+	if (consume_buffer(buffer, consumed)) {
+		printlg(ERROR_LEVEL, "Failed to consume %u bytes.\n",
+			(unsigned) consumed);
+		return 0;
+	}
+
+	return check_location(buffer, start + consumed);
+}
+
+static int peek_read_tester(file_buffer_t *buffer, unsigned char *file_map)
+{
+	size_t min_lens[] = {1, 0, PAGE_SIZE, 3, PAGE_SIZE - 1, 100};
+	size_t consumed[] = {1, 7, PAGE_SIZE - 5, 0, PAGE_SIZE / 3, 100};
+	size_t n_sizes = sizeof(min_lens) / sizeof(min_lens[0]);
+	size_t step = 0;
+	const unsigned char *peeked;
+	size_t len, file_left;
+
+	/* Mix looking at bytes in place with copying them out. */
+	while (ftell_buffer(buffer) < LARGE_SIZE) {
+		if (!peek_check(buffer, file_map, min_lens[step % n_sizes],
+				consumed[step % n_sizes])) {
+			printlg(ERROR_LEVEL, "Failed look %u.\n",
+				(unsigned) step);
+			return 0;
+		}
+		file_left = LARGE_SIZE - ftell_buffer(buffer);
+		if (step % 5 == 4 &&
+		    !read_check(buffer, file_map,
+				file_left < (size_t) SMALL_SEGMENT ?
+				file_left : (size_t) SMALL_SEGMENT,
+				SMALL_SEGMENT)) {
+			printlg(ERROR_LEVEL, "Failed read after look %u.\n",
+				(unsigned) step);
+			return 0;
+		}
+		step++;
+	}
+
+	/* At the end, there is nothing to look at or consume. */
+	peeked = peek_buffer(buffer, PAGE_SIZE, &len);
+	if (peeked == NULL || len != 0) {
+		printlg(ERROR_LEVEL, "Looked past the end of the file.\n");
+		return 0;
+	}
+	if (consume_buffer(buffer, 1) != -1 || errno != ERANGE) {
+		printlg(ERROR_LEVEL, "Consumed past the end of the file.\n");
+		return 0;
+	}
+	if (peek_buffer(buffer, get_buffer_size(buffer) + 1, &len) != NULL ||
+	    errno != EINVAL) {
+		printlg(ERROR_LEVEL, "Looked at more than the buffer.\n");
+		return 0;
+	}
+
+	/* Jump ahead and back without reading, then look. */
+	if (fseek_buffer(buffer, LARGE_SEGMENT, SEEK_SET) ||
+	    fseek_buffer(buffer, -SMALL_SEGMENT, SEEK_CUR) ||
+	    !peek_check(buffer, file_map, PAGE_SIZE, PAGE_SIZE)) {
+		printlg(ERROR_LEVEL, "Failed to look after jumping back.\n");
+		return 0;
+	}
+	/* Look at bytes that were buffered before the last jump back. */
+	if (!check_rewind(buffer) ||
+	    !read_check(buffer, file_map, SMALL_SEGMENT, SMALL_SEGMENT) ||
+	    fseek_buffer(buffer, -SMALL_SEGMENT / 2, SEEK_CUR) ||
+	    !peek_check(buffer, file_map, PAGE_SIZE, SMALL_SEGMENT)) {
+		printlg(ERROR_LEVEL, "Failed to look inside first page.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Look at bytes in place, while also reading and jumping. */
+static struct file_buffer_tv peek_read = {
+	.file_name = LARGE_FILE,
+	.tester = peek_read_tester
+};
+
+static int peek_small_tester(file_buffer_t *buffer, unsigned char *file_map)
+{
+	return peek_check(buffer, file_map, PAGE_SIZE, SMALL_SIZE) &&
+	       peek_check(buffer, file_map, 1, 1);
+}
+
+/* Look at a page of the small file. */
+static struct file_buffer_tv peek_small = {
+	.file_name = SMALL_FILE,
+	.tester = peek_small_tester
+};
+
+/* the number of threads reading at positions of the same buffer */
+#define N_POSITIONAL_THREADS	8
+/* the number of reads each of those threads makes */
+#define N_POSITIONAL_READS	2000
+/* the number of blocks in the cache they share */
+#define N_CACHE_BLOCKS		4
+
+/* a thread of the positional read test */
+struct positional_reader {
+	/* the buffer shared by the threads */
+	file_buffer_t *buffer;
+	/* the mapping of the file, containing the actual values */
+	unsigned char *file_map;
+	/* the state of the thread's pseudo-random generator */
+	uint32_t random_state;
+	/* set if any read was wrong */
+	int failed;
+};
+
+/*
+ * Thread entry point of the positional read test:
+ * read random ranges, some past the end of the file,
+ * and check them against the file.
+ * arg:		the "struct positional_reader"
+ * returns	NULL
+ */
+static void *run_positional_reader(void *arg)
+{
+	struct positional_reader *reader = arg;
+	size_t max_size = get_buffer_size(reader->buffer) * 3;
+	unsigned char *real = malloc(max_size);
+	size_t read_i;
+
+	if (real == NULL) {
+		reader->failed = 1;
+		return NULL;
+	}
+
+	for (read_i = 0; read_i < N_POSITIONAL_READS; read_i++) {
+		uint32_t *state = &reader->random_state;
+		size_t offset, size, expected_len, real_len;
+
+		*state ^= *state << 13;
+		*state ^= *state >> 17;
+		*state ^= *state << 5;
+		offset = *state % (LARGE_SIZE + 1);
+		size = (*state >> 8) % max_size;
+		expected_len = LARGE_SIZE - offset < size ?
+			       LARGE_SIZE - offset : size;
+
+		real_len = read_buffer_at(reader->buffer, (long) offset, real,
+					  size);
+		if (real_len != expected_len ||
+		    !check_string(reader->file_map + offset, real, real_len)) {
+			printlg(ERROR_LEVEL,
+				"Read %u of %u bytes at %u wrongly.\n",
+				(unsigned) real_len, (unsigned) size,
+				(unsigned) offset);
+			reader->failed = 1;
+			break;
+		}
+	}
+
+	free(real);
+	return NULL;
+}
+
+/*
+ * Read at random positions from several threads at once,
+ * while the main thread reads with the cursor.
+ * buffer:	the buffer shared by the threads
+ * file_map:	the mapping of the file, containing the actual values
+ * returns	1 if every read was correct, 0 otherwise
+ */
+static int test_positional_threads(file_buffer_t *buffer,
+				   unsigned char *file_map)
+{
+	struct positional_reader readers[N_POSITIONAL_THREADS];
+	pthread_t threads[N_POSITIONAL_THREADS];
+	int started[N_POSITIONAL_THREADS];
+	size_t thread_i;
+	int passed = 1;
+
+	for (thread_i = 0; thread_i < N_POSITIONAL_THREADS; thread_i++) {
+		readers[thread_i].buffer = buffer;
+		readers[thread_i].file_map = file_map;
+		readers[thread_i].random_state = 0x2545f491 + thread_i;
+		readers[thread_i].failed = 0;
+
+		started[thread_i] = !pthread_create(&threads[thread_i], NULL,
+						    run_positional_reader,
+						    &readers[thread_i]);
+		if (!started[thread_i]) {
+			printlg(WARNING_LEVEL, "Could not start thread %u.\n",
+				(unsigned) thread_i);
+			run_positional_reader(&readers[thread_i]);
+		}
+	}
+
+	/* The cursor is independent of the positional reads. */
+	if (!check_rewind(buffer) ||
+	    !read_check(buffer, file_map, LARGE_SIZE, LARGE_SIZE)) {
+		printlg(ERROR_LEVEL, "Failed to read with the cursor.\n");
+		passed = 0;
+	}
+
+	for (thread_i = 0; thread_i < N_POSITIONAL_THREADS; thread_i++) {
+		if (started[thread_i]) {
+			pthread_join(threads[thread_i], NULL);
+		}
+		if (readers[thread_i].failed) {
+			printlg(ERROR_LEVEL, "Thread %u read wrongly.\n",
+				(unsigned) thread_i);
+			passed = 0;
+		}
+	}
+
+	return passed;
+}
+
+static int
+positional_read_tester(file_buffer_t *buffer, unsigned char *file_map)
+{
+	unsigned char byte;
+
+	/* Reading at positions does not move the cursor. */
+	if (fseek_buffer(buffer, SMALL_SEGMENT, SEEK_SET)) {
+		printlg(ERROR_LEVEL, "Failed to jump into the file.\n");
+		return 0;
+	}
+	if (read_buffer_at(buffer, LARGE_SIZE - 1, &byte, 2) != 1 ||
+	    byte != file_map[LARGE_SIZE - 1] ||
+	    !check_location(buffer, SMALL_SEGMENT)) {
+		printlg(ERROR_LEVEL, "Failed to read the last byte.\n");
+		return 0;
+	}
+	if (read_buffer_at(buffer, LARGE_SIZE, &byte, 1) != 0) {
+		printlg(ERROR_LEVEL, "Read past the end of the file.\n");
+		return 0;
+	}
+	if (read_buffer_at(buffer, LARGE_SIZE + 1, &byte, 1) != 0 ||
+	    errno != ERANGE) {
+		printlg(ERROR_LEVEL, "Read outside the file.\n");
+		return 0;
+	}
+
+	/* Read without a cache, then through one. */
+	if (!test_positional_threads(buffer, file_map)) {
+		printlg(ERROR_LEVEL, "Failed to read without a cache.\n");
+		return 0;
+	}
+	if (init_block_cache(buffer, N_CACHE_BLOCKS, PAGE_SIZE)) {
+		printlg(ERROR_LEVEL, "Failed to make a block cache.\n");
+		return 0;
+	}
+	if (init_block_cache(buffer, N_CACHE_BLOCKS, PAGE_SIZE) != -1 ||
+	    errno != EINVAL) {
+		printlg(ERROR_LEVEL, "Made a second block cache.\n");
+		return 0;
+	}
+	if (!test_positional_threads(buffer, file_map)) {
+		printlg(ERROR_LEVEL, "Failed to read through the cache.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Read at positions from many threads at once. */
+static struct file_buffer_tv positional_read = {
+	.file_name = LARGE_FILE,
+	.tester = positional_read_tester
+};
+
+/* the most buffers read ahead in the read-ahead test */
+#define MAX_READ_AHEAD	4
+
+/*
+ * Check the number of buffers being read ahead.
+ * buffer:		the buffer reading ahead
+ * expected_depth:	the number of buffers that should be read ahead
+ * returns		1 if the number is as expected, 0 otherwise
+ */
+static int check_depth(file_buffer_t *buffer, size_t expected_depth)
+{
+	if (buffer->read_ahead_depth != expected_depth) {
+		printlg(ERROR_LEVEL,
+			"Reading %u buffers ahead, instead of %u.\n",
+			(unsigned) buffer->read_ahead_depth,
+			(unsigned) expected_depth);
+		return 0;
+	}
+	return 1;
+}
+
+static int read_ahead_tester(file_buffer_t *buffer, unsigned char *file_map)
+{
+	size_t buffer_size = get_buffer_size(buffer);
+	size_t expected_depth = 0;
+	size_t n_refills = 0;
+
+	if (set_read_ahead(buffer, FILE_BUFFER_MAX_READ_AHEAD) != -1 ||
+	    errno != EINVAL) {
+		printlg(ERROR_LEVEL, "Read too far ahead.\n");
+		return 0;
+	}
+	if (set_read_ahead(buffer, MAX_READ_AHEAD)) {
+		printlg(ERROR_LEVEL, "Failed to read ahead.\n");
+		return 0;
+	}
+
+	/*
+	 * Read a buffer at a time, so each read refills it once,
+	 * and the depth doubles each time, up to the maximum.
+	 */
+	while (ftell_buffer(buffer) < LARGE_SIZE) {
+		size_t file_left = LARGE_SIZE - ftell_buffer(buffer);
+
+		if (!read_check(buffer, file_map, file_left < buffer_size ?
+				file_left : buffer_size, buffer_size)) {
+			return 0;
+		}
+		expected_depth = expected_depth == 0 ? 1 :
+				 expected_depth * 2 > MAX_READ_AHEAD ?
+				 MAX_READ_AHEAD : expected_depth * 2;
+		n_refills++;
+		if (!check_depth(buffer, expected_depth)) {
+			printlg(ERROR_LEVEL, "Wrong depth after %u reads.\n",
+				(unsigned) n_refills);
+			return 0;
+		}
+	}
+
+	/*
+	 * Jumping back is not sequential,
+	 * but reading on from there is, if the file goes on past the buffer.
+	 */
+	if (fseek_buffer(buffer, SMALL_SEGMENT, SEEK_SET) ||
+	    !read_check(buffer, file_map, 1, 1) || !check_depth(buffer, 0)) {
+		printlg(ERROR_LEVEL, "Wrong depth after jumping back.\n");
+		return 0;
+	}
+	if (SMALL_SEGMENT + buffer_size < LARGE_SIZE &&
+	    (fseek_buffer(buffer, SMALL_SEGMENT + buffer_size, SEEK_SET) ||
+	     !read_check(buffer, file_map, 1, 1) || !check_depth(buffer, 1))) {
+		printlg(ERROR_LEVEL, "Wrong depth after reading on.\n");
+		return 0;
+	}
+
+	/* Turning it off keeps the depth at 0. */
+	if (set_read_ahead(buffer, 0) || !check_rewind(buffer) ||
+	    !read_check(buffer, file_map, LARGE_SIZE, LARGE_SIZE) ||
+	    !check_depth(buffer, 0)) {
+		printlg(ERROR_LEVEL, "Read ahead while off.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Check that reading ahead adapts to sequential and random reads. */
+static struct file_buffer_tv read_ahead = {
+	.file_name = LARGE_FILE,
+	.tester = read_ahead_tester
+};
+
 struct file_buffer_tv *file_buffer_tvs[N_FILE_BUFFER_TVS] = {
 	&full_read, &segmented_read,
 	&small_read, &smaller_read,
-	&jumping_read, &error_read
+	&jumping_read, &error_read,
+	&peek_read, &peek_small,
+	&positional_read, &read_ahead
 };
@@ -1,5 +1,7 @@
 #include "heap_sort_tvs.h"
 
+#include <limits.h>
+
 /* corner case test for an empty array. */
 static struct heap_sort_tv empty_array = {
 	.n_keys = 0,
@@ -30,6 +32,25 @@ static struct heap_sort_tv repeat_elements = {
 	.keys = repeat_elements_keys,
 };
 
+#define N_MANY	40
+static int many_elements_keys[N_MANY] = {
+	17, -3, 255, 256, -256, 65536, -65537, INT_MAX, INT_MIN, 0,
+	17, 9, -1, 1, 1 << 20, -(1 << 20), 42, 42, 42, -42,
+	1000, -1000, 7, 6, 5, 4, 3, 2, 1, 0,
+	INT_MIN, INT_MAX, 123456789, -123456789, 2047, 2048, -2048, -2049,
+	0x7f00ff, -0x7f00ff
+};
+
+/*
+ * test for enough keys to fill several heap levels,
+ * with repeats, extreme values and keys differing in only a few bytes
+ */
+static struct heap_sort_tv many_elements = {
+	.n_keys = N_MANY,
+	.keys = many_elements_keys,
+};
+
 struct heap_sort_tv *heap_sort_tvs[N_HEAP_SORT_TVS] = {
-	&empty_array, &single_element, &multiple_elements, &repeat_elements
+	&empty_array, &single_element, &multiple_elements, &repeat_elements,
+	&many_elements
 };
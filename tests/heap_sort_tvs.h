@@ -13,6 +13,6 @@ struct heap_sort_tv {
 	int *keys;
 };
 
-#define N_HEAP_SORT_TVS	4
+#define N_HEAP_SORT_TVS	5
 /* all the test vectors that will be run by "test_heap_sorts" */
 extern struct heap_sort_tv *heap_sort_tvs[N_HEAP_SORT_TVS];
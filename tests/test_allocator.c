@@ -0,0 +1,531 @@
+/* runs tests on the functions in "allocator.h" */
+#include <allocator.h>
+#include <data_structs.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/* the number of bytes in each arena block in the tests */
+#define TEST_BLOCK_SIZE		4096
+/* the number of keys put into each structure of the structure test */
+#define N_STRUCTURE_KEYS	1000
+/* the number of allocations from the arena in each round */
+#define N_ARENA_ALLOCATIONS	1000
+/* the number of heaps made from the arena or pool */
+#define N_TEST_HEAPS		200
+/* the capacity of each of those heaps */
+#define TEST_HEAP_CAPACITY	31
+/* the number of threads sharing the pool */
+#define N_POOL_THREADS		4
+/* the number of objects each thread holds at once */
+#define N_HELD_OBJECTS		100
+/* the number of times each thread allocates and frees its objects */
+#define N_POOL_ROUNDS		200
+
+/* a thread of the pool test */
+struct pool_worker {
+	/* the pool shared by the threads */
+	struct pool *pool;
+	/* the byte that the thread fills its objects with */
+	unsigned char fill;
+	/* the objects allocated by another thread, for this one to free */
+	void **to_free;
+	/* set if any object was changed while the thread held it */
+	int failed;
+};
+
+/* the state of an allocator that counts the memory it gives out */
+struct counting_state {
+	/* the number of allocations made */
+	size_t n_allocated;
+	/* the number of allocations not released yet */
+	size_t n_live;
+};
+
+/* the state of the pseudo-random generator of the test */
+static uint32_t random_state = 0x2545f491;
+
+/*
+ * Generate the next pseudo-random number, from a fixed seed.
+ * returns	the next number
+ */
+static uint32_t next_random()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+/*
+ * Check that every byte of some memory has a value.
+ * memory:	the memory to check
+ * value:	the value every byte should have
+ * size:	the number of bytes
+ * returns	1 iff every byte has the value
+ */
+static int all_bytes(const unsigned char *memory, unsigned char value,
+		     size_t size)
+{
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < size; byte_i++) {
+		if (memory[byte_i] != value) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Allocate memory with "malloc", counting the allocation.
+ * state:	the "struct counting_state"
+ * size:	the number of bytes to allocate
+ * returns	the allocated memory, or NULL on failure
+ */
+static void *allocate_counted(void *state, size_t size)
+{
+	struct counting_state *counts = state;
+	void *allocated = malloc(size > 0 ? size : 1);
+
+	if (allocated != NULL) {
+		counts->n_allocated++;
+		counts->n_live++;
+	}
+	return allocated;
+}
+
+/*
+ * Free memory from "allocate_counted", counting the release.
+ * state:	the "struct counting_state"
+ * to_release:	the memory to free, or NULL
+ */
+static void release_counted(void *state, void *to_release)
+{
+	struct counting_state *counts = state;
+
+	if (to_release != NULL) {
+		counts->n_live--;
+		free(to_release);
+	}
+}
+
+/*
+ * Allocate from an arena twice after the same mark,
+ * with a mix of sizes, some larger than a block,
+ * and check that the allocations are aligned and do not overlap,
+ * and that the second round reuses the memory of the first.
+ * returns	1 iff every allocation was as expected
+ */
+static int test_arena()
+{
+	struct arena arena;
+	struct arena_mark mark;
+	unsigned char *allocations[N_ARENA_ALLOCATIONS];
+	size_t sizes[N_ARENA_ALLOCATIONS];
+	void *first, *after_mark;
+	size_t round, alloc_i;
+	int passed = 1;
+
+	if (init_arena(&arena, TEST_BLOCK_SIZE)) {
+		return 0;
+	}
+	/* Keep something before the mark, which the reset must not free. */
+	first = allocate_arena(&arena, 10);
+	if (first == NULL) {
+		teardown_arena(&arena);
+		return 0;
+	}
+	memset(first, 0xee, 10);
+	mark = mark_arena(&arena);
+	after_mark = allocate_arena(&arena, 1);
+	reset_arena(&arena, &mark);
+
+	for (round = 0; round < 2; round++) {
+		for (alloc_i = 0; alloc_i < N_ARENA_ALLOCATIONS; alloc_i++) {
+			sizes[alloc_i] = next_random() % 100 == 0 ?
+					 TEST_BLOCK_SIZE * 2 :
+					 next_random() % 200;
+			allocations[alloc_i] = allocate_arena(&arena,
+							      sizes[alloc_i]);
+			if (allocations[alloc_i] == NULL ||
+			    (uintptr_t) allocations[alloc_i] %
+			    ARENA_ALIGNMENT != 0) {
+				printlg(ERROR_LEVEL,
+					"Bad allocation of %u bytes.\n",
+					(unsigned) sizes[alloc_i]);
+				passed = 0;
+				break;
+			}
+			memset(allocations[alloc_i], alloc_i & 0xff,
+			       sizes[alloc_i]);
+		}
+		for (alloc_i = 0; alloc_i < N_ARENA_ALLOCATIONS && passed;
+		     alloc_i++) {
+			if (!all_bytes(allocations[alloc_i], alloc_i & 0xff,
+				       sizes[alloc_i])) {
+				printlg(ERROR_LEVEL,
+					"Allocation %u was overwritten.\n",
+					(unsigned) alloc_i);
+				passed = 0;
+			}
+		}
+
+		reset_arena(&arena, &mark);
+		if (allocate_arena(&arena, 1) != after_mark) {
+			printlg(ERROR_LEVEL, "Reset did not reuse memory.\n");
+			passed = 0;
+		}
+		reset_arena(&arena, &mark);
+	}
+	if (!all_bytes(first, 0xee, 10)) {
+		printlg(ERROR_LEVEL, "Reset freed memory before the mark.\n");
+		passed = 0;
+	}
+
+	teardown_arena(&arena);
+	return passed;
+}
+
+/*
+ * Sort random keys with heaps allocated from an allocator,
+ * tearing each one down after use.
+ * allocator:	the allocator of the heaps
+ * returns	1 iff every heap sorted its keys
+ */
+static int sort_with_heaps(struct allocator *allocator)
+{
+	struct min_heap heaps[N_TEST_HEAPS];
+	size_t heap_i, element_i;
+	int passed = 1;
+
+	for (heap_i = 0; heap_i < N_TEST_HEAPS; heap_i++) {
+		if (init_min_heap_with(&heaps[heap_i], TEST_HEAP_CAPACITY,
+				       allocator)) {
+			while (heap_i > 0) {
+				teardown_min_heap(&heaps[--heap_i]);
+			}
+			return 0;
+		}
+		for (element_i = 0; element_i < TEST_HEAP_CAPACITY;
+		     element_i++) {
+			struct heap_element element;
+
+			element.key = next_random() % 1000;
+			element.data = NULL;
+			push_min_heap(&heaps[heap_i], &element);
+		}
+	}
+
+	for (heap_i = 0; heap_i < N_TEST_HEAPS; heap_i++) {
+		struct heap_element element;
+		int last = -1;
+
+		while (!pop_min_heap(&element, &heaps[heap_i])) {
+			if (element.key < last) {
+				passed = 0;
+			}
+			last = element.key;
+		}
+		teardown_min_heap(&heaps[heap_i]);
+	}
+
+	return passed;
+}
+
+/*
+ * Make heaps from an arena and from a pool,
+ * and check that a pool rejects heaps too large for its objects.
+ * returns	1 iff the heaps worked from both
+ */
+static int test_heap_allocators()
+{
+	struct arena arena;
+	struct pool pool;
+	struct min_heap too_large;
+	int passed = 1;
+
+	if (init_arena(&arena, TEST_BLOCK_SIZE)) {
+		return 0;
+	}
+	if (!sort_with_heaps(&arena.allocator)) {
+		printlg(ERROR_LEVEL, "Heaps from the arena did not sort.\n");
+		passed = 0;
+	}
+	clear_arena(&arena);
+	teardown_arena(&arena);
+
+	if (init_pool(&pool, sizeof(struct heap_element) *
+		      (TEST_HEAP_CAPACITY + 1), 16)) {
+		return 0;
+	}
+	if (!sort_with_heaps(&pool.allocator)) {
+		printlg(ERROR_LEVEL, "Heaps from the pool did not sort.\n");
+		passed = 0;
+	}
+	if (init_min_heap_with(&too_large, TEST_HEAP_CAPACITY + 1,
+			       &pool.allocator) != -1 || errno != EINVAL) {
+		printlg(ERROR_LEVEL, "Pool gave out a heap too large.\n");
+		passed = 0;
+	}
+	teardown_pool(&pool);
+
+	return passed;
+}
+
+/*
+ * Use every structure of "data_structs.h" that takes an allocator
+ * with one that counts its allocations,
+ * growing the radix heap's buckets and the hash map as they fill,
+ * and check that each structure works, keeps its arrays aligned,
+ * and releases everything it allocated when torn down.
+ * returns	1 iff every structure worked, and nothing was left allocated
+ */
+static int test_structure_allocators()
+{
+	struct counting_state counts = {0, 0};
+	struct allocator allocator = {allocate_counted, release_counted,
+				      &counts};
+	struct indexed_min_heap indexed;
+	struct dary_min_heap dary;
+	struct soa_min_heap soa;
+	struct radix_heap radix;
+	struct top_k top;
+	struct space_saving tracker;
+	struct hash_map map;
+	struct run_merger merger;
+	struct heap_element elements[N_STRUCTURE_KEYS];
+	struct heap_element *runs[2] = {elements, elements + 1};
+	size_t run_sizes[2] = {1, N_STRUCTURE_KEYS - 1};
+	struct heap_element element;
+	int last[4] = {INT_MIN, INT_MIN, INT_MIN, INT_MIN};
+	size_t key_i, handle;
+	void *value;
+	int passed = 1;
+
+	if (init_indexed_min_heap_with(&indexed, N_STRUCTURE_KEYS,
+				       &allocator) ||
+	    init_dary_min_heap_with(&dary, N_STRUCTURE_KEYS, &allocator) ||
+	    init_soa_min_heap_with(&soa, N_STRUCTURE_KEYS, &allocator) ||
+	    init_top_k_with(&top, 10, 0, &allocator) ||
+	    init_space_saving_with(&tracker, 10, &allocator) ||
+	    init_hash_map_with(&map, 0, &allocator)) {
+		printlg(ERROR_LEVEL, "Could not make the structures.\n");
+		return 0;
+	}
+	init_radix_heap_with(&radix, &allocator);
+
+	for (key_i = 0; key_i < N_STRUCTURE_KEYS; key_i++) {
+		element.key = next_random() % 10000;
+		element.data = (void *) (key_i + 1);
+		elements[key_i] = element;
+		if (push_indexed_min_heap(&indexed, &element, &handle) ||
+		    push_dary_min_heap(&dary, &element) ||
+		    push_soa_min_heap(&soa, &element) ||
+		    push_radix_heap(&radix, &element) ||
+		    put_hash_map(&map, key_i, element.data)) {
+			passed = 0;
+		}
+		offer_top_k(&top, &element);
+		add_space_saving(&tracker, element.key % 20, 1);
+	}
+	if ((uintptr_t) dary.allocated % 64 != 0 ||
+	    (uintptr_t) soa.allocated_keys % (8 * sizeof(int32_t)) != 0 ||
+	    (uintptr_t) map.control % HASH_MAP_GROUP != 0) {
+		printlg(ERROR_LEVEL, "The arrays were not aligned.\n");
+		passed = 0;
+	}
+
+	for (key_i = 0; key_i < N_STRUCTURE_KEYS; key_i++) {
+		if (pop_indexed_min_heap(&element, NULL, &indexed) ||
+		    element.key < last[0]) {
+			passed = 0;
+		}
+		last[0] = element.key;
+		if (pop_dary_min_heap(&element, &dary) ||
+		    element.key < last[1]) {
+			passed = 0;
+		}
+		last[1] = element.key;
+		if (pop_soa_min_heap(&element, &soa) ||
+		    element.key < last[2]) {
+			passed = 0;
+		}
+		last[2] = element.key;
+		if (pop_radix_heap(&element, &radix) ||
+		    element.key < last[3]) {
+			passed = 0;
+		}
+		last[3] = element.key;
+		if (get_hash_map(&map, key_i, &value) ||
+		    value != (void *) (key_i + 1)) {
+			passed = 0;
+		}
+	}
+	if (!passed) {
+		printlg(ERROR_LEVEL, "A structure gave the wrong elements.\n");
+	}
+
+	/* Merge the smallest element, alone, with the rest in order. */
+	heap_sort(elements, N_STRUCTURE_KEYS);
+	if (init_run_merger_with(&merger, runs, run_sizes, 2, &allocator)) {
+		passed = 0;
+	} else {
+		for (key_i = 0; key_i < N_STRUCTURE_KEYS; key_i++) {
+			if (next_run_merger(&element, &merger) ||
+			    element.key != elements[key_i].key) {
+				printlg(ERROR_LEVEL,
+					"The merger gave wrong elements.\n");
+				passed = 0;
+				break;
+			}
+		}
+		teardown_run_merger(&merger);
+	}
+
+	teardown_indexed_min_heap(&indexed);
+	teardown_dary_min_heap(&dary);
+	teardown_soa_min_heap(&soa);
+	teardown_radix_heap(&radix);
+	teardown_top_k(&top);
+	teardown_space_saving(&tracker);
+	teardown_hash_map(&map);
+	if (counts.n_live != 0) {
+		printlg(ERROR_LEVEL, "%u of %u allocations were kept.\n",
+			(unsigned) counts.n_live,
+			(unsigned) counts.n_allocated);
+		passed = 0;
+	}
+
+	return passed;
+}
+
+/*
+ * Thread entry point of the pool test:
+ * repeatedly allocate objects, fill them, check them, and free them,
+ * then free the objects that another thread allocated.
+ * arg:		the "struct pool_worker"
+ * returns	NULL
+ */
+static void *run_pool_worker(void *arg)
+{
+	struct pool_worker *worker = arg;
+	size_t object_size = worker->pool->object_size;
+	unsigned char *held[N_HELD_OBJECTS];
+	size_t round, object_i;
+
+	for (round = 0; round < N_POOL_ROUNDS; round++) {
+		for (object_i = 0; object_i < N_HELD_OBJECTS; object_i++) {
+			held[object_i] = allocate_pool(worker->pool);
+			if (held[object_i] == NULL) {
+				worker->failed = 1;
+				return NULL;
+			}
+			memset(held[object_i], worker->fill, object_size);
+		}
+		for (object_i = 0; object_i < N_HELD_OBJECTS; object_i++) {
+			if (!all_bytes(held[object_i], worker->fill,
+				       object_size)) {
+				worker->failed = 1;
+			}
+			free_pool(worker->pool, held[object_i]);
+		}
+	}
+
+	for (object_i = 0; object_i < N_HELD_OBJECTS; object_i++) {
+		free_pool(worker->pool, worker->to_free[object_i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Allocate and free from a pool in several threads at once,
+ * with each thread also freeing objects allocated by the main thread.
+ * returns	1 iff no object was given to two threads at once
+ */
+static int test_pool_threads()
+{
+	struct pool pool;
+	struct pool_worker workers[N_POOL_THREADS];
+	pthread_t threads[N_POOL_THREADS];
+	int started[N_POOL_THREADS];
+	void *to_free[N_POOL_THREADS][N_HELD_OBJECTS];
+	size_t thread_i, object_i;
+	int passed = 1;
+
+	if (init_pool(&pool, 40, 64)) {
+		return 0;
+	}
+
+	for (thread_i = 0; thread_i < N_POOL_THREADS; thread_i++) {
+		for (object_i = 0; object_i < N_HELD_OBJECTS; object_i++) {
+			to_free[thread_i][object_i] = allocate_pool(&pool);
+		}
+		workers[thread_i].pool = &pool;
+		workers[thread_i].fill = thread_i + 1;
+		workers[thread_i].to_free = to_free[thread_i];
+		workers[thread_i].failed = 0;
+	}
+	for (thread_i = 0; thread_i < N_POOL_THREADS; thread_i++) {
+		started[thread_i] = !pthread_create(&threads[thread_i], NULL,
+						    run_pool_worker,
+						    &workers[thread_i]);
+		if (!started[thread_i]) {
+			printlg(WARNING_LEVEL, "Could not start thread %u.\n",
+				(unsigned) thread_i);
+			run_pool_worker(&workers[thread_i]);
+		}
+	}
+	for (thread_i = 0; thread_i < N_POOL_THREADS; thread_i++) {
+		if (started[thread_i]) {
+			pthread_join(threads[thread_i], NULL);
+		}
+		if (workers[thread_i].failed) {
+			printlg(ERROR_LEVEL,
+				"Thread %u's objects were overwritten.\n",
+				(unsigned) thread_i);
+			passed = 0;
+		}
+	}
+
+	teardown_pool(&pool);
+	return passed;
+}
+
+int main(void)
+{
+	printlg(INFO_LEVEL, "Arena test...\n");
+	if (test_arena()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Heap allocator test...\n");
+	if (test_heap_allocators()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Structure allocator test...\n");
+	if (test_structure_allocators()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Threaded pool test...\n");
+	if (test_pool_threads()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	return 0;
+}
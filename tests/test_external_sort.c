@@ -0,0 +1,390 @@
+/* runs tests on the functions in "external_sort.h" */
+#include "external_sort_tvs.h"
+
+#include <logger.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+/*
+ * the most records that the generator gives at a time,
+ * so that the sort must handle short reads
+ */
+#define MAX_GENERATED_READ	37
+
+/* the state of a generator of test records */
+struct record_generator {
+	/* the test vector describing the records */
+	struct external_sort_tv *tv;
+	/* the index of the next record to generate */
+	size_t next;
+	/* the state of the random key generator */
+	uint32_t state;
+};
+
+/*
+ * Find the key of a test record, which is stored at its start.
+ * record:	the record whose key to find
+ * returns	the record's key
+ */
+static int get_test_key(const void *record)
+{
+	int key;
+
+	memcpy(&key, record, sizeof(key));
+	return key;
+}
+
+/*
+ * Find the byte that a test record holds at a given position,
+ * after its key and index.
+ * index:	the index of the record
+ * position:	the position in the record
+ * returns	the expected byte
+ */
+static unsigned char payload_byte(uint32_t index, size_t position)
+{
+	return (unsigned char) (index * 31 + position);
+}
+
+/*
+ * Write a test record,
+ * holding its key, its index, and a pattern determined by its index.
+ * record:	the space to write the record to
+ * record_size:	the number of bytes in the record
+ * key:		the record's key
+ * index:	the record's index
+ */
+static void write_test_record(unsigned char *record, size_t record_size,
+			      int key, uint32_t index)
+{
+	size_t position;
+
+	memcpy(record, &key, sizeof(key));
+	memcpy(record + sizeof(key), &index, sizeof(index));
+	for (position = sizeof(key) + sizeof(index); position < record_size;
+	     position++) {
+		record[position] = payload_byte(index, position);
+	}
+}
+
+/*
+ * Generate the next records of a test vector,
+ * as the "read_records" argument to "external_sort".
+ * records:	the space to write the records to
+ * max_records:	the maximum number of records to write
+ * n_read:	the space to write the number of records written
+ * arg:		the "struct record_generator"
+ * returns	0
+ */
+static int generate_records(void *records, size_t max_records,
+			    size_t *n_read, void *arg)
+{
+	struct record_generator *generator = arg;
+	struct external_sort_tv *tv = generator->tv;
+	size_t record_i;
+
+	if (max_records > MAX_GENERATED_READ) {
+		max_records = MAX_GENERATED_READ;
+	}
+	if (max_records > tv->n_records - generator->next) {
+		max_records = tv->n_records - generator->next;
+	}
+
+	for (record_i = 0; record_i < max_records; record_i++) {
+		uint32_t state = generator->state;
+		int key;
+
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		generator->state = state;
+		if (tv->key_range > 0) {
+			key = (int) (state % tv->key_range) -
+			      (int) (tv->key_range / 2);
+		} else {
+			key = (int) state;
+		}
+
+		write_test_record((unsigned char *) records +
+				  record_i * tv->record_size,
+				  tv->record_size, key,
+				  (uint32_t) generator->next++);
+	}
+
+	*n_read = max_records;
+	return 0;
+}
+
+/*
+ * Check that a stream holds every generated record, sorted by key.
+ * sorted:	the stream to which the sorted records were written
+ * tv:		the test vector describing the records
+ * returns	1 if the records are correct, 0 otherwise
+ */
+static int check_sorted(FILE *sorted, struct external_sort_tv *tv)
+{
+	unsigned char record[tv->record_size];
+	char *seen = calloc(tv->n_records + 1, 1);
+	size_t record_i, position;
+	int last_key = 0;
+	int passed = 1;
+
+	if (seen == NULL) {
+		printlg(ERROR_LEVEL, "Could not allocate record flags.\n");
+		return 0;
+	}
+
+	rewind(sorted);
+	for (record_i = 0; record_i < tv->n_records && passed; record_i++) {
+		uint32_t index;
+		int key;
+
+		if (fread(record, tv->record_size, 1, sorted) < 1) {
+			printlg(ERROR_LEVEL, "Only %u records were written.\n",
+				(unsigned) record_i);
+			passed = 0;
+			break;
+		}
+		key = get_test_key(record);
+		memcpy(&index, record + sizeof(key), sizeof(index));
+
+		if (record_i > 0 && key < last_key) {
+			printlg(ERROR_LEVEL,
+				"Record %u has key %d, after %d.\n",
+				(unsigned) record_i, key, last_key);
+			passed = 0;
+		} else if (index >= tv->n_records || seen[index]) {
+			printlg(ERROR_LEVEL,
+				"Record %u has bad or repeated index %u.\n",
+				(unsigned) record_i, (unsigned) index);
+			passed = 0;
+		}
+		for (position = sizeof(key) + sizeof(index);
+		     position < tv->record_size && passed; position++) {
+			if (record[position] != payload_byte(index, position)) {
+				printlg(ERROR_LEVEL,
+					"Record %u was corrupted at byte %u.\n",
+					(unsigned) record_i,
+					(unsigned) position);
+				passed = 0;
+			}
+		}
+
+		if (passed) {
+			seen[index] = 1;
+			last_key = key;
+		}
+	}
+
+	if (passed && fread(record, 1, 1, sorted) > 0) {
+		printlg(ERROR_LEVEL, "Extra records were written.\n");
+		passed = 0;
+	}
+
+	free(seen);
+	return passed;
+}
+
+/*
+ * Sort the generated records straight from the generator.
+ * tv:		the test vector describing the records
+ * returns	1 if passed, 0 otherwise
+ */
+static int test_generated_sort(struct external_sort_tv *tv)
+{
+	struct record_generator generator = {
+		.tv = tv,
+		.state = 0x2545f491,
+	};
+	FILE *sorted = tmpfile();
+	int passed;
+
+	if (sorted == NULL) {
+		printlg(ERROR_LEVEL, "Failed to create output file.\n");
+		return 0;
+	}
+
+	if (external_sort(sorted, tv->record_size, get_test_key,
+			  tv->memory_budget, generate_records, &generator)) {
+		printlg(ERROR_LEVEL, "Failed to sort generated records.\n");
+		passed = 0;
+	} else {
+		passed = check_sorted(sorted, tv);
+	}
+
+	fclose(sorted);
+	return passed;
+}
+
+/*
+ * Write the generated records to a file,
+ * then sort them by reading the file through a file buffer.
+ * tv:		the test vector describing the records
+ * returns	1 if passed, 0 otherwise
+ */
+static int test_file_sort(struct external_sort_tv *tv)
+{
+	struct record_generator generator = {
+		.tv = tv,
+		.state = 0x2545f491,
+	};
+	unsigned char records[MAX_GENERATED_READ * tv->record_size];
+	FILE *unsorted = tmpfile(), *sorted = tmpfile();
+	file_buffer_t buffer;
+	size_t n_read;
+	int passed = 1;
+
+	if (unsorted == NULL || sorted == NULL) {
+		printlg(ERROR_LEVEL, "Failed to create test files.\n");
+		passed = 0;
+	}
+
+	while (passed) {
+		generate_records(records, MAX_GENERATED_READ, &n_read,
+				 &generator);
+		if (n_read == 0) {
+			break;
+		}
+		if (fwrite(records, tv->record_size, n_read, unsorted) <
+		    n_read) {
+			printlg(ERROR_LEVEL, "Failed to write test file.\n");
+			passed = 0;
+		}
+	}
+
+	if (passed && (fflush(unsorted) ||
+		       init_file_buffer(&buffer, unsorted))) {
+		printlg(ERROR_LEVEL, "Failed to open test file buffer.\n");
+		passed = 0;
+	} else if (passed) {
+		if (external_sort_file_buffer(sorted, &buffer,
+					      tv->record_size, get_test_key,
+					      tv->memory_budget)) {
+			printlg(ERROR_LEVEL, "Failed to sort file records.\n");
+			passed = 0;
+		} else {
+			passed = check_sorted(sorted, tv);
+		}
+		destroy_file_buffer(&buffer);
+	}
+
+	if (unsorted != NULL) {
+		fclose(unsorted);
+	}
+	if (sorted != NULL) {
+		fclose(sorted);
+	}
+	return passed;
+}
+
+/*
+ * Check that bad arguments and inputs are reported with EINVAL.
+ * returns	1 if passed, 0 otherwise
+ */
+static int test_invalid(void)
+{
+	static struct external_sort_tv partial = {
+		.n_records = 10,
+		.record_size = 16,
+		.memory_budget = 0x1000,
+	};
+	struct record_generator generator = {
+		.tv = &partial,
+		.state = 0x2545f491,
+	};
+	unsigned char records[partial.n_records * partial.record_size];
+	FILE *unsorted = tmpfile(), *sorted = tmpfile();
+	file_buffer_t buffer;
+	size_t n_read;
+	int passed = 1;
+
+	if (unsorted == NULL || sorted == NULL) {
+		printlg(ERROR_LEVEL, "Failed to create test files.\n");
+		passed = 0;
+	}
+
+	/* Sorting needs room for a few records, which cannot be empty. */
+	if (passed && (external_sort(sorted, 1000, get_test_key, 0x800,
+				     generate_records, &generator) == 0 ||
+		       errno != EINVAL)) {
+		printlg(ERROR_LEVEL, "A tiny budget was not rejected.\n");
+		passed = 0;
+	}
+	if (passed && (external_sort(sorted, 0, get_test_key, 0x800,
+				     generate_records, &generator) == 0 ||
+		       errno != EINVAL)) {
+		printlg(ERROR_LEVEL, "Empty records were not rejected.\n");
+		passed = 0;
+	}
+
+	/* A file ending in part of a record is not a file of records. */
+	generate_records(records, partial.n_records, &n_read, &generator);
+	if (passed && (fwrite(records, 1, sizeof(records) - 1, unsorted) <
+		       sizeof(records) - 1 || fflush(unsorted) ||
+		       init_file_buffer(&buffer, unsorted))) {
+		printlg(ERROR_LEVEL, "Failed to open test file buffer.\n");
+		passed = 0;
+	} else if (passed) {
+		if (external_sort_file_buffer(sorted, &buffer,
+					      partial.record_size,
+					      get_test_key,
+					      partial.memory_budget) == 0 ||
+		    errno != EINVAL) {
+			printlg(ERROR_LEVEL,
+				"A partial record was not rejected.\n");
+			passed = 0;
+		}
+		destroy_file_buffer(&buffer);
+	}
+
+	if (unsorted != NULL) {
+		fclose(unsorted);
+	}
+	if (sorted != NULL) {
+		fclose(sorted);
+	}
+	return passed;
+}
+
+/*
+ * Run all of the test cases in "external_sort_tvs",
+ * both from a generator and from a file
+ */
+static void test_external_sorts()
+{
+	size_t tv_i;
+
+	for (tv_i = 0; tv_i < N_EXTERNAL_SORT_TVS; tv_i++) {
+		printlg(INFO_LEVEL, "Running generated sort test %u...\n",
+			(unsigned) tv_i);
+		if (test_generated_sort(external_sort_tvs[tv_i])) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+
+		printlg(INFO_LEVEL, "Running file sort test %u...\n",
+			(unsigned) tv_i);
+		if (test_file_sort(external_sort_tvs[tv_i])) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	printlg(INFO_LEVEL, "Running invalid input test...\n");
+	if (test_invalid()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+}
+
+int main(void)
+{
+	test_external_sorts();
+
+	return 0;
+}
@@ -1,16 +1,62 @@
-/* runs tests on the functions in "file_buffer.h" */
+/*
+ * runs tests on the functions in "file_buffer.h",
+ * and reports the speed of reading the inputs with each buffer size
+ */
 #include "file_buffer_tvs.h"
 
 #include <logger.h>
 
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
 /* the directory containing all of the files */
 #define TEST_FILE_DIR		"file_buffer_inputs/"
 #define TEST_FILE_DIR_LEN	strlen(TEST_FILE_DIR)
+/* the smallest buffer in the speed test, which doubles it up to the largest */
+#define MIN_BENCH_BUFFER	4096
+/* the number of bytes copied out of the buffer by each read */
+#define BENCH_READ_SIZE		4096
+/* the least time to spend reading a file with each buffer size */
+#define MIN_BENCH_SECONDS	0.05
+
+/* where a file buffer gets the file's data from */
+enum buffer_source {
+	/* a file stream */
+	FROM_STREAM,
+	/* a file descriptor */
+	FROM_FD,
+	/* a mapping of the file, for which the buffer size is unused */
+	FROM_MAPPING,
+};
+
+/* a way of opening a file buffer, with which to run every test */
+struct buffer_config {
+	/* the size of the buffer, or 0 for the default */
+	size_t buffer_size;
+	/* where the file is read from */
+	enum buffer_source source;
+	/* the most buffers to read ahead, or 0 not to */
+	size_t read_ahead;
+};
+
+/*
+ * the ways to run every test: the default,
+ * an odd size, which is rounded up to whole pages, and a larger one,
+ * each of which is also read from a file descriptor,
+ * then a mapping of the file, and some of them reading ahead
+ */
+#define N_BUFFER_CONFIGS	9
+static const struct buffer_config buffer_configs[N_BUFFER_CONFIGS] = {
+	{0, FROM_STREAM, 0}, {12289, FROM_STREAM, 0},
+	{0x10000, FROM_STREAM, 0}, {12289, FROM_FD, 0},
+	{0x10000, FROM_FD, 0}, {0, FROM_MAPPING, 0},
+	{0, FROM_STREAM, 4}, {12289, FROM_FD, 8}, {0, FROM_MAPPING, 4}
+};
 
 /*
  * Generate a memory map of the given file,
@@ -48,12 +94,53 @@ static unsigned char *gen_file_map(int *fd, char *path, size_t file_size)
 	return file_map;
 }
 
+/*
+ * Open a file buffer, in a given way.
+ * to_open:	the buffer to initialize
+ * path:	the path of the file to open
+ * config:	the size of the buffer, where to read the file from,
+ *		and how far to read ahead
+ * returns	0 on success, -1 on failure
+ */
+static int open_configured(file_buffer_t *to_open, const char *path,
+			   const struct buffer_config *config)
+{
+	size_t buffer_size = config->buffer_size;
+	FILE *in_file;
+	int error;
+
+	if (config->source == FROM_MAPPING) {
+		error = open_file_buffer_mapped(to_open, path);
+	} else if (config->source == FROM_FD) {
+		error = open_file_buffer_fd(to_open, path, buffer_size);
+	} else if (buffer_size == 0) {
+		error = open_file_buffer(to_open, path);
+	} else {
+		in_file = fopen(path, "r");
+		if (in_file == NULL) {
+			return -1;
+		}
+		error = init_file_buffer_sized(to_open, in_file, buffer_size);
+		if (error) {
+			fclose(in_file);
+		}
+	}
+
+	if (!error && set_read_ahead(to_open, config->read_ahead)) {
+		close_file_buffer(to_open);
+		return -1;
+	}
+	return error;
+}
+
 /*
  * Run a single file buffer test case.
  * tv:		the file buffer test vector
+ * config:	the way to open the file buffer
  * returns	1 if passed, 0 otherwise
  */
-static int test_file_buffer(struct file_buffer_tv *tv)
+static int test_file_buffer(struct file_buffer_tv *tv,
+			    const struct buffer_config *config)
 {
 	size_t name_len = strlen(tv->file_name) + 1;
 	char path[TEST_FILE_DIR_LEN + name_len];
@@ -67,7 +154,7 @@ static int test_file_buffer(struct file_buffer_tv *tv)
 	memcpy(path, TEST_FILE_DIR, TEST_FILE_DIR_LEN);
 	memcpy(path + TEST_FILE_DIR_LEN, tv->file_name, name_len);
 
-	if (open_file_buffer(&test_buffer, path)) {
+	if (open_configured(&test_buffer, path, config)) {
 		printlg(ERROR_LEVEL, "Failed to open test file %s.\n", path);
 		return 0;
 	}
@@ -90,26 +177,253 @@ static int test_file_buffer(struct file_buffer_tv *tv)
 }
 
 /*
- * Run all of the test cases in "file_buffer_tvs"
+ * Run all of the test cases in "file_buffer_tvs",
+ * in each way in "buffer_configs"
  */
 static void test_file_buffers()
 {
-	size_t tv_i;
-
-	for (tv_i = 0; tv_i < N_FILE_BUFFER_TVS; tv_i++) {
-		printlg(INFO_LEVEL, "Running file buffer test %u...\n",
-			(unsigned) tv_i);
-		if ((test_file_buffer(file_buffer_tvs[tv_i]))) {
-			printlg(INFO_LEVEL, "Passed!\n");
-		} else {
-			printlg(ERROR_LEVEL, "Failed!\n");
+	size_t config_i, tv_i;
+
+	for (config_i = 0; config_i < N_BUFFER_CONFIGS; config_i++) {
+		const struct buffer_config *config = &buffer_configs[config_i];
+
+		for (tv_i = 0; tv_i < N_FILE_BUFFER_TVS; tv_i++) {
+			printlg(INFO_LEVEL,
+				"Running file buffer test %u "
+				"with buffer size %u%s, "
+				"reading ahead %u...\n",
+				(unsigned) tv_i,
+				(unsigned) config->buffer_size,
+				config->source == FROM_FD ?
+				" from a descriptor" :
+				config->source == FROM_MAPPING ?
+				" from a mapping" : "",
+				(unsigned) config->read_ahead);
+			if ((test_file_buffer(file_buffer_tvs[tv_i], config))) {
+				printlg(INFO_LEVEL, "Passed!\n");
+			} else {
+				printlg(ERROR_LEVEL, "Failed!\n");
+			}
+		}
+	}
+}
+
+/*
+ * Check that buffer sizes are rounded up to pages,
+ * and that sizes of 0 or above "FILE_BUFFER_MAX_SIZE" are rejected.
+ * returns	1 if the sizes were handled correctly, 0 otherwise
+ */
+static int test_buffer_sizes()
+{
+	size_t page_size = (size_t) getpagesize();
+	size_t bad_sizes[] = {0, FILE_BUFFER_MAX_SIZE + 1};
+	file_buffer_t buffer;
+	FILE *in_file = fopen(TEST_FILE_DIR "small", "r");
+	size_t size_i;
+	int passed = 1;
+
+	if (in_file == NULL) {
+		printlg(ERROR_LEVEL, "Failed to open the small file.\n");
+		return 0;
+	}
+
+	for (size_i = 0; size_i < sizeof(bad_sizes) / sizeof(bad_sizes[0]);
+	     size_i++) {
+		if (init_file_buffer_sized(&buffer, in_file,
+					   bad_sizes[size_i]) != -1 ||
+		    errno != EINVAL) {
+			printlg(ERROR_LEVEL, "Accepted buffer size %u.\n",
+				(unsigned) bad_sizes[size_i]);
+			passed = 0;
+		}
+	}
+
+	if (init_file_buffer_sized(&buffer, in_file, page_size + 1)) {
+		printlg(ERROR_LEVEL, "Failed to make a sized buffer.\n");
+		passed = 0;
+	} else {
+		if (get_buffer_size(&buffer) != 2 * page_size ||
+		    (uintptr_t) buffer.buffer % page_size != 0) {
+			printlg(ERROR_LEVEL,
+				"Buffer of %u bytes was not rounded up.\n",
+				(unsigned) get_buffer_size(&buffer));
+			passed = 0;
+		}
+		destroy_file_buffer(&buffer);
+	}
+	if (init_file_buffer_sized(&buffer, in_file, FILE_BUFFER_MAX_SIZE)) {
+		printlg(ERROR_LEVEL, "Failed to make the largest buffer.\n");
+		passed = 0;
+	} else {
+		if ((uintptr_t) buffer.buffer % FILE_BUFFER_HUGE_PAGE != 0) {
+			printlg(ERROR_LEVEL,
+				"Large buffer is not aligned to huge pages.\n");
+			passed = 0;
+		}
+		destroy_file_buffer(&buffer);
+	}
+
+	fclose(in_file);
+	return passed;
+}
+
+/*
+ * Check that a regular file is mapped,
+ * and that a file that cannot be mapped is read through a file stream.
+ * returns	1 if both files were opened the right way, 0 otherwise
+ */
+static int test_mapped_fallback()
+{
+	file_buffer_t buffer;
+	int passed;
+
+	if (open_file_buffer_mapped(&buffer, TEST_FILE_DIR "small")) {
+		printlg(ERROR_LEVEL, "Failed to open the small file.\n");
+		return 0;
+	}
+	passed = buffer.mapping != NULL && buffer.buffer == NULL;
+	close_file_buffer(&buffer);
+
+	/* A character device has no size to map. */
+	if (open_file_buffer_mapped(&buffer, "/dev/null")) {
+		printlg(ERROR_LEVEL, "Failed to open an unmappable file.\n");
+		return 0;
+	}
+	passed = passed && buffer.mapping == NULL &&
+		 buffer.in_file != NULL && fgetc_buffer(&buffer) == EOF;
+	close_file_buffer(&buffer);
+
+	if (!passed) {
+		printlg(ERROR_LEVEL, "A file was read the wrong way.\n");
+	}
+	return passed;
+}
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Time reading a whole file through buffers of a given size,
+ * made again for each pass with "init_file_buffer_sized",
+ * since a rewound buffer keeps the data it holds.
+ * in_file:	the file to read, from wherever it is
+ * buffer_size:	the size of the buffers
+ * returns	the number of megabytes read per second,
+ *		or -1 if a pass failed, or read the wrong number of bytes
+ */
+static double time_buffered_reads(FILE *in_file, size_t buffer_size)
+{
+	unsigned char chunk[BENCH_READ_SIZE];
+	file_buffer_t buffer;
+	size_t n_read, pass_bytes, total_bytes = 0;
+	double start = now_seconds(), seconds;
+
+	do {
+		rewind(in_file);
+		if (init_file_buffer_sized(&buffer, in_file, buffer_size)) {
+			return -1;
+		}
+		pass_bytes = 0;
+		while ((n_read = read_buffer_bytes(chunk, BENCH_READ_SIZE,
+						   &buffer)) > 0) {
+			pass_bytes += n_read;
+		}
+		if (pass_bytes != get_file_size(&buffer)) {
+			printlg(ERROR_LEVEL, "Read %u bytes of %u.\n",
+				(unsigned) pass_bytes,
+				(unsigned) get_file_size(&buffer));
+			destroy_file_buffer(&buffer);
+			return -1;
 		}
+		destroy_file_buffer(&buffer);
+		total_bytes += pass_bytes;
+		seconds = now_seconds() - start;
+	} while (seconds < MIN_BENCH_SECONDS);
+
+	return total_bytes / seconds / 1e6;
+}
+
+/*
+ * Report the speed of reading each input file
+ * with every buffer size from "MIN_BENCH_BUFFER"
+ * to "FILE_BUFFER_MAX_SIZE", doubling it each time.
+ * returns	1 iff every file was read whole with every size
+ */
+static int test_read_speed()
+{
+	static const char *const inputs[] = {"large", "small"};
+	size_t n_inputs = sizeof(inputs) / sizeof(inputs[0]);
+	size_t input_i, buffer_size;
+	int passed = 1;
+
+	for (input_i = 0; input_i < n_inputs; input_i++) {
+		char path[TEST_FILE_DIR_LEN + strlen(inputs[input_i]) + 1];
+		FILE *in_file;
+
+		memcpy(path, TEST_FILE_DIR, TEST_FILE_DIR_LEN);
+		strcpy(path + TEST_FILE_DIR_LEN, inputs[input_i]);
+		in_file = fopen(path, "r");
+		if (in_file == NULL) {
+			printlg(ERROR_LEVEL, "Failed to open %s.\n", path);
+			passed = 0;
+			continue;
+		}
+
+		for (buffer_size = MIN_BENCH_BUFFER;
+		     buffer_size <= FILE_BUFFER_MAX_SIZE; buffer_size *= 2) {
+			double speed = time_buffered_reads(in_file,
+							   buffer_size);
+
+			if (speed < 0) {
+				printlg(ERROR_LEVEL,
+					"Failed to read %s with %u bytes.\n",
+					path, (unsigned) buffer_size);
+				passed = 0;
+				continue;
+			}
+			printlg(INFO_LEVEL, "%s, %u KiB buffer: %.3f MB/s.\n",
+				path, (unsigned) (buffer_size >> 10), speed);
+		}
+
+		fclose(in_file);
 	}
+
+	return passed;
 }
 
 int main(void)
 {
 	test_file_buffers();
 
+	printlg(INFO_LEVEL, "Buffer size test...\n");
+	if (test_buffer_sizes()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Mapping fallback test...\n");
+	if (test_mapped_fallback()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Read speed test...\n");
+	if (test_read_speed()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
 	return 0;
 }
@@ -0,0 +1,518 @@
+/*
+ * runs tests on the hash map in "data_structs.h",
+ * and compares its speed and size with a chained hash table.
+ * The number of keys in the benchmark can be given as the only argument.
+ */
+#include <data_structs.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* the number of different integer keys in the random test */
+#define N_INTEGER_KEYS		0x4000
+/* the number of random operations in the random test */
+#define N_RANDOM_OPS		400000
+/* the number of byte-string keys in the byte-string test */
+#define N_BYTE_KEYS		20000
+/* the longest byte-string key, including the terminating null */
+#define MAX_BYTE_KEY		24
+/* the number of entries kept while churning through keys */
+#define N_CHURN_KEYS		1000
+/* the number of keys put and removed while churning */
+#define N_CHURN_OPS		200000
+/*
+ * the slots the map should keep while churning,
+ * which are the fewest that fit "N_CHURN_KEYS" entries
+ */
+#define MAX_CHURN_CAPACITY	2048
+/* the number of keys in the benchmark, if none is given */
+#define DEFAULT_BENCH_SIZE	1000000
+/* the number of lookups in the benchmark for each key in the tables */
+#define BENCH_LOOKUPS_PER_KEY	4
+/* multiplies the index of a benchmark key, spreading the keys out */
+#define BENCH_KEY_MULTIPLIER	0x9e3779b97f4a7c15ULL
+
+/* a node of a "struct chained_table" */
+struct chained_node {
+	/* the key */
+	uint64_t key;
+	/* the value associated with the key */
+	void *value;
+	/* the next node in the same bucket, or NULL */
+	struct chained_node *next;
+};
+
+/*
+ * a hash table with a linked list of separately allocated nodes
+ * in each bucket, as the baseline for the benchmark of "struct hash_map"
+ */
+struct chained_table {
+	/* the number of buckets, which is a power of 2 */
+	size_t n_buckets;
+	/* the number of entries */
+	size_t size;
+	/* the first node of each bucket, or NULL */
+	struct chained_node **buckets;
+};
+
+/* the state of the pseudo-random generator of the test */
+static uint32_t random_state = 0x2545f491;
+
+/*
+ * Generate the next pseudo-random number, from a fixed seed.
+ * returns	the next number
+ */
+static uint32_t next_random()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+/*
+ * Make the value stored for a key, which is never NULL.
+ * key:		the key
+ * returns	the value
+ */
+static inline void *key_value(uint64_t key)
+{
+	return (void *) (uintptr_t) (key * 2 + 1);
+}
+
+/*
+ * Put, get and remove random integer keys,
+ * checking the map against an array of which keys it should hold.
+ * returns	1 iff the map always agreed with the array
+ */
+static int test_random_integers()
+{
+	struct hash_map map;
+	int present[N_INTEGER_KEYS] = {0};
+	size_t n_present = 0;
+	size_t op_i;
+	int passed = 1;
+
+	if (init_hash_map(&map, 0)) {
+		return 0;
+	}
+
+	for (op_i = 0; op_i < N_RANDOM_OPS && passed; op_i++) {
+		uint32_t random = next_random();
+		/* Spread the keys out, so they are not just small numbers. */
+		size_t key_i = random % N_INTEGER_KEYS;
+		uint64_t key = key_i * 0x100000001ULL;
+		void *value = NULL;
+
+		switch ((random >> 16) % 3) {
+		case 0:
+			if (put_hash_map(&map, key, key_value(key))) {
+				passed = 0;
+			}
+			n_present += !present[key_i];
+			present[key_i] = 1;
+			break;
+		case 1:
+			if (remove_hash_map(&map, key, &value) !=
+			    (present[key_i] ? 0 : -1) ||
+			    (present[key_i] && value != key_value(key))) {
+				printlg(ERROR_LEVEL, "Could not remove %u.\n",
+					(unsigned) key_i);
+				passed = 0;
+			}
+			n_present -= present[key_i];
+			present[key_i] = 0;
+			break;
+		default:
+			if (get_hash_map(&map, key, &value) !=
+			    (present[key_i] ? 0 : -1) ||
+			    (present[key_i] && value != key_value(key))) {
+				printlg(ERROR_LEVEL, "Could not get %u.\n",
+					(unsigned) key_i);
+				passed = 0;
+			}
+			break;
+		}
+
+		if (map.size != n_present) {
+			printlg(ERROR_LEVEL, "Size %u should be %u.\n",
+				(unsigned) map.size, (unsigned) n_present);
+			passed = 0;
+		}
+	}
+
+	teardown_hash_map(&map);
+	return passed;
+}
+
+/*
+ * Put byte-string keys of different lengths, including an empty one,
+ * replace some values, remove half the keys,
+ * and check the rest are all still there.
+ * returns	1 iff every lookup gave the expected result
+ */
+static int test_byte_keys()
+{
+	struct hash_map map;
+	char (*keys)[MAX_BYTE_KEY] = malloc(MAX_BYTE_KEY * N_BYTE_KEYS);
+	size_t key_sizes[N_BYTE_KEYS];
+	size_t key_i;
+	void *value;
+	int passed = 1;
+
+	if (keys == NULL || init_hash_map(&map, N_BYTE_KEYS / 2)) {
+		free(keys);
+		return 0;
+	}
+
+	/* Key 0 is empty, and the rest share prefixes with each other. */
+	for (key_i = 0; key_i < N_BYTE_KEYS; key_i++) {
+		key_sizes[key_i] = key_i == 0 ? 0 :
+				   (size_t) snprintf(keys[key_i], MAX_BYTE_KEY,
+						     "key %u%.*s",
+						     (unsigned) key_i,
+						     (int) (key_i % 9),
+						     "/////////");
+		if (put_bytes_hash_map(&map, keys[key_i], key_sizes[key_i],
+				       key_value(key_i))) {
+			passed = 0;
+		}
+	}
+	/* Replacing a value should not add an entry. */
+	for (key_i = 0; key_i < N_BYTE_KEYS; key_i += 3) {
+		if (put_bytes_hash_map(&map, keys[key_i], key_sizes[key_i],
+				       key_value(key_i + 1))) {
+			passed = 0;
+		}
+	}
+	if (map.size != N_BYTE_KEYS) {
+		printlg(ERROR_LEVEL, "Size %u should be %u.\n",
+			(unsigned) map.size, (unsigned) N_BYTE_KEYS);
+		passed = 0;
+	}
+
+	for (key_i = 0; key_i < N_BYTE_KEYS; key_i += 2) {
+		if (remove_bytes_hash_map(&map, keys[key_i], key_sizes[key_i],
+					  NULL)) {
+			printlg(ERROR_LEVEL, "Could not remove \"%.*s\".\n",
+				(int) key_sizes[key_i], keys[key_i]);
+			passed = 0;
+		}
+	}
+	for (key_i = 0; key_i < N_BYTE_KEYS; key_i++) {
+		void *expected = key_value(key_i % 3 == 0 ? key_i + 1 : key_i);
+		int found = !get_bytes_hash_map(&map, keys[key_i],
+						key_sizes[key_i], &value);
+
+		if (found != (key_i % 2 == 1) ||
+		    (found && value != expected)) {
+			printlg(ERROR_LEVEL, "Wrong lookup of \"%.*s\".\n",
+				(int) key_sizes[key_i], keys[key_i]);
+			passed = 0;
+		}
+	}
+	/* A prefix of a key is a different key. */
+	if (!get_bytes_hash_map(&map, keys[1], key_sizes[1] - 1, &value)) {
+		printlg(ERROR_LEVEL, "Found a prefix of a key.\n");
+		passed = 0;
+	}
+
+	teardown_hash_map(&map);
+	free(keys);
+	return passed;
+}
+
+/*
+ * Keep putting new keys and removing old ones, with few entries at once,
+ * so that the map fills with deleted slots.
+ * returns	1 iff the lookups were right,
+ *		and the map did not grow with the deleted slots
+ */
+static int test_churn()
+{
+	struct hash_map map;
+	uint64_t key;
+	void *value;
+	int passed = 1;
+
+	if (init_hash_map(&map, N_CHURN_KEYS)) {
+		return 0;
+	}
+
+	for (key = 0; key < N_CHURN_OPS; key++) {
+		if (put_hash_map(&map, key, key_value(key))) {
+			passed = 0;
+		}
+		if (key >= N_CHURN_KEYS &&
+		    (remove_hash_map(&map, key - N_CHURN_KEYS, &value) ||
+		     value != key_value(key - N_CHURN_KEYS))) {
+			printlg(ERROR_LEVEL, "Could not remove %u.\n",
+				(unsigned) (key - N_CHURN_KEYS));
+			passed = 0;
+		}
+	}
+	for (key = N_CHURN_OPS - N_CHURN_KEYS; key < N_CHURN_OPS; key++) {
+		if (get_hash_map(&map, key, &value) ||
+		    value != key_value(key)) {
+			printlg(ERROR_LEVEL, "Could not get %u.\n",
+				(unsigned) key);
+			passed = 0;
+		}
+	}
+	if (map.size != N_CHURN_KEYS ||
+	    map.capacity > MAX_CHURN_CAPACITY) {
+		printlg(ERROR_LEVEL, "Map grew to %u slots for %u entries.\n",
+			(unsigned) map.capacity, (unsigned) map.size);
+		passed = 0;
+	}
+
+	teardown_hash_map(&map);
+	return passed;
+}
+
+/*
+ * Initialize an empty chained table, with a fixed number of buckets.
+ * to_init:	the table to initialize
+ * n_keys:	the number of keys to make room for,
+ *		with at least one bucket for each
+ * returns	0 if successful, -1 if allocation failed
+ */
+static int init_chained_table(struct chained_table *to_init, size_t n_keys)
+{
+	to_init->n_buckets = 1;
+	while (to_init->n_buckets < n_keys) {
+		to_init->n_buckets *= 2;
+	}
+	to_init->size = 0;
+	to_init->buckets = calloc(to_init->n_buckets,
+				  sizeof(struct chained_node *));
+	return to_init->buckets == NULL ? -1 : 0;
+}
+
+/*
+ * Free every node and bucket of a chained table.
+ * to_teardown:	the table to tear down
+ */
+static void teardown_chained_table(struct chained_table *to_teardown)
+{
+	size_t bucket_i;
+
+	for (bucket_i = 0; bucket_i < to_teardown->n_buckets; bucket_i++) {
+		struct chained_node *node = to_teardown->buckets[bucket_i];
+
+		while (node != NULL) {
+			struct chained_node *next = node->next;
+
+			free(node);
+			node = next;
+		}
+	}
+	free(to_teardown->buckets);
+}
+
+/*
+ * Find the bucket of a key in a chained table,
+ * from the top bits of the key times a constant.
+ * table:	the table
+ * key:		the key
+ * returns	the index of the bucket
+ */
+static inline size_t chained_bucket(const struct chained_table *table,
+				    uint64_t key)
+{
+	return (size_t) ((key * BENCH_KEY_MULTIPLIER) >> 32) &
+	       (table->n_buckets - 1);
+}
+
+/*
+ * Put a key that is not in a chained table into the table.
+ * table:	the table
+ * key:		the new key
+ * value:	the value of the key
+ * returns	0 if successful, -1 if allocation failed
+ */
+static int put_chained_table(struct chained_table *table, uint64_t key,
+			     void *value)
+{
+	size_t bucket = chained_bucket(table, key);
+	struct chained_node *node = malloc(sizeof(struct chained_node));
+
+	if (node == NULL) {
+		return -1;
+	}
+	node->key = key;
+	node->value = value;
+	node->next = table->buckets[bucket];
+	table->buckets[bucket] = node;
+	table->size++;
+	return 0;
+}
+
+/*
+ * Look up a key in a chained table.
+ * table:	the table
+ * key:		the key
+ * value_out:	set to the value of the key, if it was found
+ * returns	0 if the key was found, -1 if not
+ */
+static int get_chained_table(const struct chained_table *table, uint64_t key,
+			     void **value_out)
+{
+	const struct chained_node *node;
+
+	for (node = table->buckets[chained_bucket(table, key)]; node != NULL;
+	     node = node->next) {
+		if (node->key == key) {
+			*value_out = node->value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Compare the lookup speed and memory per entry of "struct hash_map"
+ * with those of a chained table holding the same integer keys.
+ * Half of the keys looked up are in the tables, in a random order.
+ * The memory of the chained table does not count
+ * the bookkeeping that "malloc" adds to each node.
+ * n_keys:	the number of keys to put into each table
+ * returns	1 iff both tables found exactly the keys put into them
+ */
+static int test_lookup_speed(size_t n_keys)
+{
+	size_t n_lookups = n_keys * BENCH_LOOKUPS_PER_KEY;
+	/* The keys at indices below "n_keys" are in the tables. */
+	uint64_t *lookups = malloc(sizeof(uint64_t) * n_lookups);
+	struct hash_map map;
+	struct chained_table chained;
+	size_t n_expected = 0, n_map_hits = 0, n_chained_hits = 0;
+	double start, map_time, chained_time;
+	size_t key_i, lookup_i;
+	void *value;
+	int passed = 1;
+
+	if (lookups == NULL) {
+		return 0;
+	}
+	if (init_hash_map(&map, n_keys)) {
+		free(lookups);
+		return 0;
+	}
+	if (init_chained_table(&chained, n_keys)) {
+		teardown_hash_map(&map);
+		free(lookups);
+		return 0;
+	}
+
+	for (key_i = 0; key_i < n_keys && passed; key_i++) {
+		uint64_t key = key_i * BENCH_KEY_MULTIPLIER;
+
+		if (put_hash_map(&map, key, key_value(key)) ||
+		    put_chained_table(&chained, key, key_value(key))) {
+			passed = 0;
+		}
+	}
+	for (lookup_i = 0; lookup_i < n_lookups; lookup_i++) {
+		key_i = (((uint64_t) next_random() << 32) | next_random()) %
+			(n_keys * 2);
+		n_expected += key_i < n_keys;
+		lookups[lookup_i] = key_i * BENCH_KEY_MULTIPLIER;
+	}
+
+	start = now_seconds();
+	for (lookup_i = 0; lookup_i < n_lookups; lookup_i++) {
+		n_map_hits += !get_hash_map(&map, lookups[lookup_i], &value);
+	}
+	map_time = now_seconds() - start;
+	start = now_seconds();
+	for (lookup_i = 0; lookup_i < n_lookups; lookup_i++) {
+		n_chained_hits += !get_chained_table(&chained,
+						     lookups[lookup_i],
+						     &value);
+	}
+	chained_time = now_seconds() - start;
+
+	printlg(INFO_LEVEL, "%u keys, %u lookups, %u hits:\n",
+		(unsigned) n_keys, (unsigned) n_lookups,
+		(unsigned) n_expected);
+	printlg(INFO_LEVEL, "hash map %.1f ns per lookup, "
+		"%.1f bytes per entry.\n", map_time * 1e9 / n_lookups,
+		(double) map.capacity * (1 + sizeof(struct hash_map_entry)) /
+		map.size);
+	printlg(INFO_LEVEL, "chained table %.1f ns per lookup, "
+		"%.1f bytes per entry.\n", chained_time * 1e9 / n_lookups,
+		(double) (chained.n_buckets * sizeof(struct chained_node *) +
+			  chained.size * sizeof(struct chained_node)) /
+		chained.size);
+	if (n_map_hits != n_expected || n_chained_hits != n_expected) {
+		printlg(ERROR_LEVEL, "Found %u and %u keys instead of %u.\n",
+			(unsigned) n_map_hits, (unsigned) n_chained_hits,
+			(unsigned) n_expected);
+		passed = 0;
+	}
+
+	teardown_chained_table(&chained);
+	teardown_hash_map(&map);
+	free(lookups);
+	return passed;
+}
+
+int main(int argc, char **argv)
+{
+	size_t bench_size = DEFAULT_BENCH_SIZE;
+
+	if (argc > 1) {
+		bench_size = strtoul(argv[1], NULL, 0);
+		if (bench_size == 0) {
+			printlg(ERROR_LEVEL, "Invalid benchmark size \"%s\".\n",
+				argv[1]);
+			return 1;
+		}
+	}
+
+	printlg(INFO_LEVEL, "Random integer key test...\n");
+	if (test_random_integers()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Byte-string key test...\n");
+	if (test_byte_keys()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Churn test...\n");
+	if (test_churn()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Lookup speed test...\n");
+	if (test_lookup_speed(bench_size)) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	return 0;
+}
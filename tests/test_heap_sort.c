@@ -1,8 +1,30 @@
+/*
+ * runs tests on the heaps and sorts in "data_structs.h",
+ * "generic_heap.h" and "parallel_sort.h",
+ * and reports the speed of the heaps and sorts.
+ * The number of elements in the benchmarks can be given
+ * as the only argument.
+ */
 #include "heap_sort_tvs.h"
 
 #include <data_structs.h>
+#include <generic_heap.h>
+#include <parallel_sort.h>
 #include <logger.h>
 
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* the number of elements in the benchmarks, if none is given */
+#define DEFAULT_BENCH_SIZE	1000000
+/* the fewest elements in the pop benchmark, which goes up tenfold */
+#define MIN_POP_BENCH_SIZE	10000
+/* the most threads in the parallel sort benchmark, which doubles them */
+#define MAX_BENCH_THREADS	32
+
 /*
  * the data for each heap element,
  * to make sure that sorting was done correctly.
@@ -26,11 +48,14 @@ struct element_checker {
 };
 
 /*
- * Run a single heap sort test
+ * Run a single sorting test
  * tv:		the test case vector
+ * sorter:	the sorting function to test,
+ *		which returns 0 iff successful
  * returns	1 iff passed, 0 otherwise
  */
-static int test_heap_sort(struct heap_sort_tv *tv)
+static int _test_sort(struct heap_sort_tv *tv,
+		      int (*sorter)(struct heap_element *array, size_t size))
 {
 	size_t n_keys = tv->n_keys;
 	int correct = 1;
@@ -51,8 +76,8 @@ static int test_heap_sort(struct heap_sort_tv *tv)
 	}
 
 	/* sorting */
-	if (heap_sort(elements, n_keys)) {
-		printlg(ERROR_LEVEL, "Heap sort failed.\n");
+	if (sorter(elements, n_keys)) {
+		printlg(ERROR_LEVEL, "Sort failed.\n");
 		return 0;
 	}
 
@@ -111,15 +136,579 @@ static int test_heap_sort(struct heap_sort_tv *tv)
 }
 
 /*
- * Run all heap sort tests.
+ * wrapper around "heap_sort_in_place",
+ * so that it has the same signature as "heap_sort"
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0, since sorting in place cannot fail
+ */
+static int heap_sort_in_place_wrapper(struct heap_element *array, size_t size)
+{
+	heap_sort_in_place(array, size);
+	return 0;
+}
+
+/*
+ * Sort an array as "heap_sort" did before it sorted in place,
+ * by heapifying the array into a newly allocated min-heap,
+ * then popping every element back out into the array.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int allocating_heap_sort(struct heap_element *array, size_t size)
+{
+	struct min_heap sorter;
+	size_t element_i;
+	int failed = 0;
+
+	if (init_min_heap(&sorter, size)) {
+		return -1;
+	}
+
+	failed = heapify(&sorter, array, size);
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		failed = pop_min_heap(&array[element_i], &sorter);
+	}
+
+	teardown_min_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Sort an array by pushing every element into a min-heap one at a time,
+ * then peeking at and popping the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int push_pop_sort(struct heap_element *array, size_t size)
+{
+	struct min_heap sorter;
+	struct heap_element head;
+	size_t element_i;
+	int failed = 0;
+
+	if (init_min_heap(&sorter, size)) {
+		return -1;
+	}
+
+	for (element_i = 0; element_i < size; element_i++) {
+		if (push_min_heap(&sorter, &array[element_i])) {
+			printlg(ERROR_LEVEL, "Failed to push element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		}
+	}
+	if (push_min_heap(&sorter, &array[0]) == 0) {
+		printlg(ERROR_LEVEL, "Pushed past the capacity.\n");
+		failed = 1;
+	}
+
+	for (element_i = 0; element_i < size; element_i++) {
+		if (peek_min_heap(&head, &sorter) ||
+		    pop_min_heap(&array[element_i], &sorter)) {
+			printlg(ERROR_LEVEL, "Failed to pop element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		} else if (head.data != array[element_i].data) {
+			printlg(ERROR_LEVEL,
+				"Peeked at a different element than popped.\n");
+			failed = 1;
+		}
+	}
+	if (peek_min_heap(&head, &sorter) == 0) {
+		printlg(ERROR_LEVEL, "Peeked into an empty heap.\n");
+		failed = 1;
+	}
+
+	teardown_min_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Sort an array by heapifying it in a d-ary heap,
+ * then peeking at and popping the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int dary_heapify_sort(struct heap_element *array, size_t size)
+{
+	struct dary_min_heap sorter;
+	struct heap_element head;
+	size_t element_i;
+	int failed = 0;
+
+	if (init_dary_min_heap(&sorter, size)) {
+		return -1;
+	}
+
+	if (heapify_dary(&sorter, array, size)) {
+		printlg(ERROR_LEVEL, "Failed to heapify.\n");
+		failed = 1;
+	}
+
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		if (peek_dary_min_heap(&head, &sorter) ||
+		    pop_dary_min_heap(&array[element_i], &sorter)) {
+			printlg(ERROR_LEVEL, "Failed to pop element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		} else if (head.data != array[element_i].data) {
+			printlg(ERROR_LEVEL,
+				"Peeked at a different element than popped.\n");
+			failed = 1;
+		}
+	}
+	if (pop_dary_min_heap(&head, &sorter) == 0) {
+		printlg(ERROR_LEVEL, "Popped from an empty heap.\n");
+		failed = 1;
+	}
+
+	teardown_dary_min_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Sort an array by pushing every element into a d-ary heap one at a time,
+ * then popping the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int dary_push_sort(struct heap_element *array, size_t size)
+{
+	struct dary_min_heap sorter;
+	size_t element_i;
+	int failed = 0;
+
+	if (init_dary_min_heap(&sorter, size)) {
+		return -1;
+	}
+
+	for (element_i = 0; element_i < size; element_i++) {
+		if (push_dary_min_heap(&sorter, &array[element_i])) {
+			printlg(ERROR_LEVEL, "Failed to push element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		}
+	}
+	if (push_dary_min_heap(&sorter, &array[0]) == 0) {
+		printlg(ERROR_LEVEL, "Pushed past the capacity.\n");
+		failed = 1;
+	}
+
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		if (pop_dary_min_heap(&array[element_i], &sorter)) {
+			printlg(ERROR_LEVEL, "Failed to pop element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		}
+	}
+
+	teardown_dary_min_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Sort an array by heapifying part of it in a structure-of-arrays heap,
+ * pushing the rest, then peeking at and popping the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int soa_sort(struct heap_element *array, size_t size)
+{
+	struct soa_min_heap sorter;
+	struct heap_element head;
+	size_t n_heapified = size / 2;
+	size_t element_i;
+	int failed = 0;
+
+	if (init_soa_min_heap(&sorter, size)) {
+		return -1;
+	}
+
+	if (heapify_soa(&sorter, array, n_heapified)) {
+		printlg(ERROR_LEVEL, "Failed to heapify.\n");
+		failed = 1;
+	}
+	for (element_i = n_heapified; element_i < size; element_i++) {
+		if (push_soa_min_heap(&sorter, &array[element_i])) {
+			printlg(ERROR_LEVEL, "Failed to push element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		}
+	}
+
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		if (peek_soa_min_heap(&head, &sorter) ||
+		    pop_soa_min_heap(&array[element_i], &sorter)) {
+			printlg(ERROR_LEVEL, "Failed to pop element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		} else if (head.data != array[element_i].data) {
+			printlg(ERROR_LEVEL,
+				"Peeked at a different element than popped.\n");
+			failed = 1;
+		}
+	}
+	if (pop_soa_min_heap(&head, &sorter) == 0) {
+		printlg(ERROR_LEVEL, "Popped from an empty heap.\n");
+		failed = 1;
+	}
+
+	teardown_soa_min_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/* a generated heap with the same types as "struct min_heap" */
+DEFINE_MIN_HEAP(int_heap, int, void *, a < b)
+
+/*
+ * Sort an array through a generated heap,
+ * by heapifying the first half, pushing the rest,
+ * then peeking at and popping all the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int generated_heap_sort(struct heap_element *array, size_t size)
+{
+	struct int_heap sorter;
+	/* one spare, so that the array is not empty */
+	struct int_heap_element copies[size + 1];
+	struct int_heap_element head, popped;
+	size_t n_heapified = size / 2;
+	size_t element_i;
+	int failed = 0;
+
+	if (int_heap_init(&sorter, size)) {
+		return -1;
+	}
+
+	for (element_i = 0; element_i < size; element_i++) {
+		copies[element_i].key = array[element_i].key;
+		copies[element_i].value = array[element_i].data;
+	}
+	if (int_heap_heapify(&sorter, copies, n_heapified)) {
+		printlg(ERROR_LEVEL, "Failed to heapify.\n");
+		failed = 1;
+	}
+	for (element_i = n_heapified; element_i < size; element_i++) {
+		if (int_heap_push(&sorter, &copies[element_i])) {
+			printlg(ERROR_LEVEL, "Failed to push element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		}
+	}
+
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		if (int_heap_peek(&head, &sorter) ||
+		    int_heap_pop(&popped, &sorter)) {
+			printlg(ERROR_LEVEL, "Failed to pop element %u.\n",
+				(unsigned) element_i);
+			failed = 1;
+		} else if (head.value != popped.value) {
+			printlg(ERROR_LEVEL,
+				"Peeked at a different element than popped.\n");
+			failed = 1;
+		} else {
+			array[element_i].key = popped.key;
+			array[element_i].data = popped.value;
+		}
+	}
+
+	int_heap_teardown(&sorter);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Sort an array in place with the sort of a generated heap.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0, since sorting in place cannot fail
+ */
+static int generated_sort(struct heap_element *array, size_t size)
+{
+	/* one spare, so that the array is not empty */
+	struct int_heap_element copies[size + 1];
+	size_t element_i;
+
+	for (element_i = 0; element_i < size; element_i++) {
+		copies[element_i].key = array[element_i].key;
+		copies[element_i].value = array[element_i].data;
+	}
+	int_heap_sort(copies, size);
+	for (element_i = 0; element_i < size; element_i++) {
+		array[element_i].key = copies[element_i].key;
+		array[element_i].data = copies[element_i].value;
+	}
+
+	return 0;
+}
+
+/*
+ * Sort an array with "parallel_sort" on 4 threads,
+ * which splits into an even number of runs.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int parallel_sort_4(struct heap_element *array, size_t size)
+{
+	return parallel_sort(array, size, 4);
+}
+
+/*
+ * Sort an array with "parallel_sort" on 3 threads,
+ * which leaves a run without a partner in the first merge.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int parallel_sort_3(struct heap_element *array, size_t size)
+{
+	return parallel_sort(array, size, 3);
+}
+
+/* the number of runs into which to split an array to merge it */
+#define N_MERGED_RUNS	5
+
+/*
+ * Split an array into sorted runs of uneven sizes, some of them empty,
+ * and set up a merger for them.
+ * merger:	the merger to initialize
+ * array:	the array to split, whose runs will be sorted
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int split_and_merge(struct run_merger *merger,
+			   struct heap_element *array, size_t size)
+{
+	struct heap_element *runs[N_MERGED_RUNS];
+	size_t sizes[N_MERGED_RUNS];
+	size_t run_i, start = 0;
+
+	for (run_i = 0; run_i < N_MERGED_RUNS; run_i++) {
+		/* The first run gets half, and the second run is empty. */
+		size_t end = run_i == N_MERGED_RUNS - 1 ? size :
+			     run_i == 1 ? start : start + (size - start) / 2;
+
+		runs[run_i] = array + start;
+		sizes[run_i] = end - start;
+		heap_sort(runs[run_i], sizes[run_i]);
+		start = end;
+	}
+
+	return init_run_merger(merger, runs, sizes, N_MERGED_RUNS);
+}
+
+/*
+ * Sort an array by splitting it into sorted runs,
+ * then merging them with "merge_into".
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int merge_into_sort(struct heap_element *array, size_t size)
+{
+	struct run_merger merger;
+	/* one spare, so that the array is not empty */
+	struct heap_element merged[size + 1];
+	size_t n_merged;
+
+	if (split_and_merge(&merger, array, size)) {
+		return -1;
+	}
+
+	n_merged = merge_into(merged, &merger);
+	teardown_run_merger(&merger);
+	if (n_merged != size) {
+		printlg(ERROR_LEVEL, "Merged %u elements, instead of %u.\n",
+			(unsigned) n_merged, (unsigned) size);
+		return -1;
+	}
+
+	memcpy(array, merged, sizeof(struct heap_element) * size);
+	return 0;
+}
+
+/*
+ * Sort an array by splitting it into sorted runs,
+ * then merging them one element at a time with "next_run_merger".
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int merge_next_sort(struct heap_element *array, size_t size)
+{
+	struct run_merger merger;
+	struct heap_element merged[size + 1];
+	size_t n_merged = 0;
+
+	if (split_and_merge(&merger, array, size)) {
+		return -1;
+	}
+
+	while (n_merged <= size &&
+	       next_run_merger(&merged[n_merged], &merger) == 0) {
+		n_merged++;
+	}
+	teardown_run_merger(&merger);
+	if (n_merged != size) {
+		printlg(ERROR_LEVEL, "Merged %u elements, instead of %u.\n",
+			(unsigned) n_merged, (unsigned) size);
+		return -1;
+	}
+
+	memcpy(array, merged, sizeof(struct heap_element) * size);
+	return 0;
+}
+
+/*
+ * Sort an array by offering every element to a top-K accumulator
+ * that keeps all of them, then reading back the results.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int top_k_sort(struct heap_element *array, size_t size)
+{
+	/* one spare, so that the array is not empty */
+	struct heap_element offered[size + 1];
+	struct top_k top;
+
+	memcpy(offered, array, sizeof(struct heap_element) * size);
+	if (init_top_k(&top, size, 0)) {
+		return -1;
+	}
+	if (offer_many_top_k(&top, offered, size) != size ||
+	    results_top_k(array, &top) != size) {
+		printlg(ERROR_LEVEL, "Not every element was kept.\n");
+		teardown_top_k(&top);
+		return -1;
+	}
+
+	teardown_top_k(&top);
+	return 0;
+}
+
+/*
+ * Sort an array by pushing every element into a radix heap,
+ * then peeking at and popping the elements back out.
+ * array:	the array to sort
+ * size:	the number of elements in the array
+ * returns	0 iff successful, -1 otherwise
+ */
+static int radix_heap_sort(struct heap_element *array, size_t size)
+{
+	struct radix_heap sorter;
+	struct heap_element head;
+	size_t element_i;
+	int failed = 0;
+
+	init_radix_heap(&sorter);
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		failed = push_radix_heap(&sorter, &array[element_i]);
+	}
+	for (element_i = 0; element_i < size && !failed; element_i++) {
+		failed = peek_radix_heap(&head, &sorter) ||
+			 pop_radix_heap(&array[element_i], &sorter) ||
+			 head.data != array[element_i].data;
+	}
+	if (failed || pop_radix_heap(&head, &sorter) == 0) {
+		printlg(ERROR_LEVEL, "Radix heap did not sort.\n");
+		failed = 1;
+	}
+
+	teardown_radix_heap(&sorter);
+	return failed ? -1 : 0;
+}
+
+/* a sorting function to test, and its name for the log */
+struct sorter {
+	/* the name to print in the log */
+	char *name;
+	/* the sorting function, which returns 0 iff successful */
+	int (*sort)(struct heap_element *array, size_t size);
+};
+
+/* all the sorting functions that are run on every test vector */
+static struct sorter sorters[] = {
+	{.name = "Heap sort", .sort = heap_sort},
+	{.name = "In-place heap sort", .sort = heap_sort_in_place_wrapper},
+	{.name = "Allocating heap sort", .sort = allocating_heap_sort},
+	{.name = "Radix sort", .sort = radix_sort},
+	{.name = "Push and pop sort", .sort = push_pop_sort},
+	{.name = "D-ary heapify sort", .sort = dary_heapify_sort},
+	{.name = "D-ary push sort", .sort = dary_push_sort},
+	{.name = "Structure-of-arrays heap sort", .sort = soa_sort},
+	{.name = "Generated heap sort", .sort = generated_heap_sort},
+	{.name = "Generated in-place sort", .sort = generated_sort},
+	{.name = "4-thread parallel sort", .sort = parallel_sort_4},
+	{.name = "3-thread parallel sort", .sort = parallel_sort_3},
+	{.name = "Bulk merge sort", .sort = merge_into_sort},
+	{.name = "Lazy merge sort", .sort = merge_next_sort},
+	{.name = "Top-K sort", .sort = top_k_sort},
+	{.name = "Radix heap sort", .sort = radix_heap_sort},
+};
+#define N_SORTERS	(sizeof(sorters) / sizeof(sorters[0]))
+
+/* the number of keys in the generated test */
+#define N_GENERATED_KEYS	5000
+/*
+ * Fill an array with pseudo-random keys from a fixed seed,
+ * so that the generated test is large enough to take the paths
+ * that are skipped for small arrays, but is still reproducible.
+ * keys:	the output keys
+ * n_keys:	the number of keys to generate
+ */
+static void generate_keys(int *keys, size_t n_keys)
+{
+	uint32_t state = 0x2545f491;
+	size_t key_i;
+
+	for (key_i = 0; key_i < n_keys; key_i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		/* Use both the full range and a narrow one with repeats. */
+		keys[key_i] = (key_i % 2) ? (int) state :
+			      (int) (state % 64) - 32;
+	}
+}
+
+/*
+ * Run all sort tests, with every sorter.
  */
 static void test_heap_sorts()
 {
-	size_t test_i;
-	for (test_i = 0; test_i < N_HEAP_SORT_TVS; test_i++) {
-		printlg(INFO_LEVEL,
-			"Heap sort test %u...\n", (unsigned) test_i);
-		if (test_heap_sort(heap_sort_tvs[test_i])) {
+	int generated_keys[N_GENERATED_KEYS];
+	struct heap_sort_tv generated = {
+		.n_keys = N_GENERATED_KEYS,
+		.keys = generated_keys,
+	};
+	size_t sorter_i, test_i;
+
+	generate_keys(generated_keys, N_GENERATED_KEYS);
+
+	for (sorter_i = 0; sorter_i < N_SORTERS; sorter_i++) {
+		struct sorter *sorter = &sorters[sorter_i];
+
+		for (test_i = 0; test_i < N_HEAP_SORT_TVS; test_i++) {
+			printlg(INFO_LEVEL, "%s test %u...\n", sorter->name,
+				(unsigned) test_i);
+			if (_test_sort(heap_sort_tvs[test_i], sorter->sort)) {
+				printlg(INFO_LEVEL, "Passed!\n\n");
+			} else {
+				printlg(ERROR_LEVEL, "Failed!\n\n");
+			}
+		}
+
+		printlg(INFO_LEVEL, "%s generated test...\n", sorter->name);
+		if (_test_sort(&generated, sorter->sort)) {
 			printlg(INFO_LEVEL, "Passed!\n\n");
 		} else {
 			printlg(ERROR_LEVEL, "Failed!\n\n");
@@ -127,9 +716,1073 @@ static void test_heap_sorts()
 	}
 }
 
-int main(void)
+/* the capacity of the heap used as a priority queue */
+#define QUEUE_CAPACITY	64
+/* the number of operations to run on the priority queue */
+#define N_QUEUE_OPS	(N_GENERATED_KEYS * 4)
+
+/*
+ * Find the smallest key in the reference copy of the queue.
+ * keys:	the keys in the queue, in no particular order
+ * n_keys:	the number of keys in the queue, which must be positive
+ * returns	the position of the smallest key
+ */
+static size_t find_min_key(int *keys, size_t n_keys)
 {
-	test_heap_sorts();
+	size_t min_i = 0, key_i;
+
+	for (key_i = 1; key_i < n_keys; key_i++) {
+		if (keys[key_i] < keys[min_i]) {
+			min_i = key_i;
+		}
+	}
+
+	return min_i;
+}
+
+/*
+ * Run a mix of pushes, pops, replacements and push-pops on a heap,
+ * and check every removed key against a plain, unsorted copy of the queue,
+ * then fill the heap, and check pushes and push-pops while it is full.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_priority_queue()
+{
+	int keys[N_GENERATED_KEYS];
+	/* A push-pop holds one key more than the queue, for a moment. */
+	int reference[QUEUE_CAPACITY + 1];
+	size_t n_reference = 0;
+	struct min_heap queue;
+	struct heap_element in, out;
+	size_t op_i, min_i;
+	int passed = 1;
+
+	generate_keys(keys, N_GENERATED_KEYS);
+	if (init_min_heap(&queue, QUEUE_CAPACITY)) {
+		printlg(ERROR_LEVEL, "Could not create queue.\n");
+		return 0;
+	}
+
+	for (op_i = 0; op_i < N_QUEUE_OPS && passed; op_i++) {
+		int op = (unsigned) keys[(op_i * 7) % N_GENERATED_KEYS] % 4;
+
+		in.key = keys[op_i % N_GENERATED_KEYS];
+		in.data = NULL;
+
+		/* Push if empty, and pop if full. */
+		if (n_reference == 0) {
+			op = 0;
+		} else if (n_reference == QUEUE_CAPACITY && op == 0) {
+			op = 1;
+		}
+
+		switch (op) {
+		case 0:
+			if (push_min_heap(&queue, &in)) {
+				passed = 0;
+			}
+			reference[n_reference++] = in.key;
+			break;
+		case 1:
+			if (pop_min_heap(&out, &queue)) {
+				passed = 0;
+			}
+			min_i = find_min_key(reference, n_reference);
+			if (out.key != reference[min_i]) {
+				passed = 0;
+			}
+			reference[min_i] = reference[--n_reference];
+			break;
+		case 2:
+			/* The old head leaves before the new key enters. */
+			if (replace_min_heap(&out, &queue, &in)) {
+				passed = 0;
+			}
+			min_i = find_min_key(reference, n_reference);
+			if (out.key != reference[min_i]) {
+				passed = 0;
+			}
+			reference[min_i] = in.key;
+			break;
+		default:
+			/* The new key enters before the head leaves. */
+			pushpop_min_heap(&out, &queue, &in);
+			reference[n_reference++] = in.key;
+			min_i = find_min_key(reference, n_reference);
+			if (out.key != reference[min_i]) {
+				passed = 0;
+			}
+			reference[min_i] = reference[--n_reference];
+		}
+	}
+
+	if (!passed) {
+		printlg(ERROR_LEVEL, "Operation %u gave the wrong result.\n",
+			(unsigned) (op_i - 1));
+	} else if (queue.size != n_reference) {
+		printlg(ERROR_LEVEL, "Queue has %u elements, instead of %u.\n",
+			(unsigned) queue.size, (unsigned) n_reference);
+		passed = 0;
+	}
+
+	/* Fill the queue, which then refuses a push, but not a push-pop. */
+	for (op_i = 0; n_reference < QUEUE_CAPACITY && passed; op_i++) {
+		in.key = keys[op_i];
+		passed = !push_min_heap(&queue, &in);
+		reference[n_reference++] = in.key;
+	}
+	in.key = keys[op_i];
+	passed = passed && push_min_heap(&queue, &in) == -1 &&
+		 errno == ERANGE && queue.size == QUEUE_CAPACITY;
+	for (; op_i < QUEUE_CAPACITY * 3 && passed; op_i++) {
+		in.key = keys[op_i];
+		pushpop_min_heap(&out, &queue, &in);
+		reference[n_reference++] = in.key;
+		min_i = find_min_key(reference, n_reference);
+		passed = out.key == reference[min_i];
+		reference[min_i] = reference[--n_reference];
+	}
+	/* Everything comes back out in order. */
+	while (n_reference > 0 && passed) {
+		min_i = find_min_key(reference, n_reference);
+		passed = !pop_min_heap(&out, &queue) &&
+			 out.key == reference[min_i];
+		reference[min_i] = reference[--n_reference];
+	}
+	if (!passed || queue.size != 0) {
+		printlg(ERROR_LEVEL, "The full queue gave the wrong result.\n");
+		passed = 0;
+	}
+
+	teardown_min_heap(&queue);
+	return passed;
+}
+
+/*
+ * Find the smallest key in the reference copy of an indexed queue.
+ * keys:	the key of every handle
+ * present:	whether each handle is in the queue
+ * n_handles:	the number of handles
+ * returns	the smallest key of any present handle
+ */
+static int find_min_indexed_key(int *keys, int *present, size_t n_handles)
+{
+	int min_key = 0;
+	int found = 0;
+	size_t handle_i;
+
+	for (handle_i = 0; handle_i < n_handles; handle_i++) {
+		if (present[handle_i] && (!found || keys[handle_i] < min_key)) {
+			min_key = keys[handle_i];
+			found = 1;
+		}
+	}
+
+	return min_key;
+}
+
+/*
+ * Run a mix of pushes, pops, key changes and removals on an indexed heap,
+ * and check the results against a plain copy of the keys of every handle.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_indexed_queue()
+{
+	int keys[N_GENERATED_KEYS];
+	int reference[QUEUE_CAPACITY];
+	int present[QUEUE_CAPACITY];
+	size_t n_present = 0;
+	struct indexed_min_heap queue;
+	struct heap_element in, out;
+	size_t op_i, handle;
+	int passed = 1;
+
+	generate_keys(keys, N_GENERATED_KEYS);
+	if (init_indexed_min_heap(&queue, QUEUE_CAPACITY)) {
+		printlg(ERROR_LEVEL, "Could not create indexed queue.\n");
+		return 0;
+	}
+	memset(present, 0, sizeof(present));
+
+	for (op_i = 0; op_i < N_QUEUE_OPS && passed; op_i++) {
+		unsigned choice;
+		int key = keys[op_i % N_GENERATED_KEYS] / 2;
+		int op;
+
+		choice = (unsigned) keys[(op_i * 7) % N_GENERATED_KEYS];
+		op = choice % 5;
+
+		/* Pick a handle in use for changes and removals. */
+		handle = (choice / 5) % QUEUE_CAPACITY;
+		while (n_present > 0 && !present[handle]) {
+			handle = (handle + 1) % QUEUE_CAPACITY;
+		}
+
+		if (n_present == 0) {
+			op = 0;
+		} else if (n_present == QUEUE_CAPACITY && op == 0) {
+			op = 1;
+		}
+
+		switch (op) {
+		case 0:
+			in.key = key;
+			in.data = NULL;
+			if (push_indexed_min_heap(&queue, &in, &handle) ||
+			    present[handle]) {
+				passed = 0;
+				break;
+			}
+			reference[handle] = key;
+			present[handle] = 1;
+			n_present++;
+			break;
+		case 1:
+			if (pop_indexed_min_heap(&out, &handle, &queue) ||
+			    out.key != find_min_indexed_key(reference, present,
+							    QUEUE_CAPACITY) ||
+			    out.key != reference[handle]) {
+				passed = 0;
+				break;
+			}
+			present[handle] = 0;
+			n_present--;
+			break;
+		case 2:
+			key = reference[handle] - (choice % 100);
+			if (decrease_key_indexed_min_heap(&queue, handle,
+							  key)) {
+				passed = 0;
+			}
+			reference[handle] = key;
+			break;
+		case 3:
+			key = reference[handle] + (choice % 100);
+			if (increase_key_indexed_min_heap(&queue, handle,
+							  key)) {
+				passed = 0;
+			}
+			reference[handle] = key;
+			break;
+		default:
+			if (remove_indexed_min_heap(&out, &queue, handle) ||
+			    out.key != reference[handle] ||
+			    in_indexed_min_heap(&queue, handle)) {
+				passed = 0;
+			}
+			present[handle] = 0;
+			n_present--;
+		}
+
+		/* The element of every handle still in use must be intact. */
+		if (passed && n_present > 0) {
+			handle = choice % QUEUE_CAPACITY;
+			if (in_indexed_min_heap(&queue, handle) !=
+			    present[handle] ||
+			    (present[handle] &&
+			     get_indexed_min_heap(&queue, handle)->key !=
+			     reference[handle])) {
+				passed = 0;
+			}
+		}
+	}
+
+	if (!passed) {
+		printlg(ERROR_LEVEL, "Operation %u gave the wrong result.\n",
+			(unsigned) (op_i - 1));
+	} else if (queue.size != n_present) {
+		printlg(ERROR_LEVEL, "Queue has %u elements, instead of %u.\n",
+			(unsigned) queue.size, (unsigned) n_present);
+		passed = 0;
+	}
+	teardown_indexed_min_heap(&queue);
+
+	/* A queue with no room at all can still be created. */
+	if (passed && (init_indexed_min_heap(&queue, 0) ||
+		       !push_indexed_min_heap(&queue, &in, &handle) ||
+		       errno != ERANGE)) {
+		printlg(ERROR_LEVEL, "Empty queue did not reject a push.\n");
+		passed = 0;
+	}
+	teardown_indexed_min_heap(&queue);
+
+	return passed;
+}
+
+/*
+ * a generated heap with floating-point keys,
+ * which puts the largest key first
+ */
+DEFINE_MIN_HEAP(score_heap, double, size_t, a > b)
+
+/*
+ * Check a generated heap with other key and value types,
+ * and a reversed comparison, by sorting scores from highest to lowest.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_generated_scores()
+{
+	int keys[N_GENERATED_KEYS];
+	struct score_heap_element scores[N_GENERATED_KEYS];
+	struct score_heap heap;
+	struct score_heap_element popped;
+	size_t score_i;
+	int passed = 1;
+
+	generate_keys(keys, N_GENERATED_KEYS);
+	for (score_i = 0; score_i < N_GENERATED_KEYS; score_i++) {
+		scores[score_i].key = keys[score_i] / 7.0;
+		scores[score_i].value = score_i;
+	}
+
+	if (score_heap_init(&heap, N_GENERATED_KEYS) ||
+	    score_heap_heapify(&heap, scores, N_GENERATED_KEYS)) {
+		printlg(ERROR_LEVEL, "Could not create score heap.\n");
+		return 0;
+	}
+	score_heap_sort(scores, N_GENERATED_KEYS);
+
+	for (score_i = 0; score_i < N_GENERATED_KEYS; score_i++) {
+		if (score_heap_pop(&popped, &heap) ||
+		    popped.key != scores[score_i].key ||
+		    (score_i > 0 &&
+		     scores[score_i].key > scores[score_i - 1].key) ||
+		    keys[scores[score_i].value] / 7.0 != scores[score_i].key) {
+			printlg(ERROR_LEVEL, "Score %u is out of order.\n",
+				(unsigned) score_i);
+			passed = 0;
+			break;
+		}
+	}
+
+	score_heap_teardown(&heap);
+	return passed;
+}
+
+/* the number of layouts of keys tried by "test_selection" */
+#define N_SELECTION_LAYOUTS	5
+/* the number of K values tried on each layout by "test_selection" */
+#define N_SELECTION_KS		6
+
+/*
+ * Fill an array with keys laid out to stress selection,
+ * each element's data pointing to its original key.
+ * elements:	the output elements
+ * keys:	the generated keys, which the data will point to
+ * n_keys:	the number of keys
+ * layout:	which layout to use:
+ *		0 for the generated order, 1 for sorted, 2 for reversed,
+ *		3 for all equal, and 4 for rising then falling
+ */
+static void lay_out_keys(struct heap_element *elements, int *keys,
+			 size_t n_keys, unsigned layout)
+{
+	size_t key_i;
+
+	generate_keys(keys, n_keys);
+	for (key_i = 0; key_i < n_keys; key_i++) {
+		switch (layout) {
+		case 1:
+			keys[key_i] = (int) key_i;
+			break;
+		case 2:
+			keys[key_i] = -(int) key_i;
+			break;
+		case 3:
+			keys[key_i] = 7;
+			break;
+		case 4:
+			keys[key_i] = key_i < n_keys / 2 ? (int) key_i :
+				      (int) (n_keys - key_i);
+			break;
+		}
+		elements[key_i].key = keys[key_i];
+		elements[key_i].data = &keys[key_i];
+	}
+}
+
+/*
+ * Check that elements kept their data, and hold the expected keys.
+ * elements:	the elements to check
+ * expected:	the expected keys, in order
+ * n_elements:	the number of elements to check
+ * returns	1 iff all the keys and data match, 0 otherwise
+ */
+static int check_keys(struct heap_element *elements, int *expected,
+		      size_t n_elements)
+{
+	size_t element_i;
+
+	for (element_i = 0; element_i < n_elements; element_i++) {
+		if (elements[element_i].key != expected[element_i] ||
+		    *(int *) elements[element_i].data !=
+		    elements[element_i].key) {
+			printlg(ERROR_LEVEL,
+				"At position %u, key %d should be %d.\n",
+				(unsigned) element_i,
+				elements[element_i].key,
+				expected[element_i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Check that no key before a position is larger than the key there,
+ * and no key after it is smaller.
+ * elements:	the elements to check
+ * n_elements:	the number of elements
+ * nth:		the position splitting the elements
+ * returns	1 iff the elements are split correctly, 0 otherwise
+ */
+static int check_split(struct heap_element *elements, size_t n_elements,
+		       size_t nth)
+{
+	size_t element_i;
+
+	for (element_i = 0; element_i < n_elements; element_i++) {
+		if ((element_i < nth &&
+		     elements[element_i].key > elements[nth].key) ||
+		    (element_i > nth &&
+		     elements[element_i].key < elements[nth].key)) {
+			printlg(ERROR_LEVEL,
+				"Key %d is on the wrong side of position %u.\n",
+				elements[element_i].key, (unsigned) nth);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Check "nth_element", "partial_sort" and the top-K accumulator
+ * against a full sort, for several layouts of keys and values of K.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_selection()
+{
+	size_t ks[N_SELECTION_KS] = {
+		0, 1, 7, N_GENERATED_KEYS / 3, N_GENERATED_KEYS - 1,
+		N_GENERATED_KEYS,
+	};
+	int keys[N_GENERATED_KEYS];
+	int sorted[N_GENERATED_KEYS], reversed[N_GENERATED_KEYS];
+	struct heap_element elements[N_GENERATED_KEYS];
+	struct heap_element results[N_GENERATED_KEYS];
+	struct top_k smallest, largest;
+	unsigned layout;
+	size_t k_i, key_i;
+	int passed = 1;
+
+	for (layout = 0; layout < N_SELECTION_LAYOUTS && passed; layout++) {
+		lay_out_keys(elements, keys, N_GENERATED_KEYS, layout);
+		heap_sort_in_place(elements, N_GENERATED_KEYS);
+		for (key_i = 0; key_i < N_GENERATED_KEYS; key_i++) {
+			sorted[key_i] = elements[key_i].key;
+			reversed[N_GENERATED_KEYS - 1 - key_i] = sorted[key_i];
+		}
+
+		for (k_i = 0; k_i < N_SELECTION_KS && passed; k_i++) {
+			size_t k = ks[k_i];
+
+			/* The nth element is placed, with the others split. */
+			lay_out_keys(elements, keys, N_GENERATED_KEYS, layout);
+			if (k < N_GENERATED_KEYS) {
+				nth_element(elements, N_GENERATED_KEYS, k);
+				passed = check_keys(&elements[k], &sorted[k],
+						    1) &&
+					 check_split(elements, N_GENERATED_KEYS,
+						     k);
+			}
+
+			/* The front is sorted, and nothing is lost. */
+			lay_out_keys(elements, keys, N_GENERATED_KEYS, layout);
+			partial_sort(elements, N_GENERATED_KEYS, k);
+			passed = passed && check_keys(elements, sorted, k);
+			heap_sort_in_place(elements + k, N_GENERATED_KEYS - k);
+			passed = passed &&
+				 check_keys(elements + k, sorted + k,
+					    N_GENERATED_KEYS - k);
+
+			/* Both accumulators keep the right elements. */
+			lay_out_keys(elements, keys, N_GENERATED_KEYS, layout);
+			if (init_top_k(&smallest, k, 0)) {
+				return 0;
+			}
+			if (init_top_k(&largest, k, 1)) {
+				teardown_top_k(&smallest);
+				return 0;
+			}
+			for (key_i = 0; key_i < N_GENERATED_KEYS; key_i++) {
+				offer_top_k(&smallest, &elements[key_i]);
+			}
+			offer_many_top_k(&largest, elements, N_GENERATED_KEYS);
+
+			passed = passed &&
+				 results_top_k(results, &smallest) == k &&
+				 check_keys(results, sorted, k) &&
+				 results_top_k(results, &largest) == k &&
+				 check_keys(results, reversed, k);
+			if (k > 0 && passed) {
+				struct heap_element head;
+
+				passed = !peek_top_k(&head, &smallest) &&
+					 head.key == sorted[k - 1] &&
+					 !peek_top_k(&head, &largest) &&
+					 head.key == reversed[k - 1];
+			}
+			teardown_top_k(&smallest);
+			teardown_top_k(&largest);
+
+			if (!passed) {
+				printlg(ERROR_LEVEL,
+					"Selection failed for layout %u, "
+					"K of %u.\n", layout, (unsigned) k);
+			}
+		}
+	}
+
+	return passed;
+}
+
+/*
+ * Check a radix heap against a min-heap as a monotone priority queue,
+ * with new keys pushed at or above the last key popped,
+ * as in an event simulation.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_monotone_queue()
+{
+	struct radix_heap queue;
+	struct min_heap reference;
+	struct heap_element pushed, popped, expected;
+	uint32_t state = 0x2545f491;
+	int now = INT_MIN;
+	size_t op_i;
+	int passed = 1;
+
+	if (init_min_heap(&reference, N_QUEUE_OPS)) {
+		return 0;
+	}
+	init_radix_heap(&queue);
+
+	for (op_i = 0; op_i < N_QUEUE_OPS && passed; op_i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		if (reference.size == 0 || state % 3 != 0) {
+			/* Schedule events at, near or far after the time. */
+			unsigned range = state % 4 == 0 ? 1U << 30 : 100;
+			unsigned delay = (state >> 8) % range;
+
+			pushed.key = delay > (unsigned) INT_MAX - now ?
+				     INT_MAX : now + (int) delay;
+			pushed.data = (void *) op_i;
+			passed = !push_radix_heap(&queue, &pushed) &&
+				 !push_min_heap(&reference, &pushed);
+		} else {
+			passed = !pop_radix_heap(&popped, &queue) &&
+				 !pop_min_heap(&expected, &reference) &&
+				 popped.key == expected.key;
+			now = popped.key;
+		}
+	}
+	if (!passed) {
+		printlg(ERROR_LEVEL, "Queues differed at operation %u.\n",
+			(unsigned) op_i);
+	}
+
+	/* Going back in time is not allowed. */
+	if (passed && now > INT_MIN) {
+		pushed.key = now - 1;
+		passed = push_radix_heap(&queue, &pushed) && errno == EINVAL;
+	}
+	while (passed && reference.size > 0) {
+		passed = !pop_radix_heap(&popped, &queue) &&
+			 !pop_min_heap(&expected, &reference) &&
+			 popped.key == expected.key;
+	}
+	passed = passed && queue.size == 0;
+
+	teardown_radix_heap(&queue);
+	teardown_min_heap(&reference);
+	return passed;
+}
+
+/* the number of distinct items in the heavy hitter test */
+#define N_HITTER_ITEMS		2000
+/* the number of counters in the heavy hitter test */
+#define N_HITTER_COUNTERS	64
+/* the number of items counted in the heavy hitter test */
+#define N_HITTER_EVENTS		100000
+
+/*
+ * Check a heavy hitter tracker against exact counts.
+ * tracker:	the tracker to check
+ * counts:	the true count of each item
+ * returns	1 iff every tracked count is within its error,
+ *		every frequent enough item is tracked,
+ *		and the results are in order, 0 otherwise
+ */
+static int check_heavy_hitters(struct space_saving *tracker, uint64_t *counts)
+{
+	struct heavy_hitter results[tracker->capacity];
+	struct heavy_hitter hitter;
+	uint64_t total_counted = 0;
+	size_t result_i;
+	uint64_t item;
+
+	if (results_space_saving(results, tracker) != tracker->size) {
+		return 0;
+	}
+	for (result_i = 0; result_i < tracker->size; result_i++) {
+		struct heavy_hitter *result = &results[result_i];
+
+		total_counted += result->count;
+		if (result->count < counts[result->item] ||
+		    result->count - result->error > counts[result->item] ||
+		    (result_i > 0 &&
+		     result->count > results[result_i - 1].count)) {
+			printlg(ERROR_LEVEL,
+				"Item %u was counted %u times, "
+				"with error %u, but it appeared %u times.\n",
+				(unsigned) result->item,
+				(unsigned) result->count,
+				(unsigned) result->error,
+				(unsigned) counts[result->item]);
+			return 0;
+		}
+	}
+	if (total_counted != tracker->total) {
+		printlg(ERROR_LEVEL, "The counts add up to %u, not %u.\n",
+			(unsigned) total_counted, (unsigned) tracker->total);
+		return 0;
+	}
+
+	for (item = 0; item < N_HITTER_ITEMS; item++) {
+		int tracked = !get_space_saving(tracker, item, &hitter);
+
+		if ((tracked && hitter.item != item) ||
+		    (!tracked &&
+		     counts[item] > min_count_space_saving(tracker)) ||
+		    (counts[item] > tracker->total / tracker->capacity &&
+		     !tracked)) {
+			printlg(ERROR_LEVEL,
+				"Item %u, which appeared %u times, "
+				"was not tracked correctly.\n",
+				(unsigned) item, (unsigned) counts[item]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Count a skewed stream of items with Space-Saving trackers,
+ * one item at a time and in batches,
+ * and with enough counters to count every item exactly.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_heavy_hitters()
+{
+	uint64_t counts[N_HITTER_ITEMS] = {0};
+	uint64_t *items = malloc(sizeof(uint64_t) * N_HITTER_EVENTS);
+	struct space_saving single, batched, exact;
+	struct heavy_hitter hitter;
+	uint32_t state = 0x2545f491;
+	size_t event_i;
+	int passed = 1;
+
+	if (items == NULL) {
+		return 0;
+	}
+	if (init_space_saving(&single, N_HITTER_COUNTERS)) {
+		free(items);
+		return 0;
+	}
+	if (init_space_saving(&batched, N_HITTER_COUNTERS)) {
+		teardown_space_saving(&single);
+		free(items);
+		return 0;
+	}
+	if (init_space_saving(&exact, N_HITTER_ITEMS)) {
+		teardown_space_saving(&single);
+		teardown_space_saving(&batched);
+		free(items);
+		return 0;
+	}
+
+	/*
+	 * Skew the items, so that small items are much more common,
+	 * and repeat some in a row, for the batches to combine.
+	 */
+	for (event_i = 0; event_i < N_HITTER_EVENTS; event_i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		if (event_i > 0 && state % 5 == 0) {
+			items[event_i] = items[event_i - 1];
+		} else {
+			items[event_i] = (state % N_HITTER_ITEMS) %
+					 ((state >> 16) % N_HITTER_ITEMS + 1);
+		}
+		counts[items[event_i]]++;
+		add_space_saving(&single, items[event_i], 1);
+	}
+	for (event_i = 0; event_i < N_HITTER_EVENTS; event_i += 1000) {
+		add_many_space_saving(&batched, &items[event_i], 1000);
+	}
+	add_many_space_saving(&exact, items, N_HITTER_EVENTS);
+
+	passed = check_heavy_hitters(&single, counts) &&
+		 check_heavy_hitters(&batched, counts) &&
+		 check_heavy_hitters(&exact, counts);
+
+	/* With a counter for every item, the counts are exact. */
+	for (event_i = 0; event_i < N_HITTER_ITEMS && passed; event_i++) {
+		if (counts[event_i] > 0 &&
+		    (get_space_saving(&exact, event_i, &hitter) ||
+		     hitter.count != counts[event_i] || hitter.error != 0)) {
+			printlg(ERROR_LEVEL,
+				"Item %u was not counted exactly.\n",
+				(unsigned) event_i);
+			passed = 0;
+		}
+	}
+
+	teardown_space_saving(&single);
+	teardown_space_saving(&batched);
+	teardown_space_saving(&exact);
+	free(items);
+	return passed;
+}
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Fill an array with elements of pseudo-random keys over the full range,
+ * from a fixed seed, each element's data being its original position.
+ * elements:	the output elements
+ * n_elements:	the number of elements
+ */
+static void generate_elements(struct heap_element *elements,
+			      size_t n_elements)
+{
+	uint32_t state = 0x2545f491;
+	size_t element_i;
+
+	for (element_i = 0; element_i < n_elements; element_i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		elements[element_i].key = (int) state;
+		elements[element_i].data = (void *) element_i;
+	}
+}
+
+/*
+ * Time a sort of random elements.
+ * sort:	the sorting function, which returns 0 iff successful
+ * elements:	the space to sort the elements in,
+ *		which holds them sorted afterwards
+ * n_elements:	the number of elements
+ * returns	the number of seconds taken, or -1 if the sort failed
+ */
+static double time_sort(int (*sort)(struct heap_element *array, size_t size),
+			struct heap_element *elements, size_t n_elements)
+{
+	double start;
+
+	generate_elements(elements, n_elements);
+	start = now_seconds();
+	if (sort(elements, n_elements)) {
+		return -1;
+	}
+	return now_seconds() - start;
+}
+
+/*
+ * Compare the speed of the in-place heap sort
+ * with the allocating heap sort that it replaced.
+ * n_elements:	the number of elements to sort
+ * returns	1 iff both sorts gave the same keys, 0 otherwise
+ */
+static int test_sort_speed(size_t n_elements)
+{
+	struct heap_element *allocated = malloc(sizeof(struct heap_element) *
+						n_elements);
+	struct heap_element *in_place = malloc(sizeof(struct heap_element) *
+					       n_elements);
+	double allocated_time, in_place_time;
+	size_t element_i;
+	int passed = 1;
+
+	if (allocated == NULL || in_place == NULL) {
+		free(allocated);
+		free(in_place);
+		return 0;
+	}
+
+	allocated_time = time_sort(allocating_heap_sort, allocated,
+				   n_elements);
+	in_place_time = time_sort(heap_sort_in_place_wrapper, in_place,
+				  n_elements);
+	for (element_i = 0; element_i < n_elements && passed; element_i++) {
+		passed = allocated[element_i].key == in_place[element_i].key;
+	}
+	printlg(INFO_LEVEL, "%u elements: allocating heap sort %.3f s, "
+		"in-place heap sort %.3f s.\n", (unsigned) n_elements,
+		allocated_time, in_place_time);
+
+	free(allocated);
+	free(in_place);
+	return passed && allocated_time >= 0 && in_place_time >= 0;
+}
+
+/*
+ * Time popping every element of a binary heap, heapified from an array.
+ * elements:	the elements to heapify, which are left as they are
+ * n_elements:	the number of elements
+ * returns	the number of seconds taken,
+ *		or -1 if the heap could not be made,
+ *		or popped the keys out of order
+ */
+static double time_binary_pops(struct heap_element *elements,
+			       size_t n_elements)
+{
+	struct min_heap heap;
+	struct heap_element popped;
+	int last_key = INT_MIN;
+	int failed;
+	double start, seconds;
+
+	if (init_min_heap(&heap, n_elements)) {
+		return -1;
+	}
+	failed = heapify(&heap, elements, n_elements);
+
+	start = now_seconds();
+	while (!failed && heap.size > 0) {
+		failed = pop_min_heap(&popped, &heap) ||
+			 popped.key < last_key;
+		last_key = popped.key;
+	}
+	seconds = now_seconds() - start;
+
+	teardown_min_heap(&heap);
+	return failed ? -1 : seconds;
+}
+
+/*
+ * Time popping every element of a d-ary heap, heapified from an array.
+ * elements:	the elements to heapify, which are left as they are
+ * n_elements:	the number of elements
+ * returns	the number of seconds taken,
+ *		or -1 if the heap could not be made,
+ *		or popped the keys out of order
+ */
+static double time_dary_pops(struct heap_element *elements,
+			     size_t n_elements)
+{
+	struct dary_min_heap heap;
+	struct heap_element popped;
+	int last_key = INT_MIN;
+	int failed;
+	double start, seconds;
+
+	if (init_dary_min_heap(&heap, n_elements)) {
+		return -1;
+	}
+	failed = heapify_dary(&heap, elements, n_elements);
+
+	start = now_seconds();
+	while (!failed && heap.size > 0) {
+		failed = pop_dary_min_heap(&popped, &heap) ||
+			 popped.key < last_key;
+		last_key = popped.key;
+	}
+	seconds = now_seconds() - start;
+
+	teardown_dary_min_heap(&heap);
+	return failed ? -1 : seconds;
+}
+
+/*
+ * Compare the pop throughput of the d-ary heap with the binary heap,
+ * from "MIN_POP_BENCH_SIZE" elements up tenfold at a time.
+ * Only one heap is allocated at a time, next to the array of elements.
+ * max_elements:	the most elements to pop
+ * returns		1 iff both heaps popped every size in order,
+ *			0 otherwise
+ */
+static int test_pop_speed(size_t max_elements)
+{
+	struct heap_element *elements = malloc(sizeof(struct heap_element) *
+					       max_elements);
+	size_t n_elements;
+	int passed = 1;
+
+	if (elements == NULL) {
+		return 0;
+	}
+
+	for (n_elements = MIN_POP_BENCH_SIZE;
+	     n_elements <= max_elements && passed; n_elements *= 10) {
+		double binary_time, dary_time;
+
+		generate_elements(elements, n_elements);
+		binary_time = time_binary_pops(elements, n_elements);
+		dary_time = time_dary_pops(elements, n_elements);
+		passed = binary_time >= 0 && dary_time >= 0;
+		printlg(INFO_LEVEL, "%u elements: binary heap %.1f, "
+			"d-ary heap %.1f million pops per second.\n",
+			(unsigned) n_elements, n_elements / binary_time / 1e6,
+			n_elements / dary_time / 1e6);
+	}
+
+	free(elements);
+	return passed;
+}
+
+/*
+ * Time "parallel_sort" on the same random elements,
+ * from 1 thread up to "MAX_BENCH_THREADS", doubling each time,
+ * and check each result against a sort on a single thread.
+ * n_elements:	the number of elements to sort
+ * returns	1 iff every sort gave the same keys, 0 otherwise
+ */
+static int test_parallel_speed(size_t n_elements)
+{
+	struct heap_element *expected = malloc(sizeof(struct heap_element) *
+					       n_elements);
+	struct heap_element *sorted = malloc(sizeof(struct heap_element) *
+					     n_elements);
+	unsigned n_threads;
+	size_t element_i;
+	int passed = 1;
+
+	if (expected == NULL || sorted == NULL) {
+		free(expected);
+		free(sorted);
+		return 0;
+	}
+	generate_elements(expected, n_elements);
+	heap_sort_in_place(expected, n_elements);
+
+	for (n_threads = 1; n_threads <= MAX_BENCH_THREADS && passed;
+	     n_threads *= 2) {
+		double start, seconds;
+
+		generate_elements(sorted, n_elements);
+		start = now_seconds();
+		passed = !parallel_sort(sorted, n_elements, n_threads);
+		seconds = now_seconds() - start;
+		for (element_i = 0; element_i < n_elements && passed;
+		     element_i++) {
+			passed = sorted[element_i].key ==
+				 expected[element_i].key;
+		}
+		printlg(INFO_LEVEL, "%u elements on %2u threads: %.3f s.\n",
+			(unsigned) n_elements, n_threads, seconds);
+	}
+
+	free(expected);
+	free(sorted);
+	return passed;
+}
+
+int main(int argc, char **argv)
+{
+	size_t bench_size = DEFAULT_BENCH_SIZE;
+
+	if (argc > 1) {
+		bench_size = strtoul(argv[1], NULL, 0);
+		if (bench_size == 0) {
+			printlg(ERROR_LEVEL, "Invalid benchmark size \"%s\".\n",
+				argv[1]);
+			return 1;
+		}
+	}
+
+	test_heap_sorts();
+
+	printlg(INFO_LEVEL, "Priority queue test...\n");
+	if (test_priority_queue()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Generated score heap test...\n");
+	if (test_generated_scores()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Selection and top-K test...\n");
+	if (test_selection()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Monotone priority queue test...\n");
+	if (test_monotone_queue()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Heavy hitter test...\n");
+	if (test_heavy_hitters()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Indexed priority queue test...\n");
+	if (test_indexed_queue()) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Heap sort speed test...\n");
+	if (test_sort_speed(bench_size)) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Heap pop speed test...\n");
+	if (test_pop_speed(bench_size)) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
+
+	printlg(INFO_LEVEL, "Parallel sort scaling test...\n");
+	if (test_parallel_speed(bench_size)) {
+		printlg(INFO_LEVEL, "Passed!\n\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n\n");
+	}
 
 	return 0;
 }
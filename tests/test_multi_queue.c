@@ -0,0 +1,365 @@
+/*
+ * runs tests on the functions in "multi_queue.h",
+ * and reports their throughput and rank error.
+ * The number of threads can be given as the only argument.
+ */
+#include <multi_queue.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/* the number of threads, if none is given */
+#define DEFAULT_THREADS		4
+/* the number of keys in each test */
+#define N_TEST_KEYS		200000
+/*
+ * the largest mean rank error accepted, for each heap in the queue.
+ * Popping from the better of two random heaps gives about one per heap.
+ */
+#define MAX_MEAN_ERROR_PER_HEAP	4
+
+/* the work of a thread in the concurrent test */
+struct worker {
+	/* the queue shared by the threads */
+	struct multi_queue *queue;
+	/* the keys the thread pushes */
+	int *keys;
+	/* the number of keys in "keys" */
+	size_t n_keys;
+	/* the number of times each key was popped, by any thread */
+	atomic_uint *n_popped;
+	/* set if any push failed */
+	int failed;
+};
+
+/* the state of the pseudo-random generator of the test */
+static uint32_t random_state = 0x2545f491;
+
+/*
+ * Generate the next pseudo-random number, from a fixed seed.
+ * returns	the next number
+ */
+static uint32_t next_random()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+/*
+ * Fill an array with the keys from 0, in a random order.
+ * keys:	the array to fill
+ * n_keys:	the number of keys
+ */
+static void shuffle_keys(int *keys, size_t n_keys)
+{
+	size_t key_i;
+
+	for (key_i = 0; key_i < n_keys; key_i++) {
+		size_t other = next_random() % (key_i + 1);
+
+		keys[key_i] = keys[other];
+		keys[other] = key_i;
+	}
+}
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Push all the keys, then pop them all from a single thread,
+ * and check the rank of each popped key among the keys left,
+ * counting the keys left with a Fenwick tree.
+ * n_threads:	the number of threads to size the queue for
+ * returns	1 iff every key was popped once,
+ *		with a small enough mean rank error
+ */
+static int test_rank_error(unsigned n_threads)
+{
+	struct multi_queue queue;
+	struct heap_element element;
+	int *keys = malloc(sizeof(int) * N_TEST_KEYS);
+	/* the Fenwick tree, from 1, of the keys left in the queue */
+	unsigned *left = calloc(N_TEST_KEYS + 1, sizeof(unsigned));
+	unsigned *n_popped = calloc(N_TEST_KEYS, sizeof(unsigned));
+	uint64_t total_error = 0;
+	size_t max_error = 0;
+	size_t key_i, position;
+	int passed = 1;
+
+	if (keys == NULL || left == NULL || n_popped == NULL ||
+	    init_multi_queue(&queue, n_threads, N_TEST_KEYS)) {
+		free(keys);
+		free(left);
+		free(n_popped);
+		return 0;
+	}
+
+	shuffle_keys(keys, N_TEST_KEYS);
+	element.data = NULL;
+	for (key_i = 0; key_i < N_TEST_KEYS; key_i++) {
+		element.key = keys[key_i];
+		if (push_multi_queue(&queue, &element)) {
+			printlg(ERROR_LEVEL, "Could not push key %d.\n",
+				keys[key_i]);
+			passed = 0;
+		}
+		for (position = keys[key_i] + 1; position <= N_TEST_KEYS;
+		     position += position & -position) {
+			left[position]++;
+		}
+	}
+
+	for (key_i = 0; key_i < N_TEST_KEYS; key_i++) {
+		size_t error = 0;
+
+		if (pop_multi_queue(&element, &queue)) {
+			printlg(ERROR_LEVEL, "Queue was empty after %u pops.\n",
+				(unsigned) key_i);
+			passed = 0;
+			break;
+		}
+		if (n_popped[element.key]++ > 0) {
+			printlg(ERROR_LEVEL, "Key %d was popped twice.\n",
+				element.key);
+			passed = 0;
+			continue;
+		}
+
+		/* Count the keys left that are smaller than the popped one. */
+		for (position = element.key; position > 0;
+		     position -= position & -position) {
+			error += left[position];
+		}
+		for (position = element.key + 1; position <= N_TEST_KEYS;
+		     position += position & -position) {
+			left[position]--;
+		}
+		total_error += error;
+		if (error > max_error) {
+			max_error = error;
+		}
+	}
+	if (!pop_multi_queue(&element, &queue)) {
+		printlg(ERROR_LEVEL, "Queue was not empty after all pops.\n");
+		passed = 0;
+	}
+
+	printlg(INFO_LEVEL, "%u heaps: mean rank error %.2f, maximum %u.\n",
+		(unsigned) queue.n_heaps, (double) total_error / N_TEST_KEYS,
+		(unsigned) max_error);
+	if (total_error > (uint64_t) N_TEST_KEYS * queue.n_heaps *
+			  MAX_MEAN_ERROR_PER_HEAP) {
+		printlg(ERROR_LEVEL, "Mean rank error is too large.\n");
+		passed = 0;
+	}
+
+	teardown_multi_queue(&queue);
+	free(keys);
+	free(left);
+	free(n_popped);
+	return passed;
+}
+
+/*
+ * Thread entry point for the concurrent test:
+ * push each key, popping one key after every second push,
+ * then pop until the queue looks empty.
+ * arg:		the "struct worker"
+ * returns	NULL
+ */
+static void *run_worker(void *arg)
+{
+	struct worker *worker = arg;
+	struct heap_element element;
+	size_t key_i;
+
+	element.data = NULL;
+	for (key_i = 0; key_i < worker->n_keys; key_i++) {
+		element.key = worker->keys[key_i];
+		if (push_multi_queue(worker->queue, &element)) {
+			worker->failed = 1;
+		}
+		if (key_i % 2 == 1 &&
+		    !pop_multi_queue(&element, worker->queue)) {
+			atomic_fetch_add(&worker->n_popped[element.key], 1);
+		}
+	}
+	while (!pop_multi_queue(&element, worker->queue)) {
+		atomic_fetch_add(&worker->n_popped[element.key], 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Push and pop from several threads at once,
+ * and check that every key is popped exactly once.
+ * n_threads:	the number of threads to run
+ * returns	1 iff every key was popped once
+ */
+static int test_concurrent(unsigned n_threads)
+{
+	struct multi_queue queue;
+	struct heap_element element;
+	pthread_t threads[n_threads];
+	struct worker workers[n_threads];
+	int started[n_threads];
+	int *keys = malloc(sizeof(int) * N_TEST_KEYS);
+	atomic_uint *n_popped = calloc(N_TEST_KEYS, sizeof(atomic_uint));
+	size_t thread_i, key_i;
+	double start, seconds;
+	int passed = 1;
+
+	if (keys == NULL || n_popped == NULL ||
+	    init_multi_queue(&queue, n_threads, N_TEST_KEYS)) {
+		free(keys);
+		free(n_popped);
+		return 0;
+	}
+
+	shuffle_keys(keys, N_TEST_KEYS);
+	start = now_seconds();
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		size_t first = N_TEST_KEYS * thread_i / n_threads;
+
+		workers[thread_i].queue = &queue;
+		workers[thread_i].keys = keys + first;
+		workers[thread_i].n_keys = N_TEST_KEYS *
+					   (thread_i + 1) / n_threads - first;
+		workers[thread_i].n_popped = n_popped;
+		workers[thread_i].failed = 0;
+		started[thread_i] = !pthread_create(&threads[thread_i], NULL,
+						    run_worker,
+						    &workers[thread_i]);
+		if (!started[thread_i]) {
+			printlg(WARNING_LEVEL, "Could not start thread %u.\n",
+				(unsigned) thread_i);
+			run_worker(&workers[thread_i]);
+		}
+	}
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		if (started[thread_i]) {
+			pthread_join(threads[thread_i], NULL);
+		}
+		if (workers[thread_i].failed) {
+			printlg(ERROR_LEVEL, "Thread %u could not push.\n",
+				(unsigned) thread_i);
+			passed = 0;
+		}
+	}
+	seconds = now_seconds() - start;
+	printlg(INFO_LEVEL, "%u threads: %.2f million operations per second.\n",
+		n_threads, N_TEST_KEYS * 2 / seconds / 1e6);
+
+	/* Each thread stopped when the queue looked empty to it. */
+	while (!pop_multi_queue(&element, &queue)) {
+		n_popped[element.key]++;
+	}
+	for (key_i = 0; key_i < N_TEST_KEYS; key_i++) {
+		if (n_popped[key_i] != 1) {
+			printlg(ERROR_LEVEL, "Key %u was popped %u times.\n",
+				(unsigned) key_i, (unsigned) n_popped[key_i]);
+			passed = 0;
+			break;
+		}
+	}
+
+	teardown_multi_queue(&queue);
+	free(keys);
+	free(n_popped);
+	return passed;
+}
+
+/*
+ * Fill a queue past its capacity.
+ * returns	1 iff the queue takes as many elements as its heaps hold,
+ *		and rejects the next one with ERANGE
+ */
+static int test_full_queue()
+{
+	struct multi_queue queue;
+	struct heap_element element;
+	size_t capacity;
+	size_t key_i;
+	int passed = 1;
+
+	if (init_multi_queue(&queue, 3, 100)) {
+		return 0;
+	}
+	capacity = queue.heaps[0].heap.capacity * queue.n_heaps;
+	if (capacity < 100) {
+		printlg(ERROR_LEVEL, "Capacity %u is too small.\n",
+			(unsigned) capacity);
+		passed = 0;
+	}
+
+	element.data = NULL;
+	for (key_i = 0; key_i < capacity; key_i++) {
+		element.key = key_i;
+		if (push_multi_queue(&queue, &element)) {
+			printlg(ERROR_LEVEL, "Push %u failed.\n",
+				(unsigned) key_i);
+			passed = 0;
+		}
+	}
+	element.key = capacity;
+	if (!push_multi_queue(&queue, &element) || errno != ERANGE) {
+		printlg(ERROR_LEVEL, "Push past capacity did not fail.\n");
+		passed = 0;
+	}
+
+	teardown_multi_queue(&queue);
+	return passed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned n_threads = DEFAULT_THREADS;
+
+	if (argc > 1) {
+		n_threads = strtoul(argv[1], NULL, 0);
+		if (n_threads == 0) {
+			printlg(ERROR_LEVEL, "Invalid thread count \"%s\".\n",
+				argv[1]);
+			return 1;
+		}
+	}
+
+	printlg(INFO_LEVEL, "Rank error test...\n");
+	if (test_rank_error(n_threads)) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Concurrent test...\n");
+	if (test_concurrent(n_threads)) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Full queue test...\n");
+	if (test_full_queue()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * runs tests on the functions in "ring_buffer.h",
+ * and reports their throughput from 1 to "MAX_THREADS" threads
+ */
+#include <ring_buffer.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+/* the number of pointers passed through the queue in each test */
+#define N_TEST_ITEMS		(1 << 19)
+/* the capacity of the queues, small enough to fill up often */
+#define TEST_CAPACITY		256
+/* the most pointers pushed or popped at once */
+#define MAX_BATCH		32
+/* the most threads sharing the queue */
+#define MAX_THREADS		16
+
+/* the producer of the ring buffer test */
+struct spsc_producer {
+	/* the ring buffer to write to */
+	struct spsc_ring *ring;
+	/* the pointers to write, in order */
+	void **items;
+};
+
+/* a thread of the multi-producer, multi-consumer test */
+struct mpmc_worker {
+	/* the queue shared by the threads */
+	struct mpmc_queue *queue;
+	/* the index of the thread */
+	size_t thread_i;
+	/* the number of threads */
+	size_t n_threads;
+	/* the number of times each item was popped, by any thread */
+	atomic_uint *n_popped;
+	/* set if any thread's items were popped out of order */
+	int out_of_order;
+};
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Make the pointer for an item, which is never NULL.
+ * item_i:	the index of the item
+ * returns	the pointer passed through the queue
+ */
+static inline void *item_pointer(size_t item_i)
+{
+	return (void *) (uintptr_t) (item_i + 1);
+}
+
+/*
+ * Find the index of an item from its pointer.
+ * item:	the pointer passed through the queue
+ * returns	the index of the item
+ */
+static inline size_t item_index(void *item)
+{
+	return (uintptr_t) item - 1;
+}
+
+/*
+ * Thread entry point of the ring buffer producer:
+ * write every item, in batches of changing sizes.
+ * arg:		the "struct spsc_producer"
+ * returns	NULL
+ */
+static void *run_spsc_producer(void *arg)
+{
+	struct spsc_producer *producer = arg;
+	size_t item_i = 0, batch = 1;
+
+	while (item_i < N_TEST_ITEMS) {
+		size_t n_items = N_TEST_ITEMS - item_i < batch ?
+				 N_TEST_ITEMS - item_i : batch;
+		size_t n_pushed = push_spsc_ring(producer->ring,
+						 producer->items + item_i,
+						 n_items);
+
+		if (n_pushed == 0) {
+			sched_yield();
+		}
+		item_i += n_pushed;
+		batch = batch % MAX_BATCH + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Pass items from one thread to another through a ring buffer.
+ * returns	1 iff every item arrived once, in order
+ */
+static int test_spsc()
+{
+	struct spsc_ring ring;
+	struct spsc_producer producer;
+	pthread_t thread;
+	void **items = malloc(sizeof(void *) * N_TEST_ITEMS);
+	void *popped[MAX_BATCH];
+	size_t item_i = 0, batch = MAX_BATCH;
+	double start;
+	int passed = 1;
+
+	if (items == NULL || init_spsc_ring(&ring, TEST_CAPACITY)) {
+		free(items);
+		return 0;
+	}
+	for (item_i = 0; item_i < N_TEST_ITEMS; item_i++) {
+		items[item_i] = item_pointer(item_i);
+	}
+	producer.ring = &ring;
+	producer.items = items;
+
+	start = now_seconds();
+	if (pthread_create(&thread, NULL, run_spsc_producer, &producer)) {
+		printlg(ERROR_LEVEL, "Could not start producer.\n");
+		teardown_spsc_ring(&ring);
+		free(items);
+		return 0;
+	}
+	item_i = 0;
+	while (item_i < N_TEST_ITEMS) {
+		size_t n_popped = pop_spsc_ring(popped, &ring, batch);
+		size_t popped_i;
+
+		if (n_popped == 0) {
+			sched_yield();
+		}
+		for (popped_i = 0; popped_i < n_popped; popped_i++) {
+			if (popped[popped_i] != item_pointer(item_i)) {
+				passed = 0;
+			}
+			item_i++;
+		}
+		batch = batch > 1 ? batch - 1 : MAX_BATCH;
+	}
+	pthread_join(thread, NULL);
+	printlg(INFO_LEVEL,
+		"Ring buffer: %.2f million items per second.\n",
+		N_TEST_ITEMS / (now_seconds() - start) / 1e6);
+
+	if (!passed) {
+		printlg(ERROR_LEVEL, "Items arrived out of order.\n");
+	}
+	if (pop_spsc_ring(popped, &ring, MAX_BATCH) != 0) {
+		printlg(ERROR_LEVEL, "Ring buffer was not empty.\n");
+		passed = 0;
+	}
+
+	teardown_spsc_ring(&ring);
+	free(items);
+	return passed;
+}
+
+/*
+ * Count popped items, checking that each thread's items
+ * were popped in the order they were pushed.
+ * worker:	the "struct mpmc_worker" that popped the items
+ * popped:	the popped items
+ * n_popped:	the number of items in "popped"
+ * last:	the index of the last item popped from each thread,
+ *		plus one, or 0 if none has been
+ */
+static void count_popped(struct mpmc_worker *worker, void **popped,
+			 size_t n_popped, size_t *last)
+{
+	size_t popped_i;
+
+	for (popped_i = 0; popped_i < n_popped; popped_i++) {
+		size_t item_i = item_index(popped[popped_i]);
+		size_t pusher = item_i % worker->n_threads;
+
+		atomic_fetch_add(&worker->n_popped[item_i], 1);
+		if (item_i + 1 <= last[pusher]) {
+			worker->out_of_order = 1;
+		}
+		last[pusher] = item_i + 1;
+	}
+}
+
+/*
+ * Thread entry point for the multi-producer, multi-consumer test:
+ * push every item whose index is the thread's, modulo the threads,
+ * in batches, popping a batch after each,
+ * then pop until the queue looks empty.
+ * arg:		the "struct mpmc_worker"
+ * returns	NULL
+ */
+static void *run_mpmc_worker(void *arg)
+{
+	struct mpmc_worker *worker = arg;
+	void *pushing[MAX_BATCH];
+	void *popped[MAX_BATCH];
+	size_t last[MAX_THREADS] = {0};
+	size_t item_i = worker->thread_i;
+	size_t n_pending = 0;
+	size_t n_popped;
+
+	for (;;) {
+		size_t n_pushed;
+
+		while (n_pending < MAX_BATCH && item_i < N_TEST_ITEMS) {
+			pushing[n_pending++] = item_pointer(item_i);
+			item_i += worker->n_threads;
+		}
+		if (n_pending == 0) {
+			break;
+		}
+		n_pushed = push_mpmc_queue(worker->queue, pushing, n_pending);
+		n_pending -= n_pushed;
+		memmove(pushing, pushing + n_pushed,
+			sizeof(void *) * n_pending);
+
+		n_popped = pop_mpmc_queue(popped, worker->queue, MAX_BATCH);
+		count_popped(worker, popped, n_popped, last);
+	}
+	while ((n_popped = pop_mpmc_queue(popped, worker->queue,
+					  MAX_BATCH)) > 0) {
+		count_popped(worker, popped, n_popped, last);
+	}
+
+	return NULL;
+}
+
+/*
+ * Push and pop from several threads at once,
+ * and check that every item is popped exactly once,
+ * and that each thread sees each other thread's items in order.
+ * n_threads:	the number of threads to run
+ * returns	1 iff every item was popped once, in order
+ */
+static int test_mpmc(size_t n_threads)
+{
+	struct mpmc_queue queue;
+	struct mpmc_worker workers[n_threads], main_worker;
+	pthread_t threads[n_threads];
+	int started[n_threads];
+	atomic_uint *n_popped = calloc(N_TEST_ITEMS, sizeof(atomic_uint));
+	void *popped[MAX_BATCH];
+	size_t last[MAX_THREADS] = {0};
+	size_t thread_i, item_i, n_left;
+	double start;
+	int passed = 1;
+
+	if (n_popped == NULL || init_mpmc_queue(&queue, TEST_CAPACITY)) {
+		free(n_popped);
+		return 0;
+	}
+
+	start = now_seconds();
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		workers[thread_i].queue = &queue;
+		workers[thread_i].thread_i = thread_i;
+		workers[thread_i].n_threads = n_threads;
+		workers[thread_i].n_popped = n_popped;
+		workers[thread_i].out_of_order = 0;
+		started[thread_i] = !pthread_create(&threads[thread_i], NULL,
+						    run_mpmc_worker,
+						    &workers[thread_i]);
+		if (!started[thread_i]) {
+			printlg(WARNING_LEVEL, "Could not start thread %u.\n",
+				(unsigned) thread_i);
+			run_mpmc_worker(&workers[thread_i]);
+		}
+	}
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		if (started[thread_i]) {
+			pthread_join(threads[thread_i], NULL);
+		}
+		if (workers[thread_i].out_of_order) {
+			printlg(ERROR_LEVEL,
+				"Thread %u popped items out of order.\n",
+				(unsigned) thread_i);
+			passed = 0;
+		}
+	}
+	printlg(INFO_LEVEL, "%2u threads: %.2f million items per second.\n",
+		(unsigned) n_threads,
+		N_TEST_ITEMS / (now_seconds() - start) / 1e6);
+
+	/* Each thread stopped when the queue looked empty to it. */
+	main_worker = workers[0];
+	while ((n_left = pop_mpmc_queue(popped, &queue, MAX_BATCH)) > 0) {
+		count_popped(&main_worker, popped, n_left, last);
+	}
+	for (item_i = 0; item_i < N_TEST_ITEMS; item_i++) {
+		if (n_popped[item_i] != 1) {
+			printlg(ERROR_LEVEL, "Item %u was popped %u times.\n",
+				(unsigned) item_i, (unsigned) n_popped[item_i]);
+			passed = 0;
+			break;
+		}
+	}
+
+	teardown_mpmc_queue(&queue);
+	free(n_popped);
+	return passed;
+}
+
+/*
+ * Check the capacities that the queues are rounded up to,
+ * and that they hold exactly that many pointers.
+ * returns	1 iff the capacities are as expected
+ */
+static int test_capacity()
+{
+	struct spsc_ring ring;
+	struct mpmc_queue queue;
+	void *items[8] = {0};
+	int passed = 1;
+
+	if (init_spsc_ring(&ring, 0) != -1 || errno != EINVAL ||
+	    init_mpmc_queue(&queue, 0) != -1 || errno != EINVAL) {
+		printlg(ERROR_LEVEL, "Capacity 0 was accepted.\n");
+		return 0;
+	}
+
+	if (init_spsc_ring(&ring, 5)) {
+		return 0;
+	}
+	if (push_spsc_ring(&ring, items, 8) != 8 ||
+	    push_spsc_ring(&ring, items, 1) != 0 ||
+	    pop_spsc_ring(items, &ring, 8) != 8 ||
+	    pop_spsc_ring(items, &ring, 1) != 0) {
+		printlg(ERROR_LEVEL, "Ring buffer did not hold 8 pointers.\n");
+		passed = 0;
+	}
+	teardown_spsc_ring(&ring);
+
+	if (init_mpmc_queue(&queue, 1)) {
+		return 0;
+	}
+	if (push_mpmc_queue(&queue, items, 8) != 2 ||
+	    push_mpmc_queue(&queue, items, 1) != 0 ||
+	    pop_mpmc_queue(items, &queue, 8) != 2 ||
+	    pop_mpmc_queue(items, &queue, 1) != 0) {
+		printlg(ERROR_LEVEL, "Queue did not hold 2 pointers.\n");
+		passed = 0;
+	}
+	teardown_mpmc_queue(&queue);
+
+	return passed;
+}
+
+int main(void)
+{
+	size_t n_threads;
+
+	printlg(INFO_LEVEL, "Capacity test...\n");
+	if (test_capacity()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Single-producer, single-consumer test...\n");
+	if (test_spsc()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	for (n_threads = 1; n_threads <= MAX_THREADS; n_threads *= 2) {
+		printlg(INFO_LEVEL, "Multi-producer, multi-consumer test, "
+			"with %u threads...\n", (unsigned) n_threads);
+		if (test_mpmc(n_threads)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+/* runs tests on the functions in "running_stats.h" */
+#include <running_stats.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+/* the number of samples in each generated stream */
+#define N_GENERATED_SAMPLES	5000
+/* the number of samples in the sketch test */
+#define N_SKETCH_SAMPLES	100000
+/* the number of quantiles checked in the sketch test */
+#define N_QUANTILES		8
+
+/*
+ * Fill an array with pseudo-random samples from a fixed seed.
+ * samples:	the output samples
+ * n_samples:	the number of samples to generate
+ * range:	the number of distinct samples to generate, centered on 0,
+ *		or 0 to use the full range of "int"
+ */
+static void generate_samples(int *samples, size_t n_samples, unsigned range)
+{
+	uint32_t state = 0x2545f491;
+	size_t sample_i;
+
+	for (sample_i = 0; sample_i < n_samples; sample_i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		samples[sample_i] = range == 0 ? (int) state :
+				    (int) (state % range) - (int) (range / 2);
+	}
+}
+
+/*
+ * Sort samples by insertion, for checking against.
+ * samples:	the samples to sort
+ * n_samples:	the number of samples
+ */
+static void sort_samples(int *samples, size_t n_samples)
+{
+	size_t sorted, position;
+
+	for (sorted = 1; sorted < n_samples; sorted++) {
+		int moving = samples[sorted];
+
+		for (position = sorted;
+		     position > 0 && samples[position - 1] > moving;
+		     position--) {
+			samples[position] = samples[position - 1];
+		}
+		samples[position] = moving;
+	}
+}
+
+/*
+ * Check a running median against the sorted window after every sample,
+ * expiring some samples early along the way.
+ * window_size:	the number of samples in the window
+ * range:	the range of the samples, as in "generate_samples"
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_running_median(size_t window_size, unsigned range)
+{
+	int samples[N_GENERATED_SAMPLES];
+	int window[window_size];
+	struct running_median median;
+	size_t sample_i, first = 0;
+	int passed = 1;
+
+	generate_samples(samples, N_GENERATED_SAMPLES, range);
+	if (init_running_median(&median, window_size)) {
+		return 0;
+	}
+
+	for (sample_i = 0; sample_i < N_GENERATED_SAMPLES && passed;
+	     sample_i++) {
+		size_t n_window;
+		int lower = 0, upper = 0;
+
+		push_running_median(&median, samples[sample_i]);
+		if (sample_i + 1 - first > window_size) {
+			first = sample_i + 1 - window_size;
+		}
+
+		/* Now and then, let the oldest sample expire early. */
+		if (sample_i % 97 == 0) {
+			passed = !expire_running_median(&median);
+			first++;
+		}
+		if (first > sample_i) {
+			passed = passed &&
+				 peek_running_median(&median, &lower, &upper);
+			continue;
+		}
+
+		n_window = sample_i + 1 - first;
+		memcpy(window, &samples[first], sizeof(int) * n_window);
+		sort_samples(window, n_window);
+		if (passed && (peek_running_median(&median, &lower, &upper) ||
+			       lower != window[(n_window - 1) / 2] ||
+			       upper != window[n_window / 2])) {
+			printlg(ERROR_LEVEL,
+				"After sample %u, median was %d and %d, "
+				"not %d and %d.\n", (unsigned) sample_i,
+				lower, upper, window[(n_window - 1) / 2],
+				window[n_window / 2]);
+			passed = 0;
+		}
+	}
+
+	/* Expire everything that is left. */
+	while (passed && !expire_running_median(&median)) {
+		first++;
+	}
+	passed = passed && first == N_GENERATED_SAMPLES &&
+		 median.lower.size == 0 && median.upper.size == 0;
+
+	teardown_running_median(&median);
+	return passed;
+}
+
+/*
+ * Check the quantiles of a sketch against the exact quantiles.
+ * sketch:	the sketch to check
+ * sorted:	the samples counted by the sketch, sorted
+ * n_samples:	the number of samples
+ * returns	1 iff every estimate is within the relative error, 0 otherwise
+ */
+static int check_quantiles(struct quantile_sketch *sketch, int *sorted,
+			   size_t n_samples)
+{
+	double quantiles[N_QUANTILES] = {
+		0, 0.01, 0.25, 0.5, 0.9, 0.99, 0.999, 1,
+	};
+	size_t quantile_i;
+
+	for (quantile_i = 0; quantile_i < N_QUANTILES; quantile_i++) {
+		double quantile = quantiles[quantile_i];
+		size_t rank = (size_t) (quantile * n_samples);
+		int64_t exact, error;
+		int estimate;
+
+		/* Match the rounding up of the sketch. */
+		if (rank < quantile * n_samples || rank == 0) {
+			rank++;
+		}
+		exact = sorted[rank - 1];
+
+		if (query_quantile_sketch(sketch, quantile, &estimate)) {
+			return 0;
+		}
+		error = estimate - exact;
+		if (error < 0) {
+			error = -error;
+		}
+		if (error > ((exact < 0 ? -exact : exact) >>
+			     QUANTILE_SKETCH_BITS) + 1) {
+			printlg(ERROR_LEVEL,
+				"Quantile %f was estimated as %d, not %d.\n",
+				quantile, estimate, (int) exact);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Check a quantile sketch of many samples,
+ * then remove half of them, and merge them back in from another sketch.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_quantile_sketch()
+{
+	int *samples = malloc(sizeof(int) * N_SKETCH_SAMPLES);
+	int *sorted = malloc(sizeof(int) * N_SKETCH_SAMPLES);
+	struct heap_element *elements = malloc(sizeof(struct heap_element) *
+					       N_SKETCH_SAMPLES);
+	struct quantile_sketch sketch, removed;
+	size_t sample_i, n_kept = N_SKETCH_SAMPLES / 2;
+	int passed = 1;
+	int estimate;
+
+	if (samples == NULL || sorted == NULL || elements == NULL ||
+	    init_quantile_sketch(&sketch)) {
+		free(samples);
+		free(sorted);
+		free(elements);
+		return 0;
+	}
+	if (init_quantile_sketch(&removed)) {
+		teardown_quantile_sketch(&sketch);
+		free(samples);
+		free(sorted);
+		free(elements);
+		return 0;
+	}
+
+	/* An empty sketch has no quantiles. */
+	passed = query_quantile_sketch(&sketch, 0.5, &estimate) &&
+		 errno == EINVAL;
+
+	generate_samples(samples, N_SKETCH_SAMPLES, 0);
+	for (sample_i = 0; sample_i < N_SKETCH_SAMPLES; sample_i++) {
+		add_quantile_sketch(&sketch, samples[sample_i]);
+		elements[sample_i].key = samples[sample_i];
+	}
+	radix_sort(elements, N_SKETCH_SAMPLES);
+	for (sample_i = 0; sample_i < N_SKETCH_SAMPLES; sample_i++) {
+		sorted[sample_i] = elements[sample_i].key;
+	}
+	passed = passed && check_quantiles(&sketch, sorted, N_SKETCH_SAMPLES);
+
+	/* Remove the older half, as if it left a window. */
+	for (sample_i = 0; sample_i < N_SKETCH_SAMPLES - n_kept && passed;
+	     sample_i++) {
+		passed = !remove_quantile_sketch(&sketch, samples[sample_i]);
+		add_quantile_sketch(&removed, samples[sample_i]);
+	}
+	for (sample_i = 0; sample_i < n_kept; sample_i++) {
+		elements[sample_i].key =
+			samples[N_SKETCH_SAMPLES - n_kept + sample_i];
+	}
+	radix_sort(elements, n_kept);
+	for (sample_i = 0; sample_i < n_kept; sample_i++) {
+		sorted[sample_i] = elements[sample_i].key;
+	}
+	passed = passed && check_quantiles(&sketch, sorted, n_kept);
+
+	/* Merging the removed half back in restores the full quantiles. */
+	merge_quantile_sketch(&sketch, &removed);
+	for (sample_i = 0; sample_i < N_SKETCH_SAMPLES; sample_i++) {
+		elements[sample_i].key = samples[sample_i];
+	}
+	radix_sort(elements, N_SKETCH_SAMPLES);
+	for (sample_i = 0; sample_i < N_SKETCH_SAMPLES; sample_i++) {
+		sorted[sample_i] = elements[sample_i].key;
+	}
+	passed = passed && check_quantiles(&sketch, sorted, N_SKETCH_SAMPLES);
+
+	teardown_quantile_sketch(&sketch);
+	teardown_quantile_sketch(&removed);
+	free(samples);
+	free(sorted);
+	free(elements);
+	return passed;
+}
+
+/*
+ * Check a quantile sketch of small samples, which are counted exactly,
+ * and that samples never counted cannot be removed.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_exact_sketch()
+{
+	int samples[N_GENERATED_SAMPLES];
+	struct quantile_sketch sketch;
+	size_t sample_i;
+	int passed;
+
+	if (init_quantile_sketch(&sketch)) {
+		return 0;
+	}
+
+	generate_samples(samples, N_GENERATED_SAMPLES,
+			 1U << QUANTILE_SKETCH_BITS);
+	for (sample_i = 0; sample_i < N_GENERATED_SAMPLES; sample_i++) {
+		add_quantile_sketch(&sketch, samples[sample_i]);
+	}
+	sort_samples(samples, N_GENERATED_SAMPLES);
+	passed = check_quantiles(&sketch, samples, N_GENERATED_SAMPLES) &&
+		 remove_quantile_sketch(&sketch, 1 << 20) && errno == EINVAL;
+
+	teardown_quantile_sketch(&sketch);
+	return passed;
+}
+
+int main(void)
+{
+	size_t window_sizes[] = {1, 2, 100, 101, N_GENERATED_SAMPLES};
+	unsigned ranges[] = {0, 16};
+	size_t size_i, range_i;
+
+	for (range_i = 0; range_i < sizeof(ranges) / sizeof(ranges[0]);
+	     range_i++) {
+		for (size_i = 0;
+		     size_i < sizeof(window_sizes) / sizeof(window_sizes[0]);
+		     size_i++) {
+			printlg(INFO_LEVEL,
+				"Running median test, window %u, range %u...\n",
+				(unsigned) window_sizes[size_i],
+				ranges[range_i]);
+			if (test_running_median(window_sizes[size_i],
+						ranges[range_i])) {
+				printlg(INFO_LEVEL, "Passed!\n");
+			} else {
+				printlg(ERROR_LEVEL, "Failed!\n");
+			}
+		}
+	}
+
+	printlg(INFO_LEVEL, "Quantile sketch test...\n");
+	if (test_quantile_sketch()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Exact quantile sketch test...\n");
+	if (test_exact_sketch()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,490 @@
+/*
+ * runs tests on the functions in "timer_wheel.h",
+ * and compares their speed with a heap of all the timers
+ */
+#include <timer_wheel.h>
+#include <logger.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* the number of timers in the test */
+#define N_TEST_TIMERS		3000
+/* the most timers due too far away for the wheel at once */
+#define FAR_CAPACITY		1000
+/* the tick the test starts at, a little before a wheel boundary */
+#define START_TICK		(((uint64_t) 3 << TIMER_WHEEL_SPAN_BITS) - 5000)
+/* a later tick to start at, whose span no longer fits in an int */
+#define LARGE_START_TICK	(((uint64_t) 1 << 56) - 5000)
+/* the number of timers in the benchmark */
+#define N_BENCH_TIMERS		1000000
+/* the most ticks away that a benchmark timer is due */
+#define BENCH_MAX_DELAY		60000
+
+/* a test timer, and what is expected of it */
+struct test_timer {
+	/* the scheduled timer */
+	struct wheel_timer timer;
+	/* the tick it should expire on, or 0 if it should not be pending */
+	uint64_t expected;
+	/* the number of times it expired */
+	unsigned n_fired;
+};
+
+/* the state checked by "check_expired" */
+struct expiry_check {
+	/* the wheel that the timers expire from */
+	struct timer_wheel *wheel;
+	/* whether every timer so far expired on time */
+	int on_time;
+};
+
+/* the state of the pseudo-random generator of the test */
+static uint32_t random_state = 0x2545f491;
+
+/*
+ * Generate the next pseudo-random number, from a fixed seed.
+ * returns	the next number
+ */
+static uint32_t next_random()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+/*
+ * Find the number of seconds since some fixed point.
+ * returns	the time, in seconds
+ */
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Ignore the expired timers, as the expiry callback of the benchmark.
+ * expired:	the list of expired timers
+ * arg:		unused
+ */
+static void ignore_expired(struct wheel_timer *expired, void *arg)
+{
+	(void) expired;
+	(void) arg;
+}
+
+/*
+ * Check that every expired timer was due on the current tick,
+ * as the expiry callback.
+ * expired:	the list of expired timers
+ * arg:		the "struct expiry_check"
+ */
+static void check_expired(struct wheel_timer *expired, void *arg)
+{
+	struct expiry_check *check = arg;
+
+	for (; expired != NULL; expired = expired->next) {
+		struct test_timer *test = expired->data;
+
+		if (test->expected != check->wheel->now ||
+		    expired->state != TIMER_IDLE) {
+			printlg(ERROR_LEVEL,
+				"Timer due at %" PRIu64 " expired at %" PRIu64
+				".\n", test->expected, check->wheel->now);
+			check->on_time = 0;
+		}
+		test->expected = 0;
+		test->n_fired++;
+	}
+}
+
+/*
+ * Pick a deadline for a timer,
+ * from ones that have passed to ones far beyond the wheel.
+ * now:		the current tick
+ * returns	the deadline
+ */
+static uint64_t pick_deadline(uint64_t now)
+{
+	uint32_t choice = next_random();
+
+	switch (choice % 8) {
+	case 0:
+		return now - choice % 3;
+	case 1:
+	case 2:
+		return now + 1 + next_random() % TIMER_WHEEL_SLOTS;
+	case 3:
+	case 4:
+		return now + next_random() % 20000;
+	case 5:
+		return now + next_random() %
+		       ((uint64_t) 1 << TIMER_WHEEL_SPAN_BITS);
+	default:
+		return now + ((uint64_t) 1 << TIMER_WHEEL_SPAN_BITS) +
+		       next_random() % ((uint64_t) 3 << TIMER_WHEEL_SPAN_BITS);
+	}
+}
+
+/*
+ * Schedule, cancel and re-arm timers at random while advancing the wheel,
+ * and check that each timer expires exactly once, on time,
+ * unless it was cancelled.
+ * start_tick:	the tick the wheel starts at
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_random_timers(uint64_t start_tick)
+{
+	struct test_timer *tests = malloc(sizeof(struct test_timer) *
+					  N_TEST_TIMERS);
+	struct timer_wheel wheel;
+	struct expiry_check check = {
+		.wheel = &wheel,
+		.on_time = 1,
+	};
+	size_t timer_i, n_far = 0, n_expired = 0, n_expected = 0;
+	unsigned round;
+	int passed = 1;
+
+	if (tests == NULL || init_timer_wheel(&wheel, start_tick,
+					      N_TEST_TIMERS)) {
+		free(tests);
+		return 0;
+	}
+	for (timer_i = 0; timer_i < N_TEST_TIMERS; timer_i++) {
+		init_wheel_timer(&tests[timer_i].timer, &tests[timer_i]);
+		tests[timer_i].expected = 0;
+		tests[timer_i].n_fired = 0;
+	}
+
+	for (round = 0; round < 200 && passed; round++) {
+		/* Change some timers, then let time pass. */
+		for (timer_i = 0; timer_i < 100; timer_i++) {
+			struct test_timer *test =
+				&tests[next_random() % N_TEST_TIMERS];
+
+			if (next_random() % 4 == 0) {
+				passed = passed &&
+					 (cancel_timer_wheel(&wheel,
+							     &test->timer) == 0)
+					 == (test->expected != 0);
+				test->expected = 0;
+			} else {
+				uint64_t deadline = pick_deadline(wheel.now);
+
+				passed = passed &&
+					 !add_timer_wheel(&wheel, &test->timer,
+							  deadline);
+				test->expected = deadline > wheel.now ?
+						 deadline : wheel.now + 1;
+			}
+		}
+
+		n_expired += advance_timer_wheel(&wheel, wheel.now +
+						 next_random() % 30000 +
+						 (round % 50 == 0 ?
+						  ((uint64_t) 1 <<
+						   TIMER_WHEEL_SPAN_BITS) : 0),
+						 check_expired, &check);
+	}
+
+	/* Everything still pending expires by the end. */
+	for (timer_i = 0; timer_i < N_TEST_TIMERS; timer_i++) {
+		n_expected += tests[timer_i].expected != 0;
+		n_far += tests[timer_i].timer.state == TIMER_IN_HEAP;
+	}
+	n_expired += advance_timer_wheel(&wheel, wheel.now +
+					 ((uint64_t) 5 <<
+					  TIMER_WHEEL_SPAN_BITS),
+					 check_expired, &check);
+	for (timer_i = 0; timer_i < N_TEST_TIMERS; timer_i++) {
+		if (tests[timer_i].expected != 0 ||
+		    tests[timer_i].timer.state != TIMER_IDLE) {
+			printlg(ERROR_LEVEL, "Timer %u never expired.\n",
+				(unsigned) timer_i);
+			passed = 0;
+		}
+	}
+
+	printlg(INFO_LEVEL, "%u timers expired, %u from far away at the end.\n",
+		(unsigned) n_expired, (unsigned) n_far);
+	passed = passed && check.on_time && n_far > 0 && n_expected > 0 &&
+		 wheel.n_in_wheel == 0 && wheel.far_timers.size == 0;
+
+	teardown_timer_wheel(&wheel);
+	free(tests);
+	return passed;
+}
+
+/*
+ * Check that far timers fail to be added once the heap is full,
+ * but near ones can still be added.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_full_heap()
+{
+	struct test_timer tests[FAR_CAPACITY + 2];
+	struct timer_wheel wheel;
+	struct expiry_check check = {
+		.wheel = &wheel,
+		.on_time = 1,
+	};
+	uint64_t far = (uint64_t) 1 << TIMER_WHEEL_SPAN_BITS;
+	size_t timer_i;
+	int passed = 1;
+
+	if (init_timer_wheel(&wheel, 0, FAR_CAPACITY)) {
+		return 0;
+	}
+
+	for (timer_i = 0; timer_i < FAR_CAPACITY + 2; timer_i++) {
+		init_wheel_timer(&tests[timer_i].timer, &tests[timer_i]);
+		tests[timer_i].expected = far + timer_i;
+		tests[timer_i].n_fired = 0;
+	}
+	for (timer_i = 0; timer_i < FAR_CAPACITY && passed; timer_i++) {
+		passed = !add_timer_wheel(&wheel, &tests[timer_i].timer,
+					  tests[timer_i].expected);
+	}
+	passed = passed &&
+		 add_timer_wheel(&wheel, &tests[FAR_CAPACITY].timer,
+				 far * 2) && errno == ERANGE &&
+		 tests[FAR_CAPACITY].timer.state == TIMER_IDLE &&
+		 !add_timer_wheel(&wheel, &tests[FAR_CAPACITY + 1].timer, 1);
+	tests[FAR_CAPACITY].expected = 0;
+	tests[FAR_CAPACITY + 1].expected = 1;
+
+	passed = passed &&
+		 advance_timer_wheel(&wheel, far * 2, check_expired, &check) ==
+		 FAR_CAPACITY + 1 && check.on_time;
+
+	teardown_timer_wheel(&wheel);
+	return passed;
+}
+
+/*
+ * Check that far timers expire on time once ticks are too large
+ * for their spans to fit in an int, across the rebasing of their keys,
+ * and that deadlines too far away are rejected.
+ * returns	1 iff passed, 0 otherwise
+ */
+static int test_large_ticks()
+{
+	struct test_timer tests[3];
+	struct timer_wheel wheel;
+	struct expiry_check check = {
+		.wheel = &wheel,
+		.on_time = 1,
+	};
+	uint64_t start = (uint64_t) 1 << 56;
+	size_t timer_i;
+	int passed = 1;
+
+	if (init_timer_wheel(&wheel, start, FAR_CAPACITY)) {
+		return 0;
+	}
+	for (timer_i = 0; timer_i < 3; timer_i++) {
+		init_wheel_timer(&tests[timer_i].timer, &tests[timer_i]);
+		tests[timer_i].n_fired = 0;
+	}
+
+	/* a far timer, just past the wheel */
+	tests[0].expected = start + ((uint64_t) 1 << 25);
+	passed = passed && !add_timer_wheel(&wheel, &tests[0].timer,
+					    tests[0].expected);
+	passed = passed && tests[0].timer.state == TIMER_IN_HEAP &&
+		 advance_timer_wheel(&wheel, start + ((uint64_t) 1 << 26),
+				     check_expired, &check) == 1;
+
+	/* a timer beyond the furthest deadline, which is left alone */
+	tests[1].expected = 0;
+	passed = passed && add_timer_wheel(&wheel, &tests[1].timer,
+					   wheel.now + TIMER_WHEEL_MAX_DELAY +
+					   1) && errno == EINVAL &&
+		 tests[1].timer.state == TIMER_IDLE;
+
+	/*
+	 * The furthest timer, added after a while,
+	 * then one added once the wheel has gone far enough
+	 * for the keys to be rebased, which expires first.
+	 */
+	passed = passed && advance_timer_wheel(&wheel, start +
+					       (TIMER_WHEEL_MAX_DELAY >> 1),
+					       check_expired, &check) == 0;
+	tests[1].expected = wheel.now + TIMER_WHEEL_MAX_DELAY;
+	passed = passed && !add_timer_wheel(&wheel, &tests[1].timer,
+					    tests[1].expected);
+	passed = passed && advance_timer_wheel(&wheel, start +
+					       TIMER_WHEEL_MAX_DELAY +
+					       ((uint64_t) 1 << 30),
+					       check_expired, &check) == 0;
+	tests[2].expected = wheel.now + ((uint64_t) 1 << 29);
+	passed = passed && !add_timer_wheel(&wheel, &tests[2].timer,
+					    tests[2].expected) &&
+		 wheel.far_base > start >> TIMER_WHEEL_SPAN_BITS;
+	passed = passed && advance_timer_wheel(&wheel, tests[1].expected,
+					       check_expired, &check) == 2;
+
+	for (timer_i = 0; timer_i < 3; timer_i++) {
+		passed = passed && tests[timer_i].n_fired == 1;
+	}
+	passed = passed && check.on_time && wheel.n_in_wheel == 0 &&
+		 wheel.far_timers.size == 0;
+
+	teardown_timer_wheel(&wheel);
+	return passed;
+}
+
+/*
+ * Insert many timers, re-arm each of them once,
+ * then advance until all of them expire,
+ * first in a wheel, then in a heap of all the timers,
+ * and report the time each step takes for each timer.
+ * returns	1 iff every timer expired once, in both cases
+ */
+static int test_benchmark()
+{
+	uint32_t *deadlines = malloc(sizeof(uint32_t) * 2 * N_BENCH_TIMERS);
+	struct wheel_timer *timers = malloc(sizeof(struct wheel_timer) *
+					    N_BENCH_TIMERS);
+	size_t *handles = malloc(sizeof(size_t) * N_BENCH_TIMERS);
+	struct timer_wheel wheel;
+	struct indexed_min_heap heap;
+	struct heap_element head;
+	double start, insert_time, rearm_time, expire_time;
+	size_t timer_i, n_expired = 0;
+	int tick;
+	int passed = 1;
+
+	if (deadlines == NULL || timers == NULL || handles == NULL) {
+		free(deadlines);
+		free(timers);
+		free(handles);
+		return 0;
+	}
+	for (timer_i = 0; timer_i < 2 * N_BENCH_TIMERS; timer_i++) {
+		deadlines[timer_i] = 1 + next_random() % BENCH_MAX_DELAY;
+	}
+
+	if (init_timer_wheel(&wheel, 0, 1)) {
+		passed = 0;
+		goto free_arrays;
+	}
+	for (timer_i = 0; timer_i < N_BENCH_TIMERS; timer_i++) {
+		init_wheel_timer(&timers[timer_i], NULL);
+	}
+	start = now_seconds();
+	for (timer_i = 0; timer_i < N_BENCH_TIMERS; timer_i++) {
+		add_timer_wheel(&wheel, &timers[timer_i], deadlines[timer_i]);
+	}
+	insert_time = now_seconds() - start;
+	start = now_seconds();
+	for (timer_i = 0; timer_i < N_BENCH_TIMERS; timer_i++) {
+		add_timer_wheel(&wheel, &timers[timer_i],
+				deadlines[N_BENCH_TIMERS + timer_i]);
+	}
+	rearm_time = now_seconds() - start;
+	start = now_seconds();
+	n_expired = advance_timer_wheel(&wheel, BENCH_MAX_DELAY,
+					ignore_expired, NULL);
+	expire_time = now_seconds() - start;
+	teardown_timer_wheel(&wheel);
+	passed = n_expired == N_BENCH_TIMERS;
+	printlg(INFO_LEVEL, "Wheel: %.0f ns to insert, %.0f ns to re-arm, "
+		"%.0f ns to expire each timer.\n",
+		insert_time * 1e9 / N_BENCH_TIMERS,
+		rearm_time * 1e9 / N_BENCH_TIMERS,
+		expire_time * 1e9 / N_BENCH_TIMERS);
+
+	if (init_indexed_min_heap(&heap, N_BENCH_TIMERS)) {
+		passed = 0;
+		goto free_arrays;
+	}
+	start = now_seconds();
+	for (timer_i = 0; timer_i < N_BENCH_TIMERS; timer_i++) {
+		struct heap_element element = {
+			.key = deadlines[timer_i],
+			.data = &timers[timer_i],
+		};
+
+		push_indexed_min_heap(&heap, &element, &handles[timer_i]);
+	}
+	insert_time = now_seconds() - start;
+	start = now_seconds();
+	for (timer_i = 0; timer_i < N_BENCH_TIMERS; timer_i++) {
+		struct heap_element element;
+
+		remove_indexed_min_heap(&element, &heap, handles[timer_i]);
+		element.key = deadlines[N_BENCH_TIMERS + timer_i];
+		push_indexed_min_heap(&heap, &element, &handles[timer_i]);
+	}
+	rearm_time = now_seconds() - start;
+	n_expired = 0;
+	start = now_seconds();
+	for (tick = 1; tick <= BENCH_MAX_DELAY; tick++) {
+		while (heap.size > 0 && heap.elements[1].key <= tick) {
+			pop_indexed_min_heap(&head, NULL, &heap);
+			n_expired++;
+		}
+	}
+	expire_time = now_seconds() - start;
+	teardown_indexed_min_heap(&heap);
+	passed = passed && n_expired == N_BENCH_TIMERS;
+	printlg(INFO_LEVEL, "Heap:  %.0f ns to insert, %.0f ns to re-arm, "
+		"%.0f ns to expire each timer.\n",
+		insert_time * 1e9 / N_BENCH_TIMERS,
+		rearm_time * 1e9 / N_BENCH_TIMERS,
+		expire_time * 1e9 / N_BENCH_TIMERS);
+
+free_arrays:
+	free(deadlines);
+	free(timers);
+	free(handles);
+	return passed;
+}
+
+int main(void)
+{
+	printlg(INFO_LEVEL, "Random timer test...\n");
+	if (test_random_timers(START_TICK)) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Random timer test at large ticks...\n");
+	if (test_random_timers(LARGE_START_TICK)) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Large tick test...\n");
+	if (test_large_ticks()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Full heap test...\n");
+	if (test_full_heap()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	printlg(INFO_LEVEL, "Benchmark...\n");
+	if (test_benchmark()) {
+		printlg(INFO_LEVEL, "Passed!\n");
+	} else {
+		printlg(ERROR_LEVEL, "Failed!\n");
+	}
+
+	return 0;
+}